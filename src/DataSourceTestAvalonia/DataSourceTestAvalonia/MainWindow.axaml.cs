@@ -113,6 +113,11 @@ public class AppSettings
 internal partial class MainWindow : Window
 {
     private readonly TestToolServer _server = new();
+    // How long a started client may take to connect, and a stopped one to drop its connection
+    private const int ClientStartTimeoutMs = 15000;
+    private const int ClientStopTimeoutMs = 3000;
+    // How long a screenshot may take to be encoded and written by the client
+    private const int ScreenshotTimeoutMs = 10000;
     private readonly ReadXML _xmlReader = new();
     private readonly ObservableCollection<string> _warnings = new();
 
@@ -120,6 +125,12 @@ internal partial class MainWindow : Window
     private ObservableCollection<XmlDataItem> _filteredIF = new();
     // Session changes for UI display - shows only modified values
     private readonly ObservableCollection<XmlDataItem> _sessionChanges = new();
+    // Passed to started clients with --session; a client restarted within the
+    // same session restores its property snapshot and announces it in its HELLO
+    private string _sessionId = NewSessionId();
+    // Set when a session value could not be sent or the client rejected it, so
+    // a restored snapshot lacks it
+    private bool _sessionValuesMissed;
 
     // Client process management
     private Process? _clientProcess;
@@ -158,6 +169,8 @@ internal partial class MainWindow : Window
     private XmlDocument _recordXml = new XmlDocument();
     private XmlElement? _scriptRoot;
     private int _screenshotIndex = 0;
+    // Commands collected while a precondition or resend is batching, null otherwise
+    private List<(string File, string Type, string Name, string Value)>? _pendingBatch;
     private string _baseDir = AppDomain.CurrentDomain.BaseDirectory;
     private AppState _currentState = AppState.Initializing;
 
@@ -282,6 +295,7 @@ internal partial class MainWindow : Window
 
         // Server event handlers
         _server.StatusChanged += (msg) => Dispatcher.UIThread.Post(() => UpdateServerStatus(msg));
+        _server.CommandRejected += () => Dispatcher.UIThread.Post(() => _sessionValuesMissed = true);
     }
 
     /// <summary>
@@ -896,7 +910,14 @@ internal partial class MainWindow : Window
         UpdateSessionChanges(fileName, name, type, value);
 
         string sendValue = ConvertBooleanValue(value, type);
-        _server.SendSyncCommand(fileName, type, name, sendValue);
+        if (_pendingBatch != null)
+        {
+            _pendingBatch.Add((fileName, type, name, sendValue));
+        }
+        else if (!_server.SendSyncCommand(fileName, type, name, sendValue))
+        {
+            _sessionValuesMissed = true;
+        }
 
         // Track this message in history only if requested (exclude preconditions)
         if (trackInHistory)
@@ -905,6 +926,20 @@ internal partial class MainWindow : Window
         }
     }
 
+    /// <summary>
+    /// Sends the commands collected in _pendingBatch as one BATCH command.
+    /// </summary>
+    private void FlushPendingBatch()
+    {
+        if (_pendingBatch == null || _pendingBatch.Count == 0) return;
+
+        if (!_server.SendBatchCommand(_pendingBatch))
+        {
+            _sessionValuesMissed = true;
+        }
+        _pendingBatch.Clear();
+    }
+
     /// <summary>
     /// Updates the session changes collection with the new value.
     /// </summary>
@@ -1060,34 +1095,83 @@ internal partial class MainWindow : Window
         var commands = documentElement.ChildNodes.OfType<XmlElement>().ToList();
         _warnings.Add($"Loading {commands.Count} precondition commands with wait delay support...");
 
-        foreach (XmlElement item in commands)
+        // Consecutive interface commands are sent as one batch; wait, screenshot,
+        // compare, capture, frames and exit flush the batch first so the client
+        // sees them in script order
+        _pendingBatch = new();
+        int comparesPassed = 0;
+        int comparesFailed = 0;
+        try
         {
-            // Handle wait commands
-            if (item.Name.Equals("wait", StringComparison.OrdinalIgnoreCase))
-            {
-                await ProcessWaitCommand(item);
-            }
-            // Handle screenshot commands
-            else if (item.Name.Equals("screenshot", StringComparison.OrdinalIgnoreCase))
-            {
-                await ProcessScreenshotCommand(item);
-            }
-            // Handle exit commands
-            else if (item.Name.Equals("exit", StringComparison.OrdinalIgnoreCase))
-            {
-                _warnings.Add("Exit command encountered - stopping precondition execution.");
-                break;
-            }
-            // Handle regular interface commands
-            else
+            foreach (XmlElement item in commands)
             {
-                ExecutePreconditionCommand(item);
-                // Default delay between commands (can be overridden by explicit wait commands)
-                await Task.Delay(200);
+                // Handle wait commands
+                if (item.Name.Equals("wait", StringComparison.OrdinalIgnoreCase))
+                {
+                    FlushPendingBatch();
+                    await ProcessWaitCommand(item);
+                }
+                // Handle screenshot commands
+                else if (item.Name.Equals("screenshot", StringComparison.OrdinalIgnoreCase))
+                {
+                    FlushPendingBatch();
+                    await ProcessScreenshotCommand(item);
+                }
+                // Handle golden image comparisons
+                else if (item.Name.Equals("compare", StringComparison.OrdinalIgnoreCase))
+                {
+                    FlushPendingBatch();
+                    if (await ProcessCompareCommand(item))
+                    {
+                        comparesPassed++;
+                    }
+                    else
+                    {
+                        comparesFailed++;
+                    }
+                }
+                // Handle screenshots of earlier or later frames
+                else if (item.Name.Equals("capture", StringComparison.OrdinalIgnoreCase))
+                {
+                    FlushPendingBatch();
+                    await ProcessCaptureCommand(item);
+                }
+                // Handle dumps of the frames the client kept
+                else if (item.Name.Equals("frames", StringComparison.OrdinalIgnoreCase))
+                {
+                    FlushPendingBatch();
+                    await ProcessFramesCommand(item);
+                }
+                // Handle exit commands
+                else if (item.Name.Equals("exit", StringComparison.OrdinalIgnoreCase))
+                {
+                    _warnings.Add("Exit command encountered - stopping precondition execution.");
+                    break;
+                }
+                // Handle regular interface commands
+                else
+                {
+                    ExecutePreconditionCommand(item);
+                }
             }
+
+            FlushPendingBatch();
+        }
+        finally
+        {
+            _pendingBatch = null;
         }
 
         _warnings.Add("Finished loading precondition commands.");
+        if (comparesPassed + comparesFailed > 0)
+        {
+            string summary = $"Compare results: {comparesPassed} passed, {comparesFailed} failed";
+            _warnings.Add(comparesFailed == 0 ? $"✅ {summary}" : $"❌ {summary}");
+            Dispatcher.UIThread.Post(() =>
+            {
+                StatusText.Text = $"Server: {summary}";
+            });
+        }
     }
 
     /// <summary>
@@ -1156,12 +1240,10 @@ internal partial class MainWindow : Window
                 StatusText.Text = $"Server: Taking screenshot ({screenshotName})...";
             });
 
-            // Send screenshot command to server
-            _server.SendScreenshotCommand(screenshotPath);
+            // Continue once the client has written the file, so the next
+            // script step cannot change what ends up in it
             _screenshotIndex++;
-
-            // Small delay to allow screenshot to be taken
-            await Task.Delay(500);
+            var result = await _server.TakeScreenshotAsync(screenshotPath, ScreenshotTimeoutMs);
 
             // Restore normal status
             Dispatcher.UIThread.Post(() =>
@@ -1169,7 +1251,7 @@ internal partial class MainWindow : Window
                 StatusText.Text = "Server: Running";
             });
 
-            _warnings.Add($"✅ Screenshot command sent: {screenshotName}");
+            ReportScreenshotResult(screenshotName, result);
         }
         catch (Exception ex)
         {
@@ -1177,6 +1259,135 @@ internal partial class MainWindow : Window
         }
     }
 
+    /// <summary>
+    /// Compares the client's current frame with a reference image:
+    /// &lt;compare reference="MTS_1.png" tolerance="2" ignore="0,0,200,40;..." max-diff="10" heatmap="MTS_1_diff.png" /&gt;
+    /// Paths are relative to the output folder. Returns true if the frame matched.
+    /// </summary>
+    private async Task<bool> ProcessCompareCommand(XmlElement compareElement)
+    {
+        try
+        {
+            string reference = compareElement.GetAttribute("reference");
+            if (string.IsNullOrEmpty(reference))
+            {
+                _warnings.Add("⚠️ compare without a reference attribute - counted as failed");
+                return false;
+            }
+
+            var options = new List<string>();
+            string tolerance = compareElement.GetAttribute("tolerance");
+            if (!string.IsNullOrEmpty(tolerance))
+            {
+                options.Add($"tolerance={tolerance}");
+            }
+            foreach (var region in compareElement.GetAttribute("ignore").Split(';', StringSplitOptions.RemoveEmptyEntries))
+            {
+                options.Add($"ignore={region.Trim()}");
+            }
+            string maxDiff = compareElement.GetAttribute("max-diff");
+            if (!string.IsNullOrEmpty(maxDiff))
+            {
+                options.Add($"max-diff={maxDiff}");
+            }
+            string heatmap = compareElement.GetAttribute("heatmap");
+            if (!string.IsNullOrEmpty(heatmap))
+            {
+                options.Add($"heatmap={Path.Combine(_outputPath, heatmap)}");
+            }
+
+            string referencePath = Path.Combine(_outputPath, reference);
+            _warnings.Add($"🔍 Comparing with {referencePath}");
+            var result = await _server.CompareAsync(referencePath, ScreenshotTimeoutMs, options.ToArray());
+            if (result == null)
+            {
+                _warnings.Add($"⚠️ No compare result for {reference} - counted as failed");
+                return false;
+            }
+            if (result.Outcome == "error")
+            {
+                _warnings.Add($"❌ Compare with {reference}: ERROR (reference not readable or invalid options)");
+                return false;
+            }
+
+            _warnings.Add($"{(result.Passed ? "✅" : "❌")} Compare with {reference}: {result.Outcome.ToUpperInvariant()} " +
+                          $"({result.DifferingPixels} of {result.ComparedPixels} pixels differ, max delta {result.MaxDelta})");
+            return result.Passed;
+        }
+        catch (Exception ex)
+        {
+            _warnings.Add($"❌ Error processing compare command: {ex.Message}");
+            return false;
+        }
+    }
+
+    /// <summary>
+    /// Takes a screenshot of a frame relative to the current one:
+    /// &lt;capture offset="-5" name="before_popup" /&gt;. Negative offsets need a
+    /// client started with --frame-history.
+    /// </summary>
+    private async Task ProcessCaptureCommand(XmlElement captureElement)
+    {
+        try
+        {
+            if (!int.TryParse(captureElement.GetAttribute("offset"), out int offset))
+            {
+                _warnings.Add($"⚠️ Invalid offset in capture command: '{captureElement.GetAttribute("offset")}' - skipping");
+                return;
+            }
+
+            string captureName = captureElement.GetAttribute("name");
+            if (string.IsNullOrEmpty(captureName))
+            {
+                captureName = _screenshotIndex.ToString();
+            }
+            _screenshotIndex++;
+
+            string capturePath = Path.Combine(_outputPath, $"{captureName}.png");
+            _warnings.Add($"📸 Capturing frame {offset:+0;-0;0}: {captureName} -> {capturePath}");
+            ReportScreenshotResult(captureName, await _server.CaptureAsync(offset, capturePath, ScreenshotTimeoutMs));
+        }
+        catch (Exception ex)
+        {
+            _warnings.Add($"❌ Error processing capture command: {ex.Message}");
+        }
+    }
+
+    /// <summary>
+    /// Writes the frames the client kept, with a frames.txt index of their
+    /// present times: &lt;frames count="30" directory="popup_frames" /&gt;
+    /// (count 0 or missing writes all of them)
+    /// </summary>
+    private async Task ProcessFramesCommand(XmlElement framesElement)
+    {
+        try
+        {
+            int.TryParse(framesElement.GetAttribute("count"), out int count);
+            string directory = framesElement.GetAttribute("directory");
+            if (string.IsNullOrEmpty(directory))
+            {
+                directory = $"frames_{_screenshotIndex++}";
+            }
+
+            string framesPath = Path.Combine(_outputPath, directory);
+            _warnings.Add($"🎞️ Writing {(count > 0 ? count.ToString() : "all")} kept frames to {framesPath}");
+            // The dump has started once the command is applied; the frames are
+            // written in the background while the script goes on
+            if (_server.SendFrameDumpCommand(count, framesPath) && await _server.WaitForAcknowledgementsAsync(500))
+            {
+                _warnings.Add($"✅ Frame dump started: {framesPath}");
+            }
+            else
+            {
+                _warnings.Add($"⚠️ Frame dump to {framesPath} not confirmed by the client");
+            }
+        }
+        catch (Exception ex)
+        {
+            _warnings.Add($"❌ Error processing frames command: {ex.Message}");
+        }
+    }
+
     /// <summary>
     /// Executes a single precondition command
     /// </summary>
@@ -1437,12 +1648,32 @@ internal partial class MainWindow : Window
         }
     }
 
-    private void ScreenshotButton_Click(object? sender, RoutedEventArgs e)
+    private async void ScreenshotButton_Click(object? sender, RoutedEventArgs e)
     {
-        string screenshotPath = Path.Combine(_outputPath, $"{_screenshotIndex}.png");
+        string screenshotName = _screenshotIndex.ToString();
+        string screenshotPath = Path.Combine(_outputPath, $"{screenshotName}.png");
         _warnings.Add($"Taking screenshot: {screenshotPath}");
-        _server.SendScreenshotCommand(screenshotPath);
         _screenshotIndex++;
+        ReportScreenshotResult(screenshotName, await _server.TakeScreenshotAsync(screenshotPath, ScreenshotTimeoutMs));
+    }
+
+    /// <summary>
+    /// Reports a screenshot the client finished, or null when it did not confirm one
+    /// </summary>
+    private void ReportScreenshotResult(string screenshotName, ScreenshotResult? result)
+    {
+        if (result == null)
+        {
+            _warnings.Add($"⚠️ Screenshot {screenshotName} sent, but the client did not confirm it was written");
+        }
+        else if (!result.Written)
+        {
+            _warnings.Add($"❌ Screenshot {screenshotName} failed: {result.Path} was not written");
+        }
+        else
+        {
+            _warnings.Add($"✅ Screenshot written: {result.Path} ({result.Bytes} bytes in {result.EncodeUs / 1000.0:F1} ms)");
+        }
     }
 
     private void CopyDllButton_Click(object? sender, RoutedEventArgs e)
@@ -1487,8 +1718,10 @@ internal partial class MainWindow : Window
         {
             int sessionCount = _sessionChanges.Count;
 
-            // Clear the session changes collection
+            // Clear the session changes collection; clients no longer restore the old session
             _sessionChanges.Clear();
+            _sessionId = NewSessionId();
+            _sessionValuesMissed = false;
 
             // Refresh the DataGrid to show original values (without session overrides)
             var module = ModuleComboBox.SelectedItem?.ToString() ?? "";
@@ -1535,6 +1768,7 @@ internal partial class MainWindow : Window
                 StartInfo = new ProcessStartInfo
                 {
                     FileName = clientExePath,
+                    Arguments = $"--session {_sessionId}",
                     WorkingDirectory = _clientDirectory,
                     UseShellExecute = true
                 }
@@ -1633,25 +1867,50 @@ internal partial class MainWindow : Window
         }
     }
 
+    private static string NewSessionId() => Guid.NewGuid().ToString("N");
+
+    /// <summary>
+    /// Brings a restarted client up to date. The replay is skipped when the
+    /// client restored the snapshot of this session and the previous client
+    /// had received and acknowledged every session value.
+    /// </summary>
+    private Task RestoreClientSession()
+    {
+        if (_server.ClientRestoredSession == _sessionId && _server.PreviousClientAcknowledgedAll &&
+            !_sessionValuesMissed)
+        {
+            _warnings.Add($"Client restored the {_sessionChanges.Count} session values from its snapshot");
+            return Task.CompletedTask;
+        }
+        return ResendSessionValues();
+    }
+
     /// <summary>
     /// Resends all current session values to the client
     /// </summary>
-    private async Task ResendSessionValues()
+    private Task ResendSessionValues()
     {
         try
         {
+            _sessionValuesMissed = false;
             if (_sessionChanges.Count > 0)
             {
                 // Create a copy of the collection to avoid "Collection was modified" errors
                 var sessionItemsCopy = _sessionChanges.ToList();
-                _warnings.Add($"Resending {sessionItemsCopy.Count} session values to client with 200ms delays...");
+                _warnings.Add($"Resending {sessionItemsCopy.Count} session values to client as one batch...");
 
-                foreach (var sessionItem in sessionItemsCopy)
+                _pendingBatch = new();
+                try
                 {
-                    SendToClient(sessionItem.FileName, sessionItem.Name, sessionItem.Type, sessionItem.Value);
-
-                    // Add 200ms delay between commands
-                    await Task.Delay(200);
+                    foreach (var sessionItem in sessionItemsCopy)
+                    {
+                        SendToClient(sessionItem.FileName, sessionItem.Name, sessionItem.Type, sessionItem.Value);
+                    }
+                    FlushPendingBatch();
+                }
+                finally
+                {
+                    _pendingBatch = null;
                 }
 
                 _warnings.Add("Finished resending session values");
@@ -1665,6 +1924,7 @@ internal partial class MainWindow : Window
         {
             _warnings.Add($"Error resending session values: {ex.Message}");
         }
+        return Task.CompletedTask;
     }
 
     private async void NewKzbButton_Click(object? sender, RoutedEventArgs e)
@@ -1701,6 +1961,7 @@ internal partial class MainWindow : Window
             {
                 _clientProcess.Kill();
                 _clientProcess.WaitForExit(3000);
+                await _server.WaitForClientDisconnectedAsync(ClientStopTimeoutMs);
                 _warnings.Add("Closed existing client for KZB update");
             }
 
@@ -1738,6 +1999,7 @@ internal partial class MainWindow : Window
                     StartInfo = new ProcessStartInfo
                     {
                         FileName = clientExePath,
+                        Arguments = $"--session {_sessionId}",
                         WorkingDirectory = _clientDirectory,
                         UseShellExecute = true
                     }
@@ -1751,9 +2013,15 @@ internal partial class MainWindow : Window
                 _clientProcess.Start();
                 _warnings.Add($"Restarted client with new KZB: {kzbFileName}");
 
-                // Wait a moment for client to connect, then resend session values
-                await Task.Delay(2000); // Give client time to connect
-                await ResendSessionValues();
+                // Resend the session values once the new client has connected
+                if (await _server.WaitForClientReadyAsync(ClientStartTimeoutMs))
+                {
+                    await RestoreClientSession();
+                }
+                else
+                {
+                    _warnings.Add("Client did not connect - session values not resent");
+                }
             }
         }
         catch (Exception ex)
@@ -1987,8 +2255,8 @@ internal partial class MainWindow : Window
                 AddWarning("🔄 Stopped existing client");
             }
 
-            // Wait a moment then start client with new KZB
-            await Task.Delay(1000);
+            // Let the old session end before the new client starts
+            await _server.WaitForClientDisconnectedAsync(ClientStopTimeoutMs);
             // Copy the KZB file
             File.Copy(kzbFilePath, destinationPath, true);
             AddWarning($"✅ Copied KZB file: {kzbFileName}");
@@ -2001,7 +2269,7 @@ internal partial class MainWindow : Window
                 StartInfo = new ProcessStartInfo
                 {
                     FileName = GetClientExePath(),
-                    Arguments = kzbFileName,
+                    Arguments = $"--session {_sessionId} {kzbFileName}",
                     WorkingDirectory = _clientDirectory,
                     UseShellExecute = true
                 }
@@ -2015,9 +2283,15 @@ internal partial class MainWindow : Window
             _clientProcess.Start();
             AddWarning($"� Auto-restarted client with new KZB: {kzbFileName}");
 
-            // Wait a moment for client to connect, then resend session values
-            await Task.Delay(2000);
-            await ResendSessionValues();
+            // Resend the session values once the new client has connected
+            if (await _server.WaitForClientReadyAsync(ClientStartTimeoutMs))
+            {
+                await RestoreClientSession();
+            }
+            else
+            {
+                AddWarning("⚠️ Client did not connect - session values not resent");
+            }
         }
         catch (Exception ex)
         {
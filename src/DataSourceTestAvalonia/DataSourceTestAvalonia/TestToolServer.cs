@@ -1,11 +1,30 @@
 using System;
+using System.Collections.Generic;
+using System.Linq;
 using System.Net.Sockets;
+using System.Threading;
 using System.Threading.Tasks;
 using System.Text;
 using System.Net;
 
 namespace DataSourceTestAvalonia
 {
+    /// <summary>
+    /// A screenshot the client has finished: whether the file was written, its
+    /// size and the time encoding and writing took
+    /// </summary>
+    public sealed record ScreenshotResult(bool Written, long Bytes, long EncodeUs, string Path);
+
+    /// <summary>
+    /// The client's verdict on a COMPARE: "pass", "fail", or "error" when the
+    /// reference could not be read or the options were invalid
+    /// </summary>
+    public sealed record CompareResult(string Outcome, long DifferingPixels, long ComparedPixels, int MaxDelta,
+                                       long CompareUs, string Reference)
+    {
+        public bool Passed => Outcome == "pass";
+    }
+
     /// <summary>
     /// Basic TCP server that sends commands to connected clients
     /// </summary>
@@ -22,6 +41,73 @@ namespace DataSourceTestAvalonia
 
         public event Action<string>? StatusChanged;
 
+        /// <summary>
+        /// Raised from the receive loop when the client answers a command with
+        /// apply_us 0: it rejected the command and applied none of its values
+        /// </summary>
+        public event Action? CommandRejected;
+
+        // Commands sent, answered and rejected on the current connection. A
+        // client answers "ACK::seq::recv_us::apply_us" once it has applied a
+        // command, with apply_us 0 if it rejected it.
+        private long sentCommandCount;
+        private long acknowledgedCommandCount;
+        private long rejectedCommandCount;
+        private readonly StringBuilder incomingText = new StringBuilder();
+        private readonly object writeLock = new object();
+
+        // Waits for a count of ACKs, completed from ProcessIncomingData
+        private readonly List<(long Count, TaskCompletionSource<bool> Done)> acknowledgementWaiters = new();
+        // Waits for the SCREENSHOT or COMPARE notice of one command, by its
+        // sequence; completed with the notice line, or null on disconnect
+        private readonly Dictionary<long, TaskCompletionSource<string?>> noticeWaiters = new();
+        // Clients that send HELLO also send notices; older ones answer nothing
+        private bool clientSentHello;
+
+        // Completed once the connected client can take commands: it sent HELLO,
+        // or a client without HELLO had HelloTimeoutMs to send one. Replaced on
+        // disconnect for the next client.
+        private volatile TaskCompletionSource<bool> clientReady = NewSignal();
+        // Completed once the current client has gone; no client counts as gone
+        private volatile TaskCompletionSource<bool> clientGone = CompletedSignal();
+        private const int HelloTimeoutMs = 200;
+
+        /// <summary>
+        /// True once the connected client has sent at least one ACK
+        /// </summary>
+        public bool ClientSendsAcknowledgements { get; private set; }
+
+        /// <summary>
+        /// True once the connected client listed "batch" in its
+        /// "HELLO::version::capability,..." line. Older clients send no HELLO
+        /// and only get individual commands.
+        /// </summary>
+        public bool ClientSupportsBatch { get; private set; }
+
+        /// <summary>
+        /// Session the connected client restored from its property snapshot, as
+        /// announced with "restored=session" in its HELLO; null if none
+        /// </summary>
+        public string? ClientRestoredSession { get; private set; }
+
+        /// <summary>
+        /// True if the previous client had acknowledged every command sent to
+        /// it when it disconnected and rejected none, so its snapshot holds
+        /// everything it was sent
+        /// </summary>
+        public bool PreviousClientAcknowledgedAll { get; private set; }
+
+        // Protocol version of the text encoding, as answered to the client's HELLO
+        private const int TextProtocolVersion = 1;
+
+        // Largest BATCH the client takes in one frame: its message limit is
+        // 256 KB and its command queue holds 16384 commands
+        private const int MaxBatchBytes = 256 * 1024 - 1;
+        private const int MaxBatchRecords = 16384;
+
+        // What a screenshot waited for before clients reported written files
+        private const int LegacyScreenshotDelayMs = 500;
+
         public void Start()
         {
             try
@@ -40,6 +126,19 @@ namespace DataSourceTestAvalonia
                             client = await server.AcceptTcpClientAsync();
                             stream = client.GetStream();
 
+                            Interlocked.Exchange(ref sentCommandCount, 0);
+                            Interlocked.Exchange(ref acknowledgedCommandCount, 0);
+                            Interlocked.Exchange(ref rejectedCommandCount, 0);
+                            incomingText.Clear();
+                            ClientSendsAcknowledgements = false;
+                            ClientSupportsBatch = false;
+                            ClientRestoredSession = null;
+                            clientSentHello = false;
+
+                            clientGone = NewSignal();
+                            var ready = clientReady;
+                            _ = Task.Delay(HelloTimeoutMs).ContinueWith(_ => ready.TrySetResult(true));
+
                             // Store client connection information
                             ClientConnectedTime = DateTime.Now;
 
@@ -77,12 +176,15 @@ namespace DataSourceTestAvalonia
                         {
                             // Monitor the connection more reliably
                             var buffer = new byte[1024];
+                            // A read that outlives the timeout is kept for the next round,
+                            // so no incoming bytes (ACKs) are lost to an abandoned read
+                            Task<int>? readTask = null;
                             while (client.Connected)
                             {
                                 try
                                 {
                                     // Use a timeout to detect disconnection more quickly
-                                    var readTask = stream.ReadAsync(buffer, 0, buffer.Length);
+                                    readTask ??= stream.ReadAsync(buffer, 0, buffer.Length);
                                     var timeoutTask = Task.Delay(1000); // 1 second timeout
 
                                     var completedTask = await Task.WhenAny(readTask, timeoutTask);
@@ -90,11 +192,12 @@ namespace DataSourceTestAvalonia
                                     if (completedTask == readTask)
                                     {
                                         var result = await readTask;
+                                        readTask = null;
                                         if (result == 0)
                                         {
                                             break; // Client disconnected
                                         }
-                                        // If we received data, process it if needed
+                                        ProcessIncomingData(buffer, result);
                                     }
                                     else
                                     {
@@ -116,6 +219,9 @@ namespace DataSourceTestAvalonia
                     finally
                     {
                         UpdateStatus("Client disconnected - waiting for new connection");
+                        PreviousClientAcknowledgedAll = ClientSendsAcknowledgements &&
+                            Interlocked.Read(ref acknowledgedCommandCount) >= Interlocked.Read(ref sentCommandCount) &&
+                            Interlocked.Read(ref rejectedCommandCount) == 0;
                         ClientIPAddress = null;
                         ClientExecutablePath = null;
                         ClientConnectedTime = null;
@@ -129,6 +235,11 @@ namespace DataSourceTestAvalonia
                         catch { }
                         stream = null;
                         client = null;
+
+                        clientReady = NewSignal();
+                        FailAcknowledgementWaiters();
+                        FailNoticeWaiters();
+                        clientGone.TrySetResult(true);
                     }
                 }
 
@@ -153,20 +264,324 @@ namespace DataSourceTestAvalonia
             }
         }
 
+        /// <summary>
+        /// Split what the client sent into lines, count its ACKs, hand
+        /// SCREENSHOT and COMPARE notices to their waiters and note the
+        /// capabilities it announces in HELLO
+        /// </summary>
+        private void ProcessIncomingData(byte[] buffer, int length)
+        {
+            incomingText.Append(Encoding.UTF8.GetString(buffer, 0, length));
+
+            string text = incomingText.ToString();
+            int lineStart = 0;
+            int newline;
+            while ((newline = text.IndexOf('\n', lineStart)) >= 0)
+            {
+                if (string.CompareOrdinal(text, lineStart, "ACK::", 0, 5) == 0)
+                {
+                    ClientSendsAcknowledgements = true;
+                    // A rejected command is still answered, so waiters count it
+                    if (IsRejectedAcknowledgement(text.Substring(lineStart, newline - lineStart).TrimEnd('\r')))
+                    {
+                        Interlocked.Increment(ref rejectedCommandCount);
+                        CommandRejected?.Invoke();
+                    }
+                    CompleteAcknowledgementWaiters(Interlocked.Increment(ref acknowledgedCommandCount));
+                }
+                else if (string.CompareOrdinal(text, lineStart, "SCREENSHOT::", 0, 12) == 0)
+                {
+                    CompleteNoticeWaiter(text.Substring(lineStart, newline - lineStart).TrimEnd('\r'));
+                }
+                else if (string.CompareOrdinal(text, lineStart, "COMPARE::", 0, 9) == 0)
+                {
+                    var line = text.Substring(lineStart, newline - lineStart).TrimEnd('\r');
+                    ReportCompareResult(line);
+                    CompleteNoticeWaiter(line);
+                }
+                else if (string.CompareOrdinal(text, lineStart, "HELLO::", 0, 7) == 0)
+                {
+                    HandleClientHello(text.Substring(lineStart, newline - lineStart).TrimEnd('\r'));
+                }
+                lineStart = newline + 1;
+            }
+            incomingText.Remove(0, lineStart);
+        }
+
+        /// <summary>
+        /// True for "ACK::seq::recv_us::apply_us" with apply_us 0. Clients that
+        /// answer without the timings only acknowledge applied commands.
+        /// </summary>
+        private static bool IsRejectedAcknowledgement(string line)
+        {
+            var fields = line.Split("::");
+            return fields.Length >= 4 && fields[3] == "0";
+        }
+
+        /// <summary>
+        /// Record what the client supports: "HELLO::version::capability,..."
+        /// and answer "HELLO::1::text". This server only speaks the text
+        /// protocol, so it never asks the client to switch to binary frames.
+        /// </summary>
+        private void HandleClientHello(string line)
+        {
+            const string RestoredPrefix = "restored=";
+            var fields = line.Split("::", 3);
+            var capabilities = fields.Length == 3 ? fields[2].Split(',') : Array.Empty<string>();
+            ClientSupportsBatch = capabilities.Contains("batch");
+            ClientRestoredSession = capabilities.FirstOrDefault(c => c.StartsWith(RestoredPrefix))
+                ?.Substring(RestoredPrefix.Length);
+            clientSentHello = true;
+
+            // Not counted as a command: the client does not acknowledge HELLO
+            WriteLine($"HELLO::{TextProtocolVersion}::text");
+            clientReady.TrySetResult(true);
+        }
+
+        /// <summary>
+        /// Show the result of a COMPARE:
+        /// "COMPARE::seq::pass|fail|error::differing::compared::max_delta::compare_us::reference"
+        /// </summary>
+        private void ReportCompareResult(string line)
+        {
+            var fields = line.Split("::", 8);
+            if (fields.Length < 8)
+            {
+                UpdateStatus($"Malformed compare result: {line}");
+                return;
+            }
+
+            if (fields[2] == "error")
+            {
+                UpdateStatus($"Compare with {fields[7]} failed: reference image not readable");
+                return;
+            }
+            UpdateStatus($"Compare with {fields[7]}: {fields[2].ToUpperInvariant()} " +
+                         $"({fields[3]} of {fields[4]} pixels differ, max delta {fields[5]})");
+        }
+
+        /// <summary>
+        /// Wait until the client has acknowledged every command sent so far.
+        /// Clients without ACK support never answer, so this then waits the whole
+        /// timeout, like the fixed delay it replaces. Returns true if everything
+        /// was acknowledged in time.
+        /// </summary>
+        public async Task<bool> WaitForAcknowledgementsAsync(int timeoutMs)
+        {
+            var done = NewSignal();
+            lock (acknowledgementWaiters)
+            {
+                long sent = Interlocked.Read(ref sentCommandCount);
+                if (Interlocked.Read(ref acknowledgedCommandCount) >= sent)
+                {
+                    return true;
+                }
+                acknowledgementWaiters.Add((sent, done));
+            }
+
+            bool acknowledged = await WaitAsync(done.Task, timeoutMs) && done.Task.Result;
+            lock (acknowledgementWaiters)
+            {
+                acknowledgementWaiters.RemoveAll(waiter => waiter.Done == done);
+            }
+            return acknowledged;
+        }
+
+        /// <summary>
+        /// Wait until a client is connected and ready for commands, e.g. after
+        /// starting the client process. Returns false on timeout.
+        /// </summary>
+        public Task<bool> WaitForClientReadyAsync(int timeoutMs)
+        {
+            return WaitAsync(clientReady.Task, timeoutMs);
+        }
+
+        /// <summary>
+        /// Wait until the connected client has gone, e.g. after stopping the
+        /// client process. Returns at once when no client is connected.
+        /// </summary>
+        public Task<bool> WaitForClientDisconnectedAsync(int timeoutMs)
+        {
+            return WaitAsync(clientGone.Task, timeoutMs);
+        }
+
+        private void CompleteAcknowledgementWaiters(long acknowledged)
+        {
+            lock (acknowledgementWaiters)
+            {
+                acknowledgementWaiters.RemoveAll(waiter =>
+                {
+                    if (waiter.Count > acknowledged)
+                    {
+                        return false;
+                    }
+                    waiter.Done.TrySetResult(true);
+                    return true;
+                });
+            }
+        }
+
+        /// <summary>
+        /// Complete the waiter of a "SCREENSHOT::seq::..." or "COMPARE::seq::..."
+        /// notice. Notices of script screenshots carry sequence 0 and have none.
+        /// </summary>
+        private void CompleteNoticeWaiter(string line)
+        {
+            var fields = line.Split("::", 3);
+            if (fields.Length < 3 || !long.TryParse(fields[1], out long sequence))
+            {
+                return;
+            }
+
+            TaskCompletionSource<string?>? waiter;
+            lock (noticeWaiters)
+            {
+                if (!noticeWaiters.Remove(sequence, out waiter))
+                {
+                    return;
+                }
+            }
+            waiter.TrySetResult(line);
+        }
+
+        private void FailNoticeWaiters()
+        {
+            lock (noticeWaiters)
+            {
+                foreach (var waiter in noticeWaiters.Values)
+                {
+                    waiter.TrySetResult(null);
+                }
+                noticeWaiters.Clear();
+            }
+        }
+
+        private void FailAcknowledgementWaiters()
+        {
+            lock (acknowledgementWaiters)
+            {
+                foreach (var waiter in acknowledgementWaiters)
+                {
+                    waiter.Done.TrySetResult(false);
+                }
+                acknowledgementWaiters.Clear();
+            }
+        }
+
+        /// <summary>
+        /// True if signal completed within timeoutMs
+        /// </summary>
+        private static async Task<bool> WaitAsync(Task signal, int timeoutMs)
+        {
+            using var cancel = new CancellationTokenSource();
+            var completed = await Task.WhenAny(signal, Task.Delay(timeoutMs, cancel.Token));
+            cancel.Cancel();
+            return completed == signal;
+        }
+
+        // Continuations run on the thread pool, not on the read loop that completes them
+        private static TaskCompletionSource<bool> NewSignal()
+        {
+            return new TaskCompletionSource<bool>(TaskCreationOptions.RunContinuationsAsynchronously);
+        }
+
+        private static TaskCompletionSource<bool> CompletedSignal()
+        {
+            var signal = NewSignal();
+            signal.SetResult(true);
+            return signal;
+        }
+
         private void UpdateStatus(string message)
         {
             StatusChanged?.Invoke(message);
         }
 
+        /// <summary>
+        /// Send one command, terminated by '\n' so the client can split back-to-back commands
+        /// </summary>
         public bool SendCommand(string message)
+        {
+            return SendCommand(message, null);
+        }
+
+        /// <summary>
+        /// Send one command and register noticeWaiter for the notice the client
+        /// answers it with. The client numbers commands in the order it receives
+        /// them, so the sequence is taken under the write lock.
+        /// </summary>
+        private bool SendCommand(string message, TaskCompletionSource<string?>? noticeWaiter)
+        {
+            lock (writeLock)
+            {
+                long sequence = Interlocked.Read(ref sentCommandCount) + 1;
+                if (noticeWaiter != null)
+                {
+                    lock (noticeWaiters)
+                    {
+                        noticeWaiters[sequence] = noticeWaiter;
+                    }
+                }
+
+                if (!WriteLine(message))
+                {
+                    if (noticeWaiter != null)
+                    {
+                        lock (noticeWaiters)
+                        {
+                            noticeWaiters.Remove(sequence);
+                        }
+                    }
+                    return false;
+                }
+                Interlocked.Increment(ref sentCommandCount);
+                return true;
+            }
+        }
+
+        /// <summary>
+        /// Send a command the client answers with a notice and wait for it.
+        /// Returns the notice line, or null if the command could not be sent,
+        /// the client went away or timeoutMs passed.
+        /// </summary>
+        private async Task<string?> SendAndWaitForNoticeAsync(string message, int timeoutMs)
+        {
+            var notice = new TaskCompletionSource<string?>(TaskCreationOptions.RunContinuationsAsynchronously);
+            if (!SendCommand(message, notice))
+            {
+                return null;
+            }
+            if (await WaitAsync(notice.Task, timeoutMs))
+            {
+                return notice.Task.Result;
+            }
+
+            lock (noticeWaiters)
+            {
+                foreach (var entry in noticeWaiters.Where(entry => entry.Value == notice).ToList())
+                {
+                    noticeWaiters.Remove(entry.Key);
+                }
+            }
+            return null;
+        }
+
+        /// <summary>
+        /// Write one '\n' terminated line. The UI sends commands while the read
+        /// loop answers HELLO, so writes are serialized.
+        /// </summary>
+        private bool WriteLine(string line)
         {
             try
             {
-                if (stream != null && client?.Connected == true)
+                lock (writeLock)
                 {
-                    byte[] data = Encoding.UTF8.GetBytes(message);
-                    stream.Write(data, 0, data.Length);
-                    return true;
+                    if (stream != null && client?.Connected == true)
+                    {
+                        byte[] data = Encoding.UTF8.GetBytes(line + "\n");
+                        stream.Write(data, 0, data.Length);
+                        return true;
+                    }
                 }
             }
             catch
@@ -192,6 +607,44 @@ namespace DataSourceTestAvalonia
             return SendCommand($"ASYNC::{file}::{type}::{name}::{value}");
         }
 
+        /// <summary>
+        /// Send batch command: "BATCH::count::file::type::name::value\x1efile::type::name::value..."
+        /// The client applies all records of one batch together on a single frame.
+        /// A client that did not announce batch support, or a batch too large for
+        /// one frame, gets the items as individual SYNC commands instead, which
+        /// the client may apply over several frames.
+        /// </summary>
+        public bool SendBatchCommand(IReadOnlyList<(string File, string Type, string Name, string Value)> items)
+        {
+            if (items.Count == 0)
+            {
+                return true;
+            }
+
+            if (ClientSupportsBatch && items.Count <= MaxBatchRecords)
+            {
+                var records = string.Join("\u001e", items.Select(item => $"{item.File}::{item.Type}::{item.Name}::{item.Value}"));
+                var message = $"BATCH::{items.Count}::{records}";
+                if (Encoding.UTF8.GetByteCount(message) <= MaxBatchBytes)
+                {
+                    return SendCommand(message);
+                }
+            }
+
+            if (ClientSupportsBatch)
+            {
+                UpdateStatus($"Batch of {items.Count} values is too large for one frame - sending them individually");
+            }
+            foreach (var item in items)
+            {
+                if (!SendSyncCommand(item.File, item.Type, item.Name, item.Value))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
         /// <summary>
         /// Send screenshot command: "SCREENSHOT::filename"
         /// </summary>
@@ -200,6 +653,116 @@ namespace DataSourceTestAvalonia
             return SendCommand($"SCREENSHOT::{filePath}");
         }
 
+        /// <summary>
+        /// Send a screenshot command and wait until the client has written the
+        /// file, which it reports as "SCREENSHOT::seq::ok|failed::bytes::encode_us::path".
+        /// Returns null if no notice came within timeoutMs. A client without
+        /// HELLO sends no notices; it gets the old fixed 500 ms instead.
+        /// </summary>
+        public async Task<ScreenshotResult?> TakeScreenshotAsync(string filePath, int timeoutMs)
+        {
+            var message = $"SCREENSHOT::{filePath}";
+            if (!clientSentHello)
+            {
+                if (SendCommand(message))
+                {
+                    await Task.Delay(LegacyScreenshotDelayMs);
+                }
+                return null;
+            }
+
+            return ParseScreenshotNotice(await SendAndWaitForNoticeAsync(message, timeoutMs));
+        }
+
+        private static ScreenshotResult? ParseScreenshotNotice(string? line)
+        {
+            var fields = line?.Split("::", 6);
+            if (fields == null || fields.Length < 6)
+            {
+                return null;
+            }
+            long.TryParse(fields[3], out long bytes);
+            long.TryParse(fields[4], out long encodeUs);
+            return new ScreenshotResult(fields[2] == "ok", bytes, encodeUs, fields[5]);
+        }
+
+        /// <summary>
+        /// Send golden image comparison: "COMPARE::reference[::option...]" with
+        /// options such as "tolerance=2", "ignore=x,y,w,h", "max-diff=N" and
+        /// "heatmap=path". The client reports the result in a COMPARE line.
+        /// </summary>
+        public bool SendCompareCommand(string referencePath, params string[] options)
+        {
+            return SendCommand(CompareMessage(referencePath, options));
+        }
+
+        /// <summary>
+        /// Send a COMPARE and wait for the client's result. Returns null if no
+        /// result came within timeoutMs, or the client sends no notices at all.
+        /// </summary>
+        public async Task<CompareResult?> CompareAsync(string referencePath, int timeoutMs, params string[] options)
+        {
+            var message = CompareMessage(referencePath, options);
+            if (!clientSentHello)
+            {
+                SendCommand(message);
+                return null;
+            }
+
+            var fields = (await SendAndWaitForNoticeAsync(message, timeoutMs))?.Split("::", 8);
+            if (fields == null || fields.Length < 8)
+            {
+                return null;
+            }
+            long.TryParse(fields[3], out long differing);
+            long.TryParse(fields[4], out long compared);
+            int.TryParse(fields[5], out int maxDelta);
+            long.TryParse(fields[6], out long compareUs);
+            return new CompareResult(fields[2], differing, compared, maxDelta, compareUs, fields[7]);
+        }
+
+        private static string CompareMessage(string referencePath, string[] options)
+        {
+            var arguments = options.Length == 0 ? referencePath : referencePath + "::" + string.Join("::", options);
+            return $"COMPARE::{arguments}";
+        }
+
+        /// <summary>
+        /// Send retroactive screenshot: "CAPTURE::offset::filename" captures the
+        /// frame offset frames after the one the command is applied in. A
+        /// negative offset needs a client started with --frame-history.
+        /// </summary>
+        public bool SendCaptureCommand(int frameOffset, string filePath)
+        {
+            return SendCommand($"CAPTURE::{frameOffset}::{filePath}");
+        }
+
+        /// <summary>
+        /// Send a CAPTURE and wait until the client has written the file, or
+        /// failed to (e.g. the frame is no longer kept). Returns null if no
+        /// SCREENSHOT notice came within timeoutMs.
+        /// </summary>
+        public async Task<ScreenshotResult?> CaptureAsync(int frameOffset, string filePath, int timeoutMs)
+        {
+            var message = $"CAPTURE::{frameOffset}::{filePath}";
+            if (!clientSentHello)
+            {
+                SendCommand(message);
+                return null;
+            }
+            return ParseScreenshotNotice(await SendAndWaitForNoticeAsync(message, timeoutMs));
+        }
+
+        /// <summary>
+        /// Send frame dump: "FRAMES::count::directory" writes the last count
+        /// frames the client kept (0 for all) with a frames.txt index of their
+        /// present times.
+        /// </summary>
+        public bool SendFrameDumpCommand(int frameCount, string directory)
+        {
+            return SendCommand($"FRAMES::{frameCount}::{directory}");
+        }
+
         /// <summary>
         /// Close everything
         /// </summary>
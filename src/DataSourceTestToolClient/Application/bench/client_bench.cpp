@@ -0,0 +1,424 @@
+// Micro-benchmarks for the client's receive/apply hot paths.
+//
+// The command mix is built from the PreCondition/*.xml scripts (every property
+// step once) and the server's MessageHistory (every entry as often as it was
+// sent), so the measured field lengths, types and key repetition follow what
+// the server actually sends.
+//
+// Results are written as JSON, one object per benchmark with the best of
+// --iterations runs:
+//   DataSourceTestTool_bench [--precondition-dir DIR] [--settings FILE]
+//                            [--iterations N] [--repeat N] [--json FILE]
+
+#include "binary_protocol.h"
+#include "command_queue.h"
+#include "command_tokenizer.h"
+#include "frame_fingerprint.h"
+#include "frame_renderer.h"
+#include "image_compare.h"
+#include "message_framer.h"
+#include "precondition_script.h"
+#include "property_store.h"
+#include "property_value.h"
+#include "steady_time.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef DATASOURCE_REPO_ROOT
+#define DATASOURCE_REPO_ROOT "."
+#endif
+
+namespace
+{
+struct Options
+{
+    std::string preconditionDir = DATASOURCE_REPO_ROOT "/PreCondition";
+    std::string settingsPath = DATASOURCE_REPO_ROOT "/app_settings.json";
+    std::string jsonPath;
+    int iterations = 7;
+    // How many times the mix is repeated within one run
+    int repeat = 64;
+};
+
+struct Result
+{
+    std::string name;
+    uint64_t items = 0;
+    uint64_t bytes = 0;
+    int64_t bestUs = 0;
+    // Keeps the optimizer from dropping the measured work
+    uint64_t checksum = 0;
+};
+
+struct Workload
+{
+    std::vector<std::string> lines;
+    // Every line joined with '\n', as received on the socket
+    std::string textStream;
+    // The same commands as binary frames
+    std::string binaryStream;
+    size_t scriptCount = 0;
+    size_t historyCount = 0;
+    // Mix entries left out because their value does not parse
+    size_t invalidCount = 0;
+};
+
+// The chunk size of a typical TCP segment payload
+const size_t RECEIVE_CHUNK = 1460;
+
+bool parseArguments(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string argument = argv[i];
+        if (i + 1 >= argc)
+        {
+            std::cout << "Missing value for " << argument << std::endl;
+            return false;
+        }
+
+        std::string value = argv[++i];
+        if (argument == "--precondition-dir")
+            options.preconditionDir = value;
+        else if (argument == "--settings")
+            options.settingsPath = value;
+        else if (argument == "--json")
+            options.jsonPath = value;
+        else if (argument == "--iterations")
+            options.iterations = std::max(1, std::atoi(value.c_str()));
+        else if (argument == "--repeat")
+            options.repeat = std::max(1, std::atoi(value.c_str()));
+        else
+        {
+            std::cout << "Unknown option " << argument << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// MessageHistory keys carry no type; use the type the scripts declare for
+// the same property, otherwise guess from the value
+std::string inferType(const std::map<std::string, std::string> &knownTypes, const MessageHistoryEntry &entry)
+{
+    PropertyType type;
+    PropertyValue value;
+    auto known = knownTypes.find(entry.file + "::" + entry.name);
+    if (known != knownTypes.end() && parsePropertyType(known->second, type) &&
+        parsePropertyValue(type, entry.value, value))
+        return known->second;
+
+    if (parsePropertyValue(PropertyType::Int, entry.value, value))
+        return "int";
+    if (parsePropertyValue(PropertyType::Float, entry.value, value))
+        return "float";
+    if (entry.value == "true" || entry.value == "false")
+        return "bool";
+    return "string";
+}
+
+bool buildWorkload(const Options &options, Workload &workload)
+{
+    std::vector<std::string> candidates;
+    std::map<std::string, std::string> knownTypes;
+
+    std::vector<std::filesystem::path> scripts;
+    std::error_code error;
+    for (const std::filesystem::directory_entry &entry :
+         std::filesystem::directory_iterator(options.preconditionDir, error))
+    {
+        if (entry.path().extension() == ".xml")
+            scripts.push_back(entry.path());
+    }
+    if (error)
+        std::cout << "Cannot list " << options.preconditionDir << ": " << error.message() << std::endl;
+    std::sort(scripts.begin(), scripts.end());
+
+    std::vector<PreconditionStep> steps;
+    for (const std::filesystem::path &script : scripts)
+    {
+        if (!loadPreconditionScript(script.string(), steps))
+            continue;
+        ++workload.scriptCount;
+        for (const PreconditionStep &step : steps)
+        {
+            if (step.kind != PreconditionStep::Kind::Property)
+                continue;
+            knownTypes[step.file + "::" + step.name] = step.type;
+            candidates.push_back(formatPropertyCommand("SYNC", step.file, step.type, step.name, step.value));
+        }
+    }
+
+    std::vector<MessageHistoryEntry> history;
+    if (loadMessageHistory(options.settingsPath, history))
+    {
+        for (const MessageHistoryEntry &entry : history)
+        {
+            std::string command = formatPropertyCommand("SYNC", entry.file, inferType(knownTypes, entry), entry.name,
+                                                        entry.value);
+            for (uint32_t i = 0; i < std::max<uint32_t>(entry.count, 1); ++i)
+                candidates.push_back(command);
+            ++workload.historyCount;
+        }
+    }
+
+    // The client rejects these with a message per command, which would only
+    // measure console output
+    std::vector<std::string> mix;
+    Command command;
+    PropertyValue value;
+    for (const std::string &line : candidates)
+    {
+        if (tokenizeCommand(line, command) == TokenizeError::None && resolvePropertyValue(command, value))
+            mix.push_back(line);
+        else
+            ++workload.invalidCount;
+    }
+
+    if (mix.empty())
+    {
+        std::cout << "No commands found in " << options.preconditionDir << " or " << options.settingsPath
+                  << std::endl;
+        return false;
+    }
+
+    workload.lines.reserve(mix.size() * options.repeat);
+    for (int i = 0; i < options.repeat; ++i)
+        workload.lines.insert(workload.lines.end(), mix.begin(), mix.end());
+
+    for (const std::string &line : workload.lines)
+    {
+        workload.textStream.append(line).push_back('\n');
+        tokenizeCommand(line, command);
+        resolvePropertyValue(command, value);
+        BinaryProtocol::appendPropertyFrame(workload.binaryStream, command.kind, command.file, command.name, value);
+    }
+    return true;
+}
+
+// Runs body() iterations times and keeps the fastest run
+template <typename Body>
+Result measure(const char *name, int iterations, uint64_t items, uint64_t bytes, Body &&body)
+{
+    Result result;
+    result.name = name;
+    result.items = items;
+    result.bytes = bytes;
+    result.bestUs = INT64_MAX;
+    for (int i = 0; i < iterations; ++i)
+    {
+        int64_t start = steadyMicroseconds();
+        result.checksum += body();
+        result.bestUs = std::min(result.bestUs, steadyMicroseconds() - start);
+    }
+    result.bestUs = std::max<int64_t>(result.bestUs, 1);
+    return result;
+}
+
+uint64_t runFraming(MessageFramer &framer, const std::string &stream)
+{
+    framer.reset();
+    uint64_t messages = 0;
+    std::string_view message;
+    size_t offset = 0;
+    while (offset < stream.size())
+    {
+        size_t chunk = std::min(RECEIVE_CHUNK, stream.size() - offset);
+        while (chunk > 0)
+        {
+            size_t taken = framer.append(stream.data() + offset, chunk);
+            offset += taken;
+            chunk -= taken;
+            while (framer.nextMessage(message))
+                messages += message.size() != 0;
+        }
+    }
+    return messages;
+}
+
+uint64_t runTokenize(const std::vector<std::string> &lines)
+{
+    uint64_t fields = 0;
+    Command command;
+    for (const std::string &line : lines)
+    {
+        if (tokenizeCommand(line, command) == TokenizeError::None)
+            fields += command.value.size();
+    }
+    return fields;
+}
+
+uint64_t runValueParsing(const std::vector<Command> &commands)
+{
+    uint64_t parsed = 0;
+    PropertyValue value;
+    for (const Command &command : commands)
+        parsed += resolvePropertyValue(command, value) ? static_cast<uint8_t>(value.type) : 0;
+    return parsed;
+}
+
+uint64_t runBinaryDecode(const std::string &stream)
+{
+    uint64_t decoded = 0;
+    Command command;
+    size_t offset = 0;
+    while (offset + 4 <= stream.size())
+    {
+        uint32_t length = BinaryProtocol::readUint32(stream.data() + offset);
+        std::string_view payload = std::string_view(stream).substr(offset + 4, length);
+        if (BinaryProtocol::decodeCommand(payload, command) == TokenizeError::None)
+            decoded += command.hasTypedValue;
+        offset += 4 + length;
+    }
+    return decoded;
+}
+
+uint64_t runStoreApply(PropertyStore &store, const std::vector<Command> &commands)
+{
+    uint64_t applied = 0;
+    for (const Command &command : commands)
+        applied += store.apply(command);
+    return applied + store.size();
+}
+
+// A golden image check of a full frame that differs in a few cells
+uint64_t runFrameCompare(const FrameBuffer &actual, const FrameBuffer &reference)
+{
+    CompareOptions options;
+    options.tolerance[0] = options.tolerance[1] = options.tolerance[2] = 1;
+    CompareResult result = compareFrames(actual, reference, options);
+    return result.differingPixels + result.maxDelta;
+}
+
+uint64_t runFrameFingerprint(const FrameBuffer &frame, FrameFingerprint &fingerprint)
+{
+    computeFingerprint(frame, FingerprintFormat::DEFAULT_TILE_SIZE, fingerprint);
+    return fingerprint.hashes[0];
+}
+
+// The network thread pushes one command per message while this thread drains,
+// as Application::onCommandsReceived and onUpdate do
+uint64_t runQueueHandoff(CommandQueue &queue, const std::vector<Command> &commands)
+{
+    std::thread producer([&queue, &commands]() {
+        for (const Command &command : commands)
+        {
+            while (!queue.push(&command, 1))
+                std::this_thread::yield();
+        }
+    });
+
+    uint64_t received = 0;
+    uint64_t checksum = 0;
+    while (received < commands.size())
+    {
+        size_t drained = queue.drain([&checksum](const QueuedCommand &queued) { checksum += queued.name.size(); });
+        if (drained == 0)
+            std::this_thread::yield();
+        received += drained;
+    }
+    producer.join();
+    return checksum;
+}
+
+void writeJson(std::ostream &out, const Workload &workload, const Options &options, const std::vector<Result> &results)
+{
+    out << "{\n";
+    out << "  \"workload\": {\"scripts\": " << workload.scriptCount << ", \"history_entries\": "
+        << workload.historyCount << ", \"invalid_values\": " << workload.invalidCount << ", \"commands\": "
+        << workload.lines.size() << ", \"text_bytes\": "
+        << workload.textStream.size() << ", \"binary_bytes\": " << workload.binaryStream.size()
+        << ", \"iterations\": " << options.iterations << "},\n";
+    out << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const Result &result = results[i];
+        double seconds = static_cast<double>(result.bestUs) / 1e6;
+        char numbers[128];
+        std::snprintf(numbers, sizeof(numbers), "\"ns_per_item\": %.2f, \"items_per_s\": %.0f, \"mb_per_s\": %.2f",
+                      result.bestUs * 1000.0 / std::max<uint64_t>(result.items, 1), result.items / seconds,
+                      result.bytes / seconds / 1e6);
+        out << "    {\"name\": \"" << result.name << "\", \"items\": " << result.items << ", \"bytes\": "
+            << result.bytes << ", \"best_us\": " << result.bestUs << ", " << numbers << ", \"checksum\": "
+            << result.checksum << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseArguments(argc, argv, options))
+        return 1;
+
+    Workload workload;
+    if (!buildWorkload(options, workload))
+        return 1;
+
+    // Tokenized once up front for the stages that start from a Command. The
+    // views point into workload.lines, which outlives them.
+    std::vector<Command> commands(workload.lines.size());
+    for (size_t i = 0; i < workload.lines.size(); ++i)
+        tokenizeCommand(workload.lines[i], commands[i]);
+
+    uint64_t count = workload.lines.size();
+    uint64_t textBytes = workload.textStream.size();
+    std::vector<Result> results;
+
+    MessageFramer framer;
+    results.push_back(measure("framing", options.iterations, count, textBytes,
+                              [&]() { return runFraming(framer, workload.textStream); }));
+    results.push_back(measure("tokenize", options.iterations, count, textBytes,
+                              [&]() { return runTokenize(workload.lines); }));
+    results.push_back(measure("value_parse", options.iterations, count, 0,
+                              [&]() { return runValueParsing(commands); }));
+    results.push_back(measure("binary_decode", options.iterations, count, workload.binaryStream.size(),
+                              [&]() { return runBinaryDecode(workload.binaryStream); }));
+
+    PropertyStore store;
+    results.push_back(measure("store_apply", options.iterations, count, 0,
+                              [&]() { return runStoreApply(store, commands); }));
+
+    // The store as store_apply left it, drawn the way screenshots are
+    FrameBuffer frame;
+    frame.resize(1280, 480);
+    renderPropertyGrid(store, frame);
+    FrameBuffer reference = frame;
+    for (size_t i = 0; i < reference.pixels.size(); i += 4099)
+        reference.pixels[i] ^= 0x10;
+    results.push_back(measure("frame_compare", options.iterations, uint64_t(frame.width) * frame.height,
+                              frame.pixels.size() * 2, [&]() { return runFrameCompare(frame, reference); }));
+    FrameFingerprint fingerprint;
+    results.push_back(measure("frame_fingerprint", options.iterations, uint64_t(frame.width) * frame.height,
+                              frame.pixels.size(), [&]() { return runFrameFingerprint(frame, fingerprint); }));
+
+    CommandQueue queue(16384);
+    results.push_back(measure("queue_handoff", options.iterations, count, 0,
+                              [&]() { return runQueueHandoff(queue, commands); }));
+
+    if (options.jsonPath.empty())
+    {
+        writeJson(std::cout, workload, options, results);
+        return 0;
+    }
+
+    std::ofstream out(options.jsonPath);
+    if (!out)
+    {
+        std::cout << "Cannot write " << options.jsonPath << std::endl;
+        return 1;
+    }
+    writeJson(out, workload, options, results);
+    std::cout << "Wrote " << results.size() << " results to " << options.jsonPath << std::endl;
+    return 0;
+}
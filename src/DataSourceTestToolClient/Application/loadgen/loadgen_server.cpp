@@ -0,0 +1,983 @@
+// Loopback load generator standing in for TestToolServer.
+//
+// Listens like the Avalonia server does and drives every client that connects
+// with SYNC/ASYNC (optionally BATCH and SCREENSHOT) commands at a fixed rate.
+// The commands come from PreCondition scripts or a synthetic property set.
+// The client's ACKs show which commands were applied, which were rejected
+// and how long the round trip took.
+//
+//   DataSourceTestTool_loadgen [--port N] [--connections N] [--rate N]
+//       [--duration S] [--batch N] [--async] [--text-only]
+//       [--screenshot-every MS] [--compare ARGS] [--capture-offset K]
+//       [--dump-frames N] [--drain MS] [--interned]
+//       [--script FILE]... | [--synthetic N] [--unix PATH | --shm NAME]
+//
+// --rate counts messages per second per connection; a BATCH is one message
+// carrying --batch commands. Script waits are not replayed, the rate sets the
+// pace instead. The run ends once --connections clients have finished.
+//
+// --compare ARGS follows every screenshot with "COMPARE::ARGS", e.g.
+// --compare "golden.png::tolerance=2::heatmap=diff.png".
+//
+// --capture-offset K sends "CAPTURE::K::path" instead of SCREENSHOT, for the
+// frame K frames after the one the command is applied in (negative K needs a
+// client started with --frame-history). --dump-frames N sends
+// "FRAMES::N::loadgen_<id>_frames" once the run ends, 0 for every frame kept.
+//
+// --interned sends a DICT of every property once the session starts and then
+// the interned SYNCID/ASYNCID/BATCHID forms, which carry the dictionary ID
+// instead of file and name.
+//
+// --unix PATH listens on a Unix domain socket instead of the TCP port, for
+// clients started with "DataSourceTestTool --unix PATH". --shm NAME serves a
+// single client started with "DataSourceTestTool --shm NAME" over a shared
+// memory channel.
+
+#include "binary_protocol.h"
+#include "command_tokenizer.h"
+#include "message_framer.h"
+#include "pipeline_metrics.h"
+#include "precondition_script.h"
+#include "property_value.h"
+#include "shared_memory_channel.h"
+#include "steady_time.h"
+
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using boost::asio::ip::tcp;
+using boost::asio::generic::stream_protocol;
+using StreamAcceptor = boost::asio::basic_socket_acceptor<stream_protocol>;
+
+namespace
+{
+struct Options
+{
+    unsigned short port = 22207;
+    int connections = 1;
+    int rate = 1000;
+    int durationSeconds = 10;
+    int batchSize = 0;
+    bool async = false;
+    bool allowBinary = true;
+    bool interned = false;
+    int screenshotEveryMs = 0;
+    // Arguments of the COMPARE sent after each screenshot; empty for none
+    std::string compareArguments;
+    // Screenshots are CAPTURE commands with this offset when set
+    bool capture = false;
+    int captureOffset = 0;
+    // FRAMES count sent at the end of the run; negative for none
+    int dumpFrames = -1;
+    // How long to wait for outstanding ACKs after the last command
+    int drainMs = 2000;
+    std::vector<std::string> scripts;
+    int syntheticProperties = 0;
+    std::string unixSocketPath;
+    std::string sharedMemoryName;
+};
+
+// One property command, encoded once up front in every form it can be sent in
+struct LoadCommand
+{
+    std::string textLine;
+    std::string textRecord;
+    std::string binaryFrame;
+    std::string binaryRecord;
+};
+
+// Dictionary IDs of the properties sent with --interned, and the DICT that
+// defines them in both encodings
+struct LoadDictionary
+{
+    struct Entry
+    {
+        std::string file;
+        PropertyType type;
+        std::string name;
+    };
+
+    std::map<std::string, uint16_t> ids;
+    std::vector<Entry> entries;
+    std::string textLine;
+    std::string binaryFrame;
+};
+
+// Across all connections; the server runs on a single thread
+struct LoadTotals
+{
+    uint64_t messagesSent = 0;
+    uint64_t commandsSent = 0;
+    uint64_t bytesSent = 0;
+    uint64_t acknowledged = 0;
+    uint64_t rejected = 0;
+    // Messages written more than a tick after their scheduled time, because
+    // the socket was still busy with earlier ones
+    uint64_t lateMessages = 0;
+    // SCREENSHOT notices the client sent once the files were written
+    uint64_t screenshotsWritten = 0;
+    uint64_t screenshotsFailed = 0;
+    // COMPARE results by outcome
+    uint64_t comparesPassed = 0;
+    uint64_t comparesFailed = 0;
+    uint64_t compareErrors = 0;
+    int finishedConnections = 0;
+    // Span from the first connection starting to send until the last message
+    int64_t firstSendUs = 0;
+    int64_t lastSendUs = 0;
+    LatencyHistogram roundTrip;
+};
+
+// Longest catch-up written in one go when the client falls behind schedule
+const uint64_t MAX_MESSAGES_PER_WRITE = 4096;
+const auto TICK = std::chrono::milliseconds(1);
+// Clients that predate the handshake never send HELLO
+const auto HELLO_TIMEOUT = std::chrono::milliseconds(200);
+// Longest the shared memory loop sleeps between timer checks
+const auto SHARED_MEMORY_WAIT = std::chrono::microseconds(200);
+
+bool parseArguments(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string argument = argv[i];
+        if (argument == "--async")
+        {
+            options.async = true;
+            continue;
+        }
+        if (argument == "--text-only")
+        {
+            options.allowBinary = false;
+            continue;
+        }
+        if (argument == "--interned")
+        {
+            options.interned = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            std::cout << "Missing value for " << argument << std::endl;
+            return false;
+        }
+
+        std::string value = argv[++i];
+        int number = std::atoi(value.c_str());
+        if (argument == "--port")
+            options.port = static_cast<unsigned short>(number);
+        else if (argument == "--connections")
+            options.connections = std::max(1, number);
+        else if (argument == "--rate")
+            options.rate = std::max(1, number);
+        else if (argument == "--duration")
+            options.durationSeconds = std::max(1, number);
+        else if (argument == "--batch")
+            options.batchSize = std::max(0, number);
+        else if (argument == "--screenshot-every")
+            options.screenshotEveryMs = std::max(0, number);
+        else if (argument == "--compare")
+            options.compareArguments = value;
+        else if (argument == "--capture-offset")
+        {
+            options.capture = true;
+            options.captureOffset = number;
+        }
+        else if (argument == "--dump-frames")
+            options.dumpFrames = std::max(0, number);
+        else if (argument == "--drain")
+            options.drainMs = std::max(0, number);
+        else if (argument == "--script")
+            options.scripts.push_back(value);
+        else if (argument == "--synthetic")
+            options.syntheticProperties = std::max(1, number);
+        else if (argument == "--unix")
+            options.unixSocketPath = value;
+        else if (argument == "--shm")
+            options.sharedMemoryName = value;
+        else
+        {
+            std::cout << "Unknown option " << argument << std::endl;
+            return false;
+        }
+    }
+
+    if (options.scripts.empty() && options.syntheticProperties == 0)
+        options.syntheticProperties = 64;
+    if (!options.sharedMemoryName.empty() && options.connections > 1)
+    {
+        std::cout << "A shared memory channel serves one client, ignoring --connections" << std::endl;
+        options.connections = 1;
+    }
+    return true;
+}
+
+// Dictionary ID of file.name, defining it on first use. Fails when the
+// property was defined with another type or the IDs ran out.
+bool internProperty(LoadDictionary &dictionary, const std::string &file, PropertyType type, const std::string &name,
+                    uint16_t &id)
+{
+    auto found = dictionary.ids.find(file + "::" + name);
+    if (found != dictionary.ids.end())
+    {
+        id = found->second;
+        return dictionary.entries[id].type == type;
+    }
+    if (dictionary.entries.size() >= PropertyDictionary::MAX_ENTRIES)
+        return false;
+
+    id = static_cast<uint16_t>(dictionary.entries.size());
+    dictionary.ids.emplace(file + "::" + name, id);
+    dictionary.entries.push_back({file, type, name});
+    return true;
+}
+
+void encodeDictionary(LoadDictionary &dictionary)
+{
+    uint32_t count = static_cast<uint32_t>(dictionary.entries.size());
+    dictionary.textLine = "DICT::" + std::to_string(count) + "::";
+    size_t frameStart = BinaryProtocol::beginCountedFrame(dictionary.binaryFrame, BinaryProtocol::Opcode::Dictionary);
+    for (uint32_t id = 0; id < count; ++id)
+    {
+        const LoadDictionary::Entry &entry = dictionary.entries[id];
+        if (id > 0)
+            dictionary.textLine.push_back(BATCH_RECORD_SEPARATOR);
+        dictionary.textLine += std::to_string(id) + "::" + entry.file + "::" + propertyTypeName(entry.type) +
+                               "::" + entry.name;
+        BinaryProtocol::appendDictionaryRecord(dictionary.binaryFrame, static_cast<uint16_t>(id), entry.file,
+                                               entry.type, entry.name);
+    }
+    dictionary.textLine.push_back('\n');
+    BinaryProtocol::endCountedFrame(dictionary.binaryFrame, frameStart, count);
+}
+
+bool addCommand(std::vector<LoadCommand> &commands, LoadDictionary &dictionary, const Options &options,
+                const std::string &file, const std::string &type, const std::string &name, const std::string &value)
+{
+    PropertyType propertyType;
+    PropertyValue typed;
+    if (!parsePropertyType(type, propertyType) || !parsePropertyValue(propertyType, value, typed))
+    {
+        std::cout << "Skipping " << file << "." << name << ": invalid " << type << " value " << value << std::endl;
+        return false;
+    }
+
+    CommandKind kind = options.async ? CommandKind::Async : CommandKind::Sync;
+    LoadCommand command;
+    if (options.interned)
+    {
+        uint16_t id = 0;
+        if (!internProperty(dictionary, file, propertyType, name, id))
+        {
+            std::cout << "Skipping " << file << "." << name << ": no dictionary ID for a " << type << " value"
+                      << std::endl;
+            return false;
+        }
+        command.textRecord = std::to_string(id) + "::" + value;
+        command.textLine = (options.async ? "ASYNCID::" : "SYNCID::") + command.textRecord + "\n";
+        BinaryProtocol::appendInternedPropertyFrame(command.binaryFrame, kind, id, typed);
+        BinaryProtocol::appendInternedBatchRecord(command.binaryRecord, id, typed);
+    }
+    else
+    {
+        command.textRecord = file + "::" + type + "::" + name + "::" + value;
+        command.textLine = commandKindName(kind) + ("::" + command.textRecord) + "\n";
+        BinaryProtocol::appendPropertyFrame(command.binaryFrame, kind, file, name, typed);
+        BinaryProtocol::appendBatchRecord(command.binaryRecord, file, name, typed);
+    }
+    commands.push_back(std::move(command));
+    return true;
+}
+
+bool buildCommands(const Options &options, std::vector<LoadCommand> &commands, LoadDictionary &dictionary)
+{
+    std::vector<PreconditionStep> steps;
+    for (const std::string &script : options.scripts)
+    {
+        if (!loadPreconditionScript(script, steps))
+            return false;
+        for (const PreconditionStep &step : steps)
+        {
+            if (step.kind == PreconditionStep::Kind::Property)
+                addCommand(commands, dictionary, options, step.file, step.type, step.name, step.value);
+        }
+    }
+
+    // Four values per property, cycling through the types the data sources use
+    for (int round = 0; round < 4; ++round)
+    {
+        for (int i = 0; i < options.syntheticProperties; ++i)
+        {
+            std::string name = "Load.Property" + std::to_string(i);
+            int value = round * 7 + i;
+            switch (i % 4)
+            {
+            case 0:
+                addCommand(commands, dictionary, options, "Load", "int", name, std::to_string(value));
+                break;
+            case 1:
+                addCommand(commands, dictionary, options, "Load", "float", name, std::to_string(value) + ".5");
+                break;
+            case 2:
+                addCommand(commands, dictionary, options, "Load", "bool", name, (value & 1) ? "true" : "false");
+                break;
+            default:
+                addCommand(commands, dictionary, options, "Load", "string", name, "Value " + std::to_string(value));
+                break;
+            }
+        }
+    }
+
+    if (commands.empty())
+    {
+        std::cout << "No commands to send" << std::endl;
+        return false;
+    }
+    if (options.interned)
+        encodeDictionary(dictionary);
+    return true;
+}
+
+// Drives one client over a TCP or Unix domain socket or, when channel is set,
+// a shared memory channel whose reads are pulled by pollChannel()
+class LoadConnection : public std::enable_shared_from_this<LoadConnection>
+{
+public:
+    LoadConnection(stream_protocol::socket socket, SharedMemoryChannel *channel, int id, const Options &options,
+                   const std::vector<LoadCommand> &commands, const LoadDictionary &dictionary, LoadTotals &totals)
+        : m_socket(std::move(socket)),
+          m_channel(channel),
+          m_timer(m_socket.get_executor()),
+          m_id(id),
+          m_options(options),
+          m_commands(commands),
+          m_dictionary(dictionary),
+          m_totals(totals),
+          m_framer(64 * 1024),
+          m_binary(false),
+          m_started(false),
+          m_sending(true),
+          m_closed(false),
+          m_writeInFlight(false),
+          m_nextCommand(0),
+          m_messagesSent(0),
+          m_startUs(0),
+          m_nextScreenshotUs(0),
+          m_screenshotCount(0),
+          m_acknowledged(0),
+          m_rejected(0)
+    {
+        m_sendTimes.reserve(static_cast<size_t>(options.rate) * options.durationSeconds + 1);
+        // Sequences start at 1
+        m_sendTimes.push_back(0);
+    }
+
+    void start()
+    {
+        if (!m_channel)
+        {
+            boost::system::error_code ignored;
+            // Fails harmlessly on a Unix domain socket
+            m_socket.set_option(tcp::no_delay(true), ignored);
+            startRead();
+        }
+
+        auto self = shared_from_this();
+        m_timer.expires_after(HELLO_TIMEOUT);
+        m_timer.async_wait([this, self](const boost::system::error_code &error) {
+            if (!error)
+                beginSending();
+        });
+    }
+
+    // Handles the replies that arrived on the shared memory channel and
+    // writes what the ring had no room for before
+    void pollChannel()
+    {
+        if (m_closed)
+            return;
+
+        size_t available = 0;
+        char *buffer = m_framer.prepareWrite(available);
+        size_t length = m_channel->read(buffer, available);
+        if (length == 0 && m_channel->peerClosed())
+        {
+            std::cout << "Connection " << m_id << " lost: client closed the channel" << std::endl;
+            finish();
+            return;
+        }
+
+        m_framer.commitWrite(length);
+        std::string_view line;
+        while (!m_closed && m_framer.nextMessage(line))
+            handleLine(line);
+        flush();
+    }
+
+private:
+    void startRead()
+    {
+        size_t available = 0;
+        char *buffer = m_framer.prepareWrite(available);
+        auto self = shared_from_this();
+        m_socket.async_read_some(boost::asio::buffer(buffer, available),
+                                 [this, self](const boost::system::error_code &error, size_t length) {
+                                     if (error)
+                                     {
+                                         if (!m_closed)
+                                         {
+                                             std::cout << "Connection " << m_id << " lost: " << error.message()
+                                                       << std::endl;
+                                             finish();
+                                         }
+                                         return;
+                                     }
+
+                                     m_framer.commitWrite(length);
+                                     std::string_view line;
+                                     while (m_framer.nextMessage(line))
+                                         handleLine(line);
+                                     startRead();
+                                 });
+    }
+
+    void handleLine(std::string_view line)
+    {
+        Command command;
+        if (tokenizeCommand(line, command) == TokenizeError::None && command.kind == CommandKind::Hello)
+        {
+            // Too late to switch once text commands went out; without a reply
+            // the client keeps reading text
+            if (m_started)
+                return;
+
+            // "<version>::<encodings>"; binary when both sides allow it, else
+            // text, which is what TestToolServer always answers
+            std::string version = std::to_string(BinaryProtocol::VERSION);
+            m_binary = m_options.allowBinary && line.find(version + "::") != std::string_view::npos &&
+                       line.find("binary") != std::string_view::npos;
+            m_pending += "HELLO::" + (m_binary ? version + "::binary" : std::to_string(BinaryProtocol::TEXT_VERSION) +
+                                                                            "::text") + "\n";
+            beginSending();
+            return;
+        }
+
+        // SCREENSHOT::seq::ok|failed::bytes::encode_us::path
+        if (line.substr(0, 12) == "SCREENSHOT::")
+        {
+            if (line.find("::ok::") != std::string_view::npos)
+                ++m_totals.screenshotsWritten;
+            else
+                ++m_totals.screenshotsFailed;
+            return;
+        }
+
+        // COMPARE::seq::pass|fail|error::differing::compared::max_delta::compare_us::reference
+        if (line.substr(0, 9) == "COMPARE::")
+        {
+            if (line.find("::pass::") != std::string_view::npos)
+                ++m_totals.comparesPassed;
+            else if (line.find("::fail::") != std::string_view::npos)
+                ++m_totals.comparesFailed;
+            else
+                ++m_totals.compareErrors;
+            return;
+        }
+
+        // ACK::seq::receive_us::apply_us
+        std::string_view rest = line;
+        std::string_view prefix;
+        std::string_view sequenceField;
+        std::string_view receiveField;
+        uint32_t sequence = 0;
+        if (!takeField(rest, prefix) || prefix != "ACK" || !takeField(rest, sequenceField) ||
+            !takeField(rest, receiveField) || !parseDecimal(sequenceField, sequence) || sequence == 0 ||
+            sequence >= m_sendTimes.size())
+        {
+            std::cout << "Connection " << m_id << ": unexpected reply " << line << std::endl;
+            return;
+        }
+
+        if (rest == "0")
+        {
+            ++m_rejected;
+            ++m_totals.rejected;
+        }
+        else
+        {
+            ++m_acknowledged;
+            ++m_totals.acknowledged;
+        }
+        m_totals.roundTrip.record(steadyMicroseconds() - m_sendTimes[sequence]);
+
+        if (!m_sending && m_acknowledged + m_rejected >= m_messagesSent)
+            finish();
+    }
+
+    void beginSending()
+    {
+        if (m_started)
+            return;
+        m_started = true;
+        m_startUs = steadyMicroseconds();
+        if (m_totals.firstSendUs == 0)
+            m_totals.firstSendUs = m_startUs;
+        m_nextScreenshotUs = m_startUs + m_options.screenshotEveryMs * 1000;
+        std::cout << "Connection " << m_id << " using " << (m_binary ? "binary" : "text") << " protocol"
+                  << std::endl;
+        // Not acknowledged, so not counted as a sent message
+        if (m_options.interned)
+            m_pending += m_binary ? m_dictionary.binaryFrame : m_dictionary.textLine;
+        tick();
+    }
+
+    void tick()
+    {
+        if (m_closed)
+            return;
+
+        int64_t now = steadyMicroseconds();
+        int64_t elapsedUs = now - m_startUs;
+        if (m_sending && elapsedUs >= m_options.durationSeconds * 1000000ll)
+        {
+            m_sending = false;
+            m_drainDeadlineUs = now + m_options.drainMs * 1000ll;
+            if (m_options.dumpFrames >= 0)
+                appendFrameDump(now);
+            if (m_acknowledged + m_rejected >= m_messagesSent)
+            {
+                finish();
+                return;
+            }
+        }
+
+        if (m_sending)
+        {
+            uint64_t due = static_cast<uint64_t>(elapsedUs) * m_options.rate / 1000000;
+            if (due > m_scheduledSent && !writeBusy())
+                appendMessages(std::min(due - m_scheduledSent, MAX_MESSAGES_PER_WRITE), now);
+        }
+        else if (now >= m_drainDeadlineUs)
+        {
+            finish();
+            return;
+        }
+        flush();
+
+        auto self = shared_from_this();
+        m_timer.expires_after(TICK);
+        m_timer.async_wait([this, self](const boost::system::error_code &error) {
+            if (!error)
+                tick();
+        });
+    }
+
+    void appendMessages(uint64_t count, int64_t now)
+    {
+        if (m_options.screenshotEveryMs > 0 && now >= m_nextScreenshotUs)
+        {
+            std::string path = "loadgen_" + std::to_string(m_id) + "_" + std::to_string(++m_screenshotCount) + ".png";
+            if (m_options.capture && m_binary)
+                BinaryProtocol::appendCaptureFrame(m_pending, m_options.captureOffset, path);
+            else if (m_options.capture)
+                m_pending += "CAPTURE::" + std::to_string(m_options.captureOffset) + "::" + path + "\n";
+            else if (m_binary)
+                BinaryProtocol::appendScreenshotFrame(m_pending, path);
+            else
+                m_pending += "SCREENSHOT::" + path + "\n";
+            m_nextScreenshotUs += m_options.screenshotEveryMs * 1000;
+            recordSent(now, 0);
+
+            if (!m_options.compareArguments.empty())
+            {
+                if (m_binary)
+                    BinaryProtocol::appendCompareFrame(m_pending, m_options.compareArguments);
+                else
+                    m_pending += "COMPARE::" + m_options.compareArguments + "\n";
+                recordSent(now, 0);
+            }
+        }
+
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            if (m_options.batchSize > 0)
+                appendBatch();
+            else
+                appendCommand(nextCommand());
+            recordSent(now, m_options.batchSize > 0 ? m_options.batchSize : 1);
+
+            // Message k is due (k + 1) / rate seconds after the start
+            int64_t scheduledUs = m_startUs + static_cast<int64_t>(++m_scheduledSent * 1000000 / m_options.rate);
+            if (now - scheduledUs > std::chrono::duration_cast<std::chrono::microseconds>(TICK).count())
+                ++m_totals.lateMessages;
+        }
+    }
+
+    void appendFrameDump(int64_t now)
+    {
+        std::string directory = "loadgen_" + std::to_string(m_id) + "_frames";
+        uint32_t count = static_cast<uint32_t>(m_options.dumpFrames);
+        if (m_binary)
+            BinaryProtocol::appendFrameDumpFrame(m_pending, count, directory);
+        else
+            m_pending += "FRAMES::" + std::to_string(count) + "::" + directory + "\n";
+        recordSent(now, 0);
+    }
+
+    const LoadCommand &nextCommand()
+    {
+        const LoadCommand &command = m_commands[m_nextCommand];
+        m_nextCommand = (m_nextCommand + 1) % m_commands.size();
+        return command;
+    }
+
+    void appendCommand(const LoadCommand &command)
+    {
+        m_pending += m_binary ? command.binaryFrame : command.textLine;
+    }
+
+    void appendBatch()
+    {
+        uint32_t count = static_cast<uint32_t>(m_options.batchSize);
+        if (m_binary)
+        {
+            BinaryProtocol::Opcode opcode =
+                m_options.interned ? BinaryProtocol::Opcode::BatchId : BinaryProtocol::Opcode::Batch;
+            size_t frameStart = BinaryProtocol::beginCountedFrame(m_pending, opcode);
+            for (uint32_t i = 0; i < count; ++i)
+                m_pending += nextCommand().binaryRecord;
+            BinaryProtocol::endCountedFrame(m_pending, frameStart, count);
+            return;
+        }
+
+        m_pending += (m_options.interned ? "BATCHID::" : "BATCH::") + std::to_string(count) + "::";
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            if (i > 0)
+                m_pending.push_back(BATCH_RECORD_SEPARATOR);
+            m_pending += nextCommand().textRecord;
+        }
+        m_pending.push_back('\n');
+    }
+
+    void recordSent(int64_t now, uint64_t commands)
+    {
+        // Every message sent here is acknowledged by the client with the next sequence
+        m_sendTimes.push_back(now);
+        m_totals.lastSendUs = std::max(m_totals.lastSendUs, now);
+        ++m_messagesSent;
+        ++m_totals.messagesSent;
+        m_totals.commandsSent += commands;
+    }
+
+    // A TCP write still in flight, or a shared memory ring that was full
+    bool writeBusy() const { return m_channel ? !m_pending.empty() : m_writeInFlight; }
+
+    void flush()
+    {
+        if (m_closed || m_writeInFlight || m_pending.empty())
+            return;
+
+        if (m_channel)
+        {
+            size_t written = m_channel->write(m_pending.data(), m_pending.size());
+            m_pending.erase(0, written);
+            m_totals.bytesSent += written;
+            return;
+        }
+
+        m_writing.swap(m_pending);
+        m_pending.clear();
+        m_writeInFlight = true;
+        m_totals.bytesSent += m_writing.size();
+
+        auto self = shared_from_this();
+        boost::asio::async_write(m_socket, boost::asio::buffer(m_writing),
+                                 [this, self](const boost::system::error_code &error, size_t) {
+                                     m_writeInFlight = false;
+                                     if (error)
+                                     {
+                                         if (!m_closed)
+                                         {
+                                             std::cout << "Connection " << m_id
+                                                       << " write failed: " << error.message() << std::endl;
+                                             finish();
+                                         }
+                                         return;
+                                     }
+                                     flush();
+                                 });
+    }
+
+    void finish()
+    {
+        if (m_closed)
+            return;
+        m_closed = true;
+        m_timer.cancel();
+
+        if (m_channel)
+        {
+            m_channel->close();
+        }
+        else
+        {
+            boost::system::error_code ignored;
+            m_socket.shutdown(stream_protocol::socket::shutdown_both, ignored);
+            m_socket.close(ignored);
+        }
+
+        uint64_t unacknowledged = m_messagesSent - std::min(m_messagesSent, m_acknowledged + m_rejected);
+        std::cout << "Connection " << m_id << " finished: " << m_messagesSent << " messages, " << m_acknowledged
+                  << " applied, " << m_rejected << " rejected, " << unacknowledged << " unacknowledged" << std::endl;
+        ++m_totals.finishedConnections;
+    }
+
+    stream_protocol::socket m_socket;
+    SharedMemoryChannel *m_channel;
+    boost::asio::steady_timer m_timer;
+    int m_id;
+    const Options &m_options;
+    const std::vector<LoadCommand> &m_commands;
+    const LoadDictionary &m_dictionary;
+    LoadTotals &m_totals;
+
+    MessageFramer m_framer;
+    bool m_binary;
+    bool m_started;
+    bool m_sending;
+    bool m_closed;
+    bool m_writeInFlight;
+    std::string m_pending;
+    std::string m_writing;
+
+    size_t m_nextCommand;
+    uint64_t m_messagesSent;
+    // Rate-paced messages, i.e. all but the screenshots
+    uint64_t m_scheduledSent = 0;
+    int64_t m_startUs;
+    int64_t m_drainDeadlineUs = 0;
+    int64_t m_nextScreenshotUs;
+    uint64_t m_screenshotCount;
+    // Send time by sequence number
+    std::vector<int64_t> m_sendTimes;
+    uint64_t m_acknowledged;
+    uint64_t m_rejected;
+};
+
+class LoadServer
+{
+public:
+    LoadServer(boost::asio::io_context &ioContext, const Options &options, const std::vector<LoadCommand> &commands,
+               const LoadDictionary &dictionary)
+        : m_ioContext(ioContext),
+          m_acceptor(ioContext),
+          m_reportTimer(ioContext),
+          m_options(options),
+          m_commands(commands),
+          m_dictionary(dictionary),
+          m_accepted(0)
+    {
+    }
+
+    void start()
+    {
+        report();
+        if (!m_options.sharedMemoryName.empty())
+        {
+            std::cout << "Waiting on shared memory " << m_options.sharedMemoryName << ", " << m_commands.size()
+                      << " distinct commands" << std::endl;
+            return;
+        }
+
+        stream_protocol::endpoint endpoint = tcp::endpoint(tcp::v4(), m_options.port);
+        std::string description = "port " + std::to_string(m_options.port);
+        if (!m_options.unixSocketPath.empty())
+        {
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+            // A socket file left behind by an earlier run would make bind() fail
+            std::remove(m_options.unixSocketPath.c_str());
+            endpoint = boost::asio::local::stream_protocol::endpoint(m_options.unixSocketPath);
+            description = m_options.unixSocketPath;
+#else
+            throw std::runtime_error("Unix domain sockets are not supported on this platform");
+#endif
+        }
+
+        m_acceptor.open(endpoint.protocol());
+        if (m_options.unixSocketPath.empty())
+            m_acceptor.set_option(StreamAcceptor::reuse_address(true));
+        m_acceptor.bind(endpoint);
+        m_acceptor.listen();
+        std::cout << "Listening on " << description << " for " << m_options.connections << " connection(s), "
+                  << m_commands.size() << " distinct commands" << std::endl;
+        accept();
+    }
+
+    // Replaces ioContext.run() with --shm: runs the timers and pulls the
+    // channel, sleeping on it in between so ACKs are seen as they arrive
+    bool runSharedMemory()
+    {
+        if (!m_channel.create(m_options.sharedMemoryName))
+            return false;
+
+        while (!m_ioContext.stopped())
+        {
+            m_ioContext.poll();
+            if (!m_connection && m_channel.peerAttached())
+            {
+                int id = ++m_accepted;
+                std::cout << "Connection " << id << " over shared memory" << std::endl;
+                m_connection = std::make_shared<LoadConnection>(stream_protocol::socket(m_ioContext), &m_channel, id,
+                                                                m_options, m_commands, m_dictionary, m_totals);
+                m_connection->start();
+            }
+            if (m_connection)
+                m_connection->pollChannel();
+            // Closed once the connection finished, until the report timer stops the loop
+            if (m_channel.isOpen())
+                m_channel.wait(SHARED_MEMORY_WAIT);
+            else
+                std::this_thread::sleep_for(SHARED_MEMORY_WAIT);
+        }
+        m_connection.reset();
+        m_channel.close();
+        return true;
+    }
+
+    void printSummary() const
+    {
+        double seconds = std::max<int64_t>(m_totals.lastSendUs - m_totals.firstSendUs, 1) / 1e6;
+        uint64_t answered = m_totals.acknowledged + m_totals.rejected;
+        uint64_t unacknowledged = m_totals.messagesSent - std::min(m_totals.messagesSent, answered);
+
+        std::cout << "=== Load summary ===" << std::endl;
+        std::cout << "Messages sent:    " << m_totals.messagesSent << " (" << m_totals.commandsSent
+                  << " commands, " << m_totals.bytesSent << " bytes)" << std::endl;
+        std::cout << "Applied:          " << m_totals.acknowledged << std::endl;
+        std::cout << "Rejected:         " << m_totals.rejected << std::endl;
+        std::cout << "Unacknowledged:   " << unacknowledged << std::endl;
+        std::cout << "Sent late:        " << m_totals.lateMessages << std::endl;
+        if (m_totals.screenshotsWritten + m_totals.screenshotsFailed > 0)
+            std::cout << "Screenshots:      " << m_totals.screenshotsWritten << " written, "
+                      << m_totals.screenshotsFailed << " failed" << std::endl;
+        if (m_totals.comparesPassed + m_totals.comparesFailed + m_totals.compareErrors > 0)
+            std::cout << "Compares:         " << m_totals.comparesPassed << " passed, " << m_totals.comparesFailed
+                      << " failed, " << m_totals.compareErrors << " errors" << std::endl;
+        std::cout << "Throughput:       " << static_cast<uint64_t>(m_totals.messagesSent / seconds) << " msg/s sent, "
+                  << static_cast<uint64_t>(m_totals.acknowledged / seconds) << " msg/s applied" << std::endl;
+        if (answered == 0)
+        {
+            std::cout << "The client sent no ACKs, so drops are unknown" << std::endl;
+            return;
+        }
+        std::cout << "ACK round trip:   p50 " << m_totals.roundTrip.percentile(50) << " us, p99 "
+                  << m_totals.roundTrip.percentile(99) << " us, max " << m_totals.roundTrip.max() << " us"
+                  << std::endl;
+    }
+
+private:
+    void accept()
+    {
+        m_acceptor.async_accept([this](const boost::system::error_code &error, stream_protocol::socket socket) {
+            if (error)
+            {
+                std::cout << "Accept failed: " << error.message() << std::endl;
+                return;
+            }
+
+            int id = ++m_accepted;
+            std::cout << "Connection " << id << " accepted" << std::endl;
+            std::make_shared<LoadConnection>(std::move(socket), nullptr, id, m_options, m_commands, m_dictionary,
+                                             m_totals)
+                ->start();
+
+            if (m_accepted < m_options.connections)
+                accept();
+        });
+    }
+
+    void report()
+    {
+        m_reportTimer.expires_after(std::chrono::seconds(1));
+        m_reportTimer.async_wait([this](const boost::system::error_code &error) {
+            if (error)
+                return;
+
+            if (m_totals.finishedConnections >= m_options.connections)
+            {
+                boost::system::error_code ignored;
+                m_acceptor.close(ignored);
+                if (!m_options.unixSocketPath.empty())
+                    std::remove(m_options.unixSocketPath.c_str());
+                m_ioContext.stop();
+                return;
+            }
+
+            if (m_accepted > 0)
+            {
+                std::cout << "sent " << m_totals.messagesSent - m_lastSent << " msg/s, applied "
+                          << m_totals.acknowledged - m_lastAcknowledged << " msg/s, rejected "
+                          << m_totals.rejected - m_lastRejected << std::endl;
+            }
+            m_lastSent = m_totals.messagesSent;
+            m_lastAcknowledged = m_totals.acknowledged;
+            m_lastRejected = m_totals.rejected;
+            report();
+        });
+    }
+
+    boost::asio::io_context &m_ioContext;
+    StreamAcceptor m_acceptor;
+    boost::asio::steady_timer m_reportTimer;
+    const Options &m_options;
+    const std::vector<LoadCommand> &m_commands;
+    const LoadDictionary &m_dictionary;
+    LoadTotals m_totals;
+    SharedMemoryChannel m_channel;
+    std::shared_ptr<LoadConnection> m_connection;
+    int m_accepted;
+    uint64_t m_lastSent = 0;
+    uint64_t m_lastAcknowledged = 0;
+    uint64_t m_lastRejected = 0;
+};
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseArguments(argc, argv, options))
+        return 1;
+
+    std::vector<LoadCommand> commands;
+    LoadDictionary dictionary;
+    if (!buildCommands(options, commands, dictionary))
+        return 1;
+
+    try
+    {
+        boost::asio::io_context ioContext;
+        LoadServer server(ioContext, options, commands, dictionary);
+        server.start();
+        if (options.sharedMemoryName.empty())
+            ioContext.run();
+        else if (!server.runSharedMemory())
+            return 1;
+        server.printSummary();
+    }
+    catch (std::exception &e)
+    {
+        std::cout << "Load generator error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
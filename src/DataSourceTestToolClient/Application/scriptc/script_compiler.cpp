@@ -0,0 +1,122 @@
+// Compiles PreCondition scripts into the binary form described in
+// compiled_script.h.
+//
+// By default every script is written to the client's compiled script cache,
+// named by the hash of its XML, so the next SCRIPT for it starts without any
+// parsing. With --output a single script is written to the given .dsc file
+// instead, which SCRIPT also accepts directly.
+//
+//   DataSourceTestTool_scriptc [--cache DIR] script.xml...
+//   DataSourceTestTool_scriptc --output FILE script.xml
+
+#include "compiled_script.h"
+#include "file_util.h"
+#include "precondition_script.h"
+#include "steady_time.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+struct Options
+{
+    std::string cacheDirectory = defaultScriptCacheDirectory();
+    std::string outputPath;
+    std::vector<std::string> scripts;
+};
+
+bool parseArguments(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string argument = argv[i];
+        if (argument == "--cache" || argument == "--output")
+        {
+            if (i + 1 >= argc)
+            {
+                std::cout << "Missing value for " << argument << std::endl;
+                return false;
+            }
+            (argument == "--cache" ? options.cacheDirectory : options.outputPath) = argv[++i];
+        }
+        else if (argument.compare(0, 2, "--") == 0)
+        {
+            std::cout << "Unknown option " << argument << std::endl;
+            return false;
+        }
+        else
+        {
+            options.scripts.push_back(argument);
+        }
+    }
+
+    if (options.scripts.empty() || (!options.outputPath.empty() && options.scripts.size() != 1))
+    {
+        std::cout << "Usage: DataSourceTestTool_scriptc [--cache DIR] script.xml..." << std::endl;
+        std::cout << "       DataSourceTestTool_scriptc --output FILE script.xml" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool writeCompiled(const std::string &scriptPath, const std::string &outputPath)
+{
+    std::string source;
+    if (!readFile(scriptPath, source))
+        return false;
+
+    std::vector<PreconditionStep> steps;
+    std::string image;
+    if (!parsePreconditionScript(source, steps))
+    {
+        std::cout << "Malformed precondition script " << scriptPath << std::endl;
+        return false;
+    }
+    if (!compileScript(steps, hashScriptSource(source), image))
+        return false;
+
+    std::ofstream out(outputPath, std::ios::binary | std::ios::trunc);
+    out.write(image.data(), static_cast<std::streamsize>(image.size()));
+    if (!out)
+    {
+        std::cout << "Cannot write " << outputPath << std::endl;
+        return false;
+    }
+    return true;
+}
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseArguments(argc, argv, options))
+        return 1;
+
+    int failures = 0;
+    for (const std::string &path : options.scripts)
+    {
+        int64_t start = steadyMicroseconds();
+        CompiledScript script;
+        bool compiled = options.outputPath.empty() ? loadCachedScript(path, options.cacheDirectory, script)
+                                                   : writeCompiled(path, options.outputPath) &&
+                                                         script.openFile(options.outputPath);
+        if (!compiled)
+        {
+            ++failures;
+            continue;
+        }
+
+        std::uintmax_t sourceBytes = std::filesystem::file_size(path);
+        std::cout << path << ": " << script.stepCount() << " steps, " << script.nameCount() << " properties, "
+                  << sourceBytes << " -> " << script.imageSize() << " bytes in " << steadyMicroseconds() - start
+                  << " us" << std::endl;
+    }
+
+    if (options.outputPath.empty() && !options.cacheDirectory.empty())
+        std::cout << "Cache: " << options.cacheDirectory << std::endl;
+    return failures == 0 ? 0 : 1;
+}
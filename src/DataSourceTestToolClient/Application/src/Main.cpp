@@ -1,25 +1,195 @@
 #include "application.h"
 #include "network_client.h"
+#include "frame_loop.h"
 #include <iostream>
 #include <thread>
-#include <chrono>
+#include <atomic>
+#include <string>
+#include <csignal>
+#include <cstdlib>
 
-int main()
+namespace
+{
+// Cleared by Enter, or by SIGINT/SIGTERM when headless
+std::atomic<bool> running(true);
+
+void stopRunning(int)
+{
+    running = false;
+}
+}
+
+int main(int argc, char *argv[])
 {
     std::cout << "DataSourceTestTool - Clean Version" << std::endl;
 
     // Create application
     Application app;
+
+    // --unix PATH and --shm NAME talk to a server on the same host through
+    // a Unix domain socket or shared memory instead of TCP. --session ID names
+    // the server session the client belongs to and turns on the property
+    // snapshot, kept per session and endpoint; a restored one is announced in
+    // the HELLO. Without a session only --snapshot PATH keeps a snapshot, and
+    // --no-snapshot turns it off in either case.
+    // --frame-history N keeps the last N frames for CAPTURE and FRAMES, in at
+    // most --frame-memory MB.
+    //
+    // --headless draws every frame into the software framebuffer instead of
+    // waiting for Enter, and runs until SIGINT/SIGTERM or --ticks N frames,
+    // then prints the frame loop's timings. --hz N sets the frame rate, 0 for
+    // back to back frames. --verbose prints every applied property.
+    std::string unixSocketPath;
+    std::string sharedMemoryName;
+    std::string session;
+    std::string snapshotPath;
+    // The default snapshot belongs to a session; without one a restart must
+    // not bring back the values of whoever ran the client last
+    bool defaultSnapshot = true;
+    size_t frameHistory = 0;
+    size_t frameMemory = FrameRing::DEFAULT_MEMORY_CAP;
+    bool headless = false;
+    uint64_t tickLimit = 0;
+    FrameLoop loop;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string argument = argv[i];
+        if (argument == "--unix" && i + 1 < argc)
+        {
+            unixSocketPath = argv[++i];
+        }
+        else if (argument == "--shm" && i + 1 < argc)
+        {
+            sharedMemoryName = argv[++i];
+        }
+        else if (argument == "--session" && i + 1 < argc)
+        {
+            session = argv[++i];
+        }
+        else if (argument == "--snapshot" && i + 1 < argc)
+        {
+            snapshotPath = argv[++i];
+            defaultSnapshot = false;
+        }
+        else if (argument == "--no-snapshot")
+        {
+            snapshotPath.clear();
+            defaultSnapshot = false;
+        }
+        else if (argument == "--frame-history" && i + 1 < argc)
+        {
+            frameHistory = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (argument == "--frame-memory" && i + 1 < argc)
+        {
+            frameMemory = std::strtoul(argv[++i], nullptr, 10) * 1024 * 1024;
+        }
+        else if (argument == "--headless")
+        {
+            headless = true;
+        }
+        else if (argument == "--hz" && i + 1 < argc)
+        {
+            loop.setRate(static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10)));
+        }
+        else if (argument == "--ticks" && i + 1 < argc)
+        {
+            tickLimit = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (argument == "--verbose")
+        {
+            app.setVerbose(true);
+        }
+        else
+        {
+            std::cout << "Usage: DataSourceTestTool [--unix PATH | --shm NAME] [--session ID]" << std::endl;
+            std::cout << "                          [--snapshot PATH | --no-snapshot]" << std::endl;
+            std::cout << "                          [--frame-history N] [--frame-memory MB]" << std::endl;
+            std::cout << "                          [--hz N] [--headless [--ticks N]] [--verbose]" << std::endl;
+            return 1;
+        }
+    }
+    if (tickLimit > 0 && !headless)
+    {
+        std::cout << "--ticks needs --headless" << std::endl;
+        return 1;
+    }
+    // The session ID is sent as one item of the HELLO's capability list
+    if (session.find_first_of(",: \t\r\n") != std::string::npos)
+    {
+        std::cout << "--session must not contain ',', ':' or white space" << std::endl;
+        return 1;
+    }
+
+    std::string endpoint = !sharedMemoryName.empty() ? "shm:" + sharedMemoryName
+                           : !unixSocketPath.empty() ? "unix:" + unixSocketPath
+                                                     : std::string("tcp");
+    std::string snapshotIdentity = session + "@" + endpoint;
+    app.setSnapshotIdentity(snapshotIdentity);
+    app.setSnapshotPath(defaultSnapshot && !session.empty() ? defaultSnapshotPath(snapshotIdentity) : snapshotPath);
+    loop.setTickLimit(tickLimit);
+    app.setFrameHistory(frameHistory, frameMemory);
+
     app.onConfigure();
     app.onProjectLoaded();
     app.registerMetadataOverride();
 
     // Create client and connect
     NetworkClient &client = NetworkClient::getInstance();
-    client.connectToServer();
+    if (app.restoredCount() > 0 && !session.empty())
+        client.setRestoredSession(session);
+    client.setCommandHandler(
+        [&app](const Command *commands, size_t count) { return app.onCommandsReceived(commands, count); });
+    client.setSampleHandler([&app](uint32_t streamId, const StreamSample *samples, size_t count) {
+        app.onSamplesReceived(streamId, samples, count);
+    });
+    app.setAcknowledgementHandler([&client](const Acknowledgement *acknowledgements, size_t count) {
+        client.sendAcknowledgements(acknowledgements, count);
+    });
+    app.setScreenshotNoticeHandler([&client](const ScreenshotNotice &notice) { client.sendScreenshotNotice(notice); });
+    app.setCompareNoticeHandler([&client](const CompareNotice &notice) { client.sendCompareNotice(notice); });
+    if (!sharedMemoryName.empty())
+        client.connectSharedMemory(sharedMemoryName);
+    else if (!unixSocketPath.empty())
+        client.connectUnixSocket(unixSocketPath);
+    else
+        client.connectToServer();
+
+    // Frame loop: SYNC commands are applied once per frame, ASYNC ones are
+    // polled between frames. A running script's waits wake the loop exactly
+    // when they end rather than at the next poll.
+    loop.addHook(FrameLoop::Stage::Drain, [&app](const FrameLoop::Tick &) { app.drainCommands(); });
+    loop.addHook(FrameLoop::Stage::Apply, [&app](const FrameLoop::Tick &) { app.applyFrameState(); });
+    if (headless)
+        loop.addHook(FrameLoop::Stage::Render, [&app](const FrameLoop::Tick &) { app.renderFrame(); });
+    loop.addHook(FrameLoop::Stage::Present, [&app](const FrameLoop::Tick &) { app.onFramePresented(); });
+    loop.setIdleHook([&app]() {
+        app.applyAsyncCommands();
+        int64_t scriptDeadline = app.nextScriptDeadlineUs();
+        return scriptDeadline == ScriptRunner::IDLE ? FrameLoop::NO_DEADLINE : scriptDeadline;
+    });
+
+    std::thread inputThread;
+    if (headless)
+    {
+        std::cout << "Application running headless at " << loop.rate() << " Hz. Send SIGINT to quit..." << std::endl;
+        std::signal(SIGINT, stopRunning);
+        std::signal(SIGTERM, stopRunning);
+    }
+    else
+    {
+        std::cout << "Application running. Press Enter to quit..." << std::endl;
+        inputThread = std::thread([]() {
+            std::cin.get();
+            running = false;
+        });
+    }
 
-    std::cout << "Application running. Press Enter to quit..." << std::endl;
-    std::cin.get();
+    loop.run(running);
+    if (inputThread.joinable())
+        inputThread.join();
+    if (headless)
+        loop.dump(std::cout);
 
     // Cleanup
     client.disconnect();
@@ -1,7 +1,5 @@
 #include "TestToolClient_Simple.h"
 #include <iostream>
-#include <chrono>
-#include <thread>
 
 using boost::asio::ip::tcp;
 
@@ -20,83 +18,102 @@ TestToolClient_Simple &TestToolClient_Simple::getInstance()
 
 void TestToolClient_Simple::connectToServer()
 {
-    if (m_isConnected)
+    if (m_isConnected || m_connecting)
         return;
 
-    m_networkThread = std::thread(&TestToolClient_Simple::networkProcedure, this);
+    // A previous connection may still own the thread
+    if (m_networkThread.joinable())
+        m_networkThread.join();
+
+    tcp::endpoint endpoint(boost::asio::ip::address::from_string(SERVER_IP), SERVER_PORT);
+    std::cout << "Attempting to connect to " << SERVER_IP << ":" << SERVER_PORT << std::endl;
+
+    m_connecting = true;
+    m_ioContext.restart();
+    m_socket.async_connect(endpoint, [this](const boost::system::error_code &error) { onConnect(error); });
+    m_networkThread = std::thread([this]() {
+        m_ioContext.run();
+        m_isConnected = false;
+        m_connecting = false;
+    });
 }
 
 void TestToolClient_Simple::disconnect()
 {
-    m_isConnected = false;
+    // Stopping the context abandons a pending connect or read
+    m_ioContext.stop();
     if (m_networkThread.joinable())
         m_networkThread.join();
+
+    boost::system::error_code ignored;
+    m_socket.close(ignored);
+    m_isConnected = false;
+    m_connecting = false;
 }
 
-void TestToolClient_Simple::networkProcedure()
+void TestToolClient_Simple::onConnect(const boost::system::error_code &error)
 {
-    try
+    m_connecting = false;
+    if (error)
     {
-        boost::asio::io_context io_context;
-        tcp::socket socket(io_context);
-        tcp::endpoint endpoint(boost::asio::ip::address::from_string(SERVER_IP), SERVER_PORT);
-
-        std::cout << "Attempting to connect to " << SERVER_IP << ":" << SERVER_PORT << std::endl;
-
-        socket.connect(endpoint);
-        m_isConnected = true;
-
-        std::cout << "Connected successfully!" << std::endl;
-
-        // Simple message loop
-        while (m_isConnected)
-        {
-            std::vector<char> buffer(1024);
-            boost::system::error_code error;
-
-            size_t len = socket.read_some(boost::asio::buffer(buffer), error);
-
-            if (error == boost::asio::error::eof)
-            {
-                std::cout << "Connection closed by server" << std::endl;
-                break;
-            }
-            else if (error)
-            {
-                std::cout << "Error: " << error.message() << std::endl;
-                break;
-            }
-
-            if (len > 0)
-            {
-                std::string message(buffer.data(), len);
-                std::cout << "Received: " << message << std::endl;
-            }
-        }
+        std::cout << "Network error: " << error.message() << std::endl;
+        boost::system::error_code ignored;
+        m_socket.close(ignored);
+        return;
     }
-    catch (std::exception &e)
+
+    m_isConnected = true;
+    std::cout << "Connected successfully!" << std::endl;
+
+    m_framer.reset();
+    startRead();
+}
+
+void TestToolClient_Simple::startRead()
+{
+    // Read straight into the framer's preallocated buffer
+    size_t available = 0;
+    char *buffer = m_framer.prepareWrite(available);
+    m_socket.async_read_some(boost::asio::buffer(buffer, available),
+                             [this](const boost::system::error_code &error, size_t length) { onRead(error, length); });
+}
+
+void TestToolClient_Simple::onRead(const boost::system::error_code &error, size_t length)
+{
+    if (error)
     {
-        std::cout << "Network error: " << e.what() << std::endl;
+        if (error == boost::asio::error::eof)
+            std::cout << "Connection closed by server" << std::endl;
+        else if (error != boost::asio::error::operation_aborted)
+            std::cout << "Error: " << error.message() << std::endl;
+
+        boost::system::error_code ignored;
+        m_socket.close(ignored);
+        m_isConnected = false;
+        return;
     }
 
-    m_isConnected = false;
+    // A read may hold several commands or only part of one
+    m_framer.commitWrite(length);
+    std::string_view message;
+    while (m_framer.nextMessage(message))
+    {
+        handleMessage(message);
+    }
+    startRead();
 }
 
-std::vector<std::string> TestToolClient_Simple::split(const std::string &str, const std::string &delimiter)
+void TestToolClient_Simple::handleMessage(std::string_view message)
 {
-    std::vector<std::string> result;
-    size_t start = 0;
-    size_t end = str.find(delimiter);
-
-    while (end != std::string::npos)
+    Command command;
+    TokenizeError error = tokenizeCommand(message, command);
+    if (error != TokenizeError::None)
     {
-        result.push_back(str.substr(start, end - start));
-        start = end + delimiter.length();
-        end = str.find(delimiter, start);
+        std::cout << "Ignoring command (" << tokenizeErrorName(error) << "): " << message << std::endl;
+        return;
     }
 
-    result.push_back(str.substr(start));
-    return result;
+    std::cout << "Received: " << message << std::endl;
 }
 
 TestToolClient_Simple::~TestToolClient_Simple()
@@ -1,10 +1,12 @@
 #pragma once
 #include <iostream>
 #include <string>
-#include <vector>
+#include <string_view>
 #include <thread>
 #include <atomic>
 #include <boost/asio.hpp>
+#include "message_framer.h"
+#include "command_tokenizer.h"
 
 // Simple networking client without Kanzi dependencies
 class TestToolClient_Simple
@@ -18,10 +20,17 @@ public:
     ~TestToolClient_Simple();
 
 private:
-    TestToolClient_Simple() : m_isConnected(false) {}
-    void networkProcedure();
-    std::vector<std::string> split(const std::string &str, const std::string &delimiter);
+    TestToolClient_Simple() : m_socket(m_ioContext), m_isConnected(false), m_connecting(false) {}
+    void onConnect(const boost::system::error_code &error);
+    void startRead();
+    void onRead(const boost::system::error_code &error, size_t length);
+    void handleMessage(std::string_view message);
 
+    // Connect and read are asynchronous so disconnect() can stop them
+    boost::asio::io_context m_ioContext;
+    boost::asio::ip::tcp::socket m_socket;
     std::atomic<bool> m_isConnected;
+    std::atomic<bool> m_connecting;
     std::thread m_networkThread;
+    MessageFramer m_framer;
 };
@@ -1,7 +1,78 @@
 #include "application.h"
+#include "command_tokenizer.h"
+#include "steady_time.h"
+#include "pipeline_metrics.h"
+#include "frame_renderer.h"
+#include <charconv>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 
+namespace
+{
+// Commands that can wait for the application thread before the network
+// thread starts dropping them
+const size_t SYNC_QUEUE_CAPACITY = 16384;
+const size_t ASYNC_QUEUE_CAPACITY = 4096;
+
+// Room for roughly two network jitter spikes at 1 kHz
+const std::chrono::microseconds DEFAULT_STREAM_PLAYOUT_DELAY(50000);
+
+const uint32_t DEFAULT_FRAME_WIDTH = 1280;
+const uint32_t DEFAULT_FRAME_HEIGHT = 480;
+
+// Name of the index a FRAMES dump writes next to the frames: a
+// "<number> <present_us> frame_<number>.png" line per frame, oldest first, and
+// a "# gap <first> <last>" line for frames presented in between but not kept,
+// such as those presented while an earlier dump held the frame history
+const char *const FRAME_DUMP_INDEX = "frames.txt";
+
+bool parseFrameOffset(std::string_view text, int64_t &offset)
+{
+    if (!text.empty() && text.front() == '+')
+        text.remove_prefix(1);
+    const char *end = text.data() + text.size();
+    std::from_chars_result result = std::from_chars(text.data(), end, offset);
+    return !text.empty() && result.ec == std::errc() && result.ptr == end;
+}
+}
+
 // Simple implementation
+Application::Application()
+    : m_restoredCount(0), m_syncQueue(SYNC_QUEUE_CAPACITY), m_asyncQueue(ASYNC_QUEUE_CAPACITY),
+      m_streamPlayoutDelay(DEFAULT_STREAM_PLAYOUT_DELAY), m_frameRendered(false), m_presentedFrames(0),
+      m_dumpNext(0), m_dumpSequence(0), m_scriptAcknowledge(false), m_scriptSequence(0), m_scriptReceiveTimeUs(0),
+      m_coalescingEnabled(true), m_appliedCount(0), m_coalescedCount(0), m_verbose(false)
+{
+    m_frame.width = DEFAULT_FRAME_WIDTH;
+    m_frame.height = DEFAULT_FRAME_HEIGHT;
+
+    // Script screenshots are named without an extension
+    m_script.setScreenshotHandler([this](std::string_view name) {
+        if (name.find('.') == std::string_view::npos)
+            takeScreenshot(std::string(name) + ".png", 0);
+        else
+            takeScreenshot(name, 0);
+    });
+}
+
+void Application::setFrameSize(uint32_t width, uint32_t height)
+{
+    m_frame.resize(width, height);
+    // Allocated now rather than on the next present; a dump still reading the
+    // held frames leaves that to record()
+    if (!m_frameHistory.held())
+        m_frameHistory.allocate(width, height);
+}
+
+void Application::setFrameHistory(size_t frameCount, size_t memoryCap)
+{
+    // The frames of a dump in progress go with the old slots
+    m_dumpFrames.clear();
+    m_frameHistory.configure(frameCount, memoryCap);
+    m_frameHistory.allocate(m_frame.width, m_frame.height);
+}
+
 void Application::onConfigure()
 {
     std::cout << "Application configured" << std::endl;
@@ -10,6 +81,15 @@ void Application::onConfigure()
 void Application::onProjectLoaded()
 {
     std::cout << "Project loaded" << std::endl;
+
+    if (m_snapshotPath.empty() || !m_snapshot.open(m_snapshotPath, m_snapshotIdentity))
+        return;
+
+    int64_t start = steadyMicroseconds();
+    m_restoredCount = m_snapshot.restore(m_propertyStore);
+    if (m_restoredCount > 0)
+        std::cout << "Restored " << m_restoredCount << " properties from " << m_snapshotPath << " in "
+                  << steadyMicroseconds() - start << " us" << std::endl;
 }
 
 void Application::registerMetadataOverride()
@@ -22,9 +102,537 @@ void Application::onKeyInputEvent()
     std::cout << "Key input received" << std::endl;
 }
 
+bool Application::onCommandsReceived(const Command *commands, size_t count)
+{
+    // Open a declared stream right away: its samples follow the STREAM
+    // command before the application thread gets to apply it
+    for (size_t i = 0; i < count; ++i)
+    {
+        PropertyType type;
+        if (commands[i].kind == CommandKind::Stream && parsePropertyType(commands[i].type, type))
+            m_streams.open(commands[i].propertyId, type);
+    }
+
+    bool accepted = true;
+    // Split into runs so a BATCH (all SYNC) is published to its queue in one go
+    size_t runStart = 0;
+    while (runStart < count)
+    {
+        bool async = commands[runStart].kind == CommandKind::Async;
+        size_t runEnd = runStart + 1;
+        while (runEnd < count && (commands[runEnd].kind == CommandKind::Async) == async)
+            ++runEnd;
+
+        CommandQueue &queue = async ? m_asyncQueue : m_syncQueue;
+        if (runEnd - runStart > queue.capacity())
+        {
+            // Would never fit, however far the application thread catches up
+            std::cout << "Rejecting " << runEnd - runStart << " commands, more than the queue's "
+                      << queue.capacity() << std::endl;
+            accepted = false;
+        }
+        else if (!queue.push(commands + runStart, runEnd - runStart))
+        {
+            std::cout << "Command queue full, dropping " << runEnd - runStart << " commands" << std::endl;
+            accepted = false;
+        }
+        runStart = runEnd;
+    }
+    return accepted;
+}
+
+void Application::onUpdate()
+{
+    drainCommands();
+    applyFrameState();
+}
+
+void Application::drainCommands()
+{
+    uint64_t coalescedBefore = m_coalescedCount;
+    size_t applied = applyQueue(m_syncQueue);
+    uint64_t coalesced = m_coalescedCount - coalescedBefore;
+    if (m_verbose && applied + coalesced > 1)
+        std::cout << "Applied " << applied << " commands this frame (" << coalesced << " coalesced)" << std::endl;
+
+    applyAsyncCommands();
+}
+
+void Application::applyFrameState()
+{
+    m_streams.update(m_propertyStore, SignalStreams::now() - m_streamPlayoutDelay.count());
+
+    // Once per frame also covers ASYNC commands applied between frames
+    if (m_snapshot.isOpen())
+        m_snapshot.update(m_propertyStore);
+    else
+        m_propertyStore.clearChanged();
+}
+
+void Application::applyAsyncCommands()
+{
+    applyQueue(m_asyncQueue);
+    runScript();
+    sendAcknowledgements();
+
+    m_screenshots.pollCompleted(m_screenshotNoticeHandler, m_compareNoticeHandler);
+    continueFrameDump();
+}
+
+void Application::takeScreenshot(std::string_view path, uint32_t sequence)
+{
+    if (path.empty())
+    {
+        std::cout << "Ignoring SCREENSHOT without a path" << std::endl;
+        return;
+    }
+
+    drawFrame();
+    captureFrame(m_frame, path, sequence);
+}
+
+void Application::captureFrame(const FrameBuffer &frame, std::string_view path, uint32_t sequence)
+{
+    // Encoding and writing happen on the writer's threads
+    if (!m_screenshots.capture(frame, path, sequence))
+        reportCaptureFailed(path, sequence);
+}
+
+void Application::reportCaptureFailed(std::string_view path, uint32_t sequence)
+{
+    if (!m_screenshotNoticeHandler)
+        return;
+
+    ScreenshotNotice notice;
+    notice.sequence = sequence;
+    notice.written = false;
+    notice.bytes = 0;
+    notice.encodeUs = 0;
+    notice.path = std::string(path);
+    m_screenshotNoticeHandler(notice);
+}
+
+void Application::captureAtOffset(std::string_view argument, uint32_t sequence)
+{
+    std::string_view rest = argument;
+    std::string_view field;
+    int64_t offset = 0;
+    if (!takeField(rest, field) || !parseFrameOffset(field, offset) || rest.empty())
+    {
+        std::cout << "Invalid CAPTURE " << argument << std::endl;
+        reportCaptureFailed(argument, sequence);
+        return;
+    }
+
+    // Frames still to come are captured once presented, earlier ones come
+    // from the frame history
+    int64_t frame = static_cast<int64_t>(m_presentedFrames) + offset;
+    if (offset >= 0)
+    {
+        m_pendingCaptures.push_back(PendingCapture{static_cast<uint64_t>(frame), sequence, std::string(rest)});
+        return;
+    }
+
+    const FrameRing::Entry *entry = frame >= 0 ? m_frameHistory.find(static_cast<uint64_t>(frame)) : nullptr;
+    if (entry)
+    {
+        captureFrame(entry->frame, rest, sequence);
+        return;
+    }
+
+    std::cout << "Frame " << frame << " is not in the frame history, cannot capture " << rest << std::endl;
+    reportCaptureFailed(rest, sequence);
+}
+
+void Application::startFrameDump(std::string_view argument, uint32_t sequence)
+{
+    std::string_view rest = argument;
+    std::string_view field;
+    uint32_t count = 0;
+    bool valid = takeField(rest, field) && parseDecimal(field, count) && !rest.empty();
+    std::string directory(valid ? rest : argument);
+    if (!valid)
+        std::cout << "Invalid FRAMES " << argument << std::endl;
+    else if (!m_dumpFrames.empty())
+        std::cout << "Still writing the frames for " << m_dumpDirectory << ", ignoring FRAMES" << std::endl;
+    else if (m_frameHistory.size() == 0)
+        std::cout << "No frames kept, ignoring FRAMES" << std::endl;
+
+    if (!valid || !m_dumpFrames.empty() || m_frameHistory.size() == 0)
+    {
+        reportCaptureFailed(directory, sequence);
+        return;
+    }
+
+    // The newest count frames (all of them for 0), listed with their present
+    // times so they can be matched with the apply times of the ACKs
+    size_t held = m_frameHistory.size();
+    size_t first = count == 0 || count >= held ? 0 : held - count;
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    std::ofstream index(std::filesystem::path(directory) / FRAME_DUMP_INDEX, std::ios::trunc);
+    for (size_t i = first; i < held; ++i)
+    {
+        const FrameRing::Entry &entry = m_frameHistory.at(i);
+        if (i > first && entry.number != m_dumpFrames.back() + 1)
+            index << "# gap " << m_dumpFrames.back() + 1 << " " << entry.number - 1 << "\n";
+        m_dumpFrames.push_back(entry.number);
+        index << entry.number << " " << entry.presentTimeUs << " frame_" << entry.number << ".png\n";
+    }
+    if (!index)
+        std::cout << "Cannot write the frame index in " << directory << std::endl;
+
+    std::cout << "Writing " << m_dumpFrames.size() << " frames to " << directory << std::endl;
+    m_dumpDirectory = directory;
+    m_dumpSequence = sequence;
+    m_dumpNext = 0;
+    m_frameHistory.setHeld(true);
+    continueFrameDump();
+}
+
+void Application::continueFrameDump()
+{
+    if (m_dumpFrames.empty())
+        return;
+
+    // Hands over only what the writer takes now; the rest waits for free
+    // buffers while the frame history is held
+    size_t free = m_screenshots.freeBufferCount();
+    for (; free > 0 && m_dumpNext < m_dumpFrames.size(); --free, ++m_dumpNext)
+    {
+        uint64_t number = m_dumpFrames[m_dumpNext];
+        std::string path = (std::filesystem::path(m_dumpDirectory) / ("frame_" + std::to_string(number) + ".png"))
+                               .string();
+        captureFrame(m_frameHistory.find(number)->frame, path, m_dumpSequence);
+    }
+
+    if (m_dumpNext == m_dumpFrames.size())
+    {
+        m_dumpFrames.clear();
+        m_frameHistory.setHeld(false);
+    }
+}
+
+void Application::compareFrame(std::string_view argument, uint32_t sequence)
+{
+    // The frame is copied here; decoding the reference and comparing run on
+    // the screenshot workers
+    CompareRequest request;
+    bool valid = parseCompareRequest(argument, request);
+    if (valid)
+    {
+        drawFrame();
+        if (m_screenshots.compare(m_frame, request, sequence))
+            return;
+    }
+    if (!m_compareNoticeHandler)
+        return;
+
+    CompareNotice notice;
+    notice.sequence = sequence;
+    notice.outcome = CompareOutcome::Error;
+    notice.reference = valid ? request.reference : std::string(argument.substr(0, argument.find("::")));
+    m_compareNoticeHandler(notice);
+}
+
+void Application::renderFrame()
+{
+    drawFrame();
+    m_frameRendered = true;
+}
+
+void Application::drawFrame()
+{
+    // Drawn on demand so the picture is exactly the state the commands before
+    // it left
+    if (m_frame.pixels.empty())
+        m_frame.resize(m_frame.width, m_frame.height);
+    renderPropertyGrid(m_propertyStore, m_frame);
+}
+
+void Application::onFramePresented()
+{
+    int64_t presentTime = steadyMicroseconds();
+    uint64_t frame = m_presentedFrames++;
+
+    // Without a render stage, frames are only drawn here when they are kept
+    // or captured
+    const FrameBuffer *presented = m_frameRendered ? &m_frame : nullptr;
+    m_frameRendered = false;
+    if (FrameBuffer *slot = m_frameHistory.record(frame, presentTime, m_frame.width, m_frame.height))
+    {
+        if (presented)
+            *slot = *presented;
+        else
+            renderPropertyGrid(m_propertyStore, *slot);
+        presented = slot;
+    }
+    for (size_t i = 0; i < m_pendingCaptures.size();)
+    {
+        PendingCapture &capture = m_pendingCaptures[i];
+        if (capture.frame != frame)
+        {
+            ++i;
+            continue;
+        }
+        if (!presented)
+        {
+            drawFrame();
+            presented = &m_frame;
+        }
+        captureFrame(*presented, capture.path, capture.sequence);
+        capture = std::move(m_pendingCaptures.back());
+        m_pendingCaptures.pop_back();
+    }
+    continueFrameDump();
+
+    if (m_pendingPresents.empty())
+        return;
+
+    PipelineMetrics &metrics = PipelineMetrics::getInstance();
+    for (const PendingPresent &pending : m_pendingPresents)
+    {
+        metrics.record(PipelineMetrics::Stage::ApplyToPresent, presentTime - pending.applyTimeUs);
+        metrics.record(PipelineMetrics::Stage::ReceiveToPresent, presentTime - pending.receiveTimeUs);
+    }
+    m_pendingPresents.clear();
+}
+
+void Application::sendAcknowledgements()
+{
+    if (m_acknowledgements.empty())
+        return;
+
+    if (m_acknowledgementHandler)
+        m_acknowledgementHandler(m_acknowledgements.data(), m_acknowledgements.size());
+    m_acknowledgements.clear();
+}
+
+void Application::setKeepEveryValue(std::string_view module, std::string_view name)
+{
+    m_keepEveryValueNames.emplace_back(module, name);
+    m_keepEveryValue.clear();
+    updateKeepEveryValueFlags();
+}
+
+void Application::updateKeepEveryValueFlags()
+{
+    // Resolve the opt-out list for properties added since the last call
+    size_t known = m_keepEveryValue.size();
+    m_keepEveryValue.resize(m_propertyStore.size(), 0);
+    for (size_t index = known; index < m_keepEveryValue.size(); ++index)
+    {
+        for (const std::pair<std::string, std::string> &key : m_keepEveryValueNames)
+        {
+            if (m_propertyStore.module(static_cast<uint32_t>(index)) == key.first &&
+                m_propertyStore.name(static_cast<uint32_t>(index)) == key.second)
+                m_keepEveryValue[index] = 1;
+        }
+    }
+}
+
+size_t Application::applyQueue(CommandQueue &queue)
+{
+    // Property updates are coalesced in runs between other commands, so a
+    // SCREENSHOT still sees exactly the state the server set up before it
+    size_t count = queue.readable();
+    size_t runStart = 0;
+    size_t applied = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const QueuedCommand &command = queue.peek(i);
+        if (command.isProperty())
+            continue;
+
+        applied += applyPropertyRun(queue, runStart, i);
+        runStart = i + 1;
+
+        // Unknown marks a command rejected on the network thread
+        if (command.kind == CommandKind::Unknown)
+            continue;
+        if (command.kind == CommandKind::Stream)
+            declareStream(command);
+        else if (command.kind == CommandKind::Stats)
+            dumpStats(command.text);
+        else if (command.kind == CommandKind::Script)
+            startScript(command);
+        else if (command.kind == CommandKind::Screenshot)
+            takeScreenshot(command.text, command.acknowledge ? command.sequence : 0);
+        else if (command.kind == CommandKind::Compare)
+            compareFrame(command.text, command.acknowledge ? command.sequence : 0);
+        else if (command.kind == CommandKind::Capture)
+            captureAtOffset(command.text, command.acknowledge ? command.sequence : 0);
+        else if (command.kind == CommandKind::FrameDump)
+            startFrameDump(command.text, command.acknowledge ? command.sequence : 0);
+        else
+            std::cout << "Received: " << commandKindName(command.kind) << " " << command.text << std::endl;
+        ++applied;
+    }
+    applied += applyPropertyRun(queue, runStart, count);
+
+    // Coalesced commands count as applied: the value they set was superseded
+    int64_t applyTime = steadyMicroseconds();
+    PipelineMetrics &metrics = PipelineMetrics::getInstance();
+    for (size_t i = 0; i < count; ++i)
+    {
+        // A SCRIPT is acknowledged by finishScript() instead
+        const QueuedCommand &command = queue.peek(i);
+        if (!command.acknowledge || command.kind == CommandKind::Script)
+            continue;
+
+        bool rejected = command.kind == CommandKind::Unknown;
+        m_acknowledgements.push_back(
+            Acknowledgement{command.sequence, command.receiveTimeUs, rejected ? 0 : applyTime});
+        if (!rejected)
+        {
+            metrics.record(PipelineMetrics::Stage::ParseToApply, applyTime - command.parseTimeUs);
+            m_pendingPresents.push_back(PendingPresent{command.receiveTimeUs, applyTime});
+        }
+    }
+
+    queue.release(count);
+    return applied;
+}
+
+size_t Application::applyPropertyRun(CommandQueue &queue, size_t begin, size_t end)
+{
+    if (begin == end)
+        return 0;
+
+    // First pass: find every property's index and remember its last write
+    m_runIndices.resize(end - begin);
+    for (size_t i = begin; i < end; ++i)
+    {
+        const QueuedCommand &command = queue.peek(i);
+        m_runIndices[i - begin] = m_propertyStore.findOrInsert(command.file, command.name, command.value.type);
+    }
+
+    if (m_keepEveryValue.size() < m_propertyStore.size())
+        updateKeepEveryValueFlags();
+    if (m_lastWrite.size() < m_propertyStore.size())
+        m_lastWrite.resize(m_propertyStore.size());
+
+    // Entries from earlier runs are stale but always overwritten here for
+    // every index this run touches, so the table never needs clearing
+    for (size_t i = 0; i < m_runIndices.size(); ++i)
+        m_lastWrite[m_runIndices[i]] = static_cast<uint32_t>(i);
+
+    // Second pass: apply the last write of each property, or every write
+    // for those that opted out
+    size_t applied = 0;
+    for (size_t i = 0; i < m_runIndices.size(); ++i)
+    {
+        uint32_t index = m_runIndices[i];
+        if (m_coalescingEnabled && !m_keepEveryValue[index] && m_lastWrite[index] != i)
+        {
+            ++m_coalescedCount;
+            continue;
+        }
+
+        applyProperty(queue.peek(begin + i), index);
+        ++applied;
+    }
+    m_appliedCount += applied;
+    return applied;
+}
+
+void Application::applyProperty(const QueuedCommand &command, uint32_t index)
+{
+    PropertyValue value = command.typedValue();
+    m_propertyStore.set(index, value);
+
+    if (m_verbose)
+        std::cout << "Received: " << commandKindName(command.kind) << " " << command.file << " "
+                  << propertyTypeName(value.type) << " " << command.name << " = " << value << std::endl;
+}
+
+void Application::onSamplesReceived(uint32_t streamId, const StreamSample *samples, size_t count)
+{
+    if (!m_streams.isOpen(streamId))
+        std::cout << "Ignoring samples for undeclared stream " << streamId << std::endl;
+    else if (!m_streams.push(streamId, samples, count, SignalStreams::now()))
+        std::cout << "Dropped samples for stream " << streamId << std::endl;
+}
+
+void Application::declareStream(const QueuedCommand &command)
+{
+    uint32_t index = m_propertyStore.findOrInsert(command.file, command.name, command.value.type);
+    if (!m_streams.declare(command.propertyId, index, command.value.type))
+    {
+        std::cout << "Cannot stream " << propertyTypeName(command.value.type) << " property " << command.name
+                  << " as stream " << command.propertyId << std::endl;
+        return;
+    }
+
+    std::cout << "Streaming " << command.file << " " << command.name << " as stream " << command.propertyId
+              << std::endl;
+}
+
+void Application::dumpStats(std::string_view argument)
+{
+    PipelineMetrics &metrics = PipelineMetrics::getInstance();
+    metrics.dump(std::cout);
+    if (argument == "reset")
+        metrics.reset();
+}
+
+void Application::startScript(const QueuedCommand &command)
+{
+    if (m_script.running())
+    {
+        std::cout << "Script replaced before it finished" << std::endl;
+        finishScript(false);
+    }
+
+    m_scriptAcknowledge = command.acknowledge;
+    m_scriptSequence = command.sequence;
+    m_scriptReceiveTimeUs = command.receiveTimeUs;
+    if (!m_script.load(command.text, m_propertyStore))
+    {
+        std::cout << "Cannot run script " << (command.text.front() == '<' ? "(inline)" : command.text) << std::endl;
+        finishScript(false);
+        return;
+    }
+
+    std::cout << "Running script with " << m_script.stepCount() << " steps" << std::endl;
+    m_script.start(steadyMicroseconds());
+    runScript();
+}
+
+void Application::runScript()
+{
+    if (!m_script.running())
+        return;
+
+    m_script.run(steadyMicroseconds(), m_propertyStore);
+    if (!m_script.running())
+        finishScript(true);
+}
+
+void Application::finishScript(bool completed)
+{
+    int64_t applyTime = steadyMicroseconds();
+    m_script.stop();
+    if (completed)
+    {
+        m_appliedCount += m_script.propertyCount();
+        m_pendingPresents.push_back(PendingPresent{m_scriptReceiveTimeUs, applyTime});
+        std::cout << "Script finished in " << m_script.elapsedUs() << " us, waits ended at most "
+                  << m_script.maxLatenessUs() << " us late" << std::endl;
+    }
+
+    if (m_scriptAcknowledge)
+        m_acknowledgements.push_back(
+            Acknowledgement{m_scriptSequence, m_scriptReceiveTimeUs, completed ? applyTime : 0});
+    m_scriptAcknowledge = false;
+}
+
 void Application::quit()
 {
     std::cout << "Application quitting" << std::endl;
+    m_screenshots.waitIdle();
+    m_screenshots.pollCompleted(m_screenshotNoticeHandler, m_compareNoticeHandler);
+    m_snapshot.discard();
 }
 
 Application::~Application()
@@ -1,13 +1,223 @@
 #pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "property_store.h"
+#include "property_snapshot.h"
+#include "command_queue.h"
+#include "signal_stream.h"
+#include "script_runner.h"
+#include "frame_buffer.h"
+#include "screenshot_writer.h"
+#include "frame_ring.h"
+#include <chrono>
+#include <functional>
+
+struct Command;
 
 // Simple application class
 class Application
 {
 public:
+    Application();
     void onConfigure();
+    // Restores the property snapshot left by a previous run that did not
+    // quit, before the server sends anything
     void onProjectLoaded();
     void registerMetadataOverride();
     void onKeyInputEvent();
+
+    // Called by NetworkClient on the network thread for each command, or once
+    // for a whole BATCH. Only queues the commands; nothing is applied here.
+    // Returns false if the commands were dropped because a queue was full, or
+    // a BATCH has more commands than the queue holds.
+    bool onCommandsReceived(const Command *commands, size_t count);
+
+    // Receives the ACKs of commands applied by onUpdate()/applyAsyncCommands(),
+    // once per call, on the application thread
+    using AcknowledgementHandler = std::function<void(const Acknowledgement *acknowledgements, size_t count)>;
+    void setAcknowledgementHandler(AcknowledgementHandler handler) { m_acknowledgementHandler = std::move(handler); }
+
+    // Receives a SCREENSHOT notice on the application thread (from
+    // applyAsyncCommands()) once the file of a SCREENSHOT command or script
+    // screenshot has been written, or at once if it had to be dropped
+    using ScreenshotNoticeHandler = ScreenshotWriter::CompletionHandler;
+    void setScreenshotNoticeHandler(ScreenshotNoticeHandler handler)
+    {
+        m_screenshotNoticeHandler = std::move(handler);
+    }
+
+    // Receives the result of each COMPARE command on the application thread,
+    // like the SCREENSHOT notices
+    using CompareNoticeHandler = ScreenshotWriter::CompareHandler;
+    void setCompareNoticeHandler(CompareNoticeHandler handler) { m_compareNoticeHandler = std::move(handler); }
+
+    // Size of the software frame screenshots and comparisons are taken from
+    void setFrameSize(uint32_t width, uint32_t height);
+    // Tile size of the fingerprint written next to each screenshot, 0 for none
+    void setFingerprintTileSize(uint32_t tileSize) { m_screenshots.setFingerprintTileSize(tileSize); }
+    // Encoder threads and buffers for screenshots; see ScreenshotWriter::configure()
+    void configureScreenshots(size_t bufferCount, size_t workerCount)
+    {
+        m_screenshots.configure(bufferCount, workerCount);
+    }
+    // Keeps the last frameCount presented frames, within memoryCap bytes, for
+    // CAPTURE with a negative offset and FRAMES; 0 keeps none. Every presented
+    // frame is then drawn. The memory is allocated here and by setFrameSize(),
+    // not by the frame loop.
+    void setFrameHistory(size_t frameCount, size_t memoryCap);
+
+    // Called by NetworkClient on the network thread for each SAMPLE command
+    void onSamplesReceived(uint32_t streamId, const StreamSample *samples, size_t count);
+
+    // Frame boundary on the application thread: drainCommands(), then
+    // applyFrameState()
+    void onUpdate();
+
+    // Drain stage of a frame: applies every SYNC command (and SCREENSHOT,
+    // STREAM, SCRIPT...) received since the previous frame, then any ASYNC
+    // commands
+    void drainCommands();
+    // Apply stage of a frame: resamples the streamed signals into the store,
+    // then mirrors the frame's changes to the snapshot
+    void applyFrameState();
+    // Render stage of a frame: draws the current state into the software
+    // framebuffer, which the following onFramePresented() then presents as is
+    void renderFrame();
+
+    // Applies ASYNC commands as soon as they arrive and runs the due steps of
+    // a SCRIPT; may be called any number of times between frames
+    void applyAsyncCommands();
+
+    // Steady clock time (see steadyMicroseconds()) at which the running
+    // script next needs applyAsyncCommands(), or ScriptRunner::IDLE. A SCRIPT
+    // that arrives while another runs replaces it, and the replaced one is
+    // acknowledged as rejected.
+    int64_t nextScriptDeadlineUs() const { return m_script.nextDeadlineUs(); }
+
+    // Call once a frame has been presented; closes the latency measurement of
+    // every command applied since the previous call, keeps the frame in the
+    // frame history and takes the CAPTURE screenshots due for it
+    void onFramePresented();
+    // Number of the frame the next onFramePresented() presents, counting from
+    // 0. Commands applied before it show in that frame: a CAPTURE with offset
+    // k is taken of frame presentedFrameCount() + k as of its apply.
+    uint64_t presentedFrameCount() const { return m_presentedFrames; }
+
+    // Updates queued for the same property between two applies are merged,
+    // keeping only the last value. Properties that need every value (e.g. to
+    // drive an animation through each step) can opt out individually.
+    void setCoalescingEnabled(bool enabled) { m_coalescingEnabled = enabled; }
+    void setKeepEveryValue(std::string_view module, std::string_view name);
+    uint64_t appliedCount() const { return m_appliedCount; }
+    uint64_t coalescedCount() const { return m_coalescedCount; }
+
+    // Prints every applied property and the per-frame apply counts. Off by
+    // default: the output is written from the frame loop.
+    void setVerbose(bool verbose) { m_verbose = verbose; }
+
+    // Where SCRIPT compiles script files to; empty disables the cache
+    void setScriptCacheDirectory(std::string directory) { m_script.setCacheDirectory(std::move(directory)); }
+
+    // File the applied properties are mirrored to every frame; empty, the
+    // default, disables the snapshot. Takes effect at onProjectLoaded().
+    void setSnapshotPath(std::string path) { m_snapshotPath = std::move(path); }
+    // Server session and endpoint the snapshot belongs to (see
+    // defaultSnapshotPath()); a snapshot of another identity is not restored
+    void setSnapshotIdentity(std::string identity) { m_snapshotIdentity = std::move(identity); }
+    // Properties onProjectLoaded() restored from the snapshot
+    size_t restoredCount() const { return m_restoredCount; }
+
+    // How far behind the newest samples streamed signals are rendered
+    void setStreamPlayoutDelay(std::chrono::microseconds delay) { m_streamPlayoutDelay = delay; }
+
+    // Ends the session, finishing pending screenshots and deleting its snapshot
     void quit();
     ~Application();
+
+    // Current data source state as received from the server
+    const PropertyStore &propertyStore() const { return m_propertyStore; }
+
+private:
+    size_t applyQueue(CommandQueue &queue);
+    size_t applyPropertyRun(CommandQueue &queue, size_t begin, size_t end);
+    void applyProperty(const QueuedCommand &command, uint32_t index);
+    void updateKeepEveryValueFlags();
+    void declareStream(const QueuedCommand &command);
+    void sendAcknowledgements();
+    void dumpStats(std::string_view argument);
+    void startScript(const QueuedCommand &command);
+    void runScript();
+    void finishScript(bool completed);
+    void takeScreenshot(std::string_view path, uint32_t sequence);
+    void captureFrame(const FrameBuffer &frame, std::string_view path, uint32_t sequence);
+    void reportCaptureFailed(std::string_view path, uint32_t sequence);
+    void captureAtOffset(std::string_view argument, uint32_t sequence);
+    void startFrameDump(std::string_view argument, uint32_t sequence);
+    void continueFrameDump();
+    void compareFrame(std::string_view argument, uint32_t sequence);
+    void drawFrame();
+
+    PropertyStore m_propertyStore;
+    std::string m_snapshotPath;
+    std::string m_snapshotIdentity;
+    PropertySnapshot m_snapshot;
+    size_t m_restoredCount;
+    CommandQueue m_syncQueue;
+    CommandQueue m_asyncQueue;
+    SignalStreams m_streams;
+    std::chrono::microseconds m_streamPlayoutDelay;
+    AcknowledgementHandler m_acknowledgementHandler;
+    std::vector<Acknowledgement> m_acknowledgements;
+    // Receive and apply times of messages applied but not yet presented
+    struct PendingPresent
+    {
+        int64_t receiveTimeUs;
+        int64_t applyTimeUs;
+    };
+    std::vector<PendingPresent> m_pendingPresents;
+
+    FrameBuffer m_frame;
+    // Set by renderFrame() until the frame is presented
+    bool m_frameRendered;
+    ScreenshotWriter m_screenshots;
+    ScreenshotNoticeHandler m_screenshotNoticeHandler;
+    CompareNoticeHandler m_compareNoticeHandler;
+
+    FrameRing m_frameHistory;
+    uint64_t m_presentedFrames;
+    // CAPTURE screenshots of frames not presented yet
+    struct PendingCapture
+    {
+        uint64_t frame;
+        uint32_t sequence;
+        std::string path;
+    };
+    std::vector<PendingCapture> m_pendingCaptures;
+    // FRAMES in progress: the frame history is held until every frame has
+    // been handed to the screenshot writer, as fast as it has buffers free
+    std::vector<uint64_t> m_dumpFrames;
+    size_t m_dumpNext;
+    std::string m_dumpDirectory;
+    uint32_t m_dumpSequence;
+
+    // A SCRIPT is acknowledged once it has run to the end
+    ScriptRunner m_script;
+    bool m_scriptAcknowledge;
+    uint32_t m_scriptSequence;
+    int64_t m_scriptReceiveTimeUs;
+
+    bool m_coalescingEnabled;
+    std::vector<std::pair<std::string, std::string>> m_keepEveryValueNames;
+    // Per store index: 1 when the property opted out of coalescing
+    std::vector<uint8_t> m_keepEveryValue;
+    // Scratch for applyPropertyRun(), reused between frames
+    std::vector<uint32_t> m_runIndices;
+    std::vector<uint32_t> m_lastWrite;
+    uint64_t m_appliedCount;
+    uint64_t m_coalescedCount;
+    bool m_verbose;
 };
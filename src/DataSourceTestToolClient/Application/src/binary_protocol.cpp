@@ -0,0 +1,501 @@
+#include "binary_protocol.h"
+#include "signal_stream.h"
+#include <cstring>
+
+namespace BinaryProtocol
+{
+namespace
+{
+// Bounds-checked cursor over a frame payload
+struct Reader
+{
+    const char *data;
+    size_t remaining;
+
+    bool readUint8(uint8_t &value)
+    {
+        if (remaining < 1)
+            return false;
+        value = static_cast<uint8_t>(*data);
+        ++data;
+        --remaining;
+        return true;
+    }
+
+    bool readUint16(uint16_t &value)
+    {
+        if (remaining < 2)
+            return false;
+        const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+        value = static_cast<uint16_t>(bytes[0] | (bytes[1] << 8));
+        data += 2;
+        remaining -= 2;
+        return true;
+    }
+
+    bool readUint32(uint32_t &value)
+    {
+        if (remaining < 4)
+            return false;
+        value = BinaryProtocol::readUint32(data);
+        data += 4;
+        remaining -= 4;
+        return true;
+    }
+
+    bool readUint64(uint64_t &value)
+    {
+        uint32_t low, high;
+        if (!readUint32(low) || !readUint32(high))
+            return false;
+        value = static_cast<uint64_t>(low) | (static_cast<uint64_t>(high) << 32);
+        return true;
+    }
+
+    bool readString(std::string_view &value)
+    {
+        uint16_t length;
+        if (!readUint16(length) || remaining < length)
+            return false;
+        value = std::string_view(data, length);
+        data += length;
+        remaining -= length;
+        return true;
+    }
+};
+
+TokenizeError readValue(Reader &reader, uint8_t typeTag, Command &command)
+{
+    PropertyValue &value = command.typedValue;
+    value.type = static_cast<PropertyType>(typeTag);
+    switch (value.type)
+    {
+    case PropertyType::Int:
+    case PropertyType::Float:
+    {
+        // int32 and float share the same 4 bytes in the union
+        uint32_t bits;
+        if (!reader.readUint32(bits))
+            return TokenizeError::Truncated;
+        std::memcpy(&value.intValue, &bits, sizeof(bits));
+        break;
+    }
+    case PropertyType::Bool:
+    {
+        uint8_t flag;
+        if (!reader.readUint8(flag))
+            return TokenizeError::Truncated;
+        value.boolValue = flag != 0;
+        break;
+    }
+    case PropertyType::String:
+        if (!reader.readString(value.stringValue))
+            return TokenizeError::Truncated;
+        command.value = value.stringValue;
+        break;
+    default:
+        return TokenizeError::InvalidValue;
+    }
+
+    command.type = propertyTypeName(value.type);
+    command.hasTypedValue = true;
+    return TokenizeError::None;
+}
+
+TokenizeError readProperty(Reader &reader, Command &command)
+{
+    uint8_t typeTag;
+    if (!reader.readString(command.file) || !reader.readUint8(typeTag) || !reader.readString(command.name))
+        return TokenizeError::Truncated;
+
+    return readValue(reader, typeTag, command);
+}
+
+TokenizeError readInternedProperty(Reader &reader, Command &command)
+{
+    uint16_t id;
+    uint8_t typeTag;
+    if (!reader.readUint16(id) || !reader.readUint8(typeTag))
+        return TokenizeError::Truncated;
+
+    command.propertyId = id;
+    command.interned = true;
+    return readValue(reader, typeTag, command);
+}
+
+TokenizeError readStream(Reader &reader, Command &command)
+{
+    uint16_t id;
+    uint8_t typeTag;
+    if (!reader.readUint16(id) || !reader.readString(command.file) || !reader.readUint8(typeTag) ||
+        !reader.readString(command.name))
+        return TokenizeError::Truncated;
+
+    command.propertyId = id;
+    command.type = propertyTypeName(static_cast<PropertyType>(typeTag));
+    return TokenizeError::None;
+}
+
+// The text form's arguments as one string, which must not be empty
+TokenizeError readArguments(Reader &reader, Command &command)
+{
+    if (!reader.readString(command.value))
+        return TokenizeError::Truncated;
+    return command.value.empty() ? TokenizeError::MissingField : TokenizeError::None;
+}
+
+void appendUint16(std::string &out, uint16_t value)
+{
+    out.push_back(static_cast<char>(value & 0xff));
+    out.push_back(static_cast<char>(value >> 8));
+}
+
+void appendUint32(std::string &out, uint32_t value)
+{
+    for (int shift = 0; shift < 32; shift += 8)
+        out.push_back(static_cast<char>((value >> shift) & 0xff));
+}
+
+void writeUint32(std::string &out, size_t offset, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        out[offset + i] = static_cast<char>((value >> (8 * i)) & 0xff);
+}
+
+void appendString(std::string &out, std::string_view value)
+{
+    appendUint16(out, static_cast<uint16_t>(value.size()));
+    out.append(value.data(), value.size());
+}
+
+void appendValue(std::string &out, const PropertyValue &value)
+{
+    switch (value.type)
+    {
+    case PropertyType::Int:
+    case PropertyType::Float:
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &value.intValue, sizeof(bits));
+        appendUint32(out, bits);
+        break;
+    }
+    case PropertyType::Bool:
+        out.push_back(value.boolValue ? 1 : 0);
+        break;
+    case PropertyType::String:
+        appendString(out, value.stringValue);
+        break;
+    }
+}
+
+void appendProperty(std::string &out, std::string_view file, std::string_view name, const PropertyValue &value)
+{
+    appendString(out, file);
+    out.push_back(static_cast<char>(value.type));
+    appendString(out, name);
+    appendValue(out, value);
+}
+
+void appendInternedProperty(std::string &out, uint16_t id, const PropertyValue &value)
+{
+    appendUint16(out, id);
+    out.push_back(static_cast<char>(value.type));
+    appendValue(out, value);
+}
+}
+
+uint32_t readUint32(const char *data)
+{
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+    return static_cast<uint32_t>(bytes[0]) | (static_cast<uint32_t>(bytes[1]) << 8) |
+           (static_cast<uint32_t>(bytes[2]) << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+}
+
+std::string makeClientHello(std::string_view restoredSession)
+{
+    std::string hello = "HELLO::" + std::to_string(VERSION) + "::text,binary,batch";
+    if (!restoredSession.empty())
+        hello.append(",restored=").append(restoredSession);
+    return hello + "\n";
+}
+
+TokenizeError decodeCommand(std::string_view payload, Command &command)
+{
+    command = Command();
+    Reader reader{payload.data(), payload.size()};
+
+    uint8_t opcode;
+    if (!reader.readUint8(opcode))
+        return TokenizeError::Empty;
+
+    switch (static_cast<Opcode>(opcode))
+    {
+    case Opcode::Sync:
+        command.kind = CommandKind::Sync;
+        return readProperty(reader, command);
+    case Opcode::Async:
+        command.kind = CommandKind::Async;
+        return readProperty(reader, command);
+    case Opcode::Screenshot:
+        command.kind = CommandKind::Screenshot;
+        return reader.readString(command.value) ? TokenizeError::None : TokenizeError::Truncated;
+    case Opcode::Stats:
+        command.kind = CommandKind::Stats;
+        return reader.readString(command.value) ? TokenizeError::None : TokenizeError::Truncated;
+    case Opcode::Compare:
+        command.kind = CommandKind::Compare;
+        return readArguments(reader, command);
+    case Opcode::Capture:
+        command.kind = CommandKind::Capture;
+        return readArguments(reader, command);
+    case Opcode::FrameDump:
+        command.kind = CommandKind::FrameDump;
+        return readArguments(reader, command);
+    case Opcode::SyncId:
+        command.kind = CommandKind::Sync;
+        return readInternedProperty(reader, command);
+    case Opcode::AsyncId:
+        command.kind = CommandKind::Async;
+        return readInternedProperty(reader, command);
+    case Opcode::Batch:
+    case Opcode::BatchId:
+        command.kind = CommandKind::Batch;
+        command.interned = static_cast<Opcode>(opcode) == Opcode::BatchId;
+        command.value = std::string_view(reader.data, reader.remaining);
+        return TokenizeError::None;
+    case Opcode::Script:
+        // Not a str: inline scripts may be longer than 64 KiB
+        command.kind = CommandKind::Script;
+        command.value = std::string_view(reader.data, reader.remaining);
+        return command.value.empty() ? TokenizeError::MissingField : TokenizeError::None;
+    case Opcode::Dictionary:
+        command.kind = CommandKind::Dictionary;
+        command.value = std::string_view(reader.data, reader.remaining);
+        return TokenizeError::None;
+    case Opcode::Stream:
+        command.kind = CommandKind::Stream;
+        return readStream(reader, command);
+    case Opcode::Sample:
+    {
+        command.kind = CommandKind::Sample;
+        uint16_t id;
+        if (!reader.readUint16(id))
+            return TokenizeError::Truncated;
+        command.propertyId = id;
+        command.value = std::string_view(reader.data, reader.remaining);
+        return TokenizeError::None;
+    }
+    }
+    return TokenizeError::UnknownCommand;
+}
+
+TokenizeError decodeBatch(std::string_view records, bool interned, std::vector<Command> &commands)
+{
+    commands.clear();
+    Reader reader{records.data(), records.size()};
+
+    uint32_t count;
+    if (!reader.readUint32(count))
+        return TokenizeError::Truncated;
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        Command command;
+        command.kind = CommandKind::Sync;
+        TokenizeError error = interned ? readInternedProperty(reader, command) : readProperty(reader, command);
+        if (error != TokenizeError::None)
+            return error;
+        commands.push_back(command);
+    }
+
+    return reader.remaining == 0 ? TokenizeError::None : TokenizeError::InvalidCount;
+}
+
+TokenizeError decodeDictionary(std::string_view records, PropertyDictionary &dictionary)
+{
+    Reader reader{records.data(), records.size()};
+
+    uint32_t count;
+    if (!reader.readUint32(count))
+        return TokenizeError::Truncated;
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        uint16_t id;
+        uint8_t typeTag;
+        std::string_view file, name;
+        if (!reader.readUint16(id) || !reader.readString(file) || !reader.readUint8(typeTag) ||
+            !reader.readString(name))
+            return TokenizeError::Truncated;
+
+        PropertyType type = static_cast<PropertyType>(typeTag);
+        if (typeTag < static_cast<uint8_t>(PropertyType::Int) || typeTag > static_cast<uint8_t>(PropertyType::String) ||
+            !dictionary.define(id, file, type, name))
+            return TokenizeError::InvalidValue;
+    }
+
+    return reader.remaining == 0 ? TokenizeError::None : TokenizeError::InvalidCount;
+}
+
+TokenizeError decodeSamples(std::string_view records, std::vector<StreamSample> &samples)
+{
+    samples.clear();
+    Reader reader{records.data(), records.size()};
+
+    uint32_t count;
+    if (!reader.readUint32(count))
+        return TokenizeError::Truncated;
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        uint64_t time;
+        uint32_t bits;
+        if (!reader.readUint64(time) || !reader.readUint32(bits))
+            return TokenizeError::Truncated;
+
+        StreamSample sample;
+        sample.timeUs = static_cast<int64_t>(time);
+        std::memcpy(&sample.value, &bits, sizeof(bits));
+        samples.push_back(sample);
+    }
+
+    return reader.remaining == 0 ? TokenizeError::None : TokenizeError::InvalidCount;
+}
+
+void appendPropertyFrame(std::string &out, CommandKind kind, std::string_view file, std::string_view name,
+                         const PropertyValue &value)
+{
+    size_t frameStart = out.size();
+    appendUint32(out, 0);
+    out.push_back(static_cast<char>(kind == CommandKind::Async ? Opcode::Async : Opcode::Sync));
+    appendProperty(out, file, name, value);
+    writeUint32(out, frameStart, static_cast<uint32_t>(out.size() - frameStart - LENGTH_PREFIX_SIZE));
+}
+
+void appendInternedPropertyFrame(std::string &out, CommandKind kind, uint16_t id, const PropertyValue &value)
+{
+    size_t frameStart = out.size();
+    appendUint32(out, 0);
+    out.push_back(static_cast<char>(kind == CommandKind::Async ? Opcode::AsyncId : Opcode::SyncId));
+    appendInternedProperty(out, id, value);
+    writeUint32(out, frameStart, static_cast<uint32_t>(out.size() - frameStart - LENGTH_PREFIX_SIZE));
+}
+
+void appendScreenshotFrame(std::string &out, std::string_view path)
+{
+    size_t frameStart = out.size();
+    appendUint32(out, 0);
+    out.push_back(static_cast<char>(Opcode::Screenshot));
+    appendString(out, path);
+    writeUint32(out, frameStart, static_cast<uint32_t>(out.size() - frameStart - LENGTH_PREFIX_SIZE));
+}
+
+void appendStreamFrame(std::string &out, uint16_t id, std::string_view file, PropertyType type, std::string_view name)
+{
+    size_t frameStart = out.size();
+    appendUint32(out, 0);
+    out.push_back(static_cast<char>(Opcode::Stream));
+    // Same layout as a DICT record
+    appendDictionaryRecord(out, id, file, type, name);
+    writeUint32(out, frameStart, static_cast<uint32_t>(out.size() - frameStart - LENGTH_PREFIX_SIZE));
+}
+
+void appendSampleFrame(std::string &out, uint16_t id, const StreamSample *samples, size_t count)
+{
+    size_t frameStart = out.size();
+    appendUint32(out, 0);
+    out.push_back(static_cast<char>(Opcode::Sample));
+    appendUint16(out, id);
+    appendUint32(out, static_cast<uint32_t>(count));
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint64_t time = static_cast<uint64_t>(samples[i].timeUs);
+        uint32_t bits;
+        std::memcpy(&bits, &samples[i].value, sizeof(bits));
+        appendUint32(out, static_cast<uint32_t>(time));
+        appendUint32(out, static_cast<uint32_t>(time >> 32));
+        appendUint32(out, bits);
+    }
+    writeUint32(out, frameStart, static_cast<uint32_t>(out.size() - frameStart - LENGTH_PREFIX_SIZE));
+}
+
+void appendStatsFrame(std::string &out, std::string_view argument)
+{
+    size_t frameStart = out.size();
+    appendUint32(out, 0);
+    out.push_back(static_cast<char>(Opcode::Stats));
+    appendString(out, argument);
+    writeUint32(out, frameStart, static_cast<uint32_t>(out.size() - frameStart - LENGTH_PREFIX_SIZE));
+}
+
+void appendScriptFrame(std::string &out, std::string_view source)
+{
+    size_t frameStart = out.size();
+    appendUint32(out, 0);
+    out.push_back(static_cast<char>(Opcode::Script));
+    out.append(source.data(), source.size());
+    writeUint32(out, frameStart, static_cast<uint32_t>(out.size() - frameStart - LENGTH_PREFIX_SIZE));
+}
+
+void appendCompareFrame(std::string &out, std::string_view arguments)
+{
+    size_t frameStart = out.size();
+    appendUint32(out, 0);
+    out.push_back(static_cast<char>(Opcode::Compare));
+    appendString(out, arguments);
+    writeUint32(out, frameStart, static_cast<uint32_t>(out.size() - frameStart - LENGTH_PREFIX_SIZE));
+}
+
+void appendCaptureFrame(std::string &out, int32_t offset, std::string_view path)
+{
+    size_t frameStart = out.size();
+    appendUint32(out, 0);
+    out.push_back(static_cast<char>(Opcode::Capture));
+    appendString(out, std::to_string(offset) + "::" + std::string(path));
+    writeUint32(out, frameStart, static_cast<uint32_t>(out.size() - frameStart - LENGTH_PREFIX_SIZE));
+}
+
+void appendFrameDumpFrame(std::string &out, uint32_t count, std::string_view directory)
+{
+    size_t frameStart = out.size();
+    appendUint32(out, 0);
+    out.push_back(static_cast<char>(Opcode::FrameDump));
+    appendString(out, std::to_string(count) + "::" + std::string(directory));
+    writeUint32(out, frameStart, static_cast<uint32_t>(out.size() - frameStart - LENGTH_PREFIX_SIZE));
+}
+
+size_t beginCountedFrame(std::string &out, Opcode opcode)
+{
+    size_t frameStart = out.size();
+    appendUint32(out, 0);
+    out.push_back(static_cast<char>(opcode));
+    appendUint32(out, 0);
+    return frameStart;
+}
+
+void appendBatchRecord(std::string &out, std::string_view file, std::string_view name, const PropertyValue &value)
+{
+    appendProperty(out, file, name, value);
+}
+
+void appendInternedBatchRecord(std::string &out, uint16_t id, const PropertyValue &value)
+{
+    appendInternedProperty(out, id, value);
+}
+
+void appendDictionaryRecord(std::string &out, uint16_t id, std::string_view file, PropertyType type,
+                            std::string_view name)
+{
+    appendUint16(out, id);
+    appendString(out, file);
+    out.push_back(static_cast<char>(type));
+    appendString(out, name);
+}
+
+void endCountedFrame(std::string &out, size_t frameStart, uint32_t count)
+{
+    writeUint32(out, frameStart, static_cast<uint32_t>(out.size() - frameStart - LENGTH_PREFIX_SIZE));
+    writeUint32(out, frameStart + LENGTH_PREFIX_SIZE + 1, count);
+}
+}
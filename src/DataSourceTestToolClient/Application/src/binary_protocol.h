@@ -0,0 +1,103 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include "command_tokenizer.h"
+#include "property_value.h"
+#include "property_dictionary.h"
+
+struct StreamSample;
+
+// Compact binary encoding negotiated at connect time.
+//
+// Handshake (text, '\n' terminated):
+//   client -> server  HELLO::<version>::text,binary,batch[,restored=<session>]
+//   server -> client  HELLO::<version>::binary   (or ::text, or no reply at all)
+// The client's list names the encodings it reads and the optional commands it
+// understands; a server only sends BATCH to a client that listed "batch".
+// "restored" tells the server the client restored its snapshot of that server
+// session, so the values it holds need not be sent again.
+// Every server frame after a "binary" reply is length prefixed:
+//   u32 payload length, then the payload starting with a u8 opcode.
+// A server that does not answer keeps talking the text protocol.
+//
+// Payloads (all integers little endian, str = u16 length + UTF-8 bytes):
+//   SYNC / ASYNC  opcode, str file, u8 type, str name, value
+//   SCREENSHOT    opcode, str path
+//   BATCH         opcode, u32 count, count x (str file, u8 type, str name, value)
+//   DICT          opcode, u32 count, count x (u16 id, str file, u8 type, str name)
+//   SYNCID/ASYNCID opcode, u16 id, u8 type, value
+//   BATCHID       opcode, u32 count, count x (u16 id, u8 type, value)
+//   STREAM        opcode, u16 id, str file, u8 type, str name
+//   SAMPLE        opcode, u16 id, u32 count, count x (i64 time_us, f32 value)
+//   STATS         opcode, str argument (empty or "reset")
+//   SCRIPT        opcode, path or inline script XML filling the rest of the frame
+//   COMPARE       opcode, str arguments (as in the text form, without "COMPARE::")
+//   CAPTURE       opcode, str arguments (offset::path)
+//   FRAMES        opcode, str arguments (count::directory)
+// where value is i32 (int), f32 (float), u8 (bool) or str (string). The
+// interned forms keep their type tag so frames decode without the dictionary.
+namespace BinaryProtocol
+{
+const int TEXT_VERSION = 1;
+const int VERSION = 2;
+const size_t LENGTH_PREFIX_SIZE = 4;
+
+enum class Opcode : uint8_t
+{
+    Sync = 1,
+    Async = 2,
+    Screenshot = 3,
+    Batch = 4,
+    Dictionary = 5,
+    SyncId = 6,
+    AsyncId = 7,
+    BatchId = 8,
+    Stream = 9,
+    Sample = 10,
+    Stats = 11,
+    Script = 12,
+    Compare = 13,
+    Capture = 14,
+    FrameDump = 15
+};
+
+// Builds the client's HELLO line including the terminating '\n'. A non-empty
+// restoredSession is announced as "restored=<session>".
+std::string makeClientHello(std::string_view restoredSession = std::string_view());
+
+// Decodes one frame payload (without its length prefix). BATCH, DICT and
+// SAMPLE come back with their records in value, to be split with
+// decodeBatch(), decodeDictionary() or decodeSamples().
+TokenizeError decodeCommand(std::string_view payload, Command &command);
+TokenizeError decodeBatch(std::string_view records, bool interned, std::vector<Command> &commands);
+TokenizeError decodeDictionary(std::string_view records, PropertyDictionary &dictionary);
+TokenizeError decodeSamples(std::string_view records, std::vector<StreamSample> &samples);
+
+// Encoders for test servers and benchmarks. Each appends one complete frame
+// including its length prefix.
+void appendPropertyFrame(std::string &out, CommandKind kind, std::string_view file, std::string_view name,
+                         const PropertyValue &value);
+void appendInternedPropertyFrame(std::string &out, CommandKind kind, uint16_t id, const PropertyValue &value);
+void appendScreenshotFrame(std::string &out, std::string_view path);
+void appendStreamFrame(std::string &out, uint16_t id, std::string_view file, PropertyType type, std::string_view name);
+void appendSampleFrame(std::string &out, uint16_t id, const StreamSample *samples, size_t count);
+void appendStatsFrame(std::string &out, std::string_view argument);
+void appendScriptFrame(std::string &out, std::string_view source);
+void appendCompareFrame(std::string &out, std::string_view arguments);
+void appendCaptureFrame(std::string &out, int32_t offset, std::string_view path);
+void appendFrameDumpFrame(std::string &out, uint32_t count, std::string_view directory);
+
+// BATCH, BATCHID and DICT frames are built with beginCountedFrame(), one
+// record per entry and endCountedFrame() to patch the length and count.
+size_t beginCountedFrame(std::string &out, Opcode opcode);
+void appendBatchRecord(std::string &out, std::string_view file, std::string_view name, const PropertyValue &value);
+void appendInternedBatchRecord(std::string &out, uint16_t id, const PropertyValue &value);
+void appendDictionaryRecord(std::string &out, uint16_t id, std::string_view file, PropertyType type,
+                            std::string_view name);
+void endCountedFrame(std::string &out, size_t frameStart, uint32_t count);
+
+// Reads a little-endian u32 from unaligned memory
+uint32_t readUint32(const char *data);
+}
@@ -0,0 +1,100 @@
+#include "command_queue.h"
+#include <iostream>
+
+PropertyValue QueuedCommand::typedValue() const
+{
+    PropertyValue result = value;
+    if (result.type == PropertyType::String)
+        result.stringValue = text;
+    return result;
+}
+
+CommandQueue::CommandQueue(size_t capacity) : m_queue(capacity), m_droppedCount(0)
+{
+}
+
+bool CommandQueue::push(const Command *commands, size_t count)
+{
+    if (!m_queue.canWrite(count))
+    {
+        m_droppedCount.fetch_add(count, std::memory_order_relaxed);
+        return false;
+    }
+
+    size_t messageStart = 0;
+    bool messageValid = true;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const Command &command = commands[i];
+        QueuedCommand &slot = m_queue.writeSlot(i);
+        slot.kind = command.kind;
+        slot.acknowledge = false;
+        slot.sequence = command.sequence;
+        slot.receiveTimeUs = command.receiveTimeUs;
+        slot.parseTimeUs = command.parseTimeUs;
+
+        if (slot.isProperty())
+        {
+            PropertyValue value;
+            if (!resolvePropertyValue(command, value))
+            {
+                std::cout << "Invalid " << command.type << " value for " << command.name << ": " << command.value
+                          << std::endl;
+                slot.kind = CommandKind::Unknown;
+            }
+            else
+            {
+                // assign() keeps the slot's capacity, so steady state does not allocate
+                slot.file.assign(command.file.data(), command.file.size());
+                slot.name.assign(command.name.data(), command.name.size());
+                slot.value = value;
+                slot.value.stringValue = std::string_view();
+                if (value.type == PropertyType::String)
+                    slot.text.assign(value.stringValue.data(), value.stringValue.size());
+            }
+        }
+        else if (command.kind == CommandKind::Stream)
+        {
+            if (!parsePropertyType(command.type, slot.value.type))
+            {
+                std::cout << "Invalid stream type for " << command.name << ": " << command.type << std::endl;
+                slot.kind = CommandKind::Unknown;
+            }
+            else
+            {
+                slot.file.assign(command.file.data(), command.file.size());
+                slot.name.assign(command.name.data(), command.name.size());
+                slot.propertyId = command.propertyId;
+            }
+        }
+        else
+        {
+            slot.file.clear();
+            slot.name.clear();
+            slot.text.assign(command.value.data(), command.value.size());
+        }
+
+        messageValid = messageValid && slot.kind != CommandKind::Unknown;
+
+        // Records of one message share its sequence; unacknowledged commands
+        // (sequence 0) stand alone
+        bool lastOfMessage = command.sequence == 0 || i + 1 == count || commands[i + 1].sequence != command.sequence;
+        if (!lastOfMessage)
+            continue;
+
+        // The last record carries the message's ACK, which reports the
+        // rejection when any record was invalid
+        if (!messageValid)
+        {
+            for (size_t j = messageStart; j <= i; ++j)
+                m_queue.writeSlot(j).kind = CommandKind::Unknown;
+        }
+        if (command.sequence != 0)
+            m_queue.writeSlot(i).acknowledge = true;
+        messageStart = i + 1;
+        messageValid = true;
+    }
+
+    m_queue.commitWrite(count);
+    return true;
+}
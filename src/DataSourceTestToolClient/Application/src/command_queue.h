@@ -0,0 +1,75 @@
+#pragma once
+#include <string>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "command_tokenizer.h"
+#include "spsc_queue.h"
+
+// A command copied out of the receive buffer so it can cross from the
+// network thread to the application thread
+struct QueuedCommand
+{
+    CommandKind kind = CommandKind::Unknown;
+    std::string file;
+    std::string name;
+    // Typed value of a property command. For strings use stringValue() instead.
+    PropertyValue value;
+    // String value, or the argument of a non-property command such as the
+    // SCREENSHOT path
+    std::string text;
+    // Stream ID of a STREAM declaration, whose property type is in value.type
+    uint32_t propertyId = NO_PROPERTY_ID;
+    // Set on one command per acknowledged message: its last valid record, or
+    // the last record (kind Unknown) when none was valid
+    bool acknowledge = false;
+    uint32_t sequence = 0;
+    int64_t receiveTimeUs = 0;
+    int64_t parseTimeUs = 0;
+
+    bool isProperty() const { return kind == CommandKind::Sync || kind == CommandKind::Async; }
+    PropertyValue typedValue() const;
+};
+
+// Lock-free handoff of commands from the network thread (producer) to the
+// application thread (consumer). Values are parsed on the network thread so
+// the consumer only copies typed data.
+class CommandQueue
+{
+public:
+    explicit CommandQueue(size_t capacity);
+
+    // Network thread. Copies the commands and publishes them together, so the
+    // consumer never sees part of a batch. When they do not all fit, nothing
+    // is queued and false is returned. Commands with an invalid value are
+    // queued with kind Unknown so their message is still acknowledged; a
+    // BATCH is applied whole or not at all, so one invalid record turns every
+    // record of its message into Unknown.
+    bool push(const Command *commands, size_t count);
+
+    // Application thread. Calls apply(const QueuedCommand &) for every command
+    // published before the call and returns how many there were.
+    template <typename Apply>
+    size_t drain(Apply &&apply)
+    {
+        size_t count = readable();
+        for (size_t i = 0; i < count; ++i)
+            apply(peek(i));
+        release(count);
+        return count;
+    }
+
+    // Application thread, for consumers that need to look ahead: commands
+    // published so far, access by offset, and handing slots back
+    size_t readable() { return m_queue.readable(); }
+    const QueuedCommand &peek(size_t offset) { return m_queue.readSlot(offset); }
+    void release(size_t count) { m_queue.commitRead(count); }
+
+    // Most commands queued at once; a larger push can never succeed
+    size_t capacity() const { return m_queue.capacity(); }
+    uint64_t droppedCount() const { return m_droppedCount.load(std::memory_order_relaxed); }
+
+private:
+    SpscQueue<QueuedCommand> m_queue;
+    std::atomic<uint64_t> m_droppedCount;
+};
@@ -0,0 +1,372 @@
+#include "command_tokenizer.h"
+#include <charconv>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define TOKENIZER_USE_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TOKENIZER_USE_SSE2 1
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace
+{
+const std::string_view SYNC_PREFIX = "SYNC";
+const std::string_view ASYNC_PREFIX = "ASYNC";
+const std::string_view SCREENSHOT_PREFIX = "SCREENSHOT";
+const std::string_view BATCH_PREFIX = "BATCH";
+const std::string_view HELLO_PREFIX = "HELLO";
+const std::string_view DICTIONARY_PREFIX = "DICT";
+const std::string_view SYNC_ID_PREFIX = "SYNCID";
+const std::string_view ASYNC_ID_PREFIX = "ASYNCID";
+const std::string_view BATCH_ID_PREFIX = "BATCHID";
+const std::string_view STREAM_PREFIX = "STREAM";
+const std::string_view SAMPLE_PREFIX = "SAMPLE";
+const std::string_view STATS_PREFIX = "STATS";
+const std::string_view SCRIPT_PREFIX = "SCRIPT";
+const std::string_view COMPARE_PREFIX = "COMPARE";
+const std::string_view CAPTURE_PREFIX = "CAPTURE";
+const std::string_view FRAME_DUMP_PREFIX = "FRAMES";
+
+#if defined(TOKENIZER_USE_AVX2) || defined(TOKENIZER_USE_SSE2)
+inline unsigned lowestSetBit(unsigned mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+#endif
+
+size_t findFieldSeparatorScalar(const char *data, size_t offset, size_t length)
+{
+    for (size_t i = offset; i + 1 < length; ++i)
+    {
+        if (data[i] == ':' && data[i + 1] == ':')
+            return i;
+    }
+    return length;
+}
+
+// Parses "file::type::name::value"
+TokenizeError tokenizeProperty(std::string_view rest, Command &command)
+{
+    if (!takeField(rest, command.file) || !takeField(rest, command.type) || !takeField(rest, command.name))
+        return TokenizeError::MissingField;
+
+    command.value = rest;
+    return TokenizeError::None;
+}
+
+// Parses "id::value"
+TokenizeError tokenizeInternedProperty(std::string_view rest, Command &command)
+{
+    std::string_view id;
+    if (!takeField(rest, id))
+        return TokenizeError::MissingField;
+    if (!parseDecimal(id, command.propertyId))
+        return TokenizeError::InvalidValue;
+
+    command.value = rest;
+    return TokenizeError::None;
+}
+
+// Parses "id::file::type::name"
+TokenizeError tokenizeStream(std::string_view rest, Command &command)
+{
+    std::string_view id;
+    if (!takeField(rest, id) || !takeField(rest, command.file) || !takeField(rest, command.type) || rest.empty())
+        return TokenizeError::MissingField;
+    if (!parseDecimal(id, command.propertyId))
+        return TokenizeError::InvalidValue;
+
+    command.name = rest;
+    return TokenizeError::None;
+}
+}
+
+bool takeField(std::string_view &rest, std::string_view &field)
+{
+    size_t separator = findFieldSeparator(rest.data(), rest.size());
+    if (separator == rest.size())
+        return false;
+
+    field = rest.substr(0, separator);
+    rest.remove_prefix(separator + 2);
+    return true;
+}
+
+bool parseDecimal(std::string_view text, uint32_t &value)
+{
+    const char *end = text.data() + text.size();
+    std::from_chars_result parsed = std::from_chars(text.data(), end, value);
+    return !text.empty() && parsed.ec == std::errc() && parsed.ptr == end;
+}
+
+size_t findFieldSeparator(const char *data, size_t length)
+{
+    size_t i = 0;
+
+    // Compare each block and the block shifted by one byte against ':';
+    // a bit set in both masks marks the start of "::".
+#if defined(TOKENIZER_USE_AVX2)
+    const __m256i colon = _mm256_set1_epi8(':');
+    for (; i + 33 <= length; i += 32)
+    {
+        __m256i first = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        __m256i second = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + 1));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(first, colon), _mm256_cmpeq_epi8(second, colon))));
+        if (mask != 0)
+            return i + lowestSetBit(mask);
+    }
+#elif defined(TOKENIZER_USE_SSE2)
+    const __m128i colon = _mm_set1_epi8(':');
+    for (; i + 17 <= length; i += 16)
+    {
+        __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 1));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(first, colon), _mm_cmpeq_epi8(second, colon))));
+        if (mask != 0)
+            return i + lowestSetBit(mask);
+    }
+#endif
+
+    return findFieldSeparatorScalar(data, i, length);
+}
+
+TokenizeError tokenizeCommand(std::string_view message, Command &command)
+{
+    command = Command();
+    if (message.empty())
+        return TokenizeError::Empty;
+
+    // STATS is the only command that may come without arguments
+    if (message == STATS_PREFIX)
+    {
+        command.kind = CommandKind::Stats;
+        return TokenizeError::None;
+    }
+
+    std::string_view rest = message;
+    std::string_view prefix;
+    if (!takeField(rest, prefix))
+        return TokenizeError::UnknownCommand;
+
+    if (prefix == SYNC_PREFIX)
+        command.kind = CommandKind::Sync;
+    else if (prefix == ASYNC_PREFIX)
+        command.kind = CommandKind::Async;
+    else if (prefix == SCREENSHOT_PREFIX)
+        command.kind = CommandKind::Screenshot;
+    else if (prefix == BATCH_PREFIX)
+        command.kind = CommandKind::Batch;
+    else if (prefix == HELLO_PREFIX)
+        command.kind = CommandKind::Hello;
+    else if (prefix == DICTIONARY_PREFIX)
+        command.kind = CommandKind::Dictionary;
+    else if (prefix == SYNC_ID_PREFIX)
+        command.kind = CommandKind::Sync;
+    else if (prefix == ASYNC_ID_PREFIX)
+        command.kind = CommandKind::Async;
+    else if (prefix == BATCH_ID_PREFIX)
+        command.kind = CommandKind::Batch;
+    else if (prefix == STREAM_PREFIX)
+        command.kind = CommandKind::Stream;
+    else if (prefix == SAMPLE_PREFIX)
+        command.kind = CommandKind::Sample;
+    else if (prefix == STATS_PREFIX)
+        command.kind = CommandKind::Stats;
+    else if (prefix == SCRIPT_PREFIX)
+        command.kind = CommandKind::Script;
+    else if (prefix == COMPARE_PREFIX)
+        command.kind = CommandKind::Compare;
+    else if (prefix == CAPTURE_PREFIX)
+        command.kind = CommandKind::Capture;
+    else if (prefix == FRAME_DUMP_PREFIX)
+        command.kind = CommandKind::FrameDump;
+    else
+        return TokenizeError::UnknownCommand;
+
+    command.interned = prefix == SYNC_ID_PREFIX || prefix == ASYNC_ID_PREFIX || prefix == BATCH_ID_PREFIX;
+
+    if (command.kind == CommandKind::Stats)
+    {
+        command.value = rest;
+        return TokenizeError::None;
+    }
+
+    if (command.kind == CommandKind::Screenshot || command.kind == CommandKind::Batch ||
+        command.kind == CommandKind::Hello || command.kind == CommandKind::Dictionary ||
+        command.kind == CommandKind::Script || command.kind == CommandKind::Compare ||
+        command.kind == CommandKind::Capture || command.kind == CommandKind::FrameDump)
+    {
+        command.value = rest;
+        return rest.empty() ? TokenizeError::MissingField : TokenizeError::None;
+    }
+
+    // SAMPLE shares the "id::rest" layout of the interned commands
+    if (command.kind == CommandKind::Stream)
+        return tokenizeStream(rest, command);
+    if (command.kind == CommandKind::Sample)
+        return tokenizeInternedProperty(rest, command);
+
+    return command.interned ? tokenizeInternedProperty(rest, command) : tokenizeProperty(rest, command);
+}
+
+TokenizeError tokenizeBatch(std::string_view records, bool interned, std::vector<Command> &commands)
+{
+    commands.clear();
+
+    std::string_view countField;
+    if (!takeField(records, countField))
+        return TokenizeError::MissingField;
+
+    uint32_t count = 0;
+    if (!parseDecimal(countField, count))
+        return TokenizeError::InvalidCount;
+
+    while (!records.empty())
+    {
+        const void *found = std::memchr(records.data(), BATCH_RECORD_SEPARATOR, records.size());
+        size_t recordLength = found ? static_cast<const char *>(found) - records.data() : records.size();
+
+        Command command;
+        command.kind = CommandKind::Sync;
+        command.interned = interned;
+        std::string_view record = records.substr(0, recordLength);
+        TokenizeError error = interned ? tokenizeInternedProperty(record, command) : tokenizeProperty(record, command);
+        if (error != TokenizeError::None)
+            return error;
+
+        commands.push_back(command);
+        records.remove_prefix(found ? recordLength + 1 : recordLength);
+    }
+
+    return commands.size() == count ? TokenizeError::None : TokenizeError::InvalidCount;
+}
+
+bool resolvePropertyValue(const Command &command, PropertyValue &value)
+{
+    if (command.hasTypedValue)
+    {
+        value = command.typedValue;
+        return true;
+    }
+
+    PropertyType type;
+    return parsePropertyType(command.type, type) && parsePropertyValue(type, command.value, value);
+}
+
+void appendAcknowledgement(std::string &out, const Acknowledgement &acknowledgement)
+{
+    // Fixed-size stack buffers instead of std::to_string temporaries
+    char number[24];
+    out += "ACK::";
+    out.append(number, std::to_chars(number, number + sizeof(number), acknowledgement.sequence).ptr - number);
+    out += "::";
+    out.append(number, std::to_chars(number, number + sizeof(number), acknowledgement.receiveTimeUs).ptr - number);
+    out += "::";
+    out.append(number, std::to_chars(number, number + sizeof(number), acknowledgement.applyTimeUs).ptr - number);
+    out += '\n';
+}
+
+void appendScreenshotNotice(std::string &out, const ScreenshotNotice &notice)
+{
+    char number[24];
+    out += "SCREENSHOT::";
+    out.append(number, std::to_chars(number, number + sizeof(number), notice.sequence).ptr - number);
+    out += notice.written ? "::ok::" : "::failed::";
+    out.append(number, std::to_chars(number, number + sizeof(number), notice.bytes).ptr - number);
+    out += "::";
+    out.append(number, std::to_chars(number, number + sizeof(number), notice.encodeUs).ptr - number);
+    out += "::";
+    out += notice.path;
+    out += '\n';
+}
+
+void appendCompareNotice(std::string &out, const CompareNotice &notice)
+{
+    static const char *const OUTCOMES[] = {"::pass::", "::fail::", "::error::"};
+    char number[24];
+    out += "COMPARE::";
+    out.append(number, std::to_chars(number, number + sizeof(number), notice.sequence).ptr - number);
+    out += OUTCOMES[static_cast<int>(notice.outcome)];
+    out.append(number, std::to_chars(number, number + sizeof(number), notice.differingPixels).ptr - number);
+    out += "::";
+    out.append(number, std::to_chars(number, number + sizeof(number), notice.comparedPixels).ptr - number);
+    out += "::";
+    out.append(number, std::to_chars(number, number + sizeof(number), notice.maxDelta).ptr - number);
+    out += "::";
+    out.append(number, std::to_chars(number, number + sizeof(number), notice.compareUs).ptr - number);
+    out += "::";
+    out += notice.reference;
+    out += '\n';
+}
+
+const char *tokenizeErrorName(TokenizeError error)
+{
+    switch (error)
+    {
+    case TokenizeError::None:
+        return "none";
+    case TokenizeError::Empty:
+        return "empty message";
+    case TokenizeError::UnknownCommand:
+        return "unknown command";
+    case TokenizeError::MissingField:
+        return "missing field";
+    case TokenizeError::InvalidCount:
+        return "invalid record count";
+    case TokenizeError::Truncated:
+        return "truncated message";
+    case TokenizeError::InvalidValue:
+        return "invalid value";
+    }
+    return "invalid";
+}
+
+const char *commandKindName(CommandKind kind)
+{
+    switch (kind)
+    {
+    case CommandKind::Sync:
+        return "SYNC";
+    case CommandKind::Async:
+        return "ASYNC";
+    case CommandKind::Screenshot:
+        return "SCREENSHOT";
+    case CommandKind::Batch:
+        return "BATCH";
+    case CommandKind::Hello:
+        return "HELLO";
+    case CommandKind::Dictionary:
+        return "DICT";
+    case CommandKind::Stream:
+        return "STREAM";
+    case CommandKind::Sample:
+        return "SAMPLE";
+    case CommandKind::Stats:
+        return "STATS";
+    case CommandKind::Script:
+        return "SCRIPT";
+    case CommandKind::Compare:
+        return "COMPARE";
+    case CommandKind::Capture:
+        return "CAPTURE";
+    case CommandKind::FrameDump:
+        return "FRAMES";
+    case CommandKind::Unknown:
+        break;
+    }
+    return "UNKNOWN";
+}
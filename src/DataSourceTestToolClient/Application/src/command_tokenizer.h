@@ -0,0 +1,152 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "property_value.h"
+
+// Command types sent by TestToolServer
+enum class CommandKind
+{
+    Unknown,
+    Sync,       // SYNC::file::type::name::value
+    Async,      // ASYNC::file::type::name::value
+    Screenshot, // SCREENSHOT::path
+    Batch,      // BATCH::count::file::type::name::value<RS>file::type::name::value...
+    Hello,      // HELLO::version::encoding (protocol handshake)
+    Dictionary, // DICT::count::id::file::type::name<RS>id::file::type::name...
+    Stream,     // STREAM::id::file::type::name (declares a sampled signal)
+    Sample,     // SAMPLE::id::time_us::value<RS>time_us::value...
+    Stats,      // STATS or STATS::reset (dump latency histograms)
+    Script,     // SCRIPT::path or SCRIPT::<script>...</script> (inline, on one line)
+    Compare,    // COMPARE::reference[::option...] (golden image check of the frame)
+    Capture,    // CAPTURE::offset::path (screenshot of the frame offset frames after this one)
+    FrameDump   // FRAMES::count::directory (writes the last count frames kept)
+};
+
+// Interned forms, using IDs defined by an earlier DICT command:
+//   SYNCID::id::value, ASYNCID::id::value, BATCHID::count::id::value<RS>id::value...
+const uint32_t NO_PROPERTY_ID = 0xffffffffu;
+
+// Separates the records of a BATCH command (ASCII record separator)
+const char BATCH_RECORD_SEPARATOR = '\x1e';
+
+enum class TokenizeError
+{
+    None,
+    Empty,
+    UnknownCommand,
+    MissingField,
+    InvalidCount,
+    Truncated,
+    InvalidValue
+};
+
+// One parsed command. All fields are views into the received message and are
+// only valid as long as the message buffer is.
+struct Command
+{
+    CommandKind kind = CommandKind::Unknown;
+    std::string_view file;
+    std::string_view type;
+    std::string_view name;
+    // Property value, the target path for SCREENSHOT, the path or text of a
+    // SCRIPT, the arguments of a COMPARE/CAPTURE/FRAMES, or the records of a
+    // BATCH/DICT
+    std::string_view value;
+    // Dictionary ID for interned commands; file, type and name are filled in
+    // by PropertyDictionary::resolve(). Stream ID for STREAM and SAMPLE.
+    uint32_t propertyId = NO_PROPERTY_ID;
+    // BATCH records use the interned id::value form
+    bool interned = false;
+    // Set when the value arrived already typed (binary protocol)
+    bool hasTypedValue = false;
+    PropertyValue typedValue;
+    // Assigned by NetworkClient to every message it acknowledges (0 = none);
+    // all records of a BATCH share the sequence of their message
+    uint32_t sequence = 0;
+    int64_t receiveTimeUs = 0;
+    int64_t parseTimeUs = 0;
+};
+
+// Sent back to the server once a command has been applied:
+//   ACK::sequence::receive_us::apply_us
+// Times are local steady clock microseconds; apply_us 0 means the command was
+// rejected (unparsable, unknown property ID or a full queue).
+struct Acknowledgement
+{
+    uint32_t sequence;
+    int64_t receiveTimeUs;
+    int64_t applyTimeUs;
+};
+
+// Appends one '\n' terminated ACK line
+void appendAcknowledgement(std::string &out, const Acknowledgement &acknowledgement);
+
+// Sent once a captured SCREENSHOT has been encoded and written, or failed:
+//   SCREENSHOT::sequence::ok|failed::bytes::encode_us::path
+// sequence is that of the SCREENSHOT message (0 for a script step) and
+// encode_us covers encoding and writing. The path comes last so it may
+// contain "::".
+struct ScreenshotNotice
+{
+    uint32_t sequence = 0;
+    bool written = false;
+    uint64_t bytes = 0;
+    int64_t encodeUs = 0;
+    std::string path;
+};
+
+// Appends one '\n' terminated SCREENSHOT notice line
+void appendScreenshotNotice(std::string &out, const ScreenshotNotice &notice);
+
+// Sent once a COMPARE has been evaluated:
+//   COMPARE::sequence::pass|fail|error::differing::compared::max_delta::compare_us::reference
+// differing and compared count pixels, max_delta is the largest channel
+// difference seen. error means the reference could not be loaded.
+enum class CompareOutcome
+{
+    Pass,
+    Fail,
+    Error
+};
+
+struct CompareNotice
+{
+    uint32_t sequence = 0;
+    CompareOutcome outcome = CompareOutcome::Error;
+    uint64_t differingPixels = 0;
+    uint64_t comparedPixels = 0;
+    uint32_t maxDelta = 0;
+    int64_t compareUs = 0;
+    std::string reference;
+};
+
+// Appends one '\n' terminated COMPARE notice line
+void appendCompareNotice(std::string &out, const CompareNotice &notice);
+
+// Splits a message into its fixed fields without copying or allocating.
+// The value is everything after the last expected separator, so it may itself
+// contain "::".
+TokenizeError tokenizeCommand(std::string_view message, Command &command);
+
+// Splits the value of a BATCH command into one Sync command per record.
+// commands is cleared first and keeps its capacity, so a reused vector does
+// not allocate once it has grown to the largest batch seen.
+TokenizeError tokenizeBatch(std::string_view records, bool interned, std::vector<Command> &commands);
+
+// Takes the text before the next "::" and advances rest past the separator
+bool takeField(std::string_view &rest, std::string_view &field);
+
+// Strict unsigned decimal parse of a whole field
+bool parseDecimal(std::string_view text, uint32_t &value);
+
+// Returns the typed value of a property command, parsing the text form if needed
+bool resolvePropertyValue(const Command &command, PropertyValue &value);
+
+// Returns the offset of the next "::" in data, or length when there is none
+size_t findFieldSeparator(const char *data, size_t length);
+
+const char *tokenizeErrorName(TokenizeError error);
+const char *commandKindName(CommandKind kind);
@@ -0,0 +1,399 @@
+#include "compiled_script.h"
+#include "file_util.h"
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace ScriptFormat;
+
+namespace
+{
+uint32_t align8(size_t offset)
+{
+    return static_cast<uint32_t>((offset + 7) & ~size_t(7));
+}
+
+// Collects the string pool, sharing storage between equal strings
+class StringPool
+{
+public:
+    uint32_t add(std::string_view text)
+    {
+        auto found = m_offsets.find(std::string(text));
+        if (found != m_offsets.end())
+            return found->second;
+
+        uint32_t offset = static_cast<uint32_t>(m_bytes.size());
+        m_bytes.append(text.data(), text.size());
+        m_offsets.emplace(std::string(text), offset);
+        return offset;
+    }
+
+    const std::string &bytes() const { return m_bytes; }
+
+private:
+    std::string m_bytes;
+    std::unordered_map<std::string, uint32_t> m_offsets;
+};
+
+std::string cacheFileName(uint64_t hash)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash));
+    return std::string(name) + FILE_EXTENSION;
+}
+}
+
+uint64_t hashScriptSource(std::string_view source)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : source)
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    return hash;
+}
+
+bool compileScript(const std::vector<PreconditionStep> &steps, uint64_t sourceHash, std::string &image)
+{
+    StringPool strings;
+    std::vector<NameEntry> names;
+    std::unordered_map<std::string, uint32_t> nameIds;
+    std::vector<Step> compiled;
+    compiled.reserve(steps.size());
+
+    for (const PreconditionStep &source : steps)
+    {
+        Step step = {};
+        switch (source.kind)
+        {
+        case PreconditionStep::Kind::Property:
+        {
+            PropertyType type;
+            PropertyValue value;
+            if (!parsePropertyType(source.type, type) || !parsePropertyValue(type, source.value, value))
+            {
+                // Sent one by one, the server's commands would be rejected the same way
+                std::cout << "Skipping invalid " << source.type << " value for " << source.name << " in script: "
+                          << source.value << std::endl;
+                continue;
+            }
+            if (source.file.size() > 0xffff || source.name.size() > 0xffff)
+            {
+                std::cout << "Property name too long in script: " << source.name << std::endl;
+                return false;
+            }
+
+            // One name entry per distinct property and type
+            std::string key = source.file + '\0' + source.name + '\0' + static_cast<char>(type);
+            auto found = nameIds.find(key);
+            if (found == nameIds.end())
+            {
+                NameEntry entry = {};
+                entry.fileOffset = strings.add(source.file);
+                entry.nameOffset = strings.add(source.name);
+                entry.fileLength = static_cast<uint16_t>(source.file.size());
+                entry.nameLength = static_cast<uint16_t>(source.name.size());
+                entry.type = static_cast<uint8_t>(type);
+                found = nameIds.emplace(key, static_cast<uint32_t>(names.size())).first;
+                names.push_back(entry);
+            }
+
+            step.opcode = static_cast<uint8_t>(Opcode::Property);
+            step.type = static_cast<uint8_t>(type);
+            step.nameId = found->second;
+            switch (type)
+            {
+            case PropertyType::Int:
+                std::memcpy(&step.value, &value.intValue, sizeof(step.value));
+                break;
+            case PropertyType::Float:
+                std::memcpy(&step.value, &value.floatValue, sizeof(step.value));
+                break;
+            case PropertyType::Bool:
+                step.value = value.boolValue ? 1 : 0;
+                break;
+            case PropertyType::String:
+                step.value = strings.add(source.value);
+                step.length = static_cast<uint32_t>(source.value.size());
+                break;
+            }
+            break;
+        }
+        case PreconditionStep::Kind::Wait:
+            step.opcode = static_cast<uint8_t>(Opcode::Wait);
+            step.value = source.delayMs;
+            break;
+        case PreconditionStep::Kind::Screenshot:
+            step.opcode = static_cast<uint8_t>(Opcode::Screenshot);
+            step.value = strings.add(source.value);
+            step.length = static_cast<uint32_t>(source.value.size());
+            break;
+        case PreconditionStep::Kind::Exit:
+            step.opcode = static_cast<uint8_t>(Opcode::Exit);
+            break;
+        }
+        compiled.push_back(step);
+    }
+
+    Header header = {};
+    std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+    header.stepCount = static_cast<uint32_t>(compiled.size());
+    header.nameCount = static_cast<uint32_t>(names.size());
+    header.stringBytes = static_cast<uint32_t>(strings.bytes().size());
+    header.sourceHash = sourceHash;
+    header.namesOffset = align8(sizeof(Header));
+    header.stepsOffset = align8(header.namesOffset + names.size() * sizeof(NameEntry));
+    header.stringsOffset = align8(header.stepsOffset + compiled.size() * sizeof(Step));
+
+    image.assign(header.stringsOffset + strings.bytes().size(), '\0');
+    std::memcpy(&image[0], &header, sizeof(header));
+    if (!names.empty())
+        std::memcpy(&image[header.namesOffset], names.data(), names.size() * sizeof(NameEntry));
+    if (!compiled.empty())
+        std::memcpy(&image[header.stepsOffset], compiled.data(), compiled.size() * sizeof(Step));
+    if (!strings.bytes().empty())
+        std::memcpy(&image[header.stringsOffset], strings.bytes().data(), strings.bytes().size());
+    return true;
+}
+
+CompiledScript::CompiledScript()
+    : m_data(nullptr), m_size(0), m_names(nullptr), m_steps(nullptr), m_strings(nullptr), m_mapping(nullptr),
+      m_mappingSize(0)
+{
+}
+
+CompiledScript::~CompiledScript()
+{
+    close();
+}
+
+void CompiledScript::close()
+{
+#ifndef _WIN32
+    if (m_mapping)
+        munmap(m_mapping, m_mappingSize);
+#endif
+    m_mapping = nullptr;
+    m_mappingSize = 0;
+    m_image.clear();
+    m_data = nullptr;
+    m_size = 0;
+}
+
+bool CompiledScript::openFile(const std::string &path)
+{
+    close();
+
+#ifdef _WIN32
+    // No mapping on Windows; the image is small enough to read
+    std::string image;
+    if (!readFile(path, image))
+        return false;
+    return assign(std::move(image));
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size < static_cast<off_t>(sizeof(Header)))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *mapping = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        std::cout << "Cannot map " << path << std::endl;
+        return false;
+    }
+
+    m_mapping = mapping;
+    m_mappingSize = static_cast<size_t>(status.st_size);
+    m_data = static_cast<const char *>(mapping);
+    m_size = m_mappingSize;
+    if (!validate())
+    {
+        std::cout << "Invalid compiled script " << path << std::endl;
+        close();
+        return false;
+    }
+    return true;
+#endif
+}
+
+bool CompiledScript::assign(std::string image)
+{
+    close();
+    m_image = std::move(image);
+    m_data = m_image.data();
+    m_size = m_image.size();
+    if (!validate())
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool CompiledScript::validate()
+{
+    // Checked once so the accessors can index without bounds checks
+    if (m_size < sizeof(Header) || reinterpret_cast<uintptr_t>(m_data) % alignof(Header) != 0)
+        return false;
+
+    const Header &h = header();
+    if (std::memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0 || h.version != VERSION)
+        return false;
+    if (h.namesOffset % 8 != 0 || h.stepsOffset % 8 != 0 ||
+        h.namesOffset + static_cast<uint64_t>(h.nameCount) * sizeof(NameEntry) > m_size ||
+        h.stepsOffset + static_cast<uint64_t>(h.stepCount) * sizeof(Step) > m_size ||
+        h.stringsOffset + static_cast<uint64_t>(h.stringBytes) > m_size)
+        return false;
+
+    m_names = reinterpret_cast<const NameEntry *>(m_data + h.namesOffset);
+    m_steps = reinterpret_cast<const Step *>(m_data + h.stepsOffset);
+    m_strings = m_data + h.stringsOffset;
+
+    auto inPool = [&h](uint64_t offset, uint64_t length) { return offset + length <= h.stringBytes; };
+    for (uint32_t i = 0; i < h.nameCount; ++i)
+    {
+        const NameEntry &entry = m_names[i];
+        if (!inPool(entry.fileOffset, entry.fileLength) || !inPool(entry.nameOffset, entry.nameLength))
+            return false;
+        if (entry.type < static_cast<uint8_t>(PropertyType::Int) ||
+            entry.type > static_cast<uint8_t>(PropertyType::String))
+            return false;
+    }
+
+    for (uint32_t i = 0; i < h.stepCount; ++i)
+    {
+        const Step &step = m_steps[i];
+        switch (static_cast<Opcode>(step.opcode))
+        {
+        case Opcode::Property:
+            if (step.nameId >= h.nameCount || step.type != m_names[step.nameId].type)
+                return false;
+            if (step.type == static_cast<uint8_t>(PropertyType::String) && !inPool(step.value, step.length))
+                return false;
+            break;
+        case Opcode::Screenshot:
+            if (!inPool(step.value, step.length))
+                return false;
+            break;
+        case Opcode::Wait:
+        case Opcode::Exit:
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string_view CompiledScript::file(uint32_t nameId) const
+{
+    return pool(m_names[nameId].fileOffset, m_names[nameId].fileLength);
+}
+
+std::string_view CompiledScript::name(uint32_t nameId) const
+{
+    return pool(m_names[nameId].nameOffset, m_names[nameId].nameLength);
+}
+
+PropertyValue CompiledScript::value(const Step &step) const
+{
+    PropertyValue value;
+    value.type = static_cast<PropertyType>(step.type);
+    switch (value.type)
+    {
+    case PropertyType::Int:
+        std::memcpy(&value.intValue, &step.value, sizeof(value.intValue));
+        break;
+    case PropertyType::Float:
+        std::memcpy(&value.floatValue, &step.value, sizeof(value.floatValue));
+        break;
+    case PropertyType::Bool:
+        value.boolValue = step.value != 0;
+        break;
+    case PropertyType::String:
+        value.stringValue = pool(step.value, step.length);
+        break;
+    }
+    return value;
+}
+
+std::string_view CompiledScript::text(const Step &step) const
+{
+    return pool(step.value, step.length);
+}
+
+bool loadCachedScript(const std::string &path, const std::string &cacheDirectory, CompiledScript &script)
+{
+    std::string source;
+    if (!readFile(path, source))
+        return false;
+    uint64_t hash = hashScriptSource(source);
+
+    std::filesystem::path cachePath;
+    if (!cacheDirectory.empty())
+    {
+        cachePath = std::filesystem::path(cacheDirectory) / cacheFileName(hash);
+        if (script.openFile(cachePath.string()) && script.sourceHash() == hash)
+            return true;
+    }
+
+    std::vector<PreconditionStep> steps;
+    std::string image;
+    if (!parsePreconditionScript(source, steps))
+    {
+        std::cout << "Malformed precondition script " << path << std::endl;
+        return false;
+    }
+    if (!compileScript(steps, hash, image))
+        return false;
+    if (cacheDirectory.empty())
+        return script.assign(std::move(image));
+
+    // Write then rename, so a concurrent reader never maps a partial file
+    std::error_code error;
+    std::filesystem::create_directories(cacheDirectory, error);
+    std::filesystem::path temporary = cachePath;
+    temporary += ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        out.write(image.data(), static_cast<std::streamsize>(image.size()));
+        if (!out)
+            error = std::make_error_code(std::errc::io_error);
+    }
+    if (!error)
+        std::filesystem::rename(temporary, cachePath, error);
+    if (error)
+    {
+        std::cout << "Cannot cache compiled script in " << cacheDirectory << ": " << error.message() << std::endl;
+        std::filesystem::remove(temporary, error);
+        return script.assign(std::move(image));
+    }
+    return script.openFile(cachePath.string()) || script.assign(std::move(image));
+}
+
+std::string defaultScriptCacheDirectory()
+{
+    std::error_code error;
+    std::filesystem::path temporary = std::filesystem::temp_directory_path(error);
+    if (error)
+        return std::string();
+    return (temporary / "DataSourceTestTool" / "scripts").string();
+}
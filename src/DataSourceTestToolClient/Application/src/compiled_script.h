@@ -0,0 +1,144 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "precondition_script.h"
+#include "property_value.h"
+
+// Precompiled form of a PreCondition script, laid out so a memory-mapped file
+// can be run in place.
+//
+//   Header        fixed size, at offset 0
+//   NameEntry[]   one per distinct property (file, type, name), by name ID
+//   Step[]        one per script element, 16 bytes each
+//   char[]        string pool: file/property names, string values, screenshot names
+//
+// Every table starts at a multiple of 8 and all integers are little endian
+// (the host byte order of every supported target). Values are stored already
+// typed, so loading a compiled script needs no text parsing at all.
+namespace ScriptFormat
+{
+const char MAGIC[8] = {'D', 'S', 'S', 'C', 'R', 'I', 'P', 'T'};
+const uint32_t VERSION = 1;
+const char *const FILE_EXTENSION = ".dsc";
+
+enum class Opcode : uint8_t
+{
+    Property = 1,
+    Wait = 2,
+    Screenshot = 3,
+    Exit = 4
+};
+
+struct Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t stepCount;
+    uint32_t nameCount;
+    uint32_t stringBytes;
+    // Hash of the XML the script was compiled from
+    uint64_t sourceHash;
+    uint32_t namesOffset;
+    uint32_t stepsOffset;
+    uint32_t stringsOffset;
+    uint32_t reserved;
+};
+
+struct NameEntry
+{
+    uint32_t fileOffset;
+    uint32_t nameOffset;
+    uint16_t fileLength;
+    uint16_t nameLength;
+    uint8_t type;
+    uint8_t reserved[3];
+};
+
+// Property: nameId, type, value (i32, f32 bits or bool; pool offset for strings), length
+// Wait:     value = delay in milliseconds
+// Screenshot: value = pool offset of the name, length
+struct Step
+{
+    uint8_t opcode;
+    uint8_t type;
+    uint16_t reserved;
+    uint32_t nameId;
+    uint32_t value;
+    uint32_t length;
+};
+
+static_assert(sizeof(Header) == 48, "script header layout");
+static_assert(sizeof(NameEntry) == 16, "script name entry layout");
+static_assert(sizeof(Step) == 16, "script step layout");
+}
+
+// 64-bit FNV-1a of the script source, the key of the compiled script cache
+uint64_t hashScriptSource(std::string_view source);
+
+// Builds the compiled image of parsed script steps. Property steps with an
+// invalid type or value are left out with a message; returns false (and
+// prints why) if the script cannot be compiled at all.
+bool compileScript(const std::vector<PreconditionStep> &steps, uint64_t sourceHash, std::string &image);
+
+// A validated compiled script, either memory-mapped from a file or owning an
+// in-memory image. Accessors are only valid while isOpen().
+class CompiledScript
+{
+public:
+    CompiledScript();
+    ~CompiledScript();
+    CompiledScript(const CompiledScript &) = delete;
+    CompiledScript &operator=(const CompiledScript &) = delete;
+
+    // Maps a .dsc file read-only
+    bool openFile(const std::string &path);
+    // Takes over an image built by compileScript()
+    bool assign(std::string image);
+    void close();
+
+    bool isOpen() const { return m_data != nullptr; }
+    uint64_t sourceHash() const { return header().sourceHash; }
+    size_t imageSize() const { return m_size; }
+
+    size_t stepCount() const { return header().stepCount; }
+    const ScriptFormat::Step &step(size_t index) const { return m_steps[index]; }
+
+    size_t nameCount() const { return header().nameCount; }
+    std::string_view file(uint32_t nameId) const;
+    std::string_view name(uint32_t nameId) const;
+    PropertyType type(uint32_t nameId) const { return static_cast<PropertyType>(m_names[nameId].type); }
+
+    // Typed value of a Property step; string values view the image
+    PropertyValue value(const ScriptFormat::Step &step) const;
+    // Name of a Screenshot step
+    std::string_view text(const ScriptFormat::Step &step) const;
+
+private:
+    const ScriptFormat::Header &header() const { return *reinterpret_cast<const ScriptFormat::Header *>(m_data); }
+    std::string_view pool(uint32_t offset, uint32_t length) const
+    {
+        return std::string_view(m_strings + offset, length);
+    }
+    bool validate();
+
+    const char *m_data;
+    size_t m_size;
+    const ScriptFormat::NameEntry *m_names;
+    const ScriptFormat::Step *m_steps;
+    const char *m_strings;
+    // Backing storage: an in-memory image, or a file mapping
+    std::string m_image;
+    void *m_mapping;
+    size_t m_mappingSize;
+};
+
+// Opens the compiled form of a script file through a cache directory keyed by
+// the hash of the XML. Compiles and stores the script on a miss. With an empty
+// cacheDirectory the script is compiled in memory every time.
+bool loadCachedScript(const std::string &path, const std::string &cacheDirectory, CompiledScript &script);
+
+// Default cache location: DataSourceTestTool/scripts under the temp directory
+std::string defaultScriptCacheDirectory();
@@ -0,0 +1,19 @@
+#include "file_util.h"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+bool readFile(const std::string &path, std::string &contents)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        std::cout << "Cannot open " << path << std::endl;
+        return false;
+    }
+
+    std::ostringstream buffer;
+    buffer << file.rdbuf();
+    contents = buffer.str();
+    return true;
+}
@@ -0,0 +1,6 @@
+#pragma once
+#include <string>
+
+// Reads the whole file into contents. Prints a message and returns false when
+// it cannot be opened.
+bool readFile(const std::string &path, std::string &contents);
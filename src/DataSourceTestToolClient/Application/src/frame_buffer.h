@@ -0,0 +1,26 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Software framebuffer the client renders its state into: 8-bit RGBA, rows
+// top to bottom with no padding between them
+struct FrameBuffer
+{
+    static const uint32_t BYTES_PER_PIXEL = 4;
+
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<uint8_t> pixels;
+
+    void resize(uint32_t newWidth, uint32_t newHeight)
+    {
+        width = newWidth;
+        height = newHeight;
+        pixels.assign(static_cast<size_t>(width) * height * BYTES_PER_PIXEL, 0);
+    }
+
+    size_t stride() const { return static_cast<size_t>(width) * BYTES_PER_PIXEL; }
+    uint8_t *row(uint32_t y) { return pixels.data() + y * stride(); }
+    const uint8_t *row(uint32_t y) const { return pixels.data() + y * stride(); }
+};
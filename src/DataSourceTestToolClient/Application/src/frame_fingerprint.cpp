@@ -0,0 +1,272 @@
+#include "frame_fingerprint.h"
+#include "file_util.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <iostream>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FINGERPRINT_USE_SSE2 1
+#endif
+
+namespace
+{
+// One 32-bit key per pixel of a tile row, and a row of keys for every row
+// within the tile so rows cannot swap unnoticed
+const size_t KEYS_PER_ROW = FingerprintFormat::MAX_TILE_SIZE;
+using KeyTable = std::array<uint32_t, KEYS_PER_ROW * FingerprintFormat::MAX_TILE_SIZE>;
+
+const KeyTable &keyTable()
+{
+    // splitmix64 from a fixed seed: the keys, and so the hashes, never change
+    static const KeyTable table = []() {
+        KeyTable keys;
+        uint64_t state = 0x44535449'4c454650ull;
+        for (size_t i = 0; i < keys.size(); i += 2)
+        {
+            uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            z ^= z >> 31;
+            keys[i] = static_cast<uint32_t>(z);
+            keys[i + 1] = static_cast<uint32_t>(z >> 32);
+        }
+        return keys;
+    }();
+    return table;
+}
+
+uint64_t mix64(uint64_t value)
+{
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdull;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ull;
+    value ^= value >> 33;
+    return value;
+}
+
+// NH universal hash of one tile row: 32-bit additions with the keys, then
+// 64-bit sums of the products of paired words. length is a multiple of 32.
+void hashTileRow(const uint8_t *data, size_t length, const uint32_t *keys, uint64_t &first, uint64_t &second)
+{
+    size_t i = 0;
+
+#if defined(FINGERPRINT_USE_SSE2)
+    __m128i sum = _mm_setzero_si128();
+    for (; i < length; i += 32)
+    {
+        __m128i x = _mm_add_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i)),
+                                  _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys + i / 4)));
+        __m128i y = _mm_add_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 16)),
+                                  _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys + i / 4 + 4)));
+        // Even words, then odd words: lane 0 gets x0*y0 + x1*y1, lane 1 x2*y2 + x3*y3
+        sum = _mm_add_epi64(sum, _mm_mul_epu32(x, y));
+        sum = _mm_add_epi64(sum, _mm_mul_epu32(_mm_srli_epi64(x, 32), _mm_srli_epi64(y, 32)));
+    }
+    alignas(16) uint64_t lanes[2];
+    _mm_store_si128(reinterpret_cast<__m128i *>(lanes), sum);
+    first += lanes[0];
+    second += lanes[1];
+#endif
+
+    for (; i < length; i += 32)
+    {
+        uint32_t words[8];
+        std::memcpy(words, data + i, sizeof(words));
+        uint64_t x[4], y[4];
+        for (int j = 0; j < 4; ++j)
+        {
+            x[j] = static_cast<uint32_t>(words[j] + keys[i / 4 + j]);
+            y[j] = static_cast<uint32_t>(words[j + 4] + keys[i / 4 + j + 4]);
+        }
+        first += x[0] * y[0] + x[1] * y[1];
+        second += x[2] * y[2] + x[3] * y[3];
+    }
+}
+
+void appendUint32(std::string &out, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        out.push_back(static_cast<char>(value >> (8 * i)));
+}
+
+uint32_t readUint32(const char *data)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < 4; ++i)
+        value |= static_cast<uint32_t>(static_cast<uint8_t>(data[i])) << (8 * i);
+    return value;
+}
+}
+
+void computeFingerprint(const FrameBuffer &frame, uint32_t tileSize, FrameFingerprint &fingerprint)
+{
+    fingerprint.tileSize = tileSize;
+    fingerprint.width = frame.width;
+    fingerprint.height = frame.height;
+    fingerprint.columns = (frame.width + tileSize - 1) / tileSize;
+    fingerprint.rows = (frame.height + tileSize - 1) / tileSize;
+    fingerprint.hashes.assign(static_cast<size_t>(fingerprint.columns) * fingerprint.rows, 0);
+
+    const KeyTable &keys = keyTable();
+    size_t tileBytes = static_cast<size_t>(tileSize) * FrameBuffer::BYTES_PER_PIXEL;
+    // Two NH sums per tile of the current tile row
+    std::vector<uint64_t> sums(static_cast<size_t>(fingerprint.columns) * 2);
+    // Edge tiles are hashed zero padded to the full tile width
+    uint8_t padded[FingerprintFormat::MAX_TILE_SIZE * FrameBuffer::BYTES_PER_PIXEL];
+
+    for (uint32_t y = 0; y < frame.height; ++y)
+    {
+        uint32_t rowInTile = y % tileSize;
+        const uint32_t *rowKeys = keys.data() + rowInTile * KEYS_PER_ROW;
+        const uint8_t *row = frame.row(y);
+        for (uint32_t column = 0; column < fingerprint.columns; ++column)
+        {
+            size_t offset = column * tileBytes;
+            const uint8_t *segment = row + offset;
+            if (offset + tileBytes > frame.stride())
+            {
+                std::memset(padded, 0, tileBytes);
+                std::memcpy(padded, segment, frame.stride() - offset);
+                segment = padded;
+            }
+            hashTileRow(segment, tileBytes, rowKeys, sums[column * 2], sums[column * 2 + 1]);
+        }
+
+        if (rowInTile + 1 == tileSize || y + 1 == frame.height)
+        {
+            uint64_t *hashes = fingerprint.hashes.data() + static_cast<size_t>(y / tileSize) * fingerprint.columns;
+            for (uint32_t column = 0; column < fingerprint.columns; ++column)
+                hashes[column] = mix64(sums[column * 2] ^ mix64(sums[column * 2 + 1]));
+            std::fill(sums.begin(), sums.end(), 0);
+        }
+    }
+}
+
+void encodeFingerprint(const FrameFingerprint &fingerprint, std::string &out)
+{
+    out.clear();
+    out.reserve(FingerprintFormat::HEADER_SIZE + fingerprint.hashes.size() * 8);
+    out.append(FingerprintFormat::MAGIC, sizeof(FingerprintFormat::MAGIC));
+    appendUint32(out, FingerprintFormat::VERSION);
+    appendUint32(out, fingerprint.tileSize);
+    appendUint32(out, fingerprint.width);
+    appendUint32(out, fingerprint.height);
+    appendUint32(out, fingerprint.columns);
+    appendUint32(out, fingerprint.rows);
+    for (uint64_t hash : fingerprint.hashes)
+    {
+        appendUint32(out, static_cast<uint32_t>(hash));
+        appendUint32(out, static_cast<uint32_t>(hash >> 32));
+    }
+}
+
+bool decodeFingerprint(const std::string &data, FrameFingerprint &fingerprint)
+{
+    if (data.size() < FingerprintFormat::HEADER_SIZE ||
+        std::memcmp(data.data(), FingerprintFormat::MAGIC, sizeof(FingerprintFormat::MAGIC)) != 0 ||
+        readUint32(data.data() + 8) != FingerprintFormat::VERSION)
+        return false;
+
+    fingerprint.tileSize = readUint32(data.data() + 12);
+    fingerprint.width = readUint32(data.data() + 16);
+    fingerprint.height = readUint32(data.data() + 20);
+    fingerprint.columns = readUint32(data.data() + 24);
+    fingerprint.rows = readUint32(data.data() + 28);
+    size_t count = static_cast<size_t>(fingerprint.columns) * fingerprint.rows;
+    if (fingerprint.tileSize == 0 || (data.size() - FingerprintFormat::HEADER_SIZE) / 8 != count ||
+        fingerprint.columns != (fingerprint.width + fingerprint.tileSize - 1) / fingerprint.tileSize ||
+        fingerprint.rows != (fingerprint.height + fingerprint.tileSize - 1) / fingerprint.tileSize)
+        return false;
+
+    fingerprint.hashes.resize(count);
+    const char *hashes = data.data() + FingerprintFormat::HEADER_SIZE;
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint64_t low = readUint32(hashes + i * 8);
+        uint64_t high = readUint32(hashes + i * 8 + 4);
+        fingerprint.hashes[i] = low | high << 32;
+    }
+    return true;
+}
+
+bool loadFingerprint(const std::string &path, FrameFingerprint &fingerprint)
+{
+    std::string data;
+    if (!readFile(path, data))
+        return false;
+    if (!decodeFingerprint(data, fingerprint))
+    {
+        std::cout << "Invalid fingerprint " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+size_t diffFingerprints(const FrameFingerprint &a, const FrameFingerprint &b, std::vector<uint8_t> &changed)
+{
+    changed.assign(a.hashes.size(), 1);
+    if (a.tileSize != b.tileSize || a.width != b.width || a.height != b.height)
+        return changed.size();
+
+    size_t count = 0;
+    for (size_t i = 0; i < a.hashes.size(); ++i)
+    {
+        changed[i] = a.hashes[i] != b.hashes[i] ? 1 : 0;
+        count += changed[i];
+    }
+    return count;
+}
+
+std::vector<CompareRegion> changedRegions(const FrameFingerprint &fingerprint, const std::vector<uint8_t> &changed)
+{
+    std::vector<CompareRegion> regions;
+    std::vector<uint8_t> visited(changed.size(), 0);
+    std::vector<uint32_t> pending;
+    for (size_t start = 0; start < changed.size(); ++start)
+    {
+        if (!changed[start] || visited[start])
+            continue;
+
+        // Flood fill over the 4-connected changed tiles, tracking the bounds
+        uint32_t left = fingerprint.columns, top = fingerprint.rows, right = 0, bottom = 0;
+        visited[start] = 1;
+        pending.assign(1, static_cast<uint32_t>(start));
+        while (!pending.empty())
+        {
+            uint32_t tile = pending.back();
+            pending.pop_back();
+            uint32_t column = tile % fingerprint.columns;
+            uint32_t row = tile / fingerprint.columns;
+            left = std::min(left, column);
+            right = std::max(right, column);
+            top = std::min(top, row);
+            bottom = std::max(bottom, row);
+
+            const int64_t neighbours[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+            for (const int64_t *step : neighbours)
+            {
+                int64_t x = static_cast<int64_t>(column) + step[0];
+                int64_t y = static_cast<int64_t>(row) + step[1];
+                if (x < 0 || y < 0 || x >= fingerprint.columns || y >= fingerprint.rows)
+                    continue;
+                size_t next = static_cast<size_t>(y) * fingerprint.columns + static_cast<size_t>(x);
+                if (changed[next] && !visited[next])
+                {
+                    visited[next] = 1;
+                    pending.push_back(static_cast<uint32_t>(next));
+                }
+            }
+        }
+
+        CompareRegion region;
+        region.x = left * fingerprint.tileSize;
+        region.y = top * fingerprint.tileSize;
+        region.width = std::min((right + 1) * fingerprint.tileSize, fingerprint.width) - region.x;
+        region.height = std::min((bottom + 1) * fingerprint.tileSize, fingerprint.height) - region.y;
+        regions.push_back(region);
+    }
+    return regions;
+}
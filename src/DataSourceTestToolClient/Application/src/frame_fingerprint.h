@@ -0,0 +1,59 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "frame_buffer.h"
+#include "image_compare.h"
+
+// Per-tile hashes of a frame, written next to every screenshot as
+// "<screenshot>.tiles" so runs can be compared without decoding any image.
+//
+// File layout (little endian):
+//   Header   magic "DSTILEFP", u32 version, u32 tile size, u32 frame width,
+//            u32 frame height, u32 columns, u32 rows
+//   Hashes   columns x rows u64, row by row
+// Tiles on the right and bottom edge may be smaller than the tile size.
+//
+// The hash is fixed across builds (the SSE2 and scalar paths compute the
+// same value), so fingerprints of different builds compare.
+namespace FingerprintFormat
+{
+const char MAGIC[8] = {'D', 'S', 'T', 'I', 'L', 'E', 'F', 'P'};
+const uint32_t VERSION = 1;
+const size_t HEADER_SIZE = 32;
+const uint32_t DEFAULT_TILE_SIZE = 32;
+const uint32_t MAX_TILE_SIZE = 64;
+const char *const FILE_SUFFIX = ".tiles";
+}
+
+struct FrameFingerprint
+{
+    uint32_t tileSize = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t columns = 0;
+    uint32_t rows = 0;
+    std::vector<uint64_t> hashes;
+
+    uint64_t hash(uint32_t column, uint32_t row) const { return hashes[static_cast<size_t>(row) * columns + column]; }
+};
+
+// Replaces fingerprint with the tile hashes of frame. tileSize must be a
+// multiple of 8 no larger than MAX_TILE_SIZE.
+void computeFingerprint(const FrameBuffer &frame, uint32_t tileSize, FrameFingerprint &fingerprint);
+
+// Encodes into out, replacing its contents
+void encodeFingerprint(const FrameFingerprint &fingerprint, std::string &out);
+bool decodeFingerprint(const std::string &data, FrameFingerprint &fingerprint);
+// Reads path, printing why if it fails
+bool loadFingerprint(const std::string &path, FrameFingerprint &fingerprint);
+
+// Marks each tile whose hash differs (1) in changed, one byte per tile, and
+// returns how many there are. Fingerprints of different frame or tile sizes
+// cannot be compared: all tiles of a count as changed.
+size_t diffFingerprints(const FrameFingerprint &a, const FrameFingerprint &b, std::vector<uint8_t> &changed);
+
+// Pixel rectangles covering the changed tiles, one per group of adjacent
+// changed tiles (the group's bounding box), clipped to the frame
+std::vector<CompareRegion> changedRegions(const FrameFingerprint &fingerprint, const std::vector<uint8_t> &changed);
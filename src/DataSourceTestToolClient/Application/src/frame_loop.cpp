@@ -0,0 +1,129 @@
+#include "frame_loop.h"
+#include "steady_time.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <thread>
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+// Longest the idle hook waits while it has no deadline of its own
+const std::chrono::milliseconds IDLE_POLL_INTERVAL(1);
+
+int64_t elapsedNanoseconds(Clock::time_point start, Clock::time_point end)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+void dumpRow(std::ostream &stream, const char *name, const LatencyHistogram &histogram)
+{
+    stream << "  " << std::left << std::setw(20) << name << std::right << std::setw(10) << histogram.count()
+           << std::setw(10) << static_cast<uint64_t>(histogram.mean() + 0.5) << std::setw(10)
+           << histogram.percentile(50.0) << std::setw(10) << histogram.percentile(90.0) << std::setw(10)
+           << histogram.percentile(99.0) << std::setw(10) << histogram.percentile(99.9) << std::setw(10)
+           << histogram.max() << std::endl;
+}
+}
+
+FrameLoop::FrameLoop()
+    : m_rateHz(DEFAULT_RATE_HZ), m_tickLimit(0), m_tickCount(0), m_overrunCount(0), m_firstTickUs(0), m_lastTickUs(0)
+{
+}
+
+void FrameLoop::run(const std::atomic<bool> &running)
+{
+    const Clock::duration period =
+        m_rateHz > 0 ? std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(1000000000 / m_rateHz))
+                     : Clock::duration::zero();
+    Clock::time_point nextTick = Clock::now();
+    while (running && (m_tickLimit == 0 || m_tickCount < m_tickLimit))
+    {
+        Tick tick{m_tickCount, steadyMicroseconds()};
+        if (m_tickCount == 0)
+            m_firstTickUs = tick.startUs;
+        m_lastTickUs = tick.startUs;
+        runTick(tick);
+        ++m_tickCount;
+
+        if (m_rateHz == 0)
+        {
+            if (m_idleHook)
+                m_idleHook();
+            continue;
+        }
+
+        nextTick += period;
+        if (Clock::now() > nextTick)
+        {
+            ++m_overrunCount;
+            nextTick = Clock::now();
+        }
+        while (running && Clock::now() < nextTick)
+        {
+            int64_t deadline = m_idleHook ? m_idleHook() : NO_DEADLINE;
+            Clock::time_point wake = std::min(nextTick, Clock::now() + IDLE_POLL_INTERVAL);
+            if (deadline != NO_DEADLINE)
+                wake = std::min(wake, Clock::time_point(std::chrono::microseconds(deadline)));
+            std::this_thread::sleep_until(wake);
+        }
+    }
+}
+
+void FrameLoop::runTick(const Tick &tick)
+{
+    Clock::time_point tickStart = Clock::now();
+    Clock::time_point stageStart = tickStart;
+    for (size_t stage = 0; stage < static_cast<size_t>(Stage::Count); ++stage)
+    {
+        if (m_hooks[stage].empty())
+            continue;
+
+        for (const Hook &hook : m_hooks[stage])
+            hook(tick);
+        Clock::time_point stageEnd = Clock::now();
+        m_stageTimes[stage].record(elapsedNanoseconds(stageStart, stageEnd));
+        stageStart = stageEnd;
+    }
+    m_tickTime.record(elapsedNanoseconds(tickStart, stageStart));
+}
+
+void FrameLoop::dump(std::ostream &stream) const
+{
+    double seconds = static_cast<double>(m_lastTickUs - m_firstTickUs) / 1e6;
+    stream << "Frame loop: " << m_tickCount << " ticks";
+    if (m_tickCount > 1 && seconds > 0)
+        stream << " at " << std::fixed << std::setprecision(1) << (m_tickCount - 1) / seconds << " Hz"
+               << std::defaultfloat;
+    if (m_rateHz > 0)
+        stream << " (target " << m_rateHz << " Hz), " << m_overrunCount << " overruns";
+    stream << std::endl;
+
+    stream << "Frame stage time (ns)      count      mean       p50       p90       p99     p99.9       max"
+           << std::endl;
+    for (size_t stage = 0; stage < static_cast<size_t>(Stage::Count); ++stage)
+    {
+        if (!m_hooks[stage].empty())
+            dumpRow(stream, frameStageName(static_cast<Stage>(stage)), m_stageTimes[stage]);
+    }
+    dumpRow(stream, "tick", m_tickTime);
+}
+
+const char *frameStageName(FrameLoop::Stage stage)
+{
+    switch (stage)
+    {
+    case FrameLoop::Stage::Drain:
+        return "drain";
+    case FrameLoop::Stage::Apply:
+        return "apply";
+    case FrameLoop::Stage::Render:
+        return "render";
+    case FrameLoop::Stage::Present:
+        return "present";
+    case FrameLoop::Stage::Count:
+        break;
+    }
+    return "unknown";
+}
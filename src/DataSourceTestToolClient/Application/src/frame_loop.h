@@ -0,0 +1,89 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <ostream>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "pipeline_metrics.h"
+
+// Fixed-rate frame loop on the application thread, with or without a display.
+//
+// Each tick runs the hooks of every stage in this order, and the hooks of one
+// stage in the order they were added:
+//   Drain    apply the commands received since the previous tick
+//   Apply    per-frame property updates (streamed signals, snapshot)
+//   Render   draw the frame, e.g. into the software framebuffer
+//   Present  hand the frame on (frame history, captures, latency)
+// Between ticks the idle hook runs every millisecond, or sooner when it asks
+// to, until the next tick is due.
+//
+// A tick that starts more than a period late counts as an overrun and the
+// schedule restarts from it: frames are skipped rather than burst to catch up.
+class FrameLoop
+{
+public:
+    enum class Stage
+    {
+        Drain,
+        Apply,
+        Render,
+        Present,
+        Count
+    };
+
+    struct Tick
+    {
+        // Counts ticks from 0
+        uint64_t number;
+        // Steady clock time (see steadyMicroseconds()) the tick started at
+        int64_t startUs;
+    };
+
+    using Hook = std::function<void(const Tick &tick)>;
+    // Returns the steady clock time it next needs to run, or NO_DEADLINE
+    using IdleHook = std::function<int64_t()>;
+
+    static const uint32_t DEFAULT_RATE_HZ = 60;
+    static const int64_t NO_DEADLINE = INT64_MAX;
+
+    FrameLoop();
+
+    // Ticks per second; 0 runs the ticks back to back without idling
+    void setRate(uint32_t hz) { m_rateHz = hz; }
+    uint32_t rate() const { return m_rateHz; }
+    // Stops after this many ticks, 0 for no limit
+    void setTickLimit(uint64_t ticks) { m_tickLimit = ticks; }
+
+    void addHook(Stage stage, Hook hook) { m_hooks[static_cast<size_t>(stage)].push_back(std::move(hook)); }
+    void setIdleHook(IdleHook hook) { m_idleHook = std::move(hook); }
+
+    // Ticks until running turns false or the tick limit is reached
+    void run(const std::atomic<bool> &running);
+
+    uint64_t tickCount() const { return m_tickCount; }
+    uint64_t overrunCount() const { return m_overrunCount; }
+    // Time spent in the hooks of stage per tick, in nanoseconds
+    const LatencyHistogram &stageTime(Stage stage) const { return m_stageTimes[static_cast<size_t>(stage)]; }
+
+    // Tick and overrun counts, the achieved rate, and one table row per stage
+    // (and for whole ticks) with mean, percentiles and max in nanoseconds
+    void dump(std::ostream &stream) const;
+
+private:
+    void runTick(const Tick &tick);
+
+    uint32_t m_rateHz;
+    uint64_t m_tickLimit;
+    std::vector<Hook> m_hooks[static_cast<size_t>(Stage::Count)];
+    IdleHook m_idleHook;
+
+    uint64_t m_tickCount;
+    uint64_t m_overrunCount;
+    int64_t m_firstTickUs;
+    int64_t m_lastTickUs;
+    LatencyHistogram m_stageTimes[static_cast<size_t>(Stage::Count)];
+    LatencyHistogram m_tickTime;
+};
+
+const char *frameStageName(FrameLoop::Stage stage);
@@ -0,0 +1,79 @@
+#include "frame_renderer.h"
+#include "property_store.h"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+const uint32_t CELL_SIZE = 16;
+const uint8_t BACKGROUND[4] = {24, 24, 32, 255};
+
+uint32_t hashBytes(uint32_t hash, const void *data, size_t length)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < length; ++i)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
+uint32_t cellColour(const PropertyStore &store, uint32_t index)
+{
+    uint32_t hash = 2166136261u;
+    hash = hashBytes(hash, store.module(index).data(), store.module(index).size());
+    hash = hashBytes(hash, store.name(index).data(), store.name(index).size());
+    PropertyType type = store.type(index);
+    hash = hashBytes(hash, &type, sizeof(type));
+    switch (type)
+    {
+    case PropertyType::Int:
+    {
+        int32_t value = store.intValue(index);
+        hash = hashBytes(hash, &value, sizeof(value));
+        break;
+    }
+    case PropertyType::Float:
+    {
+        float value = store.floatValue(index);
+        hash = hashBytes(hash, &value, sizeof(value));
+        break;
+    }
+    case PropertyType::Bool:
+    {
+        bool value = store.boolValue(index);
+        hash = hashBytes(hash, &value, sizeof(value));
+        break;
+    }
+    case PropertyType::String:
+        hash = hashBytes(hash, store.stringValue(index).data(), store.stringValue(index).size());
+        break;
+    }
+    return hash;
+}
+}
+
+void renderPropertyGrid(const PropertyStore &store, FrameBuffer &frame)
+{
+    size_t pixelCount = static_cast<size_t>(frame.width) * frame.height;
+    uint8_t *pixels = frame.pixels.data();
+    for (size_t i = 0; i < pixelCount; ++i)
+        std::memcpy(pixels + i * FrameBuffer::BYTES_PER_PIXEL, BACKGROUND, sizeof(BACKGROUND));
+
+    uint32_t columns = frame.width / CELL_SIZE;
+    uint32_t rows = frame.height / CELL_SIZE;
+    size_t cells = std::min<size_t>(store.size(), static_cast<size_t>(columns) * rows);
+    for (uint32_t index = 0; index < cells; ++index)
+    {
+        uint32_t colour = cellColour(store, index);
+        const uint8_t rgba[4] = {static_cast<uint8_t>(colour), static_cast<uint8_t>(colour >> 8),
+                                 static_cast<uint8_t>(colour >> 16), 255};
+
+        // One pixel of background is left around each cell
+        uint32_t left = (index % columns) * CELL_SIZE + 1;
+        uint32_t top = (index / columns) * CELL_SIZE + 1;
+        uint8_t *first = frame.row(top) + left * FrameBuffer::BYTES_PER_PIXEL;
+        for (uint32_t x = 0; x < CELL_SIZE - 2; ++x)
+            std::memcpy(first + x * FrameBuffer::BYTES_PER_PIXEL, rgba, sizeof(rgba));
+        for (uint32_t y = 1; y < CELL_SIZE - 2; ++y)
+            std::memcpy(first + y * frame.stride(), first, (CELL_SIZE - 2) * FrameBuffer::BYTES_PER_PIXEL);
+    }
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include "frame_buffer.h"
+
+class PropertyStore;
+
+// Stand-in for the HMI scene: draws every property of the store as one cell
+// of a grid, in store index order, coloured by a hash of its key and value.
+// Any change of a value changes the pixels of its cell and nothing else, so
+// screenshots and frame comparisons see the data source state without a GPU.
+void renderPropertyGrid(const PropertyStore &store, FrameBuffer &frame);
@@ -0,0 +1,83 @@
+#include "frame_ring.h"
+#include <algorithm>
+#include <iostream>
+
+FrameRing::FrameRing()
+    : m_frameCount(0), m_memoryCap(DEFAULT_MEMORY_CAP), m_next(0), m_count(0), m_held(false), m_unfitWidth(0),
+      m_unfitHeight(0)
+{
+}
+
+void FrameRing::configure(size_t frameCount, size_t memoryCap)
+{
+    m_frameCount = frameCount;
+    m_memoryCap = memoryCap;
+    m_slots.clear();
+    m_next = 0;
+    m_count = 0;
+    m_held = false;
+    m_unfitWidth = 0;
+    m_unfitHeight = 0;
+}
+
+bool FrameRing::allocate(uint32_t width, uint32_t height)
+{
+    m_slots.clear();
+    m_next = 0;
+    m_count = 0;
+    if (m_frameCount == 0)
+        return false;
+
+    size_t frameBytes = std::max<size_t>(static_cast<size_t>(width) * height * FrameBuffer::BYTES_PER_PIXEL, 1);
+    size_t slots = std::min(m_frameCount, m_memoryCap / frameBytes);
+    if (slots == 0)
+    {
+        std::cout << "A " << width << "x" << height << " frame does not fit in the frame history's " << m_memoryCap
+                  << " bytes, keeping no frames of this size" << std::endl;
+        m_unfitWidth = width;
+        m_unfitHeight = height;
+        return false;
+    }
+    if (slots < m_frameCount)
+        std::cout << "Frame history capped at " << slots << " of " << m_frameCount << " frames by its "
+                  << m_memoryCap << " bytes" << std::endl;
+
+    m_slots.resize(slots);
+    for (Entry &slot : m_slots)
+        slot.frame.resize(width, height);
+    m_unfitWidth = 0;
+    m_unfitHeight = 0;
+    return true;
+}
+
+FrameBuffer *FrameRing::record(uint64_t number, int64_t presentTimeUs, uint32_t width, uint32_t height)
+{
+    if (m_frameCount == 0 || m_held)
+        return nullptr;
+    bool allocated = !m_slots.empty() && m_slots.front().frame.width == width && m_slots.front().frame.height == height;
+    if (!allocated && ((width == m_unfitWidth && height == m_unfitHeight) || !allocate(width, height)))
+        return nullptr;
+
+    Entry &slot = m_slots[m_next];
+    slot.number = number;
+    slot.presentTimeUs = presentTimeUs;
+    m_next = (m_next + 1) % m_slots.size();
+    m_count = std::min(m_count + 1, m_slots.size());
+    return &slot.frame;
+}
+
+const FrameRing::Entry *FrameRing::find(uint64_t number) const
+{
+    // Binary search by number, oldest to newest
+    size_t low = 0;
+    size_t high = m_count;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if (at(middle).number < number)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low < m_count && at(low).number == number ? &at(low) : nullptr;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "frame_buffer.h"
+
+// The last presented frames, so a capture can still get a frame after it was
+// presented (see Application's CAPTURE and FRAMES commands).
+//
+// The slots are allocated ahead by allocate() for the frame size in use and
+// reused from then on; record() replaces the oldest frame and only allocates
+// when the frame size changed. The slot count is the configured frame count,
+// lowered so the slots fit the memory cap. A size of which not even one frame
+// fits keeps nothing, but the configured count stays for the next size.
+class FrameRing
+{
+public:
+    static const size_t DEFAULT_MEMORY_CAP = 256 * 1024 * 1024;
+
+    struct Entry
+    {
+        // Counts presented frames from 0
+        uint64_t number = 0;
+        // Steady clock time (see steadyMicroseconds()) of the present
+        int64_t presentTimeUs = 0;
+        FrameBuffer frame;
+    };
+
+    FrameRing();
+
+    // Keeps up to frameCount frames, 0 for none. Drops the frames held so far.
+    void configure(size_t frameCount, size_t memoryCap);
+    bool enabled() const { return m_frameCount > 0; }
+
+    // Allocates the slots for frames of width x height, dropping the frames
+    // held. Returns false if disabled or no frame of that size fits the
+    // memory cap; record() then keeps nothing until the size changes.
+    bool allocate(uint32_t width, uint32_t height);
+
+    // Slot to draw frame number into, replacing the oldest frame. Null while
+    // disabled or held, or when the frame size does not fit. Allocates the
+    // slots when the frame size changed.
+    FrameBuffer *record(uint64_t number, int64_t presentTimeUs, uint32_t width, uint32_t height);
+
+    // Frames held, oldest first. Numbers only increase but have gaps where
+    // frames were presented while held.
+    size_t size() const { return m_count; }
+    const Entry &at(size_t index) const
+    {
+        return m_slots[(m_next + m_slots.size() - m_count + index) % m_slots.size()];
+    }
+    // Null when frame number was not recorded or has been replaced since
+    const Entry *find(uint64_t number) const;
+
+    // While held (e.g. during a dump), record() keeps every frame in place
+    void setHeld(bool held) { m_held = held; }
+    bool held() const { return m_held; }
+
+private:
+    size_t m_frameCount;
+    size_t m_memoryCap;
+    std::vector<Entry> m_slots;
+    // Slot the next record() writes
+    size_t m_next;
+    size_t m_count;
+    bool m_held;
+    // Last size allocate() found too large, so record() does not retry it every frame
+    uint32_t m_unfitWidth;
+    uint32_t m_unfitHeight;
+};
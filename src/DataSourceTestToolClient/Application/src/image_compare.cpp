@@ -0,0 +1,297 @@
+#include "image_compare.h"
+#include "command_tokenizer.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define COMPARE_USE_SSE2 1
+#endif
+
+namespace
+{
+const uint8_t IGNORED_COLOUR[4] = {0, 0, 96, 255};
+
+using Span = std::pair<uint32_t, uint32_t>;
+
+// The [begin, end) ranges of row y that no ignore region covers
+void includedSpans(const std::vector<CompareRegion> &ignore, uint32_t y, uint32_t width, std::vector<Span> &spans)
+{
+    // Collects the ignored ranges first, then turns them into the gaps between
+    std::vector<Span> &ignored = spans;
+    ignored.clear();
+    for (const CompareRegion &region : ignore)
+    {
+        if (y < region.y || y - region.y >= region.height || region.x >= width)
+            continue;
+        ignored.emplace_back(region.x, region.x + std::min(region.width, width - region.x));
+    }
+    std::sort(ignored.begin(), ignored.end());
+
+    // In place: the span written at kept never overtakes the one read at i
+    size_t count = ignored.size();
+    uint32_t position = 0;
+    size_t kept = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        Span region = ignored[i];
+        if (region.first > position)
+            ignored[kept++] = Span(position, region.first);
+        position = std::max(position, region.second);
+    }
+    ignored.resize(kept);
+    if (position < width)
+        ignored.emplace_back(position, width);
+}
+
+uint8_t channelDelta(uint8_t a, uint8_t b)
+{
+    return a > b ? a - b : b - a;
+}
+
+// Like takeField(), but the last field needs no trailing separator
+std::string_view nextField(std::string_view &rest)
+{
+    size_t separator = findFieldSeparator(rest.data(), rest.size());
+    std::string_view field = rest.substr(0, separator);
+    rest.remove_prefix(std::min(rest.size(), separator + 2));
+    return field;
+}
+
+bool parseUint64(std::string_view text, uint64_t &value)
+{
+    const char *end = text.data() + text.size();
+    std::from_chars_result result = std::from_chars(text.data(), end, value);
+    return !text.empty() && result.ec == std::errc() && result.ptr == end;
+}
+
+bool parseTolerance(std::string_view text, uint8_t tolerance[4])
+{
+    uint32_t values[4];
+    int count = 0;
+    while (count < 4)
+    {
+        size_t comma = text.find(',');
+        if (!parseDecimal(text.substr(0, comma), values[count]) || values[count] > 255)
+            return false;
+        ++count;
+        if (comma == std::string_view::npos)
+            break;
+        text.remove_prefix(comma + 1);
+    }
+    if (count != 1 && count != 4)
+        return false;
+    for (int i = 0; i < 4; ++i)
+        tolerance[i] = static_cast<uint8_t>(values[count == 1 ? 0 : i]);
+    return true;
+}
+
+bool parseRegion(std::string_view text, CompareRegion &region)
+{
+    uint32_t *fields[4] = {&region.x, &region.y, &region.width, &region.height};
+    for (int i = 0; i < 4; ++i)
+    {
+        size_t comma = text.find(',');
+        if ((comma == std::string_view::npos) != (i == 3) || !parseDecimal(text.substr(0, comma), *fields[i]))
+            return false;
+        text.remove_prefix(comma == std::string_view::npos ? text.size() : comma + 1);
+    }
+    return true;
+}
+}
+
+bool parseCompareRequest(std::string_view argument, CompareRequest &request)
+{
+    request = CompareRequest();
+    std::string_view field = nextField(argument);
+    if (field.empty())
+    {
+        std::cout << "COMPARE needs a reference image" << std::endl;
+        return false;
+    }
+    request.reference = std::string(field);
+
+    while (!argument.empty())
+    {
+        field = nextField(argument);
+        size_t equals = field.find('=');
+        std::string_view key = field.substr(0, equals);
+        std::string_view value = equals == std::string_view::npos ? std::string_view() : field.substr(equals + 1);
+        bool valid = false;
+        if (key == "tolerance")
+        {
+            valid = parseTolerance(value, request.options.tolerance);
+        }
+        else if (key == "ignore")
+        {
+            CompareRegion region;
+            valid = parseRegion(value, region);
+            request.options.ignore.push_back(region);
+        }
+        else if (key == "max-diff")
+        {
+            valid = parseUint64(value, request.options.maxDifferingPixels);
+        }
+        else if (key == "heatmap")
+        {
+            valid = !value.empty();
+            request.heatmap = std::string(value);
+        }
+
+        if (!valid)
+        {
+            std::cout << "Invalid COMPARE option " << field << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+uint64_t countDifferingPixels(const uint8_t *actual, const uint8_t *reference, size_t pixelCount,
+                              const uint8_t tolerance[4], uint8_t &maxDelta)
+{
+    uint64_t differing = 0;
+    size_t i = 0;
+
+#if defined(COMPARE_USE_SSE2)
+    // Four pixels per step: |a - b| per channel from two saturating
+    // subtractions, then a channel is over its tolerance when subtracting the
+    // tolerance still leaves something
+    int32_t toleranceWord;
+    std::memcpy(&toleranceWord, tolerance, sizeof(toleranceWord));
+    const __m128i toleranceVector = _mm_set1_epi32(toleranceWord);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i maximum = zero;
+    for (; i + 4 <= pixelCount; i += 4)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(actual + i * 4));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(reference + i * 4));
+        __m128i delta = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+        maximum = _mm_max_epu8(maximum, delta);
+
+        // One bit per channel within tolerance; the common case is all of them
+        unsigned within = static_cast<unsigned>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(delta, toleranceVector), zero)));
+        if (within == 0xffff)
+            continue;
+
+        // Fold each pixel's four channel bits into its lowest one
+        unsigned over = ~within & 0xffff;
+        over |= over >> 1;
+        over |= over >> 2;
+        differing += (over & 1) + (over >> 4 & 1) + (over >> 8 & 1) + (over >> 12 & 1);
+    }
+
+    alignas(16) uint8_t lanes[16];
+    _mm_store_si128(reinterpret_cast<__m128i *>(lanes), maximum);
+    for (uint8_t lane : lanes)
+        maxDelta = std::max(maxDelta, lane);
+#endif
+
+    for (; i < pixelCount; ++i)
+    {
+        bool over = false;
+        for (int channel = 0; channel < 4; ++channel)
+        {
+            uint8_t delta = channelDelta(actual[i * 4 + channel], reference[i * 4 + channel]);
+            maxDelta = std::max(maxDelta, delta);
+            over |= delta > tolerance[channel];
+        }
+        differing += over ? 1 : 0;
+    }
+    return differing;
+}
+
+CompareResult compareFrames(const FrameBuffer &actual, const FrameBuffer &reference, const CompareOptions &options)
+{
+    CompareResult result;
+    if (actual.width != reference.width || actual.height != reference.height)
+        return result;
+    result.sizeMatches = true;
+
+    // Rows have no padding, so without ignore regions it is one long span
+    if (options.ignore.empty())
+    {
+        result.comparedPixels = static_cast<uint64_t>(actual.width) * actual.height;
+        result.differingPixels = countDifferingPixels(actual.pixels.data(), reference.pixels.data(),
+                                                      result.comparedPixels, options.tolerance, result.maxDelta);
+        return result;
+    }
+
+    std::vector<Span> spans;
+    for (uint32_t y = 0; y < actual.height; ++y)
+    {
+        includedSpans(options.ignore, y, actual.width, spans);
+        for (const Span &span : spans)
+        {
+            size_t offset = span.first * FrameBuffer::BYTES_PER_PIXEL;
+            result.comparedPixels += span.second - span.first;
+            result.differingPixels += countDifferingPixels(actual.row(y) + offset, reference.row(y) + offset,
+                                                           span.second - span.first, options.tolerance,
+                                                           result.maxDelta);
+        }
+    }
+    return result;
+}
+
+void renderDiffHeatmap(const FrameBuffer &actual, const FrameBuffer &reference, const CompareOptions &options,
+                       FrameBuffer &heatmap)
+{
+    heatmap.resize(actual.width, actual.height);
+    if (actual.width != reference.width || actual.height != reference.height)
+    {
+        // Nothing lines up: all of it differs
+        for (size_t i = 0; i < heatmap.pixels.size(); i += 4)
+        {
+            heatmap.pixels[i] = 255;
+            heatmap.pixels[i + 3] = 255;
+        }
+        return;
+    }
+
+    std::vector<Span> spans;
+    for (uint32_t y = 0; y < actual.height; ++y)
+    {
+        uint8_t *out = heatmap.row(y);
+        for (uint32_t x = 0; x < actual.width; ++x)
+            std::memcpy(out + x * 4, IGNORED_COLOUR, sizeof(IGNORED_COLOUR));
+
+        includedSpans(options.ignore, y, actual.width, spans);
+        for (const Span &span : spans)
+        {
+            for (uint32_t x = span.first; x < span.second; ++x)
+            {
+                const uint8_t *a = actual.row(y) + x * 4;
+                const uint8_t *b = reference.row(y) + x * 4;
+                uint8_t delta = 0;
+                bool over = false;
+                for (int channel = 0; channel < 4; ++channel)
+                {
+                    uint8_t channelDifference = channelDelta(a[channel], b[channel]);
+                    delta = std::max(delta, channelDifference);
+                    over |= channelDifference > options.tolerance[channel];
+                }
+
+                uint8_t *pixel = out + x * 4;
+                if (over)
+                {
+                    pixel[0] = static_cast<uint8_t>(128 + delta / 2);
+                    pixel[1] = 0;
+                    pixel[2] = 0;
+                }
+                else
+                {
+                    // Integer Rec. 601 luma, dimmed to a quarter
+                    uint8_t grey = static_cast<uint8_t>((b[0] * 77 + b[1] * 150 + b[2] * 29) >> 10);
+                    pixel[0] = grey;
+                    pixel[1] = grey;
+                    pixel[2] = grey;
+                }
+                pixel[3] = 255;
+            }
+        }
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "frame_buffer.h"
+
+// Golden image comparison of a captured frame, as requested by
+//   COMPARE::reference[::option...]
+// with the options
+//   tolerance=N or tolerance=R,G,B,A  largest per-channel difference that
+//                                     still counts as equal (default 0)
+//   ignore=x,y,w,h                    region left out of the comparison;
+//                                     may be given more than once
+//   max-diff=N                        differing pixels allowed for a pass
+//                                     (default 0)
+//   heatmap=path                      writes a diff image (format by extension)
+struct CompareRegion
+{
+    uint32_t x = 0;
+    uint32_t y = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+};
+
+struct CompareOptions
+{
+    uint8_t tolerance[4] = {0, 0, 0, 0};
+    std::vector<CompareRegion> ignore;
+    uint64_t maxDifferingPixels = 0;
+};
+
+struct CompareRequest
+{
+    std::string reference;
+    std::string heatmap;
+    CompareOptions options;
+};
+
+struct CompareResult
+{
+    bool sizeMatches = false;
+    uint64_t comparedPixels = 0;
+    uint64_t differingPixels = 0;
+    // Largest difference of any channel over the compared pixels
+    uint8_t maxDelta = 0;
+
+    bool passed(const CompareOptions &options) const
+    {
+        return sizeMatches && differingPixels <= options.maxDifferingPixels;
+    }
+};
+
+// Parses the argument of a COMPARE command, printing what is wrong with it
+bool parseCompareRequest(std::string_view argument, CompareRequest &request);
+
+// Compares two frames of the same size pixel by pixel, skipping the ignored
+// regions. A size mismatch fails without comparing anything.
+CompareResult compareFrames(const FrameBuffer &actual, const FrameBuffer &reference, const CompareOptions &options);
+
+// Counts the pixels of a span where any channel differs by more than its
+// tolerance and raises maxDelta to the largest channel difference seen.
+// Vectorized with SSE2 where available.
+uint64_t countDifferingPixels(const uint8_t *actual, const uint8_t *reference, size_t pixelCount,
+                              const uint8_t tolerance[4], uint8_t &maxDelta);
+
+// Diff image for humans: differing pixels in red, brighter the larger the
+// difference, over a dimmed grey copy of the reference; ignored regions blue
+void renderDiffHeatmap(const FrameBuffer &actual, const FrameBuffer &reference, const CompareOptions &options,
+                       FrameBuffer &heatmap);
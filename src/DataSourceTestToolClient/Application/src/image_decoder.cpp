@@ -0,0 +1,533 @@
+#include "image_decoder.h"
+#include "image_encoder.h"
+#include "file_util.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+namespace
+{
+// Rejects headers that would make a corrupt file allocate gigabytes
+const uint32_t MAX_DIMENSION = 16384;
+
+uint32_t readUint32BigEndian(const uint8_t *data)
+{
+    return static_cast<uint32_t>(data[0]) << 24 | static_cast<uint32_t>(data[1]) << 16 |
+           static_cast<uint32_t>(data[2]) << 8 | data[3];
+}
+
+uint32_t readUint32LittleEndian(const uint8_t *data)
+{
+    return static_cast<uint32_t>(data[3]) << 24 | static_cast<uint32_t>(data[2]) << 16 |
+           static_cast<uint32_t>(data[1]) << 8 | data[0];
+}
+
+bool validSize(uint32_t width, uint32_t height)
+{
+    return width > 0 && height > 0 && width <= MAX_DIMENSION && height <= MAX_DIMENSION;
+}
+
+// Deflate bit stream, least significant bit first
+struct BitReader
+{
+    const uint8_t *data;
+    size_t size;
+    size_t position = 0;
+    uint32_t buffer = 0;
+    int count = 0;
+
+    bool bits(int needed, uint32_t &value)
+    {
+        while (count < needed)
+        {
+            if (position >= size)
+                return false;
+            buffer |= static_cast<uint32_t>(data[position++]) << count;
+            count += 8;
+        }
+        value = buffer & ((1u << needed) - 1);
+        buffer >>= needed;
+        count -= needed;
+        return true;
+    }
+
+    void alignToByte()
+    {
+        buffer >>= count % 8;
+        count -= count % 8;
+    }
+};
+
+// Canonical Huffman code as deflate defines it: the number of codes of each
+// length and the symbols ordered by code
+struct Huffman
+{
+    uint16_t counts[16];
+    uint16_t symbols[288];
+};
+
+bool buildHuffman(Huffman &huffman, const uint8_t *lengths, int symbolCount)
+{
+    std::memset(huffman.counts, 0, sizeof(huffman.counts));
+    for (int symbol = 0; symbol < symbolCount; ++symbol)
+        ++huffman.counts[lengths[symbol]];
+    huffman.counts[0] = 0;
+
+    // An over-subscribed code cannot be decoded; an incomplete one can
+    int left = 1;
+    for (int length = 1; length < 16; ++length)
+    {
+        left = left * 2 - huffman.counts[length];
+        if (left < 0)
+            return false;
+    }
+
+    uint16_t offsets[16];
+    offsets[1] = 0;
+    for (int length = 1; length < 15; ++length)
+        offsets[length + 1] = offsets[length] + huffman.counts[length];
+    for (int symbol = 0; symbol < symbolCount; ++symbol)
+    {
+        if (lengths[symbol] != 0)
+            huffman.symbols[offsets[lengths[symbol]]++] = static_cast<uint16_t>(symbol);
+    }
+    return true;
+}
+
+bool decodeSymbol(BitReader &reader, const Huffman &huffman, int &symbol)
+{
+    // Codes are stored most significant bit first, one bit at a time
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (int length = 1; length < 16; ++length)
+    {
+        uint32_t bit;
+        if (!reader.bits(1, bit))
+            return false;
+        code |= static_cast<int>(bit);
+        int count = huffman.counts[length];
+        if (code - first < count)
+        {
+            symbol = huffman.symbols[index + code - first];
+            return true;
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return false;
+}
+
+const uint16_t LENGTH_BASE[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                  31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const uint8_t LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                  2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const uint16_t DISTANCE_BASE[30] = {1,    2,    3,    4,    5,    7,    9,    13,    17,    25,
+                                    33,   49,   65,   97,   129,  193,  257,  385,   513,   769,
+                                    1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const uint8_t DISTANCE_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                    6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+bool inflateCodes(BitReader &reader, const Huffman &literals, const Huffman &distances, std::vector<uint8_t> &out,
+                  size_t limit)
+{
+    for (;;)
+    {
+        int symbol;
+        if (!decodeSymbol(reader, literals, symbol))
+            return false;
+        if (symbol < 256)
+        {
+            if (out.size() >= limit)
+                return false;
+            out.push_back(static_cast<uint8_t>(symbol));
+            continue;
+        }
+        if (symbol == 256)
+            return true;
+
+        symbol -= 257;
+        uint32_t extra;
+        if (symbol >= 29 || !reader.bits(LENGTH_EXTRA[symbol], extra))
+            return false;
+        size_t length = LENGTH_BASE[symbol] + extra;
+
+        if (!decodeSymbol(reader, distances, symbol) || symbol >= 30 || !reader.bits(DISTANCE_EXTRA[symbol], extra))
+            return false;
+        size_t distance = DISTANCE_BASE[symbol] + extra;
+        if (distance > out.size() || out.size() + length > limit)
+            return false;
+
+        // Byte by byte: the source may overlap what is being written
+        size_t from = out.size() - distance;
+        for (size_t i = 0; i < length; ++i)
+            out.push_back(out[from + i]);
+    }
+}
+
+bool inflateDynamicTables(BitReader &reader, Huffman &literals, Huffman &distances)
+{
+    static const uint8_t ORDER[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+    uint32_t literalCount, distanceCount, codeLengthCount;
+    if (!reader.bits(5, literalCount) || !reader.bits(5, distanceCount) || !reader.bits(4, codeLengthCount))
+        return false;
+    literalCount += 257;
+    distanceCount += 1;
+    codeLengthCount += 4;
+    if (literalCount > 286 || distanceCount > 30)
+        return false;
+
+    uint8_t lengths[320] = {};
+    for (uint32_t i = 0; i < codeLengthCount; ++i)
+    {
+        uint32_t length;
+        if (!reader.bits(3, length))
+            return false;
+        lengths[ORDER[i]] = static_cast<uint8_t>(length);
+    }
+    Huffman codeLengths;
+    if (!buildHuffman(codeLengths, lengths, 19))
+        return false;
+
+    // Literal/length and distance code lengths form one sequence
+    std::memset(lengths, 0, sizeof(lengths));
+    uint32_t index = 0;
+    while (index < literalCount + distanceCount)
+    {
+        int symbol;
+        if (!decodeSymbol(reader, codeLengths, symbol))
+            return false;
+        if (symbol < 16)
+        {
+            lengths[index++] = static_cast<uint8_t>(symbol);
+            continue;
+        }
+
+        uint8_t repeated = 0;
+        uint32_t repeat;
+        if (symbol == 16)
+        {
+            if (index == 0 || !reader.bits(2, repeat))
+                return false;
+            repeated = lengths[index - 1];
+            repeat += 3;
+        }
+        else if (symbol == 17)
+        {
+            if (!reader.bits(3, repeat))
+                return false;
+            repeat += 3;
+        }
+        else
+        {
+            if (!reader.bits(7, repeat))
+                return false;
+            repeat += 11;
+        }
+        if (index + repeat > literalCount + distanceCount)
+            return false;
+        while (repeat-- > 0)
+            lengths[index++] = repeated;
+    }
+
+    return lengths[256] != 0 && buildHuffman(literals, lengths, static_cast<int>(literalCount)) &&
+           buildHuffman(distances, lengths + literalCount, static_cast<int>(distanceCount));
+}
+
+// Decompresses a zlib stream of at most limit bytes
+bool inflateZlib(const uint8_t *data, size_t size, std::vector<uint8_t> &out, size_t limit)
+{
+    // Deflate with no preset dictionary
+    if (size < 2 || (data[0] & 0x0f) != 8 || (data[0] * 256 + data[1]) % 31 != 0 || (data[1] & 0x20) != 0)
+        return false;
+
+    out.clear();
+    out.reserve(limit);
+    BitReader reader{data + 2, size - 2};
+    uint32_t final = 0;
+    while (final == 0)
+    {
+        uint32_t type;
+        if (!reader.bits(1, final) || !reader.bits(2, type))
+            return false;
+
+        if (type == 0)
+        {
+            // Stored: copy the bytes still in the bit buffer, then memcpy
+            reader.alignToByte();
+            uint32_t length, complement;
+            if (!reader.bits(16, length) || !reader.bits(16, complement) || length != (~complement & 0xffff) ||
+                out.size() + length > limit)
+                return false;
+            for (; length > 0 && reader.count > 0; --length)
+            {
+                uint32_t byte;
+                if (!reader.bits(8, byte))
+                    return false;
+                out.push_back(static_cast<uint8_t>(byte));
+            }
+            if (reader.size - reader.position < length)
+                return false;
+            out.insert(out.end(), reader.data + reader.position, reader.data + reader.position + length);
+            reader.position += length;
+        }
+        else if (type == 1)
+        {
+            static const std::pair<Huffman, Huffman> fixed = []() {
+                uint8_t lengths[288];
+                std::fill(lengths, lengths + 144, 8);
+                std::fill(lengths + 144, lengths + 256, 9);
+                std::fill(lengths + 256, lengths + 280, 7);
+                std::fill(lengths + 280, lengths + 288, 8);
+                std::pair<Huffman, Huffman> tables;
+                buildHuffman(tables.first, lengths, 288);
+                std::fill(lengths, lengths + 30, 5);
+                buildHuffman(tables.second, lengths, 30);
+                return tables;
+            }();
+            if (!inflateCodes(reader, fixed.first, fixed.second, out, limit))
+                return false;
+        }
+        else if (type == 2)
+        {
+            Huffman literals, distances;
+            if (!inflateDynamicTables(reader, literals, distances) ||
+                !inflateCodes(reader, literals, distances, out, limit))
+                return false;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint8_t paeth(uint8_t left, uint8_t up, uint8_t upLeft)
+{
+    int estimate = left + up - upLeft;
+    int toLeft = std::abs(estimate - left);
+    int toUp = std::abs(estimate - up);
+    int toUpLeft = std::abs(estimate - upLeft);
+    if (toLeft <= toUp && toLeft <= toUpLeft)
+        return left;
+    return toUp <= toUpLeft ? up : upLeft;
+}
+
+// Undoes the PNG row filters in place; rows keep their filter type byte
+bool unfilterRows(std::vector<uint8_t> &rows, size_t stride, uint32_t height, size_t bytesPerPixel)
+{
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        uint8_t *row = rows.data() + y * (stride + 1);
+        uint8_t filter = row[0];
+        ++row;
+        const uint8_t *previous = y > 0 ? row - (stride + 1) : nullptr;
+        for (size_t x = 0; x < stride; ++x)
+        {
+            uint8_t left = x >= bytesPerPixel ? row[x - bytesPerPixel] : 0;
+            uint8_t up = previous ? previous[x] : 0;
+            uint8_t upLeft = previous && x >= bytesPerPixel ? previous[x - bytesPerPixel] : 0;
+            switch (filter)
+            {
+            case 0:
+                break;
+            case 1:
+                row[x] = static_cast<uint8_t>(row[x] + left);
+                break;
+            case 2:
+                row[x] = static_cast<uint8_t>(row[x] + up);
+                break;
+            case 3:
+                row[x] = static_cast<uint8_t>(row[x] + (left + up) / 2);
+                break;
+            case 4:
+                row[x] = static_cast<uint8_t>(row[x] + paeth(left, up, upLeft));
+                break;
+            default:
+                return false;
+            }
+        }
+    }
+    return true;
+}
+}
+
+bool decodeImage(std::string_view data, FrameBuffer &frame)
+{
+    if (data.size() >= 8 && data.substr(0, 8) == std::string_view("\x89PNG\r\n\x1a\n", 8))
+        return decodePng(data, frame);
+    if (data.size() >= 4 && data.substr(0, 4) == "qoif")
+        return decodeQoi(data, frame);
+    if (data.size() >= sizeof(RAW_MAGIC) && std::memcmp(data.data(), RAW_MAGIC, sizeof(RAW_MAGIC)) == 0)
+        return decodeRaw(data, frame);
+    return false;
+}
+
+bool decodePng(std::string_view data, FrameBuffer &frame)
+{
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data.data());
+    size_t position = 8;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    size_t bytesPerPixel = 0;
+    std::vector<uint8_t> compressed;
+    while (position + 12 <= data.size())
+    {
+        uint32_t length = readUint32BigEndian(bytes + position);
+        std::string_view type = data.substr(position + 4, 4);
+        const uint8_t *chunk = bytes + position + 8;
+        if (length > data.size() - position - 12)
+            return false;
+
+        if (type == "IHDR")
+        {
+            // 8 bits per channel, RGB (2) or RGBA (6), not interlaced
+            if (length != 13 || chunk[8] != 8 || (chunk[9] != 2 && chunk[9] != 6) || chunk[12] != 0)
+                return false;
+            width = readUint32BigEndian(chunk);
+            height = readUint32BigEndian(chunk + 4);
+            bytesPerPixel = chunk[9] == 6 ? 4 : 3;
+        }
+        else if (type == "IDAT")
+        {
+            compressed.insert(compressed.end(), chunk, chunk + length);
+        }
+        else if (type == "IEND")
+        {
+            break;
+        }
+        position += 12 + length;
+    }
+    if (bytesPerPixel == 0 || !validSize(width, height))
+        return false;
+
+    size_t stride = width * bytesPerPixel;
+    std::vector<uint8_t> rows;
+    if (!inflateZlib(compressed.data(), compressed.size(), rows, (stride + 1) * height) ||
+        rows.size() != (stride + 1) * height || !unfilterRows(rows, stride, height, bytesPerPixel))
+        return false;
+
+    frame.resize(width, height);
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        const uint8_t *source = rows.data() + y * (stride + 1) + 1;
+        uint8_t *target = frame.row(y);
+        if (bytesPerPixel == 4)
+        {
+            std::memcpy(target, source, stride);
+            continue;
+        }
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            std::memcpy(target + x * 4, source + x * 3, 3);
+            target[x * 4 + 3] = 255;
+        }
+    }
+    return true;
+}
+
+bool decodeQoi(std::string_view data, FrameBuffer &frame)
+{
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data.data());
+    if (data.size() < 14 + 8)
+        return false;
+    uint32_t width = readUint32BigEndian(bytes + 4);
+    uint32_t height = readUint32BigEndian(bytes + 8);
+    if (!validSize(width, height))
+        return false;
+
+    frame.resize(width, height);
+    uint8_t *pixel = frame.pixels.data();
+    uint8_t *end = pixel + frame.pixels.size();
+    const uint8_t *cursor = bytes + 14;
+    // The 8-byte end marker is never read as an op
+    const uint8_t *last = bytes + data.size() - 8;
+
+    uint8_t index[64][4] = {};
+    uint8_t current[4] = {0, 0, 0, 255};
+    while (pixel < end)
+    {
+        if (cursor >= last)
+            return false;
+        uint8_t op = *cursor++;
+        uint32_t run = 1;
+        if (op == 0xfe)
+        {
+            if (last - cursor < 3)
+                return false;
+            std::memcpy(current, cursor, 3);
+            cursor += 3;
+        }
+        else if (op == 0xff)
+        {
+            if (last - cursor < 4)
+                return false;
+            std::memcpy(current, cursor, 4);
+            cursor += 4;
+        }
+        else if ((op >> 6) == 0)
+        {
+            std::memcpy(current, index[op], 4);
+        }
+        else if ((op >> 6) == 1)
+        {
+            current[0] = static_cast<uint8_t>(current[0] + ((op >> 4) & 3) - 2);
+            current[1] = static_cast<uint8_t>(current[1] + ((op >> 2) & 3) - 2);
+            current[2] = static_cast<uint8_t>(current[2] + (op & 3) - 2);
+        }
+        else if ((op >> 6) == 2)
+        {
+            if (cursor >= last)
+                return false;
+            uint8_t second = *cursor++;
+            int dg = (op & 0x3f) - 32;
+            current[0] = static_cast<uint8_t>(current[0] + dg + (second >> 4) - 8);
+            current[1] = static_cast<uint8_t>(current[1] + dg);
+            current[2] = static_cast<uint8_t>(current[2] + dg + (second & 0x0f) - 8);
+        }
+        else
+        {
+            run = (op & 0x3f) + 1u;
+        }
+
+        std::memcpy(index[(current[0] * 3 + current[1] * 5 + current[2] * 7 + current[3] * 11) % 64], current, 4);
+        for (; run > 0 && pixel < end; --run, pixel += 4)
+            std::memcpy(pixel, current, 4);
+    }
+    return true;
+}
+
+bool decodeRaw(std::string_view data, FrameBuffer &frame)
+{
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data.data());
+    if (data.size() < RAW_HEADER_SIZE || std::memcmp(bytes, RAW_MAGIC, sizeof(RAW_MAGIC)) != 0)
+        return false;
+    uint32_t width = readUint32LittleEndian(bytes + 8);
+    uint32_t height = readUint32LittleEndian(bytes + 12);
+    size_t stride = readUint32LittleEndian(bytes + 16);
+    if (!validSize(width, height) || stride < width * 4 || (data.size() - RAW_HEADER_SIZE) / stride < height)
+        return false;
+
+    frame.resize(width, height);
+    for (uint32_t y = 0; y < height; ++y)
+        std::memcpy(frame.row(y), bytes + RAW_HEADER_SIZE + y * stride, frame.stride());
+    return true;
+}
+
+bool loadImage(const std::string &path, FrameBuffer &frame)
+{
+    std::string data;
+    if (!readFile(path, data))
+        return false;
+    if (!decodeImage(data, frame))
+    {
+        std::cout << "Unsupported or corrupt image " << path << std::endl;
+        return false;
+    }
+    return true;
+}
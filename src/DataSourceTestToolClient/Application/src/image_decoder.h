@@ -0,0 +1,18 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include "frame_buffer.h"
+
+// Counterpart of image_encoder.h for reference images. Reads everything
+// encodeImage() writes, and PNGs saved by other tools as long as they are
+// 8 bits per channel RGB or RGBA and not interlaced. The format is taken
+// from the file's signature, not its name. Checksums are not verified.
+
+// Replaces frame with the decoded image; false if data is not a supported image
+bool decodeImage(std::string_view data, FrameBuffer &frame);
+bool decodePng(std::string_view data, FrameBuffer &frame);
+bool decodeQoi(std::string_view data, FrameBuffer &frame);
+bool decodeRaw(std::string_view data, FrameBuffer &frame);
+
+// Reads and decodes path, printing why if it fails
+bool loadImage(const std::string &path, FrameBuffer &frame);
@@ -0,0 +1,455 @@
+#include "image_encoder.h"
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#ifdef DATASOURCE_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace
+{
+void appendUint32BigEndian(std::string &out, uint32_t value)
+{
+    out.push_back(static_cast<char>(value >> 24));
+    out.push_back(static_cast<char>(value >> 16));
+    out.push_back(static_cast<char>(value >> 8));
+    out.push_back(static_cast<char>(value));
+}
+
+void appendUint32LittleEndian(std::string &out, uint32_t value)
+{
+    out.push_back(static_cast<char>(value));
+    out.push_back(static_cast<char>(value >> 8));
+    out.push_back(static_cast<char>(value >> 16));
+    out.push_back(static_cast<char>(value >> 24));
+}
+
+// CRC-32 (IEEE) as PNG chunks use it
+const std::array<uint32_t, 256> &crcTable()
+{
+    static const std::array<uint32_t, 256> table = []() {
+        std::array<uint32_t, 256> result{};
+        for (uint32_t n = 0; n < 256; ++n)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            result[n] = c;
+        }
+        return result;
+    }();
+    return table;
+}
+
+uint32_t crc32(const char *data, size_t length)
+{
+    const std::array<uint32_t, 256> &table = crcTable();
+    uint32_t crc = 0xffffffffu;
+    for (size_t i = 0; i < length; ++i)
+        crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xffffffffu;
+}
+
+// Adler-32 of the zlib stream, updated a row at a time
+struct Adler32
+{
+    uint32_t a = 1;
+    uint32_t b = 0;
+
+    void update(const uint8_t *data, size_t length)
+    {
+        // 5552 is the most bytes that cannot overflow b before the modulo
+        while (length > 0)
+        {
+            size_t chunk = std::min<size_t>(length, 5552);
+            for (size_t i = 0; i < chunk; ++i)
+            {
+                a += data[i];
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+            data += chunk;
+            length -= chunk;
+        }
+    }
+    uint32_t value() const { return (b << 16) | a; }
+};
+
+// Appends length bytes of the deflate stream as stored blocks. blockLeft is
+// what the current block still takes; a new block header is written whenever
+// it runs out.
+void appendStored(std::string &out, const uint8_t *data, size_t length, size_t &streamLeft, size_t &blockLeft)
+{
+    while (length > 0)
+    {
+        if (blockLeft == 0)
+        {
+            blockLeft = std::min<size_t>(streamLeft, 65535);
+            bool final = blockLeft == streamLeft;
+            uint16_t blockLength = static_cast<uint16_t>(blockLeft);
+            out.push_back(final ? 1 : 0);
+            out.push_back(static_cast<char>(blockLength));
+            out.push_back(static_cast<char>(blockLength >> 8));
+            out.push_back(static_cast<char>(~blockLength));
+            out.push_back(static_cast<char>(~blockLength >> 8));
+        }
+        size_t chunk = std::min(length, blockLeft);
+        out.append(reinterpret_cast<const char *>(data), chunk);
+        data += chunk;
+        length -= chunk;
+        blockLeft -= chunk;
+        streamLeft -= chunk;
+    }
+}
+
+// The PNG zlib stream of the rows with filter type 0 (None), in stored blocks
+void appendStoredStream(std::string &out, const uint8_t *rgba, uint32_t width, uint32_t height)
+{
+    size_t stride = static_cast<size_t>(width) * 4;
+    size_t rawSize = (stride + 1) * height;
+    size_t blockCount = std::max<size_t>((rawSize + 65534) / 65535, 1);
+    out.reserve(out.size() + 2 + blockCount * 5 + rawSize + 4 + 12);
+
+    // zlib header: deflate with a 32K window, no dictionary, fastest level
+    out.push_back(0x78);
+    out.push_back(0x01);
+    Adler32 adler;
+    size_t streamLeft = rawSize;
+    size_t blockLeft = 0;
+    if (rawSize == 0)
+        out.append("\x01\x00\x00\xff\xff", 5);
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        const uint8_t filter = 0;
+        const uint8_t *row = rgba + y * stride;
+        appendStored(out, &filter, 1, streamLeft, blockLeft);
+        appendStored(out, row, stride, streamLeft, blockLeft);
+        adler.update(&filter, 1);
+        adler.update(row, stride);
+    }
+    appendUint32BigEndian(out, adler.value());
+}
+
+#ifdef DATASOURCE_HAVE_ZLIB
+// Fast zlib level: UI frames are mostly flat areas and repeated rows, which
+// the low levels already find
+const int PNG_COMPRESSION_LEVEL = 3;
+
+uint8_t paeth(uint8_t left, uint8_t up, uint8_t upLeft)
+{
+    int estimate = left + up - upLeft;
+    int toLeft = std::abs(estimate - left);
+    int toUp = std::abs(estimate - up);
+    int toUpLeft = std::abs(estimate - upLeft);
+    if (toLeft <= toUp && toLeft <= toUpLeft)
+        return left;
+    return toUp <= toUpLeft ? up : upLeft;
+}
+
+// Cost of a filtered byte: its absolute value as a signed byte
+inline uint32_t filterCost(uint8_t value)
+{
+    return value < 128 ? value : 256u - value;
+}
+
+// Writes filter type and filtered row to candidate and returns the summed
+// cost, giving up once it reaches limit. previous is the unfiltered row above.
+template <uint8_t TYPE>
+uint64_t filterCandidate(const uint8_t *row, const uint8_t *previous, size_t stride, uint8_t *candidate,
+                         uint64_t limit)
+{
+    const size_t BPP = 4;
+    candidate[0] = TYPE;
+    uint64_t sum = 0;
+    for (size_t x = 0; x < stride && sum < limit; ++x)
+    {
+        uint8_t left = x >= BPP ? row[x - BPP] : 0;
+        uint8_t predicted = 0;
+        if (TYPE == 1)
+            predicted = left;
+        else if (TYPE == 2)
+            predicted = previous[x];
+        else if (TYPE == 3)
+            predicted = static_cast<uint8_t>((left + previous[x]) / 2);
+        else if (TYPE == 4)
+            predicted = paeth(left, previous[x], x >= BPP ? previous[x - BPP] : 0);
+        uint8_t value = static_cast<uint8_t>(row[x] - predicted);
+        candidate[x + 1] = value;
+        sum += filterCost(value);
+    }
+    return sum;
+}
+
+// Points filtered at the filter type byte and row filtered with the filter
+// whose output costs least, the choice libpng makes. A candidate is dropped
+// as soon as it costs more than the best so far.
+void filterRow(const uint8_t *row, const uint8_t *previous, size_t stride, std::vector<uint8_t> &candidates,
+               const uint8_t *&filtered)
+{
+    size_t length = stride + 1;
+    uint64_t best = filterCandidate<0>(row, previous, stride, &candidates[0], UINT64_MAX);
+    filtered = &candidates[0];
+
+    uint64_t (*const FILTERS[4])(const uint8_t *, const uint8_t *, size_t, uint8_t *, uint64_t) = {
+        filterCandidate<1>, filterCandidate<2>, filterCandidate<3>, filterCandidate<4>};
+    for (size_t type = 1; type < 5; ++type)
+    {
+        uint8_t *candidate = &candidates[type * length];
+        uint64_t sum = FILTERS[type - 1](row, previous, stride, candidate, best);
+        if (sum < best)
+        {
+            best = sum;
+            filtered = candidate;
+        }
+    }
+}
+
+// The PNG zlib stream of the filtered rows, compressed. Returns false if
+// zlib could not be set up, leaving out as it was.
+bool appendDeflateStream(std::string &out, const uint8_t *rgba, uint32_t width, uint32_t height)
+{
+    z_stream stream = {};
+    if (deflateInit(&stream, PNG_COMPRESSION_LEVEL) != Z_OK)
+        return false;
+
+    size_t stride = static_cast<size_t>(width) * 4;
+    size_t start = out.size();
+    // The bound holds even if nothing compresses, so the output never moves
+    out.resize(start + deflateBound(&stream, static_cast<uLong>((stride + 1) * height)));
+    stream.next_out = reinterpret_cast<Bytef *>(&out[start]);
+    stream.avail_out = static_cast<uInt>(out.size() - start);
+
+    std::vector<uint8_t> candidates(5 * (stride + 1));
+    std::vector<uint8_t> zeros(stride, 0);
+    int result = Z_OK;
+    for (uint32_t y = 0; y < height && result == Z_OK; ++y)
+    {
+        const uint8_t *row = rgba + y * stride;
+        const uint8_t *filtered = nullptr;
+        filterRow(row, y > 0 ? row - stride : zeros.data(), stride, candidates, filtered);
+        stream.next_in = const_cast<Bytef *>(filtered);
+        stream.avail_in = static_cast<uInt>(stride + 1);
+        result = deflate(&stream, Z_NO_FLUSH);
+    }
+    if (result == Z_OK)
+        result = deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+
+    if (result != Z_STREAM_END)
+    {
+        out.resize(start);
+        return false;
+    }
+    out.resize(start + stream.total_out);
+    return true;
+}
+#endif
+
+void finishChunk(std::string &out, size_t chunkStart)
+{
+    // The length excludes itself and the type; the CRC covers type and data
+    size_t dataLength = out.size() - chunkStart - 8;
+    for (int i = 0; i < 4; ++i)
+        out[chunkStart + i] = static_cast<char>(dataLength >> (24 - 8 * i));
+    appendUint32BigEndian(out, crc32(out.data() + chunkStart + 4, dataLength + 4));
+}
+
+size_t beginChunk(std::string &out, const char *type)
+{
+    size_t start = out.size();
+    out.append(4, '\0');
+    out.append(type, 4);
+    return start;
+}
+
+uint32_t qoiHash(const uint8_t *pixel)
+{
+    return (pixel[0] * 3u + pixel[1] * 5u + pixel[2] * 7u + pixel[3] * 11u) % 64u;
+}
+}
+
+ImageFormat imageFormatForPath(std::string_view path)
+{
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string_view::npos || path.size() - dot != 4)
+        return ImageFormat::Png;
+
+    char extension[3];
+    for (int i = 0; i < 3; ++i)
+        extension[i] = static_cast<char>(path[dot + 1 + i] | 0x20);
+    if (std::memcmp(extension, "qoi", 3) == 0)
+        return ImageFormat::Qoi;
+    if (std::memcmp(extension, "raw", 3) == 0)
+        return ImageFormat::Raw;
+    return ImageFormat::Png;
+}
+
+const char *imageFormatName(ImageFormat format)
+{
+    switch (format)
+    {
+    case ImageFormat::Png:
+        return "png";
+    case ImageFormat::Qoi:
+        return "qoi";
+    case ImageFormat::Raw:
+        return "raw";
+    }
+    return "unknown";
+}
+
+void encodeImage(ImageFormat format, const uint8_t *rgba, uint32_t width, uint32_t height, std::string &out)
+{
+    switch (format)
+    {
+    case ImageFormat::Png:
+        encodePng(rgba, width, height, out);
+        break;
+    case ImageFormat::Qoi:
+        encodeQoi(rgba, width, height, out);
+        break;
+    case ImageFormat::Raw:
+        encodeRaw(rgba, width, height, out);
+        break;
+    }
+}
+
+void encodePng(const uint8_t *rgba, uint32_t width, uint32_t height, std::string &out)
+{
+    static const char SIGNATURE[8] = {'\x89', 'P', 'N', 'G', '\r', '\n', '\x1a', '\n'};
+
+    out.clear();
+    out.append(SIGNATURE, sizeof(SIGNATURE));
+
+    size_t chunk = beginChunk(out, "IHDR");
+    appendUint32BigEndian(out, width);
+    appendUint32BigEndian(out, height);
+    // 8 bits per channel, RGBA, deflate, no filter method extensions, not interlaced
+    const char header[5] = {8, 6, 0, 0, 0};
+    out.append(header, sizeof(header));
+    finishChunk(out, chunk);
+
+    chunk = beginChunk(out, "IDAT");
+#ifdef DATASOURCE_HAVE_ZLIB
+    if (!appendDeflateStream(out, rgba, width, height))
+        appendStoredStream(out, rgba, width, height);
+#else
+    appendStoredStream(out, rgba, width, height);
+#endif
+    finishChunk(out, chunk);
+
+    finishChunk(out, beginChunk(out, "IEND"));
+}
+
+void encodeQoi(const uint8_t *rgba, uint32_t width, uint32_t height, std::string &out)
+{
+    const uint8_t OP_INDEX = 0x00;
+    const uint8_t OP_DIFF = 0x40;
+    const uint8_t OP_LUMA = 0x80;
+    const uint8_t OP_RUN = 0xc0;
+    const uint8_t OP_RGB = 0xfe;
+    const uint8_t OP_RGBA = 0xff;
+
+    size_t pixelCount = static_cast<size_t>(width) * height;
+    out.clear();
+    // Worst case is 5 bytes per pixel, plus header and end marker
+    out.reserve(14 + pixelCount * 5 + 8);
+    out.append("qoif", 4);
+    appendUint32BigEndian(out, width);
+    appendUint32BigEndian(out, height);
+    out.push_back(4); // channels
+    out.push_back(0); // sRGB with linear alpha
+
+    // Write through a raw pointer; resized to the real length at the end
+    size_t headerSize = out.size();
+    out.resize(out.capacity());
+    uint8_t *cursor = reinterpret_cast<uint8_t *>(&out[headerSize]);
+    uint8_t *start = cursor;
+
+    uint8_t index[64][4] = {};
+    uint8_t previous[4] = {0, 0, 0, 255};
+    uint32_t run = 0;
+    for (size_t i = 0; i < pixelCount; ++i)
+    {
+        const uint8_t *pixel = rgba + i * 4;
+        if (std::memcmp(pixel, previous, 4) == 0)
+        {
+            if (++run == 62)
+            {
+                *cursor++ = static_cast<uint8_t>(OP_RUN | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0)
+        {
+            *cursor++ = static_cast<uint8_t>(OP_RUN | (run - 1));
+            run = 0;
+        }
+
+        uint32_t slot = qoiHash(pixel);
+        if (std::memcmp(index[slot], pixel, 4) == 0)
+        {
+            *cursor++ = static_cast<uint8_t>(OP_INDEX | slot);
+        }
+        else
+        {
+            std::memcpy(index[slot], pixel, 4);
+            if (pixel[3] == previous[3])
+            {
+                int8_t dr = static_cast<int8_t>(pixel[0] - previous[0]);
+                int8_t dg = static_cast<int8_t>(pixel[1] - previous[1]);
+                int8_t db = static_cast<int8_t>(pixel[2] - previous[2]);
+                int drg = dr - dg;
+                int dbg = db - dg;
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+                {
+                    *cursor++ = static_cast<uint8_t>(OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+                }
+                else if (drg >= -8 && drg <= 7 && dg >= -32 && dg <= 31 && dbg >= -8 && dbg <= 7)
+                {
+                    *cursor++ = static_cast<uint8_t>(OP_LUMA | (dg + 32));
+                    *cursor++ = static_cast<uint8_t>((drg + 8) << 4 | (dbg + 8));
+                }
+                else
+                {
+                    *cursor++ = OP_RGB;
+                    *cursor++ = pixel[0];
+                    *cursor++ = pixel[1];
+                    *cursor++ = pixel[2];
+                }
+            }
+            else
+            {
+                *cursor++ = OP_RGBA;
+                std::memcpy(cursor, pixel, 4);
+                cursor += 4;
+            }
+        }
+        std::memcpy(previous, pixel, 4);
+    }
+    if (run > 0)
+        *cursor++ = static_cast<uint8_t>(OP_RUN | (run - 1));
+
+    static const uint8_t END_MARKER[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+    std::memcpy(cursor, END_MARKER, sizeof(END_MARKER));
+    cursor += sizeof(END_MARKER);
+    out.resize(headerSize + static_cast<size_t>(cursor - start));
+}
+
+void encodeRaw(const uint8_t *rgba, uint32_t width, uint32_t height, std::string &out)
+{
+    size_t stride = static_cast<size_t>(width) * 4;
+    out.clear();
+    out.reserve(RAW_HEADER_SIZE + stride * height);
+    out.append(RAW_MAGIC, sizeof(RAW_MAGIC));
+    appendUint32LittleEndian(out, width);
+    appendUint32LittleEndian(out, height);
+    appendUint32LittleEndian(out, static_cast<uint32_t>(stride));
+    appendUint32LittleEndian(out, 0);
+    out.append(reinterpret_cast<const char *>(rgba), stride * height);
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+// Lossless encoders for captured frames (8-bit RGBA input, no row padding).
+//
+//   Png  standard PNG. Built with zlib (DATASOURCE_HAVE_ZLIB), every row gets
+//        the PNG filter that suits it best and the rows are deflated at a
+//        fast level. Without zlib the rows go into stored (uncompressed)
+//        deflate blocks: encoding is a copy plus checksums, at the cost of
+//        file size.
+//   Qoi  "Quite OK Image" format: typically a third of the raw size for UI
+//        frames and several times faster to encode than a compressing PNG.
+//   Raw  the pixels after a 24-byte header (see RAW_MAGIC), for tools that
+//        compare frames without decoding anything.
+enum class ImageFormat
+{
+    Png,
+    Qoi,
+    Raw
+};
+
+// Raw header: magic, u32 width, u32 height, u32 bytes per row, u32 reserved
+const char RAW_MAGIC[8] = {'D', 'S', 'R', 'A', 'W', 'I', 'M', 'G'};
+const size_t RAW_HEADER_SIZE = 24;
+
+// By file extension (.png, .qoi, .raw, any case); anything else is PNG
+ImageFormat imageFormatForPath(std::string_view path);
+const char *imageFormatName(ImageFormat format);
+
+// Replaces out with the encoded image
+void encodeImage(ImageFormat format, const uint8_t *rgba, uint32_t width, uint32_t height, std::string &out);
+void encodePng(const uint8_t *rgba, uint32_t width, uint32_t height, std::string &out);
+void encodeQoi(const uint8_t *rgba, uint32_t width, uint32_t height, std::string &out);
+void encodeRaw(const uint8_t *rgba, uint32_t width, uint32_t height, std::string &out);
@@ -0,0 +1,123 @@
+#include "message_framer.h"
+#include "binary_protocol.h"
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+MessageFramer::MessageFramer(size_t capacity)
+    : m_storage(new char[capacity]), m_capacity(capacity)
+{
+}
+
+char *MessageFramer::prepareWrite(size_t &available)
+{
+    if (m_readOffset == m_writeOffset)
+    {
+        // Drained: wrap the cursors back to the start
+        m_readOffset = m_writeOffset = m_scanOffset = 0;
+    }
+    else if (m_writeOffset == m_capacity)
+    {
+        size_t pending = pendingBytes();
+
+        // A command without a delimiter this long means the stream is out of sync
+        if ((m_mode == Mode::Delimited && pending >= MAX_MESSAGE_LENGTH) || pending == m_capacity)
+        {
+            std::cout << "Discarding " << pending << " bytes without message delimiter" << std::endl;
+            m_readOffset = m_writeOffset = m_scanOffset = 0;
+        }
+        else
+        {
+            // Move the incomplete command to the front so it stays contiguous
+            std::memmove(m_storage.get(), m_storage.get() + m_readOffset, pending);
+            m_scanOffset -= m_readOffset;
+            m_readOffset = 0;
+            m_writeOffset = pending;
+        }
+    }
+
+    available = m_capacity - m_writeOffset;
+    return m_storage.get() + m_writeOffset;
+}
+
+void MessageFramer::commitWrite(size_t length)
+{
+    m_writeOffset = std::min(m_writeOffset + length, m_capacity);
+}
+
+size_t MessageFramer::append(const char *data, size_t length)
+{
+    size_t available = 0;
+    char *target = prepareWrite(available);
+    size_t chunk = std::min(length, available);
+
+    std::memcpy(target, data, chunk);
+    commitWrite(chunk);
+    return chunk;
+}
+
+bool MessageFramer::nextMessage(std::string_view &message)
+{
+    if (m_mode == Mode::LengthPrefixed)
+        return nextLengthPrefixedMessage(message);
+    return nextDelimitedMessage(message);
+}
+
+bool MessageFramer::nextLengthPrefixedMessage(std::string_view &message)
+{
+    const size_t headerSize = BinaryProtocol::LENGTH_PREFIX_SIZE;
+    if (pendingBytes() < headerSize)
+        return false;
+
+    const char *frame = m_storage.get() + m_readOffset;
+    size_t length = BinaryProtocol::readUint32(frame);
+    if (length > MAX_MESSAGE_LENGTH)
+    {
+        std::cout << "Discarding stream after oversized frame of " << length << " bytes" << std::endl;
+        m_readOffset = m_writeOffset = m_scanOffset = 0;
+        return false;
+    }
+
+    if (pendingBytes() < headerSize + length)
+        return false;
+
+    message = std::string_view(frame + headerSize, length);
+    m_readOffset += headerSize + length;
+    m_scanOffset = m_readOffset;
+    return true;
+}
+
+bool MessageFramer::nextDelimitedMessage(std::string_view &message)
+{
+    const char *base = m_storage.get();
+
+    while (m_readOffset < m_writeOffset)
+    {
+        const void *found = std::memchr(base + m_scanOffset, DELIMITER, m_writeOffset - m_scanOffset);
+        if (found == nullptr)
+        {
+            m_scanOffset = m_writeOffset;
+            return false;
+        }
+
+        size_t end = static_cast<const char *>(found) - base;
+        size_t length = end - m_readOffset;
+        if (length > 0 && base[end - 1] == '\r')
+            --length;
+
+        message = std::string_view(base + m_readOffset, length);
+        m_readOffset = m_scanOffset = end + 1;
+
+        // Skip blank lines between commands
+        if (!message.empty())
+            return true;
+    }
+
+    return false;
+}
+
+void MessageFramer::reset()
+{
+    m_mode = Mode::Delimited;
+    m_readOffset = m_writeOffset = m_scanOffset = 0;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <string_view>
+#include <memory>
+#include <cstddef>
+
+// Splits the TCP byte stream into whole commands.
+// Text commands sent by the server end with '\n'; after the binary protocol is
+// negotiated every frame starts with its u32 little-endian length instead.
+// A single read may carry several commands or only part of one, so bytes after
+// the last complete command are kept until a later read completes them.
+//
+// The receive buffer is allocated once. The socket reads straight into it
+// through prepareWrite()/commitWrite(), and commands are returned as views into
+// the buffer, so the steady state does no heap allocation. The write cursor
+// wraps to the start whenever the buffer is drained; a command that is still
+// incomplete when the cursor reaches the end is moved to the front.
+class MessageFramer
+{
+public:
+    enum class Mode
+    {
+        Delimited,
+        LengthPrefixed
+    };
+
+    static const char DELIMITER = '\n';
+    static const size_t MAX_MESSAGE_LENGTH = 256 * 1024;
+
+    explicit MessageFramer(size_t capacity = 2 * MAX_MESSAGE_LENGTH);
+
+    // Returns the free space the next read may write into
+    char *prepareWrite(size_t &available);
+
+    // Marks bytes written into the space returned by prepareWrite() as received
+    void commitWrite(size_t length);
+
+    // Copies bytes from another source into the buffer. Returns how many were
+    // taken; drain the complete commands with nextMessage() before appending the rest.
+    size_t append(const char *data, size_t length);
+
+    // Extracts the next complete command, returns false when none is buffered.
+    // The view stays valid until the next prepareWrite() or append().
+    bool nextMessage(std::string_view &message);
+
+    // Drops any buffered bytes and returns to Delimited mode (used when a new connection starts)
+    void reset();
+
+    // Takes effect from the next nextMessage() call; buffered bytes are kept
+    void setMode(Mode mode) { m_mode = mode; }
+    Mode mode() const { return m_mode; }
+
+    size_t pendingBytes() const { return m_writeOffset - m_readOffset; }
+    size_t capacity() const { return m_capacity; }
+
+private:
+    bool nextDelimitedMessage(std::string_view &message);
+    bool nextLengthPrefixedMessage(std::string_view &message);
+
+    Mode m_mode = Mode::Delimited;
+    std::unique_ptr<char[]> m_storage;
+    size_t m_capacity;
+    size_t m_readOffset = 0;
+    size_t m_writeOffset = 0;
+    // Bytes before this offset are known not to contain a delimiter
+    size_t m_scanOffset = 0;
+};
@@ -1,16 +1,35 @@
 #include "network_client.h"
+#include "steady_time.h"
 #include <iostream>
 #include <chrono>
 #include <thread>
 
 using boost::asio::ip::tcp;
+using boost::asio::generic::stream_protocol;
 
+#ifndef SERVER_IP
 #ifdef _WIN32
 #define SERVER_IP "127.0.0.1"
 #else
 #define SERVER_IP "192.168.10.222"
 #endif
+#endif
+#ifndef SERVER_PORT
 #define SERVER_PORT 22207
+#endif
+
+namespace
+{
+// ACKs the application can hand over before the network thread writes them
+const size_t ACKNOWLEDGEMENT_QUEUE_CAPACITY = 8192;
+// Screenshots and comparisons finish at most a few per frame
+const size_t SCREENSHOT_NOTICE_QUEUE_CAPACITY = 256;
+// Longest the shared memory loop sleeps without a wake-up, bounding how long
+// disconnect() or a read timeout can go unnoticed
+const std::chrono::microseconds SHARED_MEMORY_IDLE_WAIT(std::chrono::milliseconds(100));
+// Retry interval while the server's receive ring is full
+const std::chrono::microseconds SHARED_MEMORY_FULL_WAIT(std::chrono::milliseconds(1));
+}
 
 NetworkClient &NetworkClient::getInstance()
 {
@@ -18,85 +37,616 @@ NetworkClient &NetworkClient::getInstance()
     return instance;
 }
 
-void NetworkClient::connectToServer()
+NetworkClient::NetworkClient()
+    : m_socket(m_ioContext),
+      m_timeoutTimer(m_ioContext),
+      m_useSharedMemory(false),
+      m_stopRequested(false),
+      m_lastReceiveUs(0),
+      m_connectTimeout(std::chrono::seconds(5)),
+      m_readTimeout(std::chrono::milliseconds::zero()),
+      m_isConnected(false),
+      m_connecting(false),
+      m_binaryProtocol(false),
+      m_helloMessage(BinaryProtocol::makeClientHello()),
+      m_sequence(0),
+      m_acknowledgementQueue(ACKNOWLEDGEMENT_QUEUE_CAPACITY),
+      m_noticeQueue(SCREENSHOT_NOTICE_QUEUE_CAPACITY),
+      m_compareQueue(SCREENSHOT_NOTICE_QUEUE_CAPACITY),
+      m_flushPosted(false),
+      m_writeInFlight(false)
+{
+    m_batchCommands.reserve(1024);
+    m_samples.reserve(1024);
+
+    // Construct the metrics first so they outlive this singleton
+    PipelineMetrics::getInstance();
+}
+
+void NetworkClient::setTimeouts(std::chrono::milliseconds connectTimeout, std::chrono::milliseconds readTimeout)
+{
+    m_connectTimeout = connectTimeout;
+    m_readTimeout = readTimeout;
+}
+
+void NetworkClient::connectToServer(bool runOnOwnThread)
 {
     if (m_isConnected)
         return;
 
-    m_networkThread = std::thread(&NetworkClient::networkProcedure, this);
+    tcp::endpoint endpoint(boost::asio::ip::address::from_string(SERVER_IP), SERVER_PORT);
+
+    std::cout << "Attempting to connect to " << SERVER_IP << ":" << SERVER_PORT << std::endl;
+
+    connectEndpoint(endpoint, runOnOwnThread);
 }
 
-void NetworkClient::disconnect()
+void NetworkClient::connectUnixSocket(const std::string &path, bool runOnOwnThread)
 {
-    m_isConnected = false;
+    if (m_isConnected)
+        return;
+
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+    std::cout << "Attempting to connect to " << path << std::endl;
+
+    connectEndpoint(boost::asio::local::stream_protocol::endpoint(path), runOnOwnThread);
+#else
+    std::cout << "Unix domain sockets are not supported on this platform (" << path << ")" << std::endl;
+    (void)runOnOwnThread;
+#endif
+}
+
+void NetworkClient::connectEndpoint(const stream_protocol::endpoint &endpoint, bool runOnOwnThread)
+{
+    if (m_connecting)
+    {
+        std::cout << "Connection attempt already in progress" << std::endl;
+        return;
+    }
+
+    // A previous connection attempt may still own the thread
     if (m_networkThread.joinable())
         m_networkThread.join();
+
+    m_useSharedMemory = false;
+    m_connecting = true;
+    m_ioContext.restart();
+    m_socket.async_connect(endpoint, [this](const boost::system::error_code &error) { onConnect(error); });
+
+    if (m_connectTimeout.count() > 0)
+    {
+        m_timeoutTimer.expires_after(m_connectTimeout);
+        m_timeoutTimer.async_wait([this](const boost::system::error_code &error) {
+            if (!error && !m_isConnected)
+            {
+                std::cout << "Connection timed out" << std::endl;
+                closeConnection();
+            }
+        });
+    }
+
+    if (runOnOwnThread)
+    {
+        m_networkThread = std::thread([this]() {
+            try
+            {
+                m_ioContext.run();
+            }
+            catch (std::exception &e)
+            {
+                std::cout << "Network error: " << e.what() << std::endl;
+            }
+            m_isConnected = false;
+        });
+    }
 }
 
-void NetworkClient::networkProcedure()
+void NetworkClient::connectSharedMemory(const std::string &name, bool runOnOwnThread)
 {
-    try
+    if (m_isConnected)
+        return;
+    if (m_connecting)
     {
-        boost::asio::io_context io_context;
-        tcp::socket socket(io_context);
-        tcp::endpoint endpoint(boost::asio::ip::address::from_string(SERVER_IP), SERVER_PORT);
+        std::cout << "Connection attempt already in progress" << std::endl;
+        return;
+    }
+
+    if (m_networkThread.joinable())
+        m_networkThread.join();
 
-        std::cout << "Attempting to connect to " << SERVER_IP << ":" << SERVER_PORT << std::endl;
+    std::cout << "Attempting to open shared memory " << name << std::endl;
 
-        socket.connect(endpoint);
-        m_isConnected = true;
+    m_useSharedMemory = true;
+    m_stopRequested = false;
+    if (!m_sharedMemory.open(name))
+        return;
+    startSession();
 
-        std::cout << "Connected successfully!" << std::endl;
+    if (runOnOwnThread)
+    {
+        m_networkThread = std::thread([this]() {
+            size_t handled = 0;
+            while (!m_stopRequested && pollSharedMemory(SHARED_MEMORY_IDLE_WAIT, handled))
+            {
+            }
+            m_isConnected = false;
+        });
+    }
+}
 
-        // Simple message loop
-        while (m_isConnected)
+bool NetworkClient::pollSharedMemory(std::chrono::microseconds wait, size_t &handled)
+{
+    handled = 0;
+    if (!m_isConnected)
+        return false;
+
+    // Read straight into the framer's buffer, as the socket does
+    size_t available = 0;
+    char *buffer = m_framer.prepareWrite(available);
+    size_t length = m_sharedMemory.read(buffer, available);
+    int64_t now = steadyMicroseconds();
+    if (length > 0)
+    {
+        m_lastReceiveUs = now;
+        m_framer.commitWrite(length);
+        std::string_view message;
+        while (m_framer.nextMessage(message))
         {
-            std::vector<char> buffer(1024);
-            boost::system::error_code error;
+            handleMessage(message, now);
+            ++handled;
+        }
+    }
+
+    flushWrites();
+
+    if (length == 0 && m_sharedMemory.peerClosed() && m_sharedMemory.readable() == 0)
+    {
+        std::cout << "Connection closed by server" << std::endl;
+        closeConnection();
+        return false;
+    }
+    if (length == 0 && m_readTimeout.count() > 0 &&
+        now - m_lastReceiveUs >= std::chrono::duration_cast<std::chrono::microseconds>(m_readTimeout).count())
+    {
+        std::cout << "Read timed out" << std::endl;
+        closeConnection();
+        return false;
+    }
+
+    // More may be waiting already when the framer's buffer filled up
+    if (length == 0 && wait.count() > 0)
+        m_sharedMemory.wait(m_sendText.empty() ? wait : std::min(wait, SHARED_MEMORY_FULL_WAIT));
+    return true;
+}
+
+size_t NetworkClient::poll()
+{
+    if (m_useSharedMemory)
+    {
+        size_t handled = 0;
+        pollSharedMemory(std::chrono::microseconds::zero(), handled);
+        return handled;
+    }
+
+    try
+    {
+        return m_ioContext.poll();
+    }
+    catch (std::exception &e)
+    {
+        std::cout << "Network error: " << e.what() << std::endl;
+        closeConnection();
+        return 0;
+    }
+}
+
+void NetworkClient::disconnect()
+{
+    if (m_useSharedMemory)
+    {
+        m_stopRequested = true;
+        m_sharedMemory.wake();
+    }
+
+    // Stopping the context returns from run() immediately, even while a read is pending
+    m_ioContext.stop();
+    if (m_networkThread.joinable())
+        m_networkThread.join();
+
+    // Nothing runs the context now, so the socket can be closed from this thread.
+    // Polling afterwards completes the aborted operations.
+    closeConnection();
+    m_ioContext.restart();
+    m_ioContext.poll();
+    // Unmapped only here: the application thread may wake the channel until
+    // it calls disconnect()
+    m_sharedMemory.close();
+
+    PipelineMetrics &metrics = PipelineMetrics::getInstance();
+    if (!metrics.empty())
+    {
+        metrics.dump(std::cout);
+        metrics.reset();
+    }
+}
+
+void NetworkClient::onConnect(const boost::system::error_code &error)
+{
+    m_connecting = false;
+    if (error == boost::asio::error::operation_aborted)
+        return;
+
+    if (error)
+    {
+        std::cout << "Network error: " << error.message() << std::endl;
+        closeConnection();
+        return;
+    }
+
+    m_timeoutTimer.cancel();
+    startSession();
+    startRead();
+}
+
+void NetworkClient::startSession()
+{
+    m_isConnected = true;
+    m_lastReceiveUs = steadyMicroseconds();
+    m_framer.reset();
+    m_binaryProtocol = false;
+    m_dictionary.clear();
+    m_sequence = 0;
+    m_sendText.clear();
+    m_writeInFlight = false;
+    m_acknowledgementQueue.commitRead(m_acknowledgementQueue.readable());
+    m_noticeQueue.commitRead(m_noticeQueue.readable());
+    m_compareQueue.commitRead(m_compareQueue.readable());
 
-            size_t len = socket.read_some(boost::asio::buffer(buffer), error);
+    std::cout << "Connected successfully!" << std::endl;
 
-            if (error == boost::asio::error::eof)
+    sendHello();
+}
+
+void NetworkClient::startRead()
+{
+    // Read straight into the framer's preallocated buffer
+    size_t available = 0;
+    char *buffer = m_framer.prepareWrite(available);
+
+    m_socket.async_read_some(boost::asio::buffer(buffer, available),
+                             [this](const boost::system::error_code &error, size_t length) { onRead(error, length); });
+
+    if (m_readTimeout.count() > 0)
+    {
+        m_timeoutTimer.expires_after(m_readTimeout);
+        m_timeoutTimer.async_wait([this](const boost::system::error_code &error) {
+            if (!error)
             {
-                std::cout << "Connection closed by server" << std::endl;
-                break;
+                std::cout << "Read timed out" << std::endl;
+                closeConnection();
             }
-            else if (error)
+        });
+    }
+}
+
+void NetworkClient::onRead(const boost::system::error_code &error, size_t length)
+{
+    if (error == boost::asio::error::operation_aborted)
+        return;
+
+    if (error == boost::asio::error::eof)
+    {
+        std::cout << "Connection closed by server" << std::endl;
+        closeConnection();
+        return;
+    }
+    else if (error)
+    {
+        std::cout << "Error: " << error.message() << std::endl;
+        closeConnection();
+        return;
+    }
+
+    // A read may hold several commands or only part of one; they all share
+    // the time the read completed
+    int64_t receiveTime = steadyMicroseconds();
+    m_framer.commitWrite(length);
+    std::string_view message;
+    while (m_framer.nextMessage(message))
+    {
+        handleMessage(message, receiveTime);
+    }
+
+    startRead();
+}
+
+void NetworkClient::closeConnection()
+{
+    m_isConnected = false;
+    m_connecting = false;
+    m_timeoutTimer.cancel();
+
+    boost::system::error_code ignored;
+    m_socket.shutdown(stream_protocol::socket::shutdown_both, ignored);
+    m_socket.close(ignored);
+}
+
+void NetworkClient::sendHello()
+{
+    // Servers that do not know the handshake ignore it and keep sending text
+    m_sendText += m_helloMessage;
+    flushWrites();
+}
+
+void NetworkClient::handleHello(std::string_view reply)
+{
+    // reply is "<version>::<encoding>"
+    size_t separator = findFieldSeparator(reply.data(), reply.size());
+    std::string_view version = reply.substr(0, separator);
+    std::string_view encoding = separator < reply.size() ? reply.substr(separator + 2) : std::string_view();
+
+    if (encoding == "binary" && version == std::to_string(BinaryProtocol::VERSION))
+    {
+        // Every frame after this reply is length prefixed
+        m_binaryProtocol = true;
+        m_framer.setMode(MessageFramer::Mode::LengthPrefixed);
+        std::cout << "Using binary protocol version " << version << std::endl;
+    }
+    else
+    {
+        std::cout << "Using text protocol" << std::endl;
+    }
+}
+
+void NetworkClient::handleMessage(std::string_view message, int64_t receiveTimeUs)
+{
+    Command command;
+    TokenizeError error = m_binaryProtocol ? BinaryProtocol::decodeCommand(message, command)
+                                           : tokenizeCommand(message, command);
+
+    // Every message except the handshake, dictionary and stream samples is
+    // acknowledged, including ones that fail to parse, so the sequence stays
+    // in step with the server's count of sent commands
+    if (command.kind != CommandKind::Hello && command.kind != CommandKind::Dictionary &&
+        command.kind != CommandKind::Sample)
+    {
+        command.sequence = ++m_sequence;
+        command.receiveTimeUs = receiveTimeUs;
+    }
+
+    if (error == TokenizeError::None && command.kind == CommandKind::Hello)
+    {
+        handleHello(command.value);
+        return;
+    }
+
+    if (error == TokenizeError::None && command.kind == CommandKind::Dictionary)
+    {
+        error = m_binaryProtocol ? BinaryProtocol::decodeDictionary(command.value, m_dictionary)
+                                 : m_dictionary.loadText(command.value);
+        if (error == TokenizeError::None)
+        {
+            std::cout << "Property dictionary has " << m_dictionary.size() << " entries" << std::endl;
+            return;
+        }
+    }
+
+    if (error == TokenizeError::None && command.kind == CommandKind::Sample)
+    {
+        error = m_binaryProtocol ? BinaryProtocol::decodeSamples(command.value, m_samples)
+                                 : parseSampleRecords(command.value, m_samples);
+        if (error == TokenizeError::None)
+        {
+            if (m_sampleHandler)
+                m_sampleHandler(command.propertyId, m_samples.data(), m_samples.size());
+            return;
+        }
+    }
+
+    if (error == TokenizeError::None && command.kind == CommandKind::Batch)
+    {
+        error = m_binaryProtocol ? BinaryProtocol::decodeBatch(command.value, command.interned, m_batchCommands)
+                                 : tokenizeBatch(command.value, command.interned, m_batchCommands);
+        if (error == TokenizeError::None)
+        {
+            if (command.interned && !resolveInterned(m_batchCommands))
             {
-                std::cout << "Error: " << error.message() << std::endl;
-                break;
+                rejectCommand(command.sequence, command.receiveTimeUs);
+                return;
             }
 
-            if (len > 0)
+            int64_t parseTime = steadyMicroseconds();
+            PipelineMetrics::getInstance().record(PipelineMetrics::Stage::ReceiveToParse, parseTime - receiveTimeUs);
+            for (Command &record : m_batchCommands)
             {
-                std::string message(buffer.data(), len);
-                std::cout << "Received: " << message << std::endl;
+                record.sequence = command.sequence;
+                record.receiveTimeUs = command.receiveTimeUs;
+                record.parseTimeUs = parseTime;
             }
+            if (!dispatchCommands(m_batchCommands.data(), m_batchCommands.size()))
+                rejectCommand(command.sequence, command.receiveTimeUs);
+            return;
         }
     }
-    catch (std::exception &e)
+
+    if (error == TokenizeError::None && command.interned && !resolveInterned(command, "Ignoring command"))
     {
-        std::cout << "Network error: " << e.what() << std::endl;
+        rejectCommand(command.sequence, command.receiveTimeUs);
+        return;
     }
 
-    m_isConnected = false;
+    if (error != TokenizeError::None)
+    {
+        std::cout << "Ignoring command (" << tokenizeErrorName(error) << ")";
+        if (!m_binaryProtocol)
+            std::cout << ": " << message;
+        std::cout << std::endl;
+        rejectCommand(command.sequence, command.receiveTimeUs);
+        return;
+    }
+
+    command.parseTimeUs = steadyMicroseconds();
+    PipelineMetrics::getInstance().record(PipelineMetrics::Stage::ReceiveToParse, command.parseTimeUs - receiveTimeUs);
+
+    if (!dispatchCommands(&command, 1))
+        rejectCommand(command.sequence, command.receiveTimeUs);
+}
+
+bool NetworkClient::dispatchCommands(const Command *commands, size_t count)
+{
+    // An empty batch has nothing to apply
+    return count > 0 && m_commandHandler && m_commandHandler(commands, count);
+}
+
+void NetworkClient::rejectCommand(uint32_t sequence, int64_t receiveTimeUs)
+{
+    if (sequence == 0)
+        return;
+
+    appendAcknowledgement(m_sendText, Acknowledgement{sequence, receiveTimeUs, 0});
+    flushWrites();
+}
+
+void NetworkClient::sendAcknowledgements(const Acknowledgement *acknowledgements, size_t count)
+{
+    if (!m_acknowledgementQueue.canWrite(count))
+    {
+        std::cout << "Acknowledgement queue full, dropping " << count << " ACKs" << std::endl;
+        return;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+        m_acknowledgementQueue.writeSlot(i) = acknowledgements[i];
+    m_acknowledgementQueue.commitWrite(count);
+    wakeWriter();
+}
+
+void NetworkClient::sendScreenshotNotice(const ScreenshotNotice &notice)
+{
+    if (!m_noticeQueue.canWrite(1))
+    {
+        std::cout << "Screenshot notice queue full, dropping notice for " << notice.path << std::endl;
+        return;
+    }
+
+    // Assigning keeps the capacity of the slot's path string
+    ScreenshotNotice &slot = m_noticeQueue.writeSlot(0);
+    slot.sequence = notice.sequence;
+    slot.written = notice.written;
+    slot.bytes = notice.bytes;
+    slot.encodeUs = notice.encodeUs;
+    slot.path.assign(notice.path);
+    m_noticeQueue.commitWrite(1);
+    wakeWriter();
+}
+
+void NetworkClient::sendCompareNotice(const CompareNotice &notice)
+{
+    if (!m_compareQueue.canWrite(1))
+    {
+        std::cout << "Compare notice queue full, dropping notice for " << notice.reference << std::endl;
+        return;
+    }
+
+    CompareNotice &slot = m_compareQueue.writeSlot(0);
+    slot.sequence = notice.sequence;
+    slot.outcome = notice.outcome;
+    slot.differingPixels = notice.differingPixels;
+    slot.comparedPixels = notice.comparedPixels;
+    slot.maxDelta = notice.maxDelta;
+    slot.compareUs = notice.compareUs;
+    slot.reference.assign(notice.reference);
+    m_compareQueue.commitWrite(1);
+    wakeWriter();
+}
+
+void NetworkClient::wakeWriter()
+{
+    if (m_useSharedMemory)
+    {
+        m_sharedMemory.wake();
+        return;
+    }
+
+    // One wakeup covers everything queued until the network thread runs it
+    if (!m_flushPosted.exchange(true))
+        boost::asio::post(m_ioContext, [this]() {
+            m_flushPosted = false;
+            flushWrites();
+        });
 }
 
-std::vector<std::string> NetworkClient::split(const std::string &str, const std::string &delimiter)
+void NetworkClient::flushWrites()
 {
-    std::vector<std::string> result;
-    size_t start = 0;
-    size_t end = str.find(delimiter);
+    size_t count = m_acknowledgementQueue.readable();
+    for (size_t i = 0; i < count; ++i)
+        appendAcknowledgement(m_sendText, m_acknowledgementQueue.readSlot(i));
+    m_acknowledgementQueue.commitRead(count);
+    count = m_noticeQueue.readable();
+    for (size_t i = 0; i < count; ++i)
+        appendScreenshotNotice(m_sendText, m_noticeQueue.readSlot(i));
+    m_noticeQueue.commitRead(count);
+    count = m_compareQueue.readable();
+    for (size_t i = 0; i < count; ++i)
+        appendCompareNotice(m_sendText, m_compareQueue.readSlot(i));
+    m_compareQueue.commitRead(count);
+
+    if (m_writeInFlight || m_sendText.empty() || !m_isConnected)
+        return;
+
+    if (m_useSharedMemory)
+    {
+        // Whatever does not fit into the ring is retried on the next pass
+        size_t written = m_sharedMemory.write(m_sendText.data(), m_sendText.size());
+        m_sendText.erase(0, written);
+        return;
+    }
 
-    while (end != std::string::npos)
+    // Everything gathered while the previous write was in flight goes out as one write
+    m_sendingText.swap(m_sendText);
+    m_sendText.clear();
+    m_writeInFlight = true;
+    boost::asio::async_write(m_socket, boost::asio::buffer(m_sendingText),
+                             [this](const boost::system::error_code &error, size_t) {
+                                 m_writeInFlight = false;
+                                 if (error)
+                                 {
+                                     if (error != boost::asio::error::operation_aborted)
+                                         std::cout << "Send failed: " << error.message() << std::endl;
+                                     return;
+                                 }
+                                 flushWrites();
+                             });
+}
+
+bool NetworkClient::resolveInterned(Command &command, const char *ignoring)
+{
+    switch (m_dictionary.resolve(command))
     {
-        result.push_back(str.substr(start, end - start));
-        start = end + delimiter.length();
-        end = str.find(delimiter, start);
+    case PropertyDictionary::ResolveResult::Resolved:
+        return true;
+    case PropertyDictionary::ResolveResult::UnknownId:
+        std::cout << ignoring << " with unknown property id " << command.propertyId << std::endl;
+        break;
+    case PropertyDictionary::ResolveResult::TypeMismatch:
+        std::cout << ignoring << " with a " << propertyTypeName(command.typedValue.type) << " value for property id "
+                  << command.propertyId << " of another type" << std::endl;
+        break;
     }
+    return false;
+}
 
-    result.push_back(str.substr(start));
-    return result;
+bool NetworkClient::resolveInterned(std::vector<Command> &commands)
+{
+    // A BATCH is applied as one unit, so a record whose ID the dictionary does
+    // not know or whose value has another type than the ID was defined with
+    // rejects all of them
+    for (Command &command : commands)
+    {
+        if (!resolveInterned(command, "Rejecting batch record"))
+            return false;
+    }
+    return true;
 }
 
 NetworkClient::~NetworkClient()
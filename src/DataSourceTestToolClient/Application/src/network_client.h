@@ -1,27 +1,141 @@
 #pragma once
 #include <iostream>
 #include <string>
-#include <vector>
+#include <string_view>
 #include <thread>
 #include <atomic>
+#include <chrono>
+#include <vector>
+#include <functional>
 #include <boost/asio.hpp>
+#include "message_framer.h"
+#include "command_tokenizer.h"
+#include "binary_protocol.h"
+#include "property_dictionary.h"
+#include "signal_stream.h"
+#include "spsc_queue.h"
+#include "pipeline_metrics.h"
+#include "shared_memory_channel.h"
 
 // Simple networking client
+// All socket work is asynchronous on m_ioContext. By default a background
+// thread runs the context; a host with its own event loop can instead call
+// connectToServer(false) and drive the client with poll().
+// The socket is protocol independent: connectUnixSocket() reaches a server on
+// the same host through an AF_UNIX stream socket with the same stream
+// semantics and no TCP processing.
+// connectSharedMemory() replaces the socket with a shared memory channel
+// created by a server on the same host; the bytes and everything above the
+// framer are the same, only the thread loop reads the channel instead of
+// running the context.
 class NetworkClient
 {
 public:
+    // Receives parsed commands on the network thread. A BATCH arrives as one
+    // call carrying all of its commands so it can be applied as a unit. The
+    // commands point into the receive buffer and are only valid during the call.
+    // Returning false rejects them, which is acknowledged to the server at once.
+    using CommandHandler = std::function<bool(const Command *commands, size_t count)>;
+    // Receives the decoded samples of each SAMPLE command on the network thread
+    using SampleHandler = std::function<void(uint32_t streamId, const StreamSample *samples, size_t count)>;
+
     static NetworkClient &getInstance();
-    void connectToServer();
+    void connectToServer(bool runOnOwnThread = true);
+    // path is the server's listening socket, e.g. "/tmp/datasource-test.sock"
+    void connectUnixSocket(const std::string &path, bool runOnOwnThread = true);
+    // name is the shm_open() name the server created, e.g. "/datasource-test"
+    void connectSharedMemory(const std::string &name, bool runOnOwnThread = true);
+    // Also dumps the pipeline latency histograms if anything was recorded
     void disconnect();
     bool isConnected() const { return m_isConnected; }
 
+    // Runs ready network handlers without blocking, returns how many ran
+    size_t poll();
+
+    // A zero read timeout keeps an idle connection open indefinitely
+    void setTimeouts(std::chrono::milliseconds connectTimeout, std::chrono::milliseconds readTimeout);
+
+    // Must be set before connecting
+    void setCommandHandler(CommandHandler handler) { m_commandHandler = std::move(handler); }
+    void setSampleHandler(SampleHandler handler) { m_sampleHandler = std::move(handler); }
+    // Announces in the HELLO that the property snapshot of this server session
+    // was restored. Must be set before connecting.
+    void setRestoredSession(std::string_view session) { m_helloMessage = BinaryProtocol::makeClientHello(session); }
+
+    // Queues ACKs for applied commands and wakes the network thread to write
+    // them. Callable from one application thread; never blocks.
+    void sendAcknowledgements(const Acknowledgement *acknowledgements, size_t count);
+    // Same for the SCREENSHOT notice of a finished (or failed) screenshot
+    void sendScreenshotNotice(const ScreenshotNotice &notice);
+    // And for the result of a COMPARE
+    void sendCompareNotice(const CompareNotice &notice);
+
     ~NetworkClient();
 
 private:
-    NetworkClient() : m_isConnected(false) {}
-    void networkProcedure();
-    std::vector<std::string> split(const std::string &str, const std::string &delimiter);
+    NetworkClient();
+    void startRead();
+    void connectEndpoint(const boost::asio::generic::stream_protocol::endpoint &endpoint, bool runOnOwnThread);
+    void onConnect(const boost::system::error_code &error);
+    void startSession();
+    // One pass of the shared memory loop: reads and handles what arrived,
+    // writes what is queued, then waits up to wait for more. Returns false
+    // once the connection is closed.
+    bool pollSharedMemory(std::chrono::microseconds wait, size_t &handled);
+    void onRead(const boost::system::error_code &error, size_t length);
+    void closeConnection();
+    void sendHello();
+    void handleHello(std::string_view reply);
+    void handleMessage(std::string_view message, int64_t receiveTimeUs);
+    // Looks an interned command up in the dictionary; on failure prints why,
+    // starting with ignoring
+    bool resolveInterned(Command &command, const char *ignoring);
+    // Resolves every record of an interned BATCH; false if any fails
+    bool resolveInterned(std::vector<Command> &commands);
+    bool dispatchCommands(const Command *commands, size_t count);
+    void rejectCommand(uint32_t sequence, int64_t receiveTimeUs);
+    void wakeWriter();
+    void flushWrites();
+
+    boost::asio::io_context m_ioContext;
+    // TCP or AF_UNIX, whichever endpoint it was connected to
+    boost::asio::generic::stream_protocol::socket m_socket;
+    boost::asio::steady_timer m_timeoutTimer;
+    SharedMemoryChannel m_sharedMemory;
+    bool m_useSharedMemory;
+    std::atomic<bool> m_stopRequested;
+    int64_t m_lastReceiveUs;
+    std::chrono::milliseconds m_connectTimeout;
+    std::chrono::milliseconds m_readTimeout;
 
     std::atomic<bool> m_isConnected;
+    // Set from async_connect() until it completes or is cancelled, so a
+    // second connect call cannot start another one on the same socket
+    std::atomic<bool> m_connecting;
     std::thread m_networkThread;
+    MessageFramer m_framer;
+    // Set once the server accepts the binary protocol in its HELLO reply
+    bool m_binaryProtocol;
+    std::string m_helloMessage;
+    CommandHandler m_commandHandler;
+    SampleHandler m_sampleHandler;
+    // Reused for every BATCH so parsing does not allocate in the steady state
+    std::vector<Command> m_batchCommands;
+    // ID -> name table for SYNCID/ASYNCID/BATCHID, sent by the server per session
+    PropertyDictionary m_dictionary;
+    // Reused for every SAMPLE command
+    std::vector<StreamSample> m_samples;
+
+    // Sequence of the last message that will be acknowledged, per connection
+    uint32_t m_sequence;
+    // ACKs handed over by the application thread
+    SpscQueue<Acknowledgement> m_acknowledgementQueue;
+    SpscQueue<ScreenshotNotice> m_noticeQueue;
+    SpscQueue<CompareNotice> m_compareQueue;
+    std::atomic<bool> m_flushPosted;
+    // Outgoing text (HELLO, ACKs, SCREENSHOT and COMPARE notices) waiting
+    // for, and being written by, the single async_write in flight
+    std::string m_sendText;
+    std::string m_sendingText;
+    bool m_writeInFlight;
 };
@@ -0,0 +1,143 @@
+#include "pipeline_metrics.h"
+#include <algorithm>
+#include <iomanip>
+
+LatencyHistogram::LatencyHistogram() : m_count(0), m_sum(0), m_max(0)
+{
+    for (std::atomic<uint64_t> &bucket : m_buckets)
+        bucket.store(0, std::memory_order_relaxed);
+}
+
+size_t LatencyHistogram::bucketIndex(uint64_t value)
+{
+    const uint64_t subBucketCount = uint64_t(1) << SUB_BUCKET_BITS;
+    if (value < subBucketCount)
+        return static_cast<size_t>(value);
+
+    if (value >= (uint64_t(1) << MAX_VALUE_BITS))
+        value = (uint64_t(1) << MAX_VALUE_BITS) - 1;
+
+    // exponent is the position of the highest set bit; the next
+    // SUB_BUCKET_BITS bits below it pick the linear sub-bucket
+    int exponent = 63;
+    while (!(value >> exponent))
+        --exponent;
+    int shift = exponent - SUB_BUCKET_BITS;
+    size_t subBucket = static_cast<size_t>((value >> shift) & (subBucketCount - 1));
+    return (static_cast<size_t>(shift + 1) << SUB_BUCKET_BITS) + subBucket;
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(size_t index)
+{
+    const size_t subBucketCount = size_t(1) << SUB_BUCKET_BITS;
+    if (index < subBucketCount)
+        return index;
+
+    int shift = static_cast<int>(index >> SUB_BUCKET_BITS) - 1;
+    uint64_t subBucket = index & (subBucketCount - 1);
+    uint64_t lower = (subBucketCount + subBucket) << shift;
+    return lower + (uint64_t(1) << shift) - 1;
+}
+
+void LatencyHistogram::record(int64_t valueUs)
+{
+    uint64_t value = valueUs > 0 ? static_cast<uint64_t>(valueUs) : 0;
+    m_buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+
+    uint64_t previousMax = m_max.load(std::memory_order_relaxed);
+    while (value > previousMax && !m_max.compare_exchange_weak(previousMax, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+void LatencyHistogram::reset()
+{
+    for (std::atomic<uint64_t> &bucket : m_buckets)
+        bucket.store(0, std::memory_order_relaxed);
+    m_count.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+double LatencyHistogram::mean() const
+{
+    uint64_t samples = count();
+    return samples ? static_cast<double>(m_sum.load(std::memory_order_relaxed)) / samples : 0.0;
+}
+
+uint64_t LatencyHistogram::percentile(double percent) const
+{
+    uint64_t samples = count();
+    if (samples == 0)
+        return 0;
+
+    uint64_t target = static_cast<uint64_t>(percent / 100.0 * samples + 0.5);
+    if (target == 0)
+        target = 1;
+
+    uint64_t seen = 0;
+    for (size_t index = 0; index < BUCKET_COUNT; ++index)
+    {
+        seen += m_buckets[index].load(std::memory_order_relaxed);
+        if (seen >= target)
+            return std::min(bucketUpperBound(index), max());
+    }
+    return max();
+}
+
+PipelineMetrics &PipelineMetrics::getInstance()
+{
+    static PipelineMetrics instance;
+    return instance;
+}
+
+bool PipelineMetrics::empty() const
+{
+    for (const LatencyHistogram &histogram : m_histograms)
+    {
+        if (histogram.count() > 0)
+            return false;
+    }
+    return true;
+}
+
+void PipelineMetrics::reset()
+{
+    for (LatencyHistogram &histogram : m_histograms)
+        histogram.reset();
+}
+
+void PipelineMetrics::dump(std::ostream &stream) const
+{
+    stream << "Pipeline latency (us)      count      mean       p50       p90       p99     p99.9       max"
+           << std::endl;
+    for (size_t i = 0; i < static_cast<size_t>(Stage::Count); ++i)
+    {
+        const LatencyHistogram &histogram = m_histograms[i];
+        stream << "  " << std::left << std::setw(20) << pipelineStageName(static_cast<Stage>(i)) << std::right
+               << std::setw(10) << histogram.count() << std::setw(10)
+               << static_cast<uint64_t>(histogram.mean() + 0.5) << std::setw(10) << histogram.percentile(50.0)
+               << std::setw(10) << histogram.percentile(90.0) << std::setw(10) << histogram.percentile(99.0)
+               << std::setw(10) << histogram.percentile(99.9) << std::setw(10) << histogram.max() << std::endl;
+    }
+}
+
+const char *pipelineStageName(PipelineMetrics::Stage stage)
+{
+    switch (stage)
+    {
+    case PipelineMetrics::Stage::ReceiveToParse:
+        return "receive->parse";
+    case PipelineMetrics::Stage::ParseToApply:
+        return "parse->apply";
+    case PipelineMetrics::Stage::ApplyToPresent:
+        return "apply->present";
+    case PipelineMetrics::Stage::ReceiveToPresent:
+        return "receive->present";
+    case PipelineMetrics::Stage::Count:
+        break;
+    }
+    return "unknown";
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <atomic>
+#include <ostream>
+#include <cstddef>
+#include <cstdint>
+
+// Log-linear latency histogram in the style of HdrHistogram: values below 32
+// are exact, above that every power of two is split into 32 buckets, so any
+// reported value is within ~3% of the recorded one. Covers up to 2^40 us.
+//
+// record() is a few relaxed atomic increments and may be called from any
+// number of threads at once; readers see a consistent enough snapshot for
+// reporting.
+class LatencyHistogram
+{
+public:
+    static const int SUB_BUCKET_BITS = 5;
+    static const int MAX_VALUE_BITS = 40;
+    static const size_t BUCKET_COUNT = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS;
+
+    LatencyHistogram();
+
+    void record(int64_t valueUs);
+    void reset();
+
+    uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+    uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+    double mean() const;
+
+    // Upper bound of the bucket holding the given percentile (0-100)
+    uint64_t percentile(double percent) const;
+
+private:
+    static size_t bucketIndex(uint64_t value);
+    static uint64_t bucketUpperBound(size_t index);
+
+    std::atomic<uint64_t> m_buckets[BUCKET_COUNT];
+    std::atomic<uint64_t> m_count;
+    std::atomic<uint64_t> m_sum;
+    std::atomic<uint64_t> m_max;
+};
+
+// Latency of each command through the client, in microseconds:
+//   receive  socket read completed (network thread)
+//   parse    message decoded and handed to the application (network thread)
+//   apply    written to the property store (application thread)
+//   present  first frame presented after the apply (application thread)
+class PipelineMetrics
+{
+public:
+    enum class Stage
+    {
+        ReceiveToParse,
+        ParseToApply,
+        ApplyToPresent,
+        ReceiveToPresent,
+        Count
+    };
+
+    static PipelineMetrics &getInstance();
+
+    void record(Stage stage, int64_t latencyUs) { m_histograms[static_cast<size_t>(stage)].record(latencyUs); }
+    const LatencyHistogram &histogram(Stage stage) const { return m_histograms[static_cast<size_t>(stage)]; }
+    bool empty() const;
+    void reset();
+
+    // Writes one table row per stage with count, mean, percentiles and max
+    void dump(std::ostream &stream) const;
+
+private:
+    PipelineMetrics() = default;
+
+    LatencyHistogram m_histograms[static_cast<size_t>(Stage::Count)];
+};
+
+const char *pipelineStageName(PipelineMetrics::Stage stage);
@@ -0,0 +1,256 @@
+#include "precondition_script.h"
+#include "file_util.h"
+#include <charconv>
+#include <iostream>
+
+namespace
+{
+bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+void skipSpaces(std::string_view text, size_t &pos)
+{
+    while (pos < text.size() && isSpace(text[pos]))
+        ++pos;
+}
+
+// Replaces the five predefined XML entities
+std::string decodeEntities(std::string_view text)
+{
+    std::string result;
+    result.reserve(text.size());
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+        if (text[i] != '&')
+        {
+            result.push_back(text[i]);
+            continue;
+        }
+
+        std::string_view rest = text.substr(i);
+        if (rest.substr(0, 5) == "&amp;")
+            result.push_back('&'), i += 4;
+        else if (rest.substr(0, 4) == "&lt;")
+            result.push_back('<'), i += 3;
+        else if (rest.substr(0, 4) == "&gt;")
+            result.push_back('>'), i += 3;
+        else if (rest.substr(0, 6) == "&quot;")
+            result.push_back('"'), i += 5;
+        else if (rest.substr(0, 6) == "&apos;")
+            result.push_back('\''), i += 5;
+        else
+            result.push_back('&');
+    }
+    return result;
+}
+
+// Parses name="value" pairs up to the end of the tag
+bool parseAttributes(std::string_view tag, std::vector<std::pair<std::string_view, std::string>> &attributes)
+{
+    attributes.clear();
+    size_t pos = 0;
+    for (;;)
+    {
+        skipSpaces(tag, pos);
+        if (pos >= tag.size())
+            return true;
+
+        size_t nameStart = pos;
+        while (pos < tag.size() && !isSpace(tag[pos]) && tag[pos] != '=')
+            ++pos;
+        std::string_view name = tag.substr(nameStart, pos - nameStart);
+
+        // The scripts contain both filename="x" and filename= "x"
+        skipSpaces(tag, pos);
+        if (pos >= tag.size() || tag[pos] != '=')
+            return false;
+        ++pos;
+        skipSpaces(tag, pos);
+        if (pos >= tag.size() || (tag[pos] != '"' && tag[pos] != '\''))
+            return false;
+
+        char quote = tag[pos++];
+        size_t valueEnd = tag.find(quote, pos);
+        if (valueEnd == std::string_view::npos)
+            return false;
+        attributes.emplace_back(name, decodeEntities(tag.substr(pos, valueEnd - pos)));
+        pos = valueEnd + 1;
+    }
+}
+
+const std::string *findAttribute(const std::vector<std::pair<std::string_view, std::string>> &attributes,
+                                 std::string_view name)
+{
+    for (const std::pair<std::string_view, std::string> &attribute : attributes)
+    {
+        if (attribute.first == name)
+            return &attribute.second;
+    }
+    return nullptr;
+}
+}
+
+bool loadPreconditionScript(const std::string &path, std::vector<PreconditionStep> &steps)
+{
+    std::string text;
+    if (!readFile(path, text))
+        return false;
+    if (!parsePreconditionScript(text, steps))
+    {
+        std::cout << "Malformed precondition script " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool parsePreconditionScript(std::string_view text, std::vector<PreconditionStep> &steps)
+{
+    steps.clear();
+    std::vector<std::pair<std::string_view, std::string>> attributes;
+
+    size_t pos = 0;
+    while ((pos = text.find('<', pos)) != std::string_view::npos)
+    {
+        if (text.substr(pos, 4) == "<!--")
+        {
+            size_t end = text.find("-->", pos + 4);
+            if (end == std::string_view::npos)
+                return false;
+            pos = end + 3;
+            continue;
+        }
+
+        size_t end = text.find('>', pos);
+        if (end == std::string_view::npos)
+            return false;
+        std::string_view tag = text.substr(pos + 1, end - pos - 1);
+        pos = end + 1;
+
+        // Closing tags and declarations carry no step
+        if (tag.empty() || tag[0] == '/' || tag[0] == '?' || tag[0] == '!')
+            continue;
+        if (tag.back() == '/')
+            tag.remove_suffix(1);
+
+        size_t nameEnd = 0;
+        while (nameEnd < tag.size() && !isSpace(tag[nameEnd]))
+            ++nameEnd;
+        std::string_view element = tag.substr(0, nameEnd);
+        if (!parseAttributes(tag.substr(nameEnd), attributes))
+            return false;
+
+        // The root (<script>, <Commands>, ...) is the only attribute-less
+        // element besides <exit />
+        if (attributes.empty() && element != "exit")
+            continue;
+
+        PreconditionStep step;
+        if (element == "wait")
+        {
+            // A typo must not turn into a different wait
+            const std::string *delay = findAttribute(attributes, "delay");
+            step.kind = PreconditionStep::Kind::Wait;
+            bool validDelay = false;
+            if (delay)
+            {
+                const char *delayEnd = delay->data() + delay->size();
+                std::from_chars_result parsed = std::from_chars(delay->data(), delayEnd, step.delayMs);
+                validDelay = parsed.ec == std::errc() && parsed.ptr == delayEnd;
+            }
+            if (!validDelay)
+            {
+                std::cout << "Step " << steps.size() + 1 << " <wait> needs a delay in whole milliseconds, not \""
+                          << (delay ? *delay : std::string()) << "\"" << std::endl;
+                return false;
+            }
+        }
+        else if (element == "screenshot")
+        {
+            const std::string *name = findAttribute(attributes, "name");
+            step.kind = PreconditionStep::Kind::Screenshot;
+            if (name)
+                step.value = *name;
+        }
+        else if (element == "exit")
+        {
+            step.kind = PreconditionStep::Kind::Exit;
+        }
+        else
+        {
+            const std::string *file = findAttribute(attributes, "filename");
+            const std::string *type = findAttribute(attributes, "type");
+            const std::string *value = findAttribute(attributes, "value");
+            if (!file || !type || !value)
+                return false;
+            step.name = element;
+            step.file = *file;
+            step.type = *type;
+            step.value = *value;
+        }
+        steps.push_back(std::move(step));
+    }
+    return true;
+}
+
+bool loadMessageHistory(const std::string &settingsPath, std::vector<MessageHistoryEntry> &entries)
+{
+    entries.clear();
+    std::string text;
+    if (!readFile(settingsPath, text))
+        return false;
+
+    // Only the flat "MessageHistory": { "key": count, ... } object is needed,
+    // so a full JSON parser is not worth pulling in
+    size_t pos = text.find("\"MessageHistory\"");
+    if (pos == std::string::npos)
+        return true;
+    pos = text.find('{', pos);
+    size_t end = pos == std::string::npos ? pos : text.find('}', pos);
+    if (end == std::string::npos)
+        return false;
+
+    std::string_view body = std::string_view(text).substr(pos + 1, end - pos - 1);
+    size_t cursor = 0;
+    while ((cursor = body.find('"', cursor)) != std::string_view::npos)
+    {
+        size_t keyEnd = body.find('"', cursor + 1);
+        size_t colon = keyEnd == std::string_view::npos ? keyEnd : body.find(':', keyEnd);
+        if (colon == std::string_view::npos)
+            return false;
+        std::string_view key = body.substr(cursor + 1, keyEnd - cursor - 1);
+
+        size_t countStart = colon + 1;
+        skipSpaces(body, countStart);
+        uint32_t count = 0;
+        std::from_chars_result parsed = std::from_chars(body.data() + countStart, body.data() + body.size(), count);
+        cursor = parsed.ptr - body.data();
+
+        // "Name=Value (File)"
+        size_t equals = key.find('=');
+        size_t open = key.rfind(" (");
+        if (equals == std::string_view::npos || open == std::string_view::npos || open < equals ||
+            key.back() != ')' || open + 3 > key.size())
+            continue;
+
+        MessageHistoryEntry entry;
+        entry.name = std::string(key.substr(0, equals));
+        entry.value = std::string(key.substr(equals + 1, open - equals - 1));
+        entry.file = std::string(key.substr(open + 2, key.size() - open - 3));
+        entry.count = count;
+        if (!entry.name.empty() && !entry.file.empty())
+            entries.push_back(std::move(entry));
+    }
+    return true;
+}
+
+std::string formatPropertyCommand(std::string_view kind, std::string_view file, std::string_view type,
+                                  std::string_view name, std::string_view value)
+{
+    std::string command;
+    command.reserve(kind.size() + file.size() + type.size() + name.size() + value.size() + 8);
+    command.append(kind).append("::").append(file).append("::").append(type).append("::").append(name).append(
+        "::").append(value);
+    return command;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+// One element of a PreCondition/*.xml script, as played back by the server:
+//   <Gauge.Rpm filename="Gauge" type="float" value="5400" />
+//   <wait delay="1000" />
+//   <screenshot name="MTS_1" />
+//   <exit />
+struct PreconditionStep
+{
+    enum class Kind
+    {
+        Property,
+        Wait,
+        Screenshot,
+        Exit
+    };
+
+    Kind kind = Kind::Property;
+    std::string file;
+    std::string type;
+    std::string name;
+    // Property value, or the screenshot name
+    std::string value;
+    uint32_t delayMs = 0;
+};
+
+// Reads a precondition script. Comments are skipped and the name of the root
+// element is not checked. Returns false (and prints why) if the file cannot be read or an
+// element is malformed.
+bool loadPreconditionScript(const std::string &path, std::vector<PreconditionStep> &steps);
+bool parsePreconditionScript(std::string_view text, std::vector<PreconditionStep> &steps);
+
+// One entry of the server's MessageHistory in app_settings.json:
+//   "ADAS.CACCVisible=2 (ADAS)": 3
+struct MessageHistoryEntry
+{
+    std::string file;
+    std::string name;
+    std::string value;
+    uint32_t count = 0;
+};
+
+// Reads the MessageHistory object of app_settings.json. Entries that are not
+// property assignments (e.g. "wait= ()") are skipped.
+bool loadMessageHistory(const std::string &settingsPath, std::vector<MessageHistoryEntry> &entries);
+
+// Formats a property step as the text command the server sends
+std::string formatPropertyCommand(std::string_view kind, std::string_view file, std::string_view type,
+                                  std::string_view name, std::string_view value);
@@ -0,0 +1,77 @@
+#include "property_dictionary.h"
+#include <cstring>
+
+void PropertyDictionary::clear()
+{
+    m_entries.clear();
+    m_names.clear();
+    m_definedCount = 0;
+}
+
+bool PropertyDictionary::define(uint32_t id, std::string_view file, PropertyType type, std::string_view name)
+{
+    if (id >= MAX_ENTRIES || file.size() > UINT16_MAX || name.size() > UINT16_MAX)
+        return false;
+
+    if (id >= m_entries.size())
+        m_entries.resize(id + 1);
+
+    Entry &entry = m_entries[id];
+    if (!entry.defined)
+        ++m_definedCount;
+
+    // Replaced names are left in the arena; tables are small and reloaded per session
+    entry.fileOffset = static_cast<uint32_t>(m_names.size());
+    entry.fileLength = static_cast<uint16_t>(file.size());
+    m_names.append(file.data(), file.size());
+    entry.nameOffset = static_cast<uint32_t>(m_names.size());
+    entry.nameLength = static_cast<uint16_t>(name.size());
+    m_names.append(name.data(), name.size());
+    entry.type = type;
+    entry.defined = true;
+    return true;
+}
+
+TokenizeError PropertyDictionary::loadText(std::string_view records)
+{
+    std::string_view countField;
+    uint32_t count = 0;
+    if (!takeField(records, countField) || !parseDecimal(countField, count))
+        return TokenizeError::InvalidCount;
+
+    uint32_t loaded = 0;
+    while (!records.empty())
+    {
+        const void *found = std::memchr(records.data(), BATCH_RECORD_SEPARATOR, records.size());
+        size_t recordLength = found ? static_cast<const char *>(found) - records.data() : records.size();
+        std::string_view record = records.substr(0, recordLength);
+        records.remove_prefix(found ? recordLength + 1 : recordLength);
+
+        std::string_view idField, file, typeName;
+        uint32_t id = 0;
+        PropertyType type;
+        if (!takeField(record, idField) || !takeField(record, file) || !takeField(record, typeName))
+            return TokenizeError::MissingField;
+        if (!parseDecimal(idField, id) || !parsePropertyType(typeName, type) || !define(id, file, type, record))
+            return TokenizeError::InvalidValue;
+
+        ++loaded;
+    }
+
+    return loaded == count ? TokenizeError::None : TokenizeError::InvalidCount;
+}
+
+PropertyDictionary::ResolveResult PropertyDictionary::resolve(Command &command) const
+{
+    if (!contains(command.propertyId))
+        return ResolveResult::UnknownId;
+
+    const Entry &entry = m_entries[command.propertyId];
+    if (command.hasTypedValue && command.typedValue.type != entry.type)
+        return ResolveResult::TypeMismatch;
+
+    command.file = std::string_view(m_names.data() + entry.fileOffset, entry.fileLength);
+    command.name = std::string_view(m_names.data() + entry.nameOffset, entry.nameLength);
+    command.type = propertyTypeName(entry.type);
+    return ResolveResult::Resolved;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include "command_tokenizer.h"
+#include "property_value.h"
+
+// Maps small integer IDs to property names for the interned commands
+// (SYNCID/ASYNCID/BATCHID). The server sends the table with DICT commands at
+// session start; afterwards a command only carries the ID, and resolving it is
+// an array index instead of hashing and comparing names.
+//
+// Entries live in one contiguous array indexed by ID, and all names share a
+// single character arena.
+class PropertyDictionary
+{
+public:
+    static const uint32_t MAX_ENTRIES = 65536;
+
+    void clear();
+
+    // Adds or replaces one entry
+    bool define(uint32_t id, std::string_view file, PropertyType type, std::string_view name);
+
+    // Loads the records of a text DICT command: id::file::type::name<RS>...
+    TokenizeError loadText(std::string_view records);
+
+    enum class ResolveResult
+    {
+        Resolved,
+        UnknownId,
+        // A binary record's type tag differs from the type the ID was defined with
+        TypeMismatch
+    };
+
+    // Fills file, type and name of an interned command. The views stay valid
+    // until the dictionary is next modified.
+    ResolveResult resolve(Command &command) const;
+
+    bool contains(uint32_t id) const { return id < m_entries.size() && m_entries[id].defined; }
+    size_t size() const { return m_definedCount; }
+
+private:
+    struct Entry
+    {
+        uint32_t fileOffset = 0;
+        uint32_t nameOffset = 0;
+        uint16_t fileLength = 0;
+        uint16_t nameLength = 0;
+        PropertyType type = PropertyType::Int;
+        bool defined = false;
+    };
+
+    std::vector<Entry> m_entries;
+    std::string m_names;
+    size_t m_definedCount = 0;
+};
@@ -0,0 +1,394 @@
+#include "property_snapshot.h"
+#include "property_store.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using SnapshotFormat::Entry;
+using SnapshotFormat::Header;
+
+namespace
+{
+// Smallest layout written; a typical session fits without ever growing
+const size_t MIN_ENTRIES = 1024;
+const size_t MIN_STRING_BYTES = 64 * 1024;
+}
+
+uint64_t SnapshotFormat::identityHash(std::string_view identity)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : identity)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+PropertySnapshot::PropertySnapshot()
+    : m_identity(0),
+      m_data(nullptr),
+      m_size(0)
+{
+}
+
+PropertySnapshot::~PropertySnapshot()
+{
+    close();
+}
+
+bool PropertySnapshot::open(const std::string &path, std::string_view identity)
+{
+    close();
+    m_path = path;
+    m_identity = SnapshotFormat::identityHash(identity);
+
+    std::error_code error;
+    std::filesystem::path parent = std::filesystem::path(path).parent_path();
+    if (!parent.empty())
+        std::filesystem::create_directories(parent, error);
+
+    if (map(0, false) && validate())
+        return true;
+
+    // Missing, from another version or session, or cut short: start over empty
+    PropertyStore empty(0);
+    if (!rebuild(empty))
+    {
+        std::cout << "Cannot create property snapshot " << path << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void PropertySnapshot::close()
+{
+    unmap();
+    m_path.clear();
+}
+
+void PropertySnapshot::discard()
+{
+    std::string path = m_path;
+    close();
+    if (path.empty())
+        return;
+
+    std::error_code error;
+    std::filesystem::remove(path, error);
+}
+
+size_t PropertySnapshot::size() const
+{
+    return isOpen() ? header().entryCount : 0;
+}
+
+bool PropertySnapshot::map(size_t size, bool create)
+{
+    unmap();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileW(std::filesystem::path(m_path).c_str(), GENERIC_READ | GENERIC_WRITE,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                              create ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    bool sized = create || (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart >= LONGLONG(sizeof(Header)));
+    if (!create && sized)
+        size = static_cast<size_t>(fileSize.QuadPart);
+    // Mapping a created file extends it to size, zero filled
+    uint64_t mappingSize = size;
+    HANDLE mapping = sized ? CreateFileMappingW(file, nullptr, PAGE_READWRITE, DWORD(mappingSize >> 32),
+                                                DWORD(mappingSize), nullptr)
+                           : nullptr;
+    CloseHandle(file);
+    // The view keeps the mapping object alive
+    void *view = mapping ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size) : nullptr;
+    if (mapping)
+        CloseHandle(mapping);
+    if (!view)
+        return false;
+
+    m_data = static_cast<char *>(view);
+    m_size = size;
+    return true;
+#else
+    int fd = ::open(m_path.c_str(), create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0644);
+    if (fd < 0)
+        return false;
+
+    struct stat status;
+    bool sized = create ? ftruncate(fd, static_cast<off_t>(size)) == 0
+                        : fstat(fd, &status) == 0 && status.st_size >= static_cast<off_t>(sizeof(Header));
+    if (!create && sized)
+        size = static_cast<size_t>(status.st_size);
+    void *mapping = sized ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    m_data = static_cast<char *>(mapping);
+    m_size = size;
+    return true;
+#endif
+}
+
+void PropertySnapshot::unmap()
+{
+#ifdef _WIN32
+    if (m_data)
+        UnmapViewOfFile(m_data);
+#else
+    if (m_data)
+        munmap(m_data, m_size);
+#endif
+    m_data = nullptr;
+    m_size = 0;
+}
+
+bool PropertySnapshot::validate() const
+{
+    // Checked once here so restore() can trust every offset
+    const Header &head = header();
+    if (std::memcmp(head.magic, SnapshotFormat::MAGIC, sizeof(head.magic)) != 0 ||
+        head.version != SnapshotFormat::VERSION || head.identity != m_identity ||
+        head.entryCount > head.entryCapacity || head.stringUsed > head.stringCapacity ||
+        m_size != sizeof(Header) + uint64_t(head.entryCapacity) * sizeof(Entry) + head.stringCapacity)
+        return false;
+
+    for (uint32_t i = 0; i < head.entryCount; ++i)
+    {
+        const Entry &entry = entries()[i];
+        if (uint64_t(entry.keyOffset) + entry.moduleLength + entry.nameLength > head.stringUsed ||
+            entry.type < static_cast<uint8_t>(PropertyType::Int) ||
+            entry.type > static_cast<uint8_t>(PropertyType::String))
+            return false;
+        if (entry.type == static_cast<uint8_t>(PropertyType::String) &&
+            (entry.length > entry.capacity || uint64_t(entry.value) + entry.capacity > head.stringUsed))
+            return false;
+    }
+    return true;
+}
+
+size_t PropertySnapshot::restore(PropertyStore &store)
+{
+    if (!isOpen() || store.size() != 0)
+        return 0;
+
+    const char *pool = strings();
+    uint32_t count = header().entryCount;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        const Entry &entry = entries()[i];
+        std::string_view module(pool + entry.keyOffset, entry.moduleLength);
+        std::string_view name(pool + entry.keyOffset + entry.moduleLength, entry.nameLength);
+
+        PropertyValue value;
+        value.type = static_cast<PropertyType>(entry.type);
+        switch (value.type)
+        {
+        case PropertyType::Int:
+            std::memcpy(&value.intValue, &entry.value, sizeof(value.intValue));
+            break;
+        case PropertyType::Float:
+            std::memcpy(&value.floatValue, &entry.value, sizeof(value.floatValue));
+            break;
+        case PropertyType::Bool:
+            value.boolValue = entry.value != 0;
+            break;
+        case PropertyType::String:
+            value.stringValue = std::string_view(pool + entry.value, entry.length);
+            break;
+        }
+        store.set(module, name, value);
+    }
+
+    // Only a damaged file repeats a key; lay it out again so entry i is store index i
+    if (store.size() != count)
+        rebuild(store);
+
+    // Everything restored is in the file already
+    store.clearChanged();
+    return store.size();
+}
+
+bool PropertySnapshot::update(PropertyStore &store)
+{
+    if (!isOpen())
+        return false;
+
+    const std::vector<uint32_t> &changed = store.changed();
+    if (changed.empty())
+        return true;
+
+    uint32_t count = header().entryCount;
+    bool written = store.size() >= count && store.size() <= header().entryCapacity;
+    for (size_t i = 0; written && i < changed.size(); ++i)
+        written = writeEntry(store, changed[i], changed[i] >= count);
+
+    if (written)
+    {
+        // New entries are complete before the count covers them
+        std::atomic_thread_fence(std::memory_order_release);
+        header().entryCount = static_cast<uint32_t>(store.size());
+    }
+    else if (!rebuild(store))
+    {
+        std::cout << "Cannot write property snapshot " << m_path << std::endl;
+        close();
+        store.clearChanged();
+        return false;
+    }
+
+    store.clearChanged();
+    return true;
+}
+
+bool PropertySnapshot::rebuild(const PropertyStore &store)
+{
+    size_t stringBytes = 0;
+    for (uint32_t i = 0; i < store.size(); ++i)
+    {
+        stringBytes += store.module(i).size() + store.name(i).size();
+        if (store.type(i) == PropertyType::String)
+            stringBytes += store.stringValue(i).size();
+    }
+
+    size_t entryCapacity = std::max(MIN_ENTRIES, store.size() * 2);
+    size_t stringCapacity = std::max(MIN_STRING_BYTES, stringBytes * 2);
+    if (entryCapacity > UINT32_MAX / sizeof(Entry) || stringCapacity > UINT32_MAX)
+        return false;
+
+    size_t size = sizeof(Header) + entryCapacity * sizeof(Entry) + stringCapacity;
+    if (!map(size, true))
+        return false;
+
+    Header &head = header();
+    head.version = SnapshotFormat::VERSION;
+    head.entryCount = 0;
+    head.entryCapacity = static_cast<uint32_t>(entryCapacity);
+    head.stringCapacity = static_cast<uint32_t>(stringCapacity);
+    head.stringUsed = 0;
+    head.reserved = 0;
+    head.identity = m_identity;
+
+    // The store owns its strings, so nothing it holds points into the old mapping
+    for (uint32_t i = 0; i < store.size(); ++i)
+    {
+        if (!writeEntry(store, i, true))
+            return false;
+    }
+    head.entryCount = static_cast<uint32_t>(store.size());
+
+    // The magic goes in last: a file cut short by a kill is never mistaken for a snapshot
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(head.magic, SnapshotFormat::MAGIC, sizeof(head.magic));
+    return true;
+}
+
+bool PropertySnapshot::writeEntry(const PropertyStore &store, uint32_t index, bool newKey)
+{
+    Entry &entry = entries()[index];
+    if (newKey)
+    {
+        std::string_view module = store.module(index);
+        std::string_view name = store.name(index);
+        uint32_t offset = 0;
+        if (module.size() > UINT16_MAX || name.size() > UINT16_MAX ||
+            !allocateString(static_cast<uint32_t>(module.size() + name.size()), offset))
+            return false;
+
+        std::memcpy(strings() + offset, module.data(), module.size());
+        std::memcpy(strings() + offset + module.size(), name.data(), name.size());
+        entry = Entry();
+        entry.keyOffset = offset;
+        entry.moduleLength = static_cast<uint16_t>(module.size());
+        entry.nameLength = static_cast<uint16_t>(name.size());
+    }
+
+    PropertyType type = store.type(index);
+    switch (type)
+    {
+    case PropertyType::Int:
+    {
+        int32_t value = store.intValue(index);
+        std::memcpy(&entry.value, &value, sizeof(value));
+        entry.capacity = 0;
+        break;
+    }
+    case PropertyType::Float:
+    {
+        float value = store.floatValue(index);
+        std::memcpy(&entry.value, &value, sizeof(value));
+        entry.capacity = 0;
+        break;
+    }
+    case PropertyType::Bool:
+        entry.value = store.boolValue(index) ? 1 : 0;
+        entry.capacity = 0;
+        break;
+    case PropertyType::String:
+    {
+        std::string_view value = store.stringValue(index);
+        if (value.size() > UINT32_MAX)
+            return false;
+        uint32_t length = static_cast<uint32_t>(value.size());
+        // Rewritten in place while it fits its slot
+        if (entry.type != static_cast<uint8_t>(PropertyType::String) || length > entry.capacity)
+        {
+            uint32_t offset = 0;
+            if (!allocateString(length, offset))
+                return false;
+            entry.value = offset;
+            entry.capacity = length;
+        }
+        std::memcpy(strings() + entry.value, value.data(), length);
+        entry.length = length;
+        break;
+    }
+    }
+    entry.type = static_cast<uint8_t>(type);
+    return true;
+}
+
+bool PropertySnapshot::allocateString(uint32_t length, uint32_t &offset)
+{
+    Header &head = header();
+    if (length > head.stringCapacity - head.stringUsed)
+        return false;
+    offset = head.stringUsed;
+    head.stringUsed += length;
+    return true;
+}
+
+std::string defaultSnapshotPath(std::string_view identity)
+{
+    std::error_code error;
+    std::filesystem::path temporary = std::filesystem::temp_directory_path(error);
+    if (error)
+        return std::string();
+
+    std::ostringstream name;
+    name << "session-" << std::hex << std::setw(16) << std::setfill('0') << SnapshotFormat::identityHash(identity)
+         << ".snapshot";
+    return (temporary / "DataSourceTestTool" / name.str()).string();
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+
+class PropertyStore;
+
+// Copy of the property store kept in a memory-mapped file, so a client that
+// is killed and restarted (e.g. for a kzb swap) gets its whole session back
+// in one pass instead of waiting for the server to replay it.
+//
+// Each file belongs to one identity, the server session and endpoint it was
+// received from. The default path is derived from it and the header records
+// its hash, so a snapshot is never restored into another session.
+//
+//   Header    fixed size, at offset 0
+//   Entry[]   one per store index, entryCapacity slots
+//   char[]    string pool: module and name of each key, string values
+//
+// Entry i mirrors store index i. Each frame only the properties the store
+// reports as changed are rewritten; a string value that outgrows its slot
+// moves to the end of the pool. When entries or pool run out the file is
+// rebuilt from the store at twice the size. Writes go straight into the
+// shared mapping (mmap, or a file mapping view on Windows), so the system
+// writes them back even if the process is killed.
+namespace SnapshotFormat
+{
+const char MAGIC[8] = {'D', 'S', 'S', 'N', 'A', 'P', 'S', 'H'};
+const uint32_t VERSION = 2;
+
+struct Header
+{
+    char magic[8];
+    uint32_t version;
+    // Written last, so entries below it are complete
+    uint32_t entryCount;
+    uint32_t entryCapacity;
+    uint32_t stringCapacity;
+    uint32_t stringUsed;
+    uint32_t reserved;
+    // identityHash() of the session the entries belong to
+    uint64_t identity;
+};
+
+// value is the i32, f32 bits or bool of the property, or the pool offset of a
+// string value of length bytes in a slot of capacity bytes
+struct Entry
+{
+    uint32_t keyOffset;
+    uint16_t moduleLength;
+    uint16_t nameLength;
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t value;
+    uint32_t length;
+    uint32_t capacity;
+};
+
+static_assert(sizeof(Header) == 40, "snapshot header layout");
+static_assert(sizeof(Entry) == 24, "snapshot entry layout");
+
+// 64-bit FNV-1a of a snapshot identity
+uint64_t identityHash(std::string_view identity);
+}
+
+class PropertySnapshot
+{
+public:
+    PropertySnapshot();
+    ~PropertySnapshot();
+    PropertySnapshot(const PropertySnapshot &) = delete;
+    PropertySnapshot &operator=(const PropertySnapshot &) = delete;
+
+    // Maps the snapshot file, creating an empty one if it is missing, invalid
+    // or holds another identity's session
+    bool open(const std::string &path, std::string_view identity);
+    void close();
+    // Closes and deletes the file, once the session it holds has ended
+    void discard();
+    bool isOpen() const { return m_data != nullptr; }
+    size_t size() const;
+
+    // Adds every saved property to store, which must still be empty so the
+    // indices line up. Returns how many properties were restored.
+    size_t restore(PropertyStore &store);
+
+    // Writes the properties changed in store since the last call, then clears
+    // its change list
+    bool update(PropertyStore &store);
+
+private:
+    SnapshotFormat::Header &header() const { return *reinterpret_cast<SnapshotFormat::Header *>(m_data); }
+    SnapshotFormat::Entry *entries() const
+    {
+        return reinterpret_cast<SnapshotFormat::Entry *>(m_data + sizeof(SnapshotFormat::Header));
+    }
+    char *strings() const
+    {
+        return m_data + sizeof(SnapshotFormat::Header) + header().entryCapacity * sizeof(SnapshotFormat::Entry);
+    }
+
+    bool map(size_t size, bool create);
+    void unmap();
+    bool validate() const;
+    // Lays the file out anew with room for twice what store holds, and
+    // writes every property of store into it
+    bool rebuild(const PropertyStore &store);
+    bool writeEntry(const PropertyStore &store, uint32_t index, bool newKey);
+    bool allocateString(uint32_t length, uint32_t &offset);
+
+    std::string m_path;
+    uint64_t m_identity;
+    char *m_data;
+    size_t m_size;
+};
+
+// Default location of identity's snapshot:
+// DataSourceTestTool/session-<identity hash>.snapshot under the temp directory
+std::string defaultSnapshotPath(std::string_view identity);
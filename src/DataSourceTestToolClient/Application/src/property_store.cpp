@@ -0,0 +1,196 @@
+#include "property_store.h"
+#include "command_tokenizer.h"
+#include <algorithm>
+
+namespace
+{
+size_t slotCountFor(size_t properties)
+{
+    // Keep the table at most half full
+    size_t slots = 16;
+    while (slots < properties * 2)
+        slots *= 2;
+    return slots;
+}
+}
+
+PropertyStore::PropertyStore(size_t expectedProperties)
+    : m_slots(slotCountFor(expectedProperties), NOT_FOUND),
+      m_slotMask(static_cast<uint32_t>(m_slots.size() - 1))
+{
+    m_hashes.reserve(expectedProperties);
+    m_types.reserve(expectedProperties);
+    m_ints.reserve(expectedProperties);
+    m_floats.reserve(expectedProperties);
+    m_bools.reserve(expectedProperties);
+    m_strings.reserve(expectedProperties);
+    m_changedFlags.reserve(expectedProperties);
+    m_changed.reserve(expectedProperties);
+    m_modules.reserve(expectedProperties);
+    m_names.reserve(expectedProperties);
+}
+
+void PropertyStore::clear()
+{
+    std::fill(m_slots.begin(), m_slots.end(), NOT_FOUND);
+    m_hashes.clear();
+    m_types.clear();
+    m_ints.clear();
+    m_floats.clear();
+    m_bools.clear();
+    m_strings.clear();
+    m_changedFlags.clear();
+    m_changed.clear();
+    m_modules.clear();
+    m_names.clear();
+}
+
+uint32_t PropertyStore::hashKey(std::string_view module, std::string_view name)
+{
+    // FNV-1a over module, a separator and name
+    uint32_t hash = 2166136261u;
+    for (char c : module)
+        hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+    hash = (hash ^ 0xffu) * 16777619u;
+    for (char c : name)
+        hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+    return hash;
+}
+
+uint32_t PropertyStore::findSlot(uint32_t hash, std::string_view module, std::string_view name) const
+{
+    // Returns the slot holding the key, or the empty slot where it belongs
+    uint32_t slot = hash & m_slotMask;
+    for (;;)
+    {
+        uint32_t index = m_slots[slot];
+        if (index == NOT_FOUND)
+            return slot;
+        if (m_hashes[index] == hash && m_names[index] == name && m_modules[index] == module)
+            return slot;
+        slot = (slot + 1) & m_slotMask;
+    }
+}
+
+void PropertyStore::growIndex()
+{
+    m_slots.assign(m_slots.size() * 2, NOT_FOUND);
+    m_slotMask = static_cast<uint32_t>(m_slots.size() - 1);
+
+    for (uint32_t index = 0; index < m_hashes.size(); ++index)
+    {
+        uint32_t slot = m_hashes[index] & m_slotMask;
+        while (m_slots[slot] != NOT_FOUND)
+            slot = (slot + 1) & m_slotMask;
+        m_slots[slot] = index;
+    }
+}
+
+uint32_t PropertyStore::find(std::string_view module, std::string_view name) const
+{
+    return m_slots[findSlot(hashKey(module, name), module, name)];
+}
+
+uint32_t PropertyStore::findOrInsert(std::string_view module, std::string_view name, PropertyType type)
+{
+    uint32_t hash = hashKey(module, name);
+    uint32_t slot = findSlot(hash, module, name);
+    uint32_t index = m_slots[slot];
+    if (index != NOT_FOUND)
+    {
+        if (m_types[index] != type)
+        {
+            markChanged(index);
+            m_types[index] = type;
+        }
+        return index;
+    }
+
+    index = static_cast<uint32_t>(m_types.size());
+    m_slots[slot] = index;
+    m_hashes.push_back(hash);
+    m_types.push_back(type);
+    m_ints.push_back(0);
+    m_floats.push_back(0.0f);
+    m_bools.push_back(0);
+    m_strings.emplace_back();
+    m_changedFlags.push_back(1);
+    m_changed.push_back(index);
+    m_modules.emplace_back(module);
+    m_names.emplace_back(name);
+
+    if (m_types.size() * 2 > m_slots.size())
+        growIndex();
+    return index;
+}
+
+uint32_t PropertyStore::set(std::string_view module, std::string_view name, const PropertyValue &value)
+{
+    uint32_t index = findOrInsert(module, name, value.type);
+    set(index, value);
+    return index;
+}
+
+void PropertyStore::set(uint32_t index, const PropertyValue &value)
+{
+    markChanged(index);
+    m_types[index] = value.type;
+    switch (value.type)
+    {
+    case PropertyType::Int:
+        m_ints[index] = value.intValue;
+        break;
+    case PropertyType::Float:
+        m_floats[index] = value.floatValue;
+        break;
+    case PropertyType::Bool:
+        m_bools[index] = value.boolValue ? 1 : 0;
+        break;
+    case PropertyType::String:
+        // assign() reuses the existing capacity
+        m_strings[index].assign(value.stringValue.data(), value.stringValue.size());
+        break;
+    }
+}
+
+void PropertyStore::clearChanged()
+{
+    for (uint32_t index : m_changed)
+        m_changedFlags[index] = 0;
+    m_changed.clear();
+}
+
+bool PropertyStore::apply(const Command &command)
+{
+    if (command.kind != CommandKind::Sync && command.kind != CommandKind::Async)
+        return false;
+
+    PropertyValue value;
+    if (!resolvePropertyValue(command, value))
+        return false;
+
+    set(command.file, command.name, value);
+    return true;
+}
+
+PropertyValue PropertyStore::value(uint32_t index) const
+{
+    PropertyValue value;
+    value.type = m_types[index];
+    switch (value.type)
+    {
+    case PropertyType::Int:
+        value.intValue = m_ints[index];
+        break;
+    case PropertyType::Float:
+        value.floatValue = m_floats[index];
+        break;
+    case PropertyType::Bool:
+        value.boolValue = m_bools[index] != 0;
+        break;
+    case PropertyType::String:
+        value.stringValue = m_strings[index];
+        break;
+    }
+    return value;
+}
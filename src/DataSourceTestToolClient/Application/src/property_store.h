@@ -0,0 +1,91 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include "property_value.h"
+
+struct Command;
+
+// Typed data source state, keyed by module ("Common", "Gauge", "ADAS", ...)
+// and property name.
+//
+// Properties are stored as structure-of-arrays columns indexed by a dense
+// property index (0..size()-1, in insertion order). A power-of-two open
+// addressing table with linear probing maps the key hash to that index, so a
+// lookup touches one small index array plus the hash column before comparing
+// any strings. Iterating a type means walking one contiguous column.
+class PropertyStore
+{
+public:
+    static constexpr uint32_t NOT_FOUND = 0xffffffffu;
+
+    explicit PropertyStore(size_t expectedProperties = 4096);
+
+    void clear();
+
+    // Returns the index of a property, or NOT_FOUND
+    uint32_t find(std::string_view module, std::string_view name) const;
+
+    // Returns the index of a property, adding it with a default value if needed.
+    // An existing property keeps its index but takes on the new type.
+    uint32_t findOrInsert(std::string_view module, std::string_view name, PropertyType type);
+
+    // Stores a value, adding the property if needed. Returns its index.
+    uint32_t set(std::string_view module, std::string_view name, const PropertyValue &value);
+    void set(uint32_t index, const PropertyValue &value);
+
+    // Applies a SYNC/ASYNC command. Returns false for other commands or an
+    // invalid value.
+    bool apply(const Command &command);
+
+    size_t size() const { return m_types.size(); }
+
+    // Indices added or set since the last clearChanged(), each listed once,
+    // for mirroring the store elsewhere (see PropertySnapshot)
+    const std::vector<uint32_t> &changed() const { return m_changed; }
+    void clearChanged();
+
+    // Accessors by index. value() views the stored string for string
+    // properties; the view stays valid until that property is next set.
+    std::string_view module(uint32_t index) const { return m_modules[index]; }
+    std::string_view name(uint32_t index) const { return m_names[index]; }
+    PropertyType type(uint32_t index) const { return m_types[index]; }
+    int32_t intValue(uint32_t index) const { return m_ints[index]; }
+    float floatValue(uint32_t index) const { return m_floats[index]; }
+    bool boolValue(uint32_t index) const { return m_bools[index] != 0; }
+    std::string_view stringValue(uint32_t index) const { return m_strings[index]; }
+    PropertyValue value(uint32_t index) const;
+
+private:
+    static uint32_t hashKey(std::string_view module, std::string_view name);
+    uint32_t findSlot(uint32_t hash, std::string_view module, std::string_view name) const;
+    void growIndex();
+    void markChanged(uint32_t index)
+    {
+        if (!m_changedFlags[index])
+        {
+            m_changedFlags[index] = 1;
+            m_changed.push_back(index);
+        }
+    }
+
+    // Open addressing table: property index per slot, NOT_FOUND when empty
+    std::vector<uint32_t> m_slots;
+    uint32_t m_slotMask;
+
+    // Hot columns
+    std::vector<uint32_t> m_hashes;
+    std::vector<PropertyType> m_types;
+    std::vector<int32_t> m_ints;
+    std::vector<float> m_floats;
+    std::vector<uint8_t> m_bools;
+    std::vector<std::string> m_strings;
+    // 1 while the index is in m_changed
+    std::vector<uint8_t> m_changedFlags;
+    std::vector<uint32_t> m_changed;
+
+    // Keys, only read to confirm a hash match
+    std::vector<std::string> m_modules;
+    std::vector<std::string> m_names;
+};
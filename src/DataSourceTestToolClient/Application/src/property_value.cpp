@@ -0,0 +1,81 @@
+#include "property_value.h"
+#include <charconv>
+
+bool parsePropertyType(std::string_view name, PropertyType &type)
+{
+    if (name == "int")
+        type = PropertyType::Int;
+    else if (name == "float")
+        type = PropertyType::Float;
+    else if (name == "bool")
+        type = PropertyType::Bool;
+    else if (name == "string")
+        type = PropertyType::String;
+    else
+        return false;
+    return true;
+}
+
+const char *propertyTypeName(PropertyType type)
+{
+    switch (type)
+    {
+    case PropertyType::Int:
+        return "int";
+    case PropertyType::Float:
+        return "float";
+    case PropertyType::Bool:
+        return "bool";
+    case PropertyType::String:
+        return "string";
+    }
+    return "unknown";
+}
+
+bool parsePropertyValue(PropertyType type, std::string_view text, PropertyValue &value)
+{
+    value.type = type;
+    const char *end = text.data() + text.size();
+
+    switch (type)
+    {
+    case PropertyType::Int:
+    {
+        std::from_chars_result result = std::from_chars(text.data(), end, value.intValue);
+        return result.ec == std::errc() && result.ptr == end;
+    }
+    case PropertyType::Float:
+    {
+        std::from_chars_result result = std::from_chars(text.data(), end, value.floatValue);
+        return result.ec == std::errc() && result.ptr == end;
+    }
+    case PropertyType::Bool:
+        if (text == "true" || text == "True" || text == "1")
+            value.boolValue = true;
+        else if (text == "false" || text == "False" || text == "0")
+            value.boolValue = false;
+        else
+            return false;
+        return true;
+    case PropertyType::String:
+        value.stringValue = text;
+        return true;
+    }
+    return false;
+}
+
+std::ostream &operator<<(std::ostream &stream, const PropertyValue &value)
+{
+    switch (value.type)
+    {
+    case PropertyType::Int:
+        return stream << value.intValue;
+    case PropertyType::Float:
+        return stream << value.floatValue;
+    case PropertyType::Bool:
+        return stream << (value.boolValue ? "true" : "false");
+    case PropertyType::String:
+        return stream << value.stringValue;
+    }
+    return stream;
+}
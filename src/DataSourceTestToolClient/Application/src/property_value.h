@@ -0,0 +1,37 @@
+#pragma once
+#include <string_view>
+#include <ostream>
+#include <cstdint>
+
+// Data source property types, matching the "type" attribute of the interface XML
+enum class PropertyType : uint8_t
+{
+    Int = 1,
+    Float = 2,
+    Bool = 3,
+    String = 4
+};
+
+// A typed property value. stringValue views memory owned elsewhere.
+struct PropertyValue
+{
+    PropertyType type = PropertyType::Int;
+    union
+    {
+        int32_t intValue;
+        float floatValue;
+        bool boolValue;
+    };
+    std::string_view stringValue;
+
+    PropertyValue() : intValue(0) {}
+};
+
+// "int", "float", "bool" or "string"
+bool parsePropertyType(std::string_view name, PropertyType &type);
+const char *propertyTypeName(PropertyType type);
+
+// Converts the text form sent by TestToolServer. Bools accept true/false and 1/0.
+bool parsePropertyValue(PropertyType type, std::string_view text, PropertyValue &value);
+
+std::ostream &operator<<(std::ostream &stream, const PropertyValue &value);
@@ -0,0 +1,299 @@
+#include "screenshot_writer.h"
+#include "steady_time.h"
+#include "image_decoder.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+ScreenshotWriter::ScreenshotWriter()
+    : m_bufferCount(DEFAULT_BUFFER_COUNT),
+      m_workerCount(0),
+      m_fingerprintTileSize(FingerprintFormat::DEFAULT_TILE_SIZE),
+      m_running(0),
+      m_stopping(false),
+      m_completedCount(0)
+{
+}
+
+ScreenshotWriter::~ScreenshotWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_jobReady.notify_all();
+    for (std::thread &worker : m_workers)
+        worker.join();
+}
+
+void ScreenshotWriter::configure(size_t bufferCount, size_t workerCount)
+{
+    if (!m_workers.empty())
+    {
+        std::cout << "Screenshot writer already running, keeping its configuration" << std::endl;
+        return;
+    }
+    m_bufferCount = std::max<size_t>(bufferCount, 1);
+    m_workerCount = workerCount;
+}
+
+void ScreenshotWriter::startWorkers(const FrameBuffer &frame)
+{
+    size_t workers = m_workerCount;
+    if (workers == 0)
+    {
+        // Leave one hardware thread to the render loop
+        unsigned hardware = std::thread::hardware_concurrency();
+        workers = std::min<size_t>(std::max(hardware, 2u) - 1, 4);
+    }
+
+    // Sized for the first frame up front so capturing never allocates
+    m_buffers.resize(m_bufferCount);
+    for (size_t i = 0; i < m_bufferCount; ++i)
+    {
+        m_buffers[i].resize(frame.width, frame.height);
+        m_freeBuffers.push_back(i);
+    }
+    for (size_t i = 0; i < workers; ++i)
+        m_workers.emplace_back([this]() { workerLoop(); });
+}
+
+void ScreenshotWriter::setFingerprintTileSize(uint32_t tileSize)
+{
+    if (!m_workers.empty())
+    {
+        std::cout << "Screenshot writer already running, keeping its fingerprint tile size" << std::endl;
+        return;
+    }
+    if (tileSize % 8 != 0 || tileSize > FingerprintFormat::MAX_TILE_SIZE)
+    {
+        std::cout << "Fingerprint tile size must be a multiple of 8 up to " << FingerprintFormat::MAX_TILE_SIZE
+                  << ", keeping " << m_fingerprintTileSize << std::endl;
+        return;
+    }
+    m_fingerprintTileSize = tileSize;
+}
+
+bool ScreenshotWriter::takeBuffer(const FrameBuffer &frame, std::string_view purpose, size_t &buffer)
+{
+    if (m_workers.empty())
+        startWorkers(frame);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_freeBuffers.empty())
+        {
+            std::cout << "All " << m_bufferCount << " screenshot buffers busy, dropping " << purpose << std::endl;
+            return false;
+        }
+        buffer = m_freeBuffers.back();
+        m_freeBuffers.pop_back();
+    }
+
+    // The copy is the only per-pixel work on this thread. A buffer only
+    // reallocates when the frame size changed.
+    FrameBuffer &copy = m_buffers[buffer];
+    copy.width = frame.width;
+    copy.height = frame.height;
+    copy.pixels.resize(frame.pixels.size());
+    std::memcpy(copy.pixels.data(), frame.pixels.data(), frame.pixels.size());
+    return true;
+}
+
+void ScreenshotWriter::queue(Job job)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back(std::move(job));
+    }
+    m_jobReady.notify_one();
+}
+
+bool ScreenshotWriter::capture(const FrameBuffer &frame, std::string_view path, uint32_t sequence)
+{
+    size_t buffer;
+    if (!takeBuffer(frame, path, buffer))
+        return false;
+    queue(Job{buffer, sequence, std::string(path), false, CompareRequest()});
+    return true;
+}
+
+bool ScreenshotWriter::compare(const FrameBuffer &frame, CompareRequest request, uint32_t sequence)
+{
+    size_t buffer;
+    if (!takeBuffer(frame, "comparison with " + request.reference, buffer))
+        return false;
+    queue(Job{buffer, sequence, std::string(), true, std::move(request)});
+    return true;
+}
+
+size_t ScreenshotWriter::freeBufferCount()
+{
+    // Buffers are only allocated with the first capture
+    if (m_workers.empty())
+        return m_bufferCount;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_freeBuffers.size();
+}
+
+size_t ScreenshotWriter::pollCompleted(const CompletionHandler &onScreenshot, const CompareHandler &onCompare)
+{
+    if (m_completedCount.load(std::memory_order_acquire) == 0)
+        return 0;
+
+    m_collected.clear();
+    m_collectedCompares.clear();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_collected.swap(m_completed);
+        m_collectedCompares.swap(m_completedCompares);
+        m_completedCount.store(0, std::memory_order_relaxed);
+    }
+    if (onScreenshot)
+    {
+        for (const ScreenshotNotice &notice : m_collected)
+            onScreenshot(notice);
+    }
+    if (onCompare)
+    {
+        for (const CompareNotice &notice : m_collectedCompares)
+            onCompare(notice);
+    }
+    return m_collected.size() + m_collectedCompares.size();
+}
+
+void ScreenshotWriter::waitIdle()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle.wait(lock, [this]() { return m_jobs.empty() && m_running == 0; });
+}
+
+void ScreenshotWriter::workerLoop()
+{
+    // Kept between jobs, so steady state does not allocate
+    WorkerState state;
+    for (;;)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_jobReady.wait(lock, [this]() { return m_stopping || !m_jobs.empty(); });
+            // Queued jobs still run when stopping
+            if (m_jobs.empty())
+                return;
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+            ++m_running;
+        }
+
+        ScreenshotNotice screenshot;
+        CompareNotice comparison;
+        if (job.compare)
+            comparison = compareWithReference(job, state);
+        else
+            screenshot = writeScreenshot(job, state);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_freeBuffers.push_back(job.buffer);
+            if (job.compare)
+                m_completedCompares.push_back(std::move(comparison));
+            else
+                m_completed.push_back(std::move(screenshot));
+            m_completedCount.store(m_completed.size() + m_completedCompares.size(), std::memory_order_release);
+            --m_running;
+            if (m_jobs.empty() && m_running == 0)
+                m_idle.notify_all();
+        }
+    }
+}
+
+ScreenshotNotice ScreenshotWriter::writeScreenshot(const Job &job, WorkerState &state)
+{
+    int64_t start = steadyMicroseconds();
+    const FrameBuffer &frame = m_buffers[job.buffer];
+    encodeImage(imageFormatForPath(job.path), frame.pixels.data(), frame.width, frame.height, state.encoded);
+
+    ScreenshotNotice notice;
+    notice.sequence = job.sequence;
+    notice.written = writeFile(job.path, state.encoded);
+    notice.bytes = notice.written ? state.encoded.size() : 0;
+    notice.path = job.path;
+    if (!notice.written)
+        std::cout << "Cannot write screenshot " << notice.path << std::endl;
+
+    // Counted in encode_us: it is part of what the screenshot costs
+    if (notice.written && m_fingerprintTileSize != 0)
+    {
+        computeFingerprint(frame, m_fingerprintTileSize, state.fingerprint);
+        encodeFingerprint(state.fingerprint, state.encoded);
+        std::string fingerprintPath = job.path + FingerprintFormat::FILE_SUFFIX;
+        if (!writeFile(fingerprintPath, state.encoded))
+            std::cout << "Cannot write fingerprint " << fingerprintPath << std::endl;
+    }
+    notice.encodeUs = steadyMicroseconds() - start;
+    return notice;
+}
+
+CompareNotice ScreenshotWriter::compareWithReference(const Job &job, WorkerState &state)
+{
+    int64_t start = steadyMicroseconds();
+    const FrameBuffer &frame = m_buffers[job.buffer];
+    const CompareRequest &request = job.request;
+
+    CompareNotice notice;
+    notice.sequence = job.sequence;
+    notice.reference = request.reference;
+
+    // Goldens are usually compared over and over; decode only when changed
+    std::error_code error;
+    std::filesystem::file_time_type modified = std::filesystem::last_write_time(request.reference, error);
+    if (error || state.referencePath != request.reference || state.referenceTime != modified)
+    {
+        state.referencePath.clear();
+        if (error || !loadImage(request.reference, state.reference))
+        {
+            if (error)
+                std::cout << "Cannot open reference image " << request.reference << std::endl;
+            notice.outcome = CompareOutcome::Error;
+            notice.compareUs = steadyMicroseconds() - start;
+            return notice;
+        }
+        state.referencePath = request.reference;
+        state.referenceTime = modified;
+    }
+
+    CompareResult result = compareFrames(frame, state.reference, request.options);
+    notice.outcome = result.passed(request.options) ? CompareOutcome::Pass : CompareOutcome::Fail;
+    notice.differingPixels = result.sizeMatches ? result.differingPixels : uint64_t(frame.width) * frame.height;
+    notice.comparedPixels = result.comparedPixels;
+    notice.maxDelta = result.maxDelta;
+    if (!result.sizeMatches)
+        std::cout << "Reference " << request.reference << " is " << state.reference.width << "x"
+                  << state.reference.height << ", the frame " << frame.width << "x" << frame.height << std::endl;
+
+    if (!request.heatmap.empty())
+    {
+        renderDiffHeatmap(frame, state.reference, request.options, state.heatmap);
+        encodeImage(imageFormatForPath(request.heatmap), state.heatmap.pixels.data(), state.heatmap.width,
+                    state.heatmap.height, state.encoded);
+        if (!writeFile(request.heatmap, state.encoded))
+            std::cout << "Cannot write heatmap " << request.heatmap << std::endl;
+    }
+    notice.compareUs = steadyMicroseconds() - start;
+    return notice;
+}
+
+bool ScreenshotWriter::writeFile(const std::string &path, const std::string &data)
+{
+    std::error_code error;
+    std::filesystem::path parent = std::filesystem::path(path).parent_path();
+    if (!parent.empty())
+        std::filesystem::create_directories(parent, error);
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), static_cast<std::streamsize>(data.size()));
+    return static_cast<bool>(out);
+}
@@ -0,0 +1,125 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "command_tokenizer.h"
+#include "frame_buffer.h"
+#include "image_encoder.h"
+#include "image_compare.h"
+#include "frame_fingerprint.h"
+
+// Takes screenshots off the render thread.
+//
+// capture() only copies the frame into one of a fixed set of preallocated
+// buffers and queues it; a pool of worker threads encodes it (format by file
+// extension, see ImageFormat) and writes the file. Finished screenshots are
+// collected with pollCompleted() on the render thread, which turns them into
+// SCREENSHOT notices for the server.
+//
+// Next to every screenshot the worker also writes its tile fingerprint
+// ("<path>.tiles", see frame_fingerprint.h) unless disabled.
+//
+// compare() hands a frame to the same workers to be checked against a golden
+// image (see image_compare.h); the result comes back as a COMPARE notice.
+// Each worker keeps the last reference it decoded while the file is unchanged.
+//
+// When every buffer is still waiting to be encoded, capture() and compare()
+// fail at once rather than stalling the frame.
+class ScreenshotWriter
+{
+public:
+    using CompletionHandler = std::function<void(const ScreenshotNotice &notice)>;
+    using CompareHandler = std::function<void(const CompareNotice &notice)>;
+
+    static const size_t DEFAULT_BUFFER_COUNT = 4;
+
+    ScreenshotWriter();
+    // Finishes every queued screenshot
+    ~ScreenshotWriter();
+    ScreenshotWriter(const ScreenshotWriter &) = delete;
+    ScreenshotWriter &operator=(const ScreenshotWriter &) = delete;
+
+    // Must be called before the first capture(). workerCount 0 picks one per
+    // spare hardware thread, at most four.
+    void configure(size_t bufferCount, size_t workerCount);
+    // Edge of the fingerprint tiles in pixels, 0 for no fingerprints. Must be
+    // set before the first capture().
+    void setFingerprintTileSize(uint32_t tileSize);
+
+    // Render thread. Copies frame and queues it to be written to path.
+    bool capture(const FrameBuffer &frame, std::string_view path, uint32_t sequence);
+    // Render thread. Copies frame and queues its comparison with request.
+    bool compare(const FrameBuffer &frame, CompareRequest request, uint32_t sequence);
+
+    // Render thread. Calls the matching handler (if set) for every screenshot
+    // and comparison finished since the last call; returns how many there were.
+    size_t pollCompleted(const CompletionHandler &onScreenshot, const CompareHandler &onCompare);
+
+    // Render thread. How many captures would be accepted right now
+    size_t freeBufferCount();
+
+    // Blocks until every queued screenshot has been written
+    void waitIdle();
+
+private:
+    struct Job
+    {
+        size_t buffer;
+        uint32_t sequence;
+        // Screenshot file, unused when comparing
+        std::string path;
+        bool compare;
+        CompareRequest request;
+    };
+
+    // Per worker: encode buffer and the last decoded reference image
+    struct WorkerState
+    {
+        std::string encoded;
+        FrameFingerprint fingerprint;
+        FrameBuffer reference;
+        FrameBuffer heatmap;
+        std::string referencePath;
+        std::filesystem::file_time_type referenceTime;
+    };
+
+    void startWorkers(const FrameBuffer &frame);
+    bool takeBuffer(const FrameBuffer &frame, std::string_view purpose, size_t &buffer);
+    void queue(Job job);
+    void workerLoop();
+    ScreenshotNotice writeScreenshot(const Job &job, WorkerState &state);
+    CompareNotice compareWithReference(const Job &job, WorkerState &state);
+    static bool writeFile(const std::string &path, const std::string &data);
+
+    size_t m_bufferCount;
+    size_t m_workerCount;
+    uint32_t m_fingerprintTileSize;
+    // Frame copies, allocated on the first capture. A buffer is owned by the
+    // render thread while free and by one worker while its job runs
+    std::vector<FrameBuffer> m_buffers;
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_mutex;
+    std::condition_variable m_jobReady;
+    std::condition_variable m_idle;
+    std::vector<size_t> m_freeBuffers;
+    std::deque<Job> m_jobs;
+    size_t m_running;
+    bool m_stopping;
+    std::vector<ScreenshotNotice> m_completed;
+    std::vector<CompareNotice> m_completedCompares;
+    // Lets pollCompleted() skip the lock while nothing finished
+    std::atomic<size_t> m_completedCount;
+    // Swapped with the completed lists so handlers run outside the lock
+    std::vector<ScreenshotNotice> m_collected;
+    std::vector<CompareNotice> m_collectedCompares;
+};
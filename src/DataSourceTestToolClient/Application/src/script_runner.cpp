@@ -0,0 +1,112 @@
+#include "script_runner.h"
+#include "property_store.h"
+#include <algorithm>
+#include <iostream>
+
+ScriptRunner::ScriptRunner()
+    : m_cacheDirectory(defaultScriptCacheDirectory()), m_propertyCount(0), m_next(0), m_running(false),
+      m_waiting(false), m_deadlineUs(0), m_startUs(0), m_finishUs(0), m_maxLatenessUs(0)
+{
+}
+
+bool ScriptRunner::load(std::string_view source, PropertyStore &store)
+{
+    m_running = false;
+    m_propertyCount = 0;
+
+    bool loaded = false;
+    if (!source.empty() && source.front() == '<')
+    {
+        // Inline scripts are sent once, so they are not worth caching
+        std::vector<PreconditionStep> steps;
+        std::string image;
+        if (!parsePreconditionScript(source, steps))
+            std::cout << "Malformed inline script" << std::endl;
+        else if (compileScript(steps, hashScriptSource(source), image))
+            loaded = m_script.assign(std::move(image));
+    }
+    else
+    {
+        std::string path(source);
+        std::string_view extension = ScriptFormat::FILE_EXTENSION;
+        bool compiled = path.size() > extension.size() && path.compare(path.size() - extension.size(),
+                                                                       extension.size(), extension) == 0;
+        loaded = compiled ? m_script.openFile(path) : loadCachedScript(path, m_cacheDirectory, m_script);
+    }
+
+    if (!loaded)
+    {
+        m_script.close();
+        return false;
+    }
+
+    m_indices.resize(m_script.nameCount());
+    for (uint32_t id = 0; id < m_indices.size(); ++id)
+        m_indices[id] = store.findOrInsert(m_script.file(id), m_script.name(id), m_script.type(id));
+
+    for (size_t i = 0; i < m_script.stepCount(); ++i)
+        m_propertyCount += m_script.step(i).opcode == static_cast<uint8_t>(ScriptFormat::Opcode::Property);
+    return true;
+}
+
+void ScriptRunner::start(int64_t nowUs)
+{
+    m_next = 0;
+    m_running = m_script.isOpen();
+    m_waiting = false;
+    m_deadlineUs = nowUs;
+    m_startUs = nowUs;
+    m_finishUs = nowUs;
+    m_maxLatenessUs = 0;
+}
+
+size_t ScriptRunner::run(int64_t nowUs, PropertyStore &store)
+{
+    if (!m_running)
+        return 0;
+
+    if (m_waiting)
+    {
+        if (nowUs < m_deadlineUs)
+            return 0;
+        m_maxLatenessUs = std::max(m_maxLatenessUs, nowUs - m_deadlineUs);
+        m_waiting = false;
+    }
+
+    size_t executed = 0;
+    size_t count = m_script.stepCount();
+    while (m_next < count)
+    {
+        const ScriptFormat::Step &step = m_script.step(m_next++);
+        ++executed;
+
+        ScriptFormat::Opcode opcode = static_cast<ScriptFormat::Opcode>(step.opcode);
+        if (opcode == ScriptFormat::Opcode::Property)
+        {
+            store.set(m_indices[step.nameId], m_script.value(step));
+        }
+        else if (opcode == ScriptFormat::Opcode::Wait)
+        {
+            m_deadlineUs += static_cast<int64_t>(step.value) * 1000;
+            if (nowUs < m_deadlineUs)
+            {
+                m_waiting = true;
+                return executed;
+            }
+            m_maxLatenessUs = std::max(m_maxLatenessUs, nowUs - m_deadlineUs);
+        }
+        else if (opcode == ScriptFormat::Opcode::Screenshot)
+        {
+            if (m_screenshotHandler)
+                m_screenshotHandler(m_script.text(step));
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    m_running = false;
+    m_finishUs = nowUs;
+    return executed;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include "compiled_script.h"
+
+class PropertyStore;
+
+// Plays a PreCondition script on the application thread.
+//
+// Scripts run from their compiled form (see compiled_script.h): script files
+// go through the compiled script cache, so an unchanged script is mapped and
+// started without any parsing. Each property is looked up in the store once
+// at load, so running a step only writes a store column.
+//
+// Each wait ends a fixed time after the previous one was scheduled to end,
+// not after the runner got around to it, so a late step never shifts the
+// steps after it. Property steps between two waits are applied back to back.
+class ScriptRunner
+{
+public:
+    static const int64_t IDLE = INT64_MAX;
+
+    using ScreenshotHandler = std::function<void(std::string_view name)>;
+
+    ScriptRunner();
+
+    // source is the script itself if it starts with '<', otherwise the path
+    // of an XML script or of a compiled .dsc file. Replaces any loaded
+    // script. Properties are added to store as needed.
+    bool load(std::string_view source, PropertyStore &store);
+
+    void start(int64_t nowUs);
+    void stop() { m_running = false; }
+    bool running() const { return m_running; }
+
+    // Runs every step that is due at nowUs and returns how many ran. The
+    // script stops after <exit /> or its last step.
+    size_t run(int64_t nowUs, PropertyStore &store);
+
+    // When run() next has something to do, or IDLE
+    int64_t nextDeadlineUs() const { return !m_running ? IDLE : m_waiting ? m_deadlineUs : 0; }
+
+    void setScreenshotHandler(ScreenshotHandler handler) { m_screenshotHandler = std::move(handler); }
+
+    // Where compiled scripts are cached; empty compiles in memory every time
+    void setCacheDirectory(std::string directory) { m_cacheDirectory = std::move(directory); }
+
+    // Statistics of the current or last run
+    size_t stepCount() const { return m_script.isOpen() ? m_script.stepCount() : 0; }
+    size_t propertyCount() const { return m_propertyCount; }
+    int64_t elapsedUs() const { return m_finishUs - m_startUs; }
+    int64_t maxLatenessUs() const { return m_maxLatenessUs; }
+
+private:
+    CompiledScript m_script;
+    // Store index per script name ID
+    std::vector<uint32_t> m_indices;
+    std::string m_cacheDirectory;
+    size_t m_propertyCount;
+    size_t m_next;
+    bool m_running;
+    bool m_waiting;
+    int64_t m_deadlineUs;
+    int64_t m_startUs;
+    int64_t m_finishUs;
+    // Latest a wait ended after its deadline
+    int64_t m_maxLatenessUs;
+    ScreenshotHandler m_screenshotHandler;
+};
@@ -0,0 +1,396 @@
+#include "shared_memory_channel.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+#ifdef __linux__
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <csignal>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+const char MAGIC[8] = {'D', 'S', 'S', 'H', 'M', 'R', 'N', 'G'};
+const uint32_t VERSION = 2;
+const size_t CACHE_LINE = 64;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring positions must be lock free to be shared");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "futex words must be lock free to be shared");
+
+size_t roundUpToPowerOfTwo(size_t value)
+{
+    size_t result = 1;
+    while (result < value)
+        result <<= 1;
+    return result;
+}
+}
+
+// One direction. head and tail count bytes written and read since the segment
+// was created, so they never wrap and head - tail is the fill level.
+struct SharedMemoryChannel::Ring
+{
+    alignas(CACHE_LINE) std::atomic<uint64_t> head;
+    alignas(CACHE_LINE) std::atomic<uint64_t> tail;
+    // Futex word the reader sleeps on; bumped by every wake-up
+    alignas(CACHE_LINE) std::atomic<uint32_t> doorbell;
+    // Set by the reader while it is about to sleep or sleeping
+    std::atomic<uint32_t> sleeping;
+    // Set by wake() so a wake-up that lands before the reader sleeps is not lost
+    std::atomic<uint32_t> wakePending;
+    uint32_t reserved;
+    // Offset of the data from the start of the segment
+    uint64_t dataOffset;
+};
+
+struct SharedMemoryChannel::Segment
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t ringCapacity;
+    // Process that created the segment, to tell a stale one from one in use
+    int32_t serverPid;
+    std::atomic<uint32_t> serverClosed;
+    std::atomic<uint32_t> clientClosed;
+    std::atomic<uint32_t> clientAttached;
+    // Server to client
+    Ring down;
+    // Client to server
+    Ring up;
+};
+
+#ifdef __linux__
+namespace
+{
+long futexWait(std::atomic<uint32_t> &word, uint32_t expected, std::chrono::microseconds timeout)
+{
+    timespec relative;
+    relative.tv_sec = static_cast<time_t>(timeout.count() / 1000000);
+    relative.tv_nsec = static_cast<long>(timeout.count() % 1000000) * 1000;
+    // Not FUTEX_PRIVATE: the word is shared with another process
+    return syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT, expected, &relative, nullptr, 0);
+}
+
+void futexWake(std::atomic<uint32_t> &word)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+}
+}
+#endif
+
+SharedMemoryChannel::SharedMemoryChannel()
+    : m_segment(nullptr),
+      m_segmentSize(0),
+      m_server(false)
+{
+}
+
+SharedMemoryChannel::~SharedMemoryChannel()
+{
+    close();
+}
+
+#ifdef __linux__
+bool SharedMemoryChannel::create(const std::string &name, size_t ringCapacity)
+{
+    close();
+
+    size_t capacity = roundUpToPowerOfTwo(std::max<size_t>(ringCapacity, 4096));
+    if (capacity > UINT32_MAX)
+    {
+        std::cout << "Shared memory ring capacity " << ringCapacity << " is too large" << std::endl;
+        return false;
+    }
+    size_t header = (sizeof(Segment) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    size_t size = header + 2 * capacity;
+
+    // A segment left behind by a crashed run would make O_EXCL fail; one a
+    // running server still owns is left alone
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST && isStale(name))
+    {
+        shm_unlink(name.c_str());
+        fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+    if (fd < 0)
+    {
+        std::cout << "Cannot create shared memory " << name << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    void *mapping = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(size)) == 0)
+        mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int error = errno;
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        std::cout << "Cannot map shared memory " << name << ": " << std::strerror(error) << std::endl;
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    Segment *segment = new (mapping) Segment();
+    segment->version = VERSION;
+    segment->ringCapacity = static_cast<uint32_t>(capacity);
+    segment->serverPid = static_cast<int32_t>(getpid());
+    segment->down.dataOffset = header;
+    segment->up.dataOffset = header + capacity;
+    // The magic goes in last: a client that sees it sees an initialised segment
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(segment->magic, MAGIC, sizeof(MAGIC));
+
+    m_segment = segment;
+    m_segmentSize = size;
+    m_name = name;
+    m_server = true;
+    return true;
+}
+
+bool SharedMemoryChannel::isStale(const std::string &name)
+{
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+    struct stat status;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &status) == 0 && static_cast<size_t>(status.st_size) >= sizeof(Segment))
+        mapping = mmap(nullptr, sizeof(Segment), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        std::cout << "Shared memory " << name << " exists and is not a DataSourceTestTool channel" << std::endl;
+        return false;
+    }
+
+    // Only a channel of this version records its server
+    const Segment *segment = static_cast<const Segment *>(mapping);
+    bool ours = std::memcmp(segment->magic, MAGIC, sizeof(MAGIC)) == 0 && segment->version == VERSION;
+    pid_t owner = ours ? static_cast<pid_t>(segment->serverPid) : 0;
+    bool stale = ours && (segment->serverClosed.load() != 0 || (kill(owner, 0) != 0 && errno == ESRCH));
+    munmap(mapping, sizeof(Segment));
+
+    if (!ours)
+        std::cout << "Shared memory " << name << " exists and is not a channel of this version" << std::endl;
+    else if (!stale)
+        std::cout << "Shared memory " << name << " is in use by process " << owner << std::endl;
+    return stale;
+}
+
+bool SharedMemoryChannel::open(const std::string &name)
+{
+    close();
+
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0)
+    {
+        std::cout << "Cannot open shared memory " << name << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    struct stat status;
+    void *mapping = MAP_FAILED;
+    size_t size = 0;
+    if (fstat(fd, &status) == 0 && static_cast<size_t>(status.st_size) >= sizeof(Segment))
+    {
+        size = static_cast<size_t>(status.st_size);
+        mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        std::cout << "Shared memory " << name << " is not ready" << std::endl;
+        return false;
+    }
+
+    Segment *segment = static_cast<Segment *>(mapping);
+    bool valid = std::memcmp(segment->magic, MAGIC, sizeof(MAGIC)) == 0;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t capacity = segment->ringCapacity;
+    valid = valid && segment->version == VERSION && capacity > 0 && (capacity & (capacity - 1)) == 0 &&
+            segment->up.dataOffset + capacity <= size && segment->down.dataOffset + capacity <= size;
+    if (!valid)
+    {
+        std::cout << "Shared memory " << name << " is not a DataSourceTestTool channel" << std::endl;
+        munmap(mapping, size);
+        return false;
+    }
+    if (segment->serverClosed.load() != 0 || segment->clientAttached.exchange(1) != 0)
+    {
+        std::cout << "Shared memory " << name << " is already in use or closed" << std::endl;
+        munmap(mapping, size);
+        return false;
+    }
+
+    m_segment = segment;
+    m_segmentSize = size;
+    m_name = name;
+    m_server = false;
+    return true;
+}
+
+void SharedMemoryChannel::close()
+{
+    if (!m_segment)
+        return;
+
+    (m_server ? m_segment->serverClosed : m_segment->clientClosed).store(1);
+    // The peer may be asleep on the ring this end writes to
+    Ring &peerReads = outgoing();
+    peerReads.doorbell.fetch_add(1);
+    futexWake(peerReads.doorbell);
+
+    munmap(m_segment, m_segmentSize);
+    if (m_server)
+        shm_unlink(m_name.c_str());
+    m_segment = nullptr;
+    m_segmentSize = 0;
+    m_name.clear();
+}
+
+bool SharedMemoryChannel::wait(std::chrono::microseconds timeout)
+{
+    if (!m_segment)
+        return false;
+
+    Ring &ring = incoming();
+    uint32_t doorbell = ring.doorbell.load();
+    ring.sleeping.store(1);
+    // Pairs with the fence in the writer: either it sees sleeping and rings,
+    // or this sees its bytes
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (readable() == 0 && ring.wakePending.exchange(0) == 0 && !peerClosed() && timeout.count() > 0)
+        futexWait(ring.doorbell, doorbell, timeout);
+    ring.sleeping.store(0);
+    ring.wakePending.store(0);
+    return readable() > 0;
+}
+
+void SharedMemoryChannel::wakeReader(Ring &ring)
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (ring.sleeping.load(std::memory_order_relaxed) != 0)
+    {
+        ring.doorbell.fetch_add(1);
+        futexWake(ring.doorbell);
+    }
+}
+#else
+bool SharedMemoryChannel::create(const std::string &name, size_t)
+{
+    std::cout << "Shared memory transport is not supported on this platform (" << name << ")" << std::endl;
+    return false;
+}
+
+bool SharedMemoryChannel::open(const std::string &name)
+{
+    std::cout << "Shared memory transport is not supported on this platform (" << name << ")" << std::endl;
+    return false;
+}
+
+void SharedMemoryChannel::close()
+{
+}
+
+bool SharedMemoryChannel::wait(std::chrono::microseconds)
+{
+    return false;
+}
+
+void SharedMemoryChannel::wakeReader(Ring &)
+{
+}
+#endif
+
+bool SharedMemoryChannel::peerClosed() const
+{
+    return m_segment && (m_server ? m_segment->clientClosed : m_segment->serverClosed).load() != 0;
+}
+
+bool SharedMemoryChannel::peerAttached() const
+{
+    return m_segment && m_segment->clientAttached.load() != 0;
+}
+
+SharedMemoryChannel::Ring &SharedMemoryChannel::incoming() const
+{
+    return m_server ? m_segment->up : m_segment->down;
+}
+
+SharedMemoryChannel::Ring &SharedMemoryChannel::outgoing() const
+{
+    return m_server ? m_segment->down : m_segment->up;
+}
+
+size_t SharedMemoryChannel::write(const char *data, size_t length)
+{
+    if (!m_segment || length == 0)
+        return 0;
+
+    Ring &ring = outgoing();
+    uint64_t capacity = m_segment->ringCapacity;
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    uint64_t tail = ring.tail.load(std::memory_order_acquire);
+    size_t count = static_cast<size_t>(std::min<uint64_t>(length, capacity - (head - tail)));
+    if (count == 0)
+        return 0;
+
+    // At most two copies: up to the end of the buffer, then from its start
+    char *buffer = reinterpret_cast<char *>(m_segment) + ring.dataOffset;
+    size_t offset = static_cast<size_t>(head & (capacity - 1));
+    size_t first = std::min<size_t>(count, static_cast<size_t>(capacity) - offset);
+    std::memcpy(buffer + offset, data, first);
+    std::memcpy(buffer, data + first, count - first);
+    ring.head.store(head + count, std::memory_order_release);
+
+    wakeReader(ring);
+    return count;
+}
+
+size_t SharedMemoryChannel::read(char *data, size_t length)
+{
+    if (!m_segment || length == 0)
+        return 0;
+
+    Ring &ring = incoming();
+    uint64_t capacity = m_segment->ringCapacity;
+    uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+    uint64_t head = ring.head.load(std::memory_order_acquire);
+    size_t count = static_cast<size_t>(std::min<uint64_t>(length, head - tail));
+    if (count == 0)
+        return 0;
+
+    const char *buffer = reinterpret_cast<const char *>(m_segment) + ring.dataOffset;
+    size_t offset = static_cast<size_t>(tail & (capacity - 1));
+    size_t first = std::min<size_t>(count, static_cast<size_t>(capacity) - offset);
+    std::memcpy(data, buffer + offset, first);
+    std::memcpy(data + first, buffer, count - first);
+    ring.tail.store(tail + count, std::memory_order_release);
+    return count;
+}
+
+size_t SharedMemoryChannel::readable() const
+{
+    if (!m_segment)
+        return 0;
+
+    Ring &ring = incoming();
+    return static_cast<size_t>(ring.head.load(std::memory_order_acquire) -
+                               ring.tail.load(std::memory_order_relaxed));
+}
+
+void SharedMemoryChannel::wake()
+{
+    if (!m_segment)
+        return;
+
+    Ring &ring = incoming();
+    ring.wakePending.store(1);
+    wakeReader(ring);
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+// Same-host replacement for the TCP connection: a POSIX shared memory
+// segment holding two single-producer/single-consumer byte rings, one per
+// direction. The rings carry exactly the bytes the socket would (the HELLO
+// handshake, text or length-prefixed binary commands, ACK lines), so both
+// ends keep using MessageFramer unchanged.
+//
+// A reader with nothing to read sleeps on a futex in the segment. Writers
+// only make the wake-up system call when the reader announced that it is
+// going to sleep, so a busy stream moves without any system calls at all.
+//
+// The server creates the segment and the client opens it by name. Linux only;
+// elsewhere create() and open() fail.
+class SharedMemoryChannel
+{
+public:
+    static const size_t DEFAULT_RING_CAPACITY = 1024 * 1024;
+
+    SharedMemoryChannel();
+    ~SharedMemoryChannel();
+    SharedMemoryChannel(const SharedMemoryChannel &) = delete;
+    SharedMemoryChannel &operator=(const SharedMemoryChannel &) = delete;
+
+    // Server side. name is a shm_open() name such as "/datasource-test". Fails
+    // while another server has the name open; a segment left by a server
+    // that closed it or is no longer running is replaced. capacity is
+    // rounded up to a power of two.
+    bool create(const std::string &name, size_t ringCapacity = DEFAULT_RING_CAPACITY);
+    // Client side
+    bool open(const std::string &name);
+    // Marks this end closed, wakes the peer and unmaps (the server also
+    // removes the name)
+    void close();
+
+    bool isOpen() const { return m_segment != nullptr; }
+    // True once the other end called close()
+    bool peerClosed() const;
+    // True once a client opened the segment
+    bool peerAttached() const;
+
+    // Copies up to length bytes into the outgoing ring and returns how many
+    // fit. Wakes the peer if it is waiting.
+    size_t write(const char *data, size_t length);
+    // Moves up to length received bytes out of the incoming ring
+    size_t read(char *data, size_t length);
+    size_t readable() const;
+
+    // Sleeps until bytes arrive, wake() is called, the peer closes or the
+    // timeout passes. Returns readable() > 0.
+    bool wait(std::chrono::microseconds timeout);
+    // Wakes a wait() on this end, e.g. from another thread of this process
+    // that has something for the waiting thread to send
+    void wake();
+
+private:
+    struct Ring;
+    struct Segment;
+
+    Ring &incoming() const;
+    Ring &outgoing() const;
+    static void wakeReader(Ring &ring);
+    static bool isStale(const std::string &name);
+
+    Segment *m_segment;
+    size_t m_segmentSize;
+    std::string m_name;
+    bool m_server;
+};
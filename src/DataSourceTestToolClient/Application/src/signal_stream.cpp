@@ -0,0 +1,184 @@
+#include "signal_stream.h"
+#include "steady_time.h"
+#include <charconv>
+#include <cmath>
+#include <cstring>
+
+TokenizeError parseSampleRecords(std::string_view records, std::vector<StreamSample> &samples)
+{
+    samples.clear();
+    while (!records.empty())
+    {
+        const void *found = std::memchr(records.data(), BATCH_RECORD_SEPARATOR, records.size());
+        size_t recordLength = found ? static_cast<const char *>(found) - records.data() : records.size();
+        std::string_view record = records.substr(0, recordLength);
+        records.remove_prefix(found ? recordLength + 1 : recordLength);
+
+        std::string_view time;
+        if (!takeField(record, time))
+            return TokenizeError::MissingField;
+
+        StreamSample sample;
+        const char *timeEnd = time.data() + time.size();
+        const char *valueEnd = record.data() + record.size();
+        std::from_chars_result parsedTime = std::from_chars(time.data(), timeEnd, sample.timeUs);
+        std::from_chars_result parsedValue = std::from_chars(record.data(), valueEnd, sample.value);
+        if (parsedTime.ec != std::errc() || parsedTime.ptr != timeEnd || parsedValue.ec != std::errc() ||
+            parsedValue.ptr != valueEnd)
+            return TokenizeError::InvalidValue;
+
+        samples.push_back(sample);
+    }
+
+    return samples.empty() ? TokenizeError::MissingField : TokenizeError::None;
+}
+
+SignalStreams::SignalStreams() : m_droppedCount(0)
+{
+    m_streams.reserve(MAX_STREAMS);
+    for (uint32_t i = 0; i < MAX_STREAMS; ++i)
+        m_streams.emplace_back(new Stream());
+}
+
+int64_t SignalStreams::now()
+{
+    return steadyMicroseconds();
+}
+
+bool SignalStreams::open(uint32_t id, PropertyType type)
+{
+    if (id >= MAX_STREAMS || (type != PropertyType::Int && type != PropertyType::Float))
+        return false;
+
+    // The new declaration may come from a restarted server with another clock
+    Stream &stream = *m_streams[id];
+    stream.open = true;
+    stream.hasClockOffset = false;
+    stream.generation.store(stream.generation.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    return true;
+}
+
+bool SignalStreams::push(uint32_t id, const StreamSample *samples, size_t count, int64_t receiveTimeUs)
+{
+    if (!isOpen(id))
+        return false;
+
+    Stream &stream = *m_streams[id];
+    uint32_t generation = stream.generation.load(std::memory_order_relaxed);
+    size_t queued = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!stream.samples.canWrite(queued + 1))
+        {
+            m_droppedCount.fetch_add(count - i, std::memory_order_relaxed);
+            break;
+        }
+
+        // A timestamp going backwards means the server restarted the signal
+        int64_t serverTimeUs = samples[i].timeUs;
+        if (!stream.hasClockOffset || serverTimeUs < stream.lastServerTimeUs)
+        {
+            stream.clockOffsetUs = receiveTimeUs - serverTimeUs;
+            stream.hasClockOffset = true;
+        }
+        else if (receiveTimeUs - serverTimeUs < stream.clockOffsetUs)
+        {
+            stream.clockOffsetUs = receiveTimeUs - serverTimeUs;
+        }
+        stream.lastServerTimeUs = serverTimeUs;
+
+        QueuedSample &slot = stream.samples.writeSlot(queued++);
+        slot.sample.timeUs = serverTimeUs + stream.clockOffsetUs;
+        slot.sample.value = samples[i].value;
+        slot.generation = generation;
+    }
+
+    stream.samples.commitWrite(queued);
+    return queued == count;
+}
+
+bool SignalStreams::declare(uint32_t id, uint32_t propertyIndex, PropertyType type)
+{
+    if (id >= MAX_STREAMS || (type != PropertyType::Int && type != PropertyType::Float))
+        return false;
+
+    Stream &stream = *m_streams[id];
+    stream.declared = true;
+    stream.declaredGeneration = stream.generation.load(std::memory_order_acquire);
+    stream.propertyIndex = propertyIndex;
+    stream.type = type;
+    stream.hasPrevious = false;
+    return true;
+}
+
+size_t SignalStreams::update(PropertyStore &store, int64_t renderTimeUs)
+{
+    size_t changed = 0;
+    for (const std::unique_ptr<Stream> &entry : m_streams)
+    {
+        Stream &stream = *entry;
+        if (!stream.declared)
+            continue;
+
+        // Consume every sample at or before the render time, keeping the last.
+        // Samples of an earlier declaration are discarded; those of a later
+        // one wait for its declare().
+        size_t available = stream.samples.readable();
+        size_t consumed = 0;
+        while (consumed < available)
+        {
+            const QueuedSample &queued = stream.samples.readSlot(consumed);
+            if (queued.generation != stream.declaredGeneration)
+            {
+                if (queued.generation > stream.declaredGeneration)
+                    break;
+                ++consumed;
+                continue;
+            }
+            if (queued.sample.timeUs > renderTimeUs)
+                break;
+            stream.previous = queued.sample;
+            stream.hasPrevious = true;
+            ++consumed;
+        }
+        stream.samples.commitRead(consumed);
+
+        if (!stream.hasPrevious)
+            continue;
+
+        // Interpolate towards the first sample after the render time; hold the
+        // last value when the stream has stalled
+        float value = stream.previous.value;
+        if (consumed < available && stream.samples.readSlot(0).generation == stream.declaredGeneration)
+        {
+            const StreamSample &next = stream.samples.readSlot(0).sample;
+            if (next.timeUs > stream.previous.timeUs)
+            {
+                float t = static_cast<float>(renderTimeUs - stream.previous.timeUs) /
+                          static_cast<float>(next.timeUs - stream.previous.timeUs);
+                value += (next.value - stream.previous.value) * t;
+            }
+        }
+
+        PropertyValue propertyValue;
+        propertyValue.type = stream.type;
+        if (stream.type == PropertyType::Int)
+        {
+            propertyValue.intValue = static_cast<int32_t>(std::lround(value));
+            if (store.type(stream.propertyIndex) == PropertyType::Int &&
+                store.intValue(stream.propertyIndex) == propertyValue.intValue)
+                continue;
+        }
+        else
+        {
+            propertyValue.floatValue = value;
+            if (store.type(stream.propertyIndex) == PropertyType::Float &&
+                store.floatValue(stream.propertyIndex) == value)
+                continue;
+        }
+
+        store.set(stream.propertyIndex, propertyValue);
+        ++changed;
+    }
+    return changed;
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "command_tokenizer.h"
+#include "property_store.h"
+#include "spsc_queue.h"
+
+// One timestamped value of a streamed signal
+struct StreamSample
+{
+    // Server clock in microseconds on the wire, local steady clock once queued
+    int64_t timeUs;
+    float value;
+};
+
+// Parses the records of a text SAMPLE command: time_us::value<RS>time_us::value...
+TokenizeError parseSampleRecords(std::string_view records, std::vector<StreamSample> &samples);
+
+// High-rate signals (e.g. Gauge.Speed, Gauge.Rpm at 100-1000 Hz) that are
+// resampled onto the render clock instead of applied sample by sample.
+//
+// The network thread maps each sample onto the local clock and appends it to
+// the stream's own SPSC ring, so a burst of samples never waits on the
+// application. Once per frame the application interpolates every declared
+// stream at (now - playout delay) and writes the result to the property
+// store. The delay keeps a sample on either side of the render time despite
+// network jitter.
+//
+// Samples are only taken for a stream the network thread has seen declared
+// (open()). Declaring a stream again starts it over: samples queued for the
+// earlier declaration are discarded rather than interpolated into the new one.
+class SignalStreams
+{
+public:
+    static const uint32_t MAX_STREAMS = 64;
+    static const size_t SAMPLES_PER_STREAM = 1024;
+
+    SignalStreams();
+
+    // Microseconds on the steady clock used for all local sample times
+    static int64_t now();
+
+    // Network thread, when a STREAM command arrives and before it is queued.
+    // Starts accepting samples for the stream, on a new generation so those
+    // of an earlier declaration are not mixed in. Returns false if the ID is
+    // out of range or the type is not numeric.
+    bool open(uint32_t id, PropertyType type);
+    // Network thread. True once open() accepted the stream
+    bool isOpen(uint32_t id) const { return id < MAX_STREAMS && m_streams[id]->open; }
+
+    // Network thread. Returns false if the stream is not open or the ring is
+    // full; samples that do not fit are dropped and counted.
+    bool push(uint32_t id, const StreamSample *samples, size_t count, int64_t receiveTimeUs);
+
+    // Application thread, when the STREAM command is applied. Binds a stream
+    // to a numeric property and restarts its interpolation from the samples
+    // of the latest open().
+    bool declare(uint32_t id, uint32_t propertyIndex, PropertyType type);
+
+    // Application thread. Interpolates every declared stream at renderTimeUs
+    // and returns how many properties changed.
+    size_t update(PropertyStore &store, int64_t renderTimeUs);
+
+    uint64_t droppedCount() const { return m_droppedCount.load(std::memory_order_relaxed); }
+
+private:
+    struct QueuedSample
+    {
+        StreamSample sample;
+        // open() count of the stream when the sample was pushed
+        uint32_t generation;
+    };
+
+    struct Stream
+    {
+        Stream() : samples(SAMPLES_PER_STREAM), generation(0) {}
+
+        SpscQueue<QueuedSample> samples;
+        // Bumped by every open(); read by declare()
+        std::atomic<uint32_t> generation;
+
+        // Network thread: whether the stream takes samples, the
+        // server-to-local clock offset, the smallest seen so far (the least
+        // delayed sample), and the last server timestamp
+        bool open = false;
+        bool hasClockOffset = false;
+        int64_t clockOffsetUs = 0;
+        int64_t lastServerTimeUs = 0;
+
+        // Application thread
+        bool declared = false;
+        uint32_t declaredGeneration = 0;
+        uint32_t propertyIndex = 0;
+        PropertyType type = PropertyType::Float;
+        bool hasPrevious = false;
+        StreamSample previous = {0, 0.0f};
+    };
+
+    std::vector<std::unique_ptr<Stream>> m_streams;
+    std::atomic<uint64_t> m_droppedCount;
+};
@@ -0,0 +1,70 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <cstddef>
+
+// Bounded single-producer/single-consumer ring of preallocated slots.
+//
+// Neither side ever blocks or takes a lock. The producer fills slots in place
+// and publishes any number of them with one release store of the tail, so a
+// consumer sees either none or all of a group. Slots are reused rather than
+// destroyed, which lets T keep buffers (e.g. std::string capacity) between
+// uses.
+template <typename T>
+class SpscQueue
+{
+public:
+    // capacity is rounded up to a power of two
+    explicit SpscQueue(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size *= 2;
+        m_slots.reset(new T[size]);
+        m_mask = size - 1;
+    }
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    size_t capacity() const { return m_mask + 1; }
+
+    // Producer side: true if count slots can be written before the next
+    // commitWrite(). Only rereads the consumer's index when the cached one
+    // says there is not enough room.
+    bool canWrite(size_t count)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (capacity() - (tail - m_cachedHead) >= count)
+            return true;
+        m_cachedHead = m_head.load(std::memory_order_acquire);
+        return capacity() - (tail - m_cachedHead) >= count;
+    }
+
+    // offset counts from the first unpublished slot
+    T &writeSlot(size_t offset) { return m_slots[(m_tail.load(std::memory_order_relaxed) + offset) & m_mask]; }
+    void commitWrite(size_t count)
+    {
+        m_tail.store(m_tail.load(std::memory_order_relaxed) + count, std::memory_order_release);
+    }
+
+    // Consumer side: slots published and not yet released
+    size_t readable() { return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_relaxed); }
+
+    T &readSlot(size_t offset) { return m_slots[(m_head.load(std::memory_order_relaxed) + offset) & m_mask]; }
+    void commitRead(size_t count)
+    {
+        m_head.store(m_head.load(std::memory_order_relaxed) + count, std::memory_order_release);
+    }
+
+private:
+    std::unique_ptr<T[]> m_slots;
+    size_t m_mask;
+
+    // The indices live on separate cache lines. The producer keeps a cached
+    // copy of the head next to the tail it owns, so it only touches the
+    // consumer's line when the queue looks full.
+    alignas(64) std::atomic<size_t> m_head{0};
+    alignas(64) std::atomic<size_t> m_tail{0};
+    size_t m_cachedHead = 0;
+};
@@ -0,0 +1,11 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+// Microseconds on the steady clock; the time base of every local timestamp
+// (sample times, ACK receive/apply times, latency measurements)
+inline int64_t steadyMicroseconds()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
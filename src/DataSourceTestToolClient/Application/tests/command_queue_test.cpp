@@ -0,0 +1,115 @@
+// The lock-free handoff from the network thread: pushes are all or nothing,
+// the consumer sees the commands in order with their values parsed, and a
+// BATCH with one bad record is rejected whole
+#include "test_check.h"
+#include "application.h"
+#include "command_queue.h"
+#include <vector>
+
+namespace
+{
+void testCommandQueue()
+{
+    CommandQueue queue(8);
+    CHECK(queue.capacity() == 8);
+
+    std::vector<Command> commands(5);
+    for (size_t i = 0; i < commands.size(); ++i)
+    {
+        commands[i].kind = CommandKind::Sync;
+        commands[i].file = "Gauge";
+        commands[i].name = "Gear";
+        commands[i].type = "int";
+        commands[i].value = "7";
+        commands[i].sequence = static_cast<uint32_t>(i + 1);
+    }
+
+    // A batch is queued whole or not at all
+    CHECK(queue.push(commands.data(), 5));
+    CHECK(!queue.push(commands.data(), 5));
+    CHECK(queue.droppedCount() == 5);
+    CHECK(queue.push(commands.data(), 3));
+
+    std::vector<uint32_t> sequences;
+    CHECK(queue.drain([&](const QueuedCommand &command) {
+        sequences.push_back(command.sequence);
+        CHECK(command.isProperty() && command.file == "Gauge" && command.typedValue().intValue == 7);
+    }) == 8);
+    CHECK(sequences == std::vector<uint32_t>({1, 2, 3, 4, 5, 1, 2, 3}));
+    CHECK(queue.readable() == 0);
+}
+
+// Records of a BATCH message: all share its sequence
+std::vector<Command> makeBatch(uint32_t sequence, std::string_view gearValue)
+{
+    std::vector<Command> records(3);
+    const char *const names[3] = {"Gear", "Rpm", "Visible"};
+    const char *const types[3] = {"int", "float", "bool"};
+    const std::string_view values[3] = {gearValue, "900", "true"};
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        records[i].kind = CommandKind::Sync;
+        records[i].file = "Gauge";
+        records[i].name = names[i];
+        records[i].type = types[i];
+        records[i].value = values[i];
+        records[i].sequence = sequence;
+    }
+    return records;
+}
+
+void testBatchRejectedWhole()
+{
+    // The bad first record turns the whole message into rejects, with the
+    // ACK on its last record; the lone command after it is unaffected
+    CommandQueue queue(8);
+    std::vector<Command> commands = makeBatch(4, "x");
+    Command single = makeBatch(5, "2")[0];
+    commands.push_back(single);
+    CHECK(queue.push(commands.data(), commands.size()));
+    CHECK(queue.readable() == 4);
+    if (queue.readable() != 4)
+        return;
+    for (size_t i = 0; i < 3; ++i)
+    {
+        CHECK(queue.peek(i).kind == CommandKind::Unknown);
+        CHECK(queue.peek(i).acknowledge == (i == 2));
+    }
+    CHECK(queue.peek(3).kind == CommandKind::Sync && queue.peek(3).acknowledge);
+    queue.release(4);
+
+    // End to end: nothing of the bad batch is applied and its one ACK
+    // reports the rejection; a good batch is applied whole with one ACK
+    Application app;
+    std::vector<Acknowledgement> acknowledgements;
+    app.setAcknowledgementHandler([&](const Acknowledgement *received, size_t count) {
+        acknowledgements.insert(acknowledgements.end(), received, received + count);
+    });
+
+    std::vector<Command> bad = makeBatch(1, "x");
+    app.onCommandsReceived(bad.data(), bad.size());
+    app.drainCommands();
+    CHECK(app.propertyStore().size() == 0);
+    CHECK(acknowledgements.size() == 1);
+    if (acknowledgements.size() == 1)
+        CHECK(acknowledgements[0].sequence == 1 && acknowledgements[0].applyTimeUs == 0);
+
+    acknowledgements.clear();
+    std::vector<Command> good = makeBatch(2, "3");
+    app.onCommandsReceived(good.data(), good.size());
+    app.drainCommands();
+    CHECK(app.propertyStore().size() == 3);
+    uint32_t gear = app.propertyStore().find("Gauge", "Gear");
+    CHECK(gear != PropertyStore::NOT_FOUND && app.propertyStore().intValue(gear) == 3);
+    CHECK(acknowledgements.size() == 1);
+    if (acknowledgements.size() == 1)
+        CHECK(acknowledgements[0].sequence == 2 && acknowledgements[0].applyTimeUs != 0);
+}
+}
+
+int main()
+{
+    testCommandQueue();
+    testBatchRejectedWhole();
+    return testResult();
+}
@@ -0,0 +1,115 @@
+// Tile fingerprints: the .tiles encoding round trip, and that a diff of two
+// fingerprints finds exactly the tiles that changed
+#include "test_check.h"
+#include "frame_buffer.h"
+#include "frame_fingerprint.h"
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+void drawFrame(FrameBuffer &frame)
+{
+    // Not a multiple of the tile size, so the right and bottom tiles are partial
+    frame.resize(100, 70);
+    for (uint32_t y = 0; y < frame.height; ++y)
+        for (uint32_t x = 0; x < frame.width; ++x)
+        {
+            uint8_t *pixel = frame.row(y) + x * FrameBuffer::BYTES_PER_PIXEL;
+            pixel[0] = static_cast<uint8_t>(x);
+            pixel[1] = static_cast<uint8_t>(y);
+            pixel[2] = static_cast<uint8_t>(x ^ y);
+            pixel[3] = 255;
+        }
+}
+
+void testEncoding()
+{
+    FrameBuffer frame;
+    drawFrame(frame);
+    FrameFingerprint fingerprint;
+    computeFingerprint(frame, 32, fingerprint);
+    CHECK(fingerprint.tileSize == 32 && fingerprint.width == 100 && fingerprint.height == 70);
+    CHECK(fingerprint.columns == 4 && fingerprint.rows == 3 && fingerprint.hashes.size() == 12);
+
+    std::string encoded;
+    encodeFingerprint(fingerprint, encoded);
+    CHECK(encoded.size() == FingerprintFormat::HEADER_SIZE + 12 * sizeof(uint64_t));
+    CHECK(encoded.compare(0, 8, FingerprintFormat::MAGIC, 8) == 0);
+
+    FrameFingerprint decoded;
+    CHECK(decodeFingerprint(encoded, decoded));
+    CHECK(decoded.tileSize == 32 && decoded.columns == 4 && decoded.rows == 3);
+    CHECK(decoded.hashes == fingerprint.hashes);
+
+    CHECK(!decodeFingerprint(encoded.substr(0, encoded.size() - 1), decoded));
+    std::string badMagic = encoded;
+    badMagic[0] = 'X';
+    CHECK(!decodeFingerprint(badMagic, decoded));
+
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "DataSourceTestTool_fingerprint_test.tiles";
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << encoded;
+    }
+    CHECK(loadFingerprint(path.string(), decoded) && decoded.hashes == fingerprint.hashes);
+    std::filesystem::remove(path);
+
+    // Same frame, same hashes; every tile size gives its own grid
+    FrameFingerprint again;
+    computeFingerprint(frame, 32, again);
+    CHECK(again.hashes == fingerprint.hashes);
+    computeFingerprint(frame, 8, again);
+    CHECK(again.columns == 13 && again.rows == 9);
+    computeFingerprint(frame, FingerprintFormat::MAX_TILE_SIZE, again);
+    CHECK(again.columns == 2 && again.rows == 2);
+}
+
+void testDiff()
+{
+    FrameBuffer frame;
+    drawFrame(frame);
+    FrameFingerprint before;
+    computeFingerprint(frame, 32, before);
+
+    FrameFingerprint after;
+    std::vector<uint8_t> changed;
+    computeFingerprint(frame, 32, after);
+    CHECK(diffFingerprints(before, after, changed) == 0);
+    CHECK(changedRegions(after, changed).empty());
+
+    // One pixel in each of two adjacent tiles and one in the partial corner tile
+    frame.row(10)[40 * 4] ^= 1;
+    frame.row(10)[70 * 4 + 3] ^= 0x80;
+    frame.row(68)[98 * 4 + 2] ^= 1;
+    computeFingerprint(frame, 32, after);
+    CHECK(diffFingerprints(before, after, changed) == 3);
+    CHECK(changed.size() == 12);
+    if (changed.size() == 12)
+        CHECK(changed[1] && changed[2] && changed[2 * 4 + 3]);
+
+    std::vector<CompareRegion> regions = changedRegions(after, changed);
+    CHECK(regions.size() == 2);
+    bool foundTop = false, foundCorner = false;
+    for (const CompareRegion &region : regions)
+    {
+        foundTop |= region.x == 32 && region.y == 0 && region.width == 64 && region.height == 32;
+        foundCorner |= region.x == 96 && region.y == 64 && region.width == 4 && region.height == 6;
+    }
+    CHECK(foundTop && foundCorner);
+
+    // Fingerprints of different grids cannot be compared tile by tile
+    FrameFingerprint otherTiles;
+    computeFingerprint(frame, 16, otherTiles);
+    CHECK(diffFingerprints(before, otherTiles, changed) == before.hashes.size());
+}
+}
+
+int main()
+{
+    testEncoding();
+    testDiff();
+    return testResult();
+}
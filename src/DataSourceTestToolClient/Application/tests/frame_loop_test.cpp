@@ -0,0 +1,97 @@
+// FrameLoop runs the stage hooks in order once per tick and counts a tick
+// that starts more than a period late as one overrun, without bursting to
+// catch up
+#include "test_check.h"
+#include "frame_loop.h"
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+void testStageOrder()
+{
+    FrameLoop loop;
+    loop.setRate(0);
+    loop.setTickLimit(3);
+
+    std::vector<std::string> calls;
+    // Added out of stage order; two hooks on one stage keep theirs
+    loop.addHook(FrameLoop::Stage::Present, [&](const FrameLoop::Tick &) { calls.push_back("present"); });
+    loop.addHook(FrameLoop::Stage::Render, [&](const FrameLoop::Tick &) { calls.push_back("render"); });
+    loop.addHook(FrameLoop::Stage::Drain, [&](const FrameLoop::Tick &tick) {
+        calls.push_back("drain" + std::to_string(tick.number));
+    });
+    loop.addHook(FrameLoop::Stage::Apply, [&](const FrameLoop::Tick &) { calls.push_back("apply1"); });
+    loop.addHook(FrameLoop::Stage::Apply, [&](const FrameLoop::Tick &) { calls.push_back("apply2"); });
+    size_t idleCalls = 0;
+    loop.setIdleHook([&]() {
+        ++idleCalls;
+        return FrameLoop::NO_DEADLINE;
+    });
+
+    std::atomic<bool> running(true);
+    loop.run(running);
+
+    std::vector<std::string> expected;
+    for (int tick = 0; tick < 3; ++tick)
+    {
+        expected.push_back("drain" + std::to_string(tick));
+        expected.insert(expected.end(), {"apply1", "apply2", "render", "present"});
+    }
+    CHECK(calls == expected);
+    CHECK(loop.tickCount() == 3 && loop.overrunCount() == 0);
+    CHECK(idleCalls == 3);
+    for (size_t stage = 0; stage < static_cast<size_t>(FrameLoop::Stage::Count); ++stage)
+        CHECK(loop.stageTime(static_cast<FrameLoop::Stage>(stage)).count() == 3);
+
+    // A stopped loop does not tick at all
+    FrameLoop stopped;
+    stopped.setTickLimit(3);
+    running = false;
+    stopped.run(running);
+    CHECK(stopped.tickCount() == 0);
+}
+
+void testOverruns()
+{
+    // 50 Hz; ticks 2 and 5 take three periods. Each counts once, and the
+    // schedule restarts after it instead of running the missed ticks back to
+    // back.
+    const std::chrono::milliseconds period(20);
+    FrameLoop loop;
+    loop.setRate(50);
+    loop.setTickLimit(8);
+    std::vector<int64_t> starts;
+    loop.addHook(FrameLoop::Stage::Render, [&](const FrameLoop::Tick &tick) {
+        starts.push_back(tick.startUs);
+        if (tick.number == 2 || tick.number == 5)
+            std::this_thread::sleep_for(3 * period);
+    });
+
+    std::atomic<bool> running(true);
+    loop.run(running);
+
+    CHECK(loop.tickCount() == 8);
+    CHECK(loop.overrunCount() == 2);
+    CHECK(starts.size() == 8);
+    for (size_t i = 1; i < starts.size(); ++i)
+    {
+        // Never two ticks closer together than half a period, even right
+        // after an overrun
+        int64_t gapUs = starts[i] - starts[i - 1];
+        CHECK(gapUs >= 10000);
+        if (i == 3 || i == 6)
+            CHECK(gapUs >= 60000);
+    }
+}
+}
+
+int main()
+{
+    testStageOrder();
+    testOverruns();
+    return testResult();
+}
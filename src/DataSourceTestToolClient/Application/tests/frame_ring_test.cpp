@@ -0,0 +1,95 @@
+// The frame history CAPTURE and FRAMES read from: wrap-around, lookup by
+// frame number, holding during a dump and the memory cap
+#include "test_check.h"
+#include "frame_ring.h"
+#include <cstdint>
+
+namespace
+{
+const uint32_t WIDTH = 16;
+const uint32_t HEIGHT = 8;
+const size_t FRAME_BYTES = WIDTH * HEIGHT * FrameBuffer::BYTES_PER_PIXEL;
+
+// Records frame number with its number in the first pixel
+bool recordFrame(FrameRing &ring, uint64_t number, uint32_t width = WIDTH, uint32_t height = HEIGHT)
+{
+    FrameBuffer *frame = ring.record(number, static_cast<int64_t>(number) * 1000, width, height);
+    if (!frame)
+        return false;
+    frame->pixels[0] = static_cast<uint8_t>(number);
+    return true;
+}
+
+void testWrapAndFind()
+{
+    FrameRing ring;
+    CHECK(!ring.enabled() && !recordFrame(ring, 0));
+
+    ring.configure(5, FrameRing::DEFAULT_MEMORY_CAP);
+    CHECK(ring.enabled());
+    CHECK(ring.allocate(WIDTH, HEIGHT));
+    for (uint64_t number = 0; number < 3; ++number)
+        CHECK(recordFrame(ring, number));
+    CHECK(ring.size() == 3 && ring.at(0).number == 0 && ring.at(2).number == 2);
+
+    // Twelve frames through five slots: the last five remain, oldest first
+    for (uint64_t number = 3; number < 12; ++number)
+        CHECK(recordFrame(ring, number));
+    CHECK(ring.size() == 5);
+    for (size_t i = 0; i < ring.size(); ++i)
+    {
+        CHECK(ring.at(i).number == 7 + i);
+        CHECK(ring.at(i).presentTimeUs == static_cast<int64_t>(7 + i) * 1000);
+        CHECK(ring.at(i).frame.pixels[0] == 7 + i);
+    }
+
+    for (uint64_t number = 7; number < 12; ++number)
+    {
+        const FrameRing::Entry *entry = ring.find(number);
+        CHECK(entry && entry->number == number && entry->frame.pixels[0] == number);
+    }
+    CHECK(!ring.find(6) && !ring.find(12) && !ring.find(0));
+
+    // Frames presented while held are not kept, leaving a gap in the numbers
+    ring.setHeld(true);
+    CHECK(!recordFrame(ring, 12) && !recordFrame(ring, 13));
+    CHECK(ring.size() == 5 && ring.at(4).number == 11);
+    ring.setHeld(false);
+    CHECK(recordFrame(ring, 14) && recordFrame(ring, 15));
+    CHECK(ring.at(0).number == 9 && ring.at(2).number == 11 && ring.at(3).number == 14);
+    CHECK(ring.find(11) && !ring.find(12) && !ring.find(13) && ring.find(14) && ring.find(15));
+
+    // A new size drops what was kept
+    CHECK(recordFrame(ring, 16, WIDTH * 2, HEIGHT));
+    CHECK(ring.size() == 1 && ring.at(0).frame.width == WIDTH * 2 && !ring.find(15));
+
+    ring.configure(0, FrameRing::DEFAULT_MEMORY_CAP);
+    CHECK(!ring.enabled() && ring.size() == 0 && !ring.allocate(WIDTH, HEIGHT) && !recordFrame(ring, 17));
+}
+
+void testMemoryCap()
+{
+    // Room for three frames of the configured ten
+    FrameRing ring;
+    ring.configure(10, 3 * FRAME_BYTES + 1);
+    CHECK(ring.allocate(WIDTH, HEIGHT));
+    for (uint64_t number = 0; number < 10; ++number)
+        recordFrame(ring, number);
+    CHECK(ring.size() == 3 && ring.at(0).number == 7);
+
+    // A size of which not one frame fits keeps nothing, and is not retried
+    // every frame, but a smaller size later fits again
+    CHECK(!ring.allocate(WIDTH * 8, HEIGHT * 8));
+    CHECK(ring.size() == 0 && ring.enabled());
+    CHECK(!recordFrame(ring, 10, WIDTH * 8, HEIGHT * 8));
+    CHECK(recordFrame(ring, 11));
+    CHECK(ring.size() == 1 && ring.find(11));
+}
+}
+
+int main()
+{
+    testWrapAndFind();
+    testMemoryCap();
+    return testResult();
+}
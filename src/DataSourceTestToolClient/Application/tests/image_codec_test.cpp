@@ -0,0 +1,220 @@
+// Checks the PNG, QOI and raw encoders write well-formed files, decodes them
+// again to check every pixel survived, and runs the golden image comparison
+// COMPARE does on them
+#include "test_check.h"
+#include "frame_buffer.h"
+#include "image_compare.h"
+#include "image_decoder.h"
+#include "image_encoder.h"
+#include <cstring>
+#include <string>
+
+namespace
+{
+// Flat areas, a gradient, a translucent band and noise, so every PNG filter,
+// QOI op and deflate block type gets used
+void drawTestFrame(FrameBuffer &frame, uint32_t width, uint32_t height)
+{
+    frame.resize(width, height);
+    uint32_t seed = 12345;
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        uint8_t *row = frame.row(y);
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            uint8_t *pixel = row + x * FrameBuffer::BYTES_PER_PIXEL;
+            if (y < height / 4)
+            {
+                pixel[0] = 20, pixel[1] = 30, pixel[2] = 40, pixel[3] = 255;
+            }
+            else if (y < height / 2)
+            {
+                pixel[0] = static_cast<uint8_t>(x * 3), pixel[1] = static_cast<uint8_t>(y * 5);
+                pixel[2] = static_cast<uint8_t>(x + y), pixel[3] = 255;
+            }
+            else if (y < 3 * height / 4)
+            {
+                pixel[0] = 200, pixel[1] = 10, pixel[2] = static_cast<uint8_t>(x), pixel[3] = static_cast<uint8_t>(y);
+            }
+            else
+            {
+                seed = seed * 1103515245u + 12345u;
+                pixel[0] = static_cast<uint8_t>(seed >> 24), pixel[1] = static_cast<uint8_t>(seed >> 16);
+                pixel[2] = static_cast<uint8_t>(seed >> 8), pixel[3] = static_cast<uint8_t>(seed >> 20);
+            }
+        }
+    }
+}
+
+uint32_t readBigEndian(const std::string &data, size_t offset)
+{
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data.data() + offset);
+    return static_cast<uint32_t>(bytes[0]) << 24 | bytes[1] << 16 | bytes[2] << 8 | bytes[3];
+}
+
+uint32_t crc32(const char *data, size_t length)
+{
+    uint32_t crc = 0xffffffffu;
+    for (size_t i = 0; i < length; ++i)
+    {
+        crc ^= static_cast<uint8_t>(data[i]);
+        for (int bit = 0; bit < 8; ++bit)
+            crc = crc & 1 ? 0xedb88320u ^ (crc >> 1) : crc >> 1;
+    }
+    return ~crc;
+}
+
+void testEncoders(uint32_t width, uint32_t height)
+{
+    FrameBuffer frame;
+    drawTestFrame(frame, width, height);
+
+    // PNG: signature, IHDR first and IEND last, every chunk's CRC right
+    std::string png;
+    encodePng(frame.pixels.data(), width, height, png);
+    CHECK(png.compare(0, 8, "\x89PNG\r\n\x1a\n", 8) == 0);
+    CHECK(png.compare(12, 4, "IHDR") == 0 && readBigEndian(png, 16) == width && readBigEndian(png, 20) == height);
+    size_t offset = 8;
+    size_t chunks = 0;
+    bool ended = false;
+    while (offset + 12 <= png.size() && !ended)
+    {
+        uint32_t length = readBigEndian(png, offset);
+        if (offset + 12 + length > png.size())
+            break;
+        CHECK(crc32(png.data() + offset + 4, length + 4) == readBigEndian(png, offset + 8 + length));
+        ended = png.compare(offset + 4, 4, "IEND") == 0;
+        offset += 12 + length;
+        ++chunks;
+    }
+    CHECK(ended && offset == png.size() && chunks >= 3);
+
+    // QOI: header with the size and RGBA channels, and the end marker
+    std::string qoi;
+    encodeQoi(frame.pixels.data(), width, height, qoi);
+    CHECK(qoi.compare(0, 4, "qoif") == 0 && readBigEndian(qoi, 4) == width && readBigEndian(qoi, 8) == height);
+    CHECK(qoi.size() > 22 && qoi[12] == 4);
+    CHECK(qoi.size() >= 8 && qoi.compare(qoi.size() - 8, 8, std::string("\0\0\0\0\0\0\0\1", 8)) == 0);
+
+    // Raw: the header, then the pixels unchanged
+    std::string raw;
+    encodeRaw(frame.pixels.data(), width, height, raw);
+    CHECK(raw.size() == RAW_HEADER_SIZE + frame.pixels.size());
+    CHECK(std::memcmp(raw.data(), RAW_MAGIC, sizeof(RAW_MAGIC)) == 0);
+    CHECK(std::memcmp(raw.data() + RAW_HEADER_SIZE, frame.pixels.data(), frame.pixels.size()) == 0);
+
+    // encodeImage() replaces what out held
+    std::string reused = "stale";
+    encodeImage(ImageFormat::Qoi, frame.pixels.data(), width, height, reused);
+    CHECK(reused == qoi);
+}
+
+bool samePixels(const FrameBuffer &a, const FrameBuffer &b)
+{
+    return a.width == b.width && a.height == b.height && a.pixels == b.pixels;
+}
+
+void testRoundTrip(uint32_t width, uint32_t height)
+{
+    FrameBuffer frame;
+    drawTestFrame(frame, width, height);
+
+    const ImageFormat formats[] = {ImageFormat::Png, ImageFormat::Qoi, ImageFormat::Raw};
+    for (ImageFormat format : formats)
+    {
+        std::string encoded;
+        encodeImage(format, frame.pixels.data(), width, height, encoded);
+
+        FrameBuffer decoded;
+        bool ok = decodeImage(encoded, decoded);
+        CHECK(ok);
+        CHECK(samePixels(frame, decoded));
+        if (!ok || !samePixels(frame, decoded))
+            std::cout << "  " << imageFormatName(format) << " " << width << "x" << height << std::endl;
+
+        // A cut file is refused, never read past its end
+        FrameBuffer truncated;
+        CHECK(!decodeImage(std::string_view(encoded).substr(0, encoded.size() / 2), truncated));
+    }
+}
+
+void testFormatForPath()
+{
+    CHECK(imageFormatForPath("shots/a.PNG") == ImageFormat::Png);
+    CHECK(imageFormatForPath("shots/a.qoi") == ImageFormat::Qoi);
+    CHECK(imageFormatForPath("a.Raw") == ImageFormat::Raw);
+    CHECK(imageFormatForPath("a.bmp") == ImageFormat::Png);
+    CHECK(imageFormatForPath("noextension") == ImageFormat::Png);
+}
+
+void testCompare()
+{
+    FrameBuffer reference;
+    drawTestFrame(reference, 64, 48);
+    FrameBuffer actual = reference;
+
+    CompareOptions exact;
+    CompareResult result = compareFrames(actual, reference, exact);
+    CHECK(result.sizeMatches && result.comparedPixels == 64 * 48 && result.differingPixels == 0);
+    CHECK(result.passed(exact));
+
+    // Two pixels off by 3 and 40 in one channel
+    actual.row(5)[10 * 4 + 1] += 3;
+    actual.row(40)[60 * 4 + 2] ^= 40;
+    result = compareFrames(actual, reference, exact);
+    CHECK(result.differingPixels == 2 && result.maxDelta == 40 && !result.passed(exact));
+
+    CompareRequest request;
+    CHECK(parseCompareRequest("golden.png::tolerance=3::ignore=56,36,8,12::heatmap=diff.png", request));
+    CHECK(request.reference == "golden.png" && request.heatmap == "diff.png");
+    CHECK(request.options.ignore.size() == 1 && request.options.tolerance[1] == 3);
+    result = compareFrames(actual, reference, request.options);
+    CHECK(result.differingPixels == 0 && result.comparedPixels == 64 * 48 - 8 * 12 && result.passed(request.options));
+
+    CHECK(parseCompareRequest("golden.png::max-diff=2", request));
+    CHECK(compareFrames(actual, reference, request.options).passed(request.options));
+    CHECK(!parseCompareRequest("golden.png::tolerance=x", request));
+    CHECK(!parseCompareRequest("", request));
+
+    FrameBuffer smaller;
+    drawTestFrame(smaller, 32, 48);
+    CHECK(!compareFrames(smaller, reference, exact).sizeMatches);
+
+    // The vectorized count agrees with a plain loop at every span length, on
+    // pixels just within and just past the tolerance
+    for (uint32_t x = 0; x < 37; x += 3)
+        actual.row(5)[x * 4 + x % 4] += x % 2 ? 3 : 2;
+    const uint8_t tolerance[4] = {2, 2, 2, 2};
+    const uint8_t *actualRow = actual.row(5);
+    const uint8_t *referenceRow = reference.row(5);
+    for (size_t pixels = 0; pixels <= 37; ++pixels)
+    {
+        uint64_t expected = 0;
+        for (size_t i = 0; i < pixels; ++i)
+        {
+            bool differs = false;
+            for (size_t c = 0; c < 4; ++c)
+            {
+                int delta = actualRow[i * 4 + c] - referenceRow[i * 4 + c];
+                differs |= delta > 2 || delta < -2;
+            }
+            expected += differs;
+        }
+        uint8_t maxDelta = 0;
+        CHECK(countDifferingPixels(actualRow, referenceRow, pixels, tolerance, maxDelta) == expected);
+    }
+}
+}
+
+int main()
+{
+    testEncoders(67, 43);
+    testEncoders(1, 1);
+    testEncoders(320, 240);
+    testRoundTrip(67, 43);
+    testRoundTrip(1, 1);
+    testRoundTrip(320, 240);
+    testFormatForPath();
+    testCompare();
+    return testResult();
+}
@@ -0,0 +1,255 @@
+// Round trips of the binary protocol encoders through MessageFramer and the
+// decoders, the interned forms against the dictionary, and the text forms
+// of the same commands
+#include "test_check.h"
+#include "binary_protocol.h"
+#include "command_tokenizer.h"
+#include "message_framer.h"
+#include "property_dictionary.h"
+#include "signal_stream.h"
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace
+{
+PropertyValue makeInt(int32_t value)
+{
+    PropertyValue result;
+    result.type = PropertyType::Int;
+    result.intValue = value;
+    return result;
+}
+
+PropertyValue makeFloat(float value)
+{
+    PropertyValue result;
+    result.type = PropertyType::Float;
+    result.floatValue = value;
+    return result;
+}
+
+PropertyValue makeString(std::string_view value)
+{
+    PropertyValue result;
+    result.type = PropertyType::String;
+    result.stringValue = value;
+    return result;
+}
+
+// Splits a stream of frames the way NetworkClient does
+std::vector<std::string> splitFrames(const std::string &stream)
+{
+    MessageFramer framer(4096);
+    framer.setMode(MessageFramer::Mode::LengthPrefixed);
+    std::vector<std::string> payloads;
+    size_t offset = 0;
+    while (offset < stream.size())
+    {
+        // Odd-sized pieces, so frames arrive split across reads
+        offset += framer.append(stream.data() + offset, std::min<size_t>(7, stream.size() - offset));
+        std::string_view message;
+        while (framer.nextMessage(message))
+            payloads.emplace_back(message);
+    }
+    return payloads;
+}
+
+void testPropertyFrames()
+{
+    std::string stream;
+    BinaryProtocol::appendPropertyFrame(stream, CommandKind::Sync, "Gauge", "Rpm", makeFloat(5400.5f));
+    BinaryProtocol::appendPropertyFrame(stream, CommandKind::Async, "ADAS", "Label", makeString("a::b"));
+    BinaryProtocol::appendScreenshotFrame(stream, "shots/MTS_1.png");
+    BinaryProtocol::appendCompareFrame(stream, "golden.png::tolerance=2");
+    BinaryProtocol::appendCaptureFrame(stream, -3, "shots/past.png");
+    BinaryProtocol::appendFrameDumpFrame(stream, 30, "dump");
+
+    std::vector<std::string> payloads = splitFrames(stream);
+    CHECK(payloads.size() == 6);
+    if (payloads.size() != 6)
+        return;
+
+    Command command;
+    CHECK(BinaryProtocol::decodeCommand(payloads[0], command) == TokenizeError::None);
+    CHECK(command.kind == CommandKind::Sync);
+    CHECK(command.file == "Gauge" && command.name == "Rpm" && command.type == "float");
+    CHECK(command.hasTypedValue && command.typedValue.floatValue == 5400.5f);
+
+    CHECK(BinaryProtocol::decodeCommand(payloads[1], command) == TokenizeError::None);
+    CHECK(command.kind == CommandKind::Async);
+    CHECK(command.typedValue.type == PropertyType::String && command.value == "a::b");
+
+    CHECK(BinaryProtocol::decodeCommand(payloads[2], command) == TokenizeError::None);
+    CHECK(command.kind == CommandKind::Screenshot && command.value == "shots/MTS_1.png");
+
+    CHECK(BinaryProtocol::decodeCommand(payloads[3], command) == TokenizeError::None);
+    CHECK(command.kind == CommandKind::Compare && command.value == "golden.png::tolerance=2");
+
+    CHECK(BinaryProtocol::decodeCommand(payloads[4], command) == TokenizeError::None);
+    CHECK(command.kind == CommandKind::Capture && command.value == "-3::shots/past.png");
+
+    CHECK(BinaryProtocol::decodeCommand(payloads[5], command) == TokenizeError::None);
+    CHECK(command.kind == CommandKind::FrameDump && command.value == "30::dump");
+
+    // Every prefix of a frame is truncated, never misread
+    for (size_t length = 1; length < payloads[0].size(); ++length)
+        CHECK(BinaryProtocol::decodeCommand(std::string_view(payloads[0]).substr(0, length), command) !=
+              TokenizeError::None);
+}
+
+void testInternedFrames()
+{
+    std::string stream;
+    size_t frameStart = BinaryProtocol::beginCountedFrame(stream, BinaryProtocol::Opcode::Dictionary);
+    BinaryProtocol::appendDictionaryRecord(stream, 1, "Gauge", PropertyType::Float, "Speed");
+    BinaryProtocol::appendDictionaryRecord(stream, 7, "ADAS", PropertyType::Int, "CACCVisible");
+    BinaryProtocol::endCountedFrame(stream, frameStart, 2);
+    BinaryProtocol::appendInternedPropertyFrame(stream, CommandKind::Sync, 7, makeInt(2));
+    // Type tag differs from the dictionary's
+    BinaryProtocol::appendInternedPropertyFrame(stream, CommandKind::Sync, 1, makeInt(88));
+    frameStart = BinaryProtocol::beginCountedFrame(stream, BinaryProtocol::Opcode::BatchId);
+    BinaryProtocol::appendInternedBatchRecord(stream, 1, makeFloat(88.0f));
+    BinaryProtocol::appendInternedBatchRecord(stream, 9, makeInt(1));
+    BinaryProtocol::endCountedFrame(stream, frameStart, 2);
+
+    std::vector<std::string> payloads = splitFrames(stream);
+    CHECK(payloads.size() == 4);
+    if (payloads.size() != 4)
+        return;
+
+    PropertyDictionary dictionary;
+    Command command;
+    CHECK(BinaryProtocol::decodeCommand(payloads[0], command) == TokenizeError::None);
+    CHECK(command.kind == CommandKind::Dictionary);
+    CHECK(BinaryProtocol::decodeDictionary(command.value, dictionary) == TokenizeError::None);
+    CHECK(dictionary.size() == 2 && dictionary.contains(1) && dictionary.contains(7) && !dictionary.contains(2));
+
+    CHECK(BinaryProtocol::decodeCommand(payloads[1], command) == TokenizeError::None);
+    CHECK(command.interned && command.propertyId == 7);
+    CHECK(dictionary.resolve(command) == PropertyDictionary::ResolveResult::Resolved);
+    CHECK(command.file == "ADAS" && command.name == "CACCVisible" && command.type == "int");
+    CHECK(command.typedValue.intValue == 2);
+
+    CHECK(BinaryProtocol::decodeCommand(payloads[2], command) == TokenizeError::None);
+    CHECK(dictionary.resolve(command) == PropertyDictionary::ResolveResult::TypeMismatch);
+
+    CHECK(BinaryProtocol::decodeCommand(payloads[3], command) == TokenizeError::None);
+    CHECK(command.kind == CommandKind::Batch && command.interned);
+    std::vector<Command> records;
+    CHECK(BinaryProtocol::decodeBatch(command.value, true, records) == TokenizeError::None);
+    CHECK(records.size() == 2);
+    if (records.size() == 2)
+    {
+        CHECK(dictionary.resolve(records[0]) == PropertyDictionary::ResolveResult::Resolved);
+        CHECK(records[0].name == "Speed" && records[0].typedValue.floatValue == 88.0f);
+        CHECK(dictionary.resolve(records[1]) == PropertyDictionary::ResolveResult::UnknownId);
+    }
+}
+
+void testBatchFrames()
+{
+    std::string stream;
+    size_t frameStart = BinaryProtocol::beginCountedFrame(stream, BinaryProtocol::Opcode::Batch);
+    BinaryProtocol::appendBatchRecord(stream, "Gauge", "Rpm", makeFloat(900.0f));
+    BinaryProtocol::appendBatchRecord(stream, "Gauge", "Gear", makeInt(3));
+    BinaryProtocol::endCountedFrame(stream, frameStart, 2);
+
+    std::vector<std::string> payloads = splitFrames(stream);
+    CHECK(payloads.size() == 1);
+    if (payloads.size() != 1)
+        return;
+
+    Command command;
+    std::vector<Command> records;
+    CHECK(BinaryProtocol::decodeCommand(payloads[0], command) == TokenizeError::None);
+    CHECK(command.kind == CommandKind::Batch && !command.interned);
+    CHECK(BinaryProtocol::decodeBatch(command.value, false, records) == TokenizeError::None);
+    CHECK(records.size() == 2);
+    if (records.size() == 2)
+    {
+        CHECK(records[0].file == "Gauge" && records[0].name == "Rpm" && records[0].typedValue.floatValue == 900.0f);
+        CHECK(records[1].name == "Gear" && records[1].typedValue.intValue == 3);
+    }
+
+    // A count that does not match the records is rejected
+    std::string wrongCount = std::string(command.value);
+    wrongCount[0] = 3;
+    CHECK(BinaryProtocol::decodeBatch(wrongCount, false, records) != TokenizeError::None);
+}
+
+void testSampleFrames()
+{
+    std::string stream;
+    StreamSample samples[3] = {{1000, 1.5f}, {2000, -2.0f}, {int64_t(1) << 40, 3.25f}};
+    BinaryProtocol::appendSampleFrame(stream, 5, samples, 3);
+    BinaryProtocol::appendStreamFrame(stream, 5, "Gauge", PropertyType::Float, "Speed");
+
+    std::vector<std::string> payloads = splitFrames(stream);
+    CHECK(payloads.size() == 2);
+    if (payloads.size() != 2)
+        return;
+
+    Command command;
+    std::vector<StreamSample> decoded;
+    CHECK(BinaryProtocol::decodeCommand(payloads[0], command) == TokenizeError::None);
+    CHECK(command.kind == CommandKind::Sample && command.propertyId == 5);
+    CHECK(BinaryProtocol::decodeSamples(command.value, decoded) == TokenizeError::None);
+    CHECK(decoded.size() == 3);
+    for (size_t i = 0; i < decoded.size() && i < 3; ++i)
+        CHECK(decoded[i].timeUs == samples[i].timeUs && decoded[i].value == samples[i].value);
+
+    CHECK(BinaryProtocol::decodeCommand(payloads[1], command) == TokenizeError::None);
+    CHECK(command.kind == CommandKind::Stream && command.propertyId == 5);
+    CHECK(command.file == "Gauge" && command.name == "Speed" && command.type == "float");
+}
+
+void testTextForms()
+{
+    Command command;
+    CHECK(tokenizeCommand("SYNC::Gauge::float::Rpm::5400", command) == TokenizeError::None);
+    CHECK(command.kind == CommandKind::Sync && command.file == "Gauge" && command.name == "Rpm");
+    PropertyValue value;
+    CHECK(resolvePropertyValue(command, value) && value.type == PropertyType::Float && value.floatValue == 5400.0f);
+
+    std::string batch = "BATCH::2::Gauge::int::Gear::3\x1e" "ADAS::bool::Visible::true";
+    CHECK(tokenizeCommand(batch, command) == TokenizeError::None);
+    CHECK(command.kind == CommandKind::Batch && !command.interned);
+    std::vector<Command> records;
+    CHECK(tokenizeBatch(command.value, false, records) == TokenizeError::None);
+    CHECK(records.size() == 2 && records[0].name == "Gear" && records[0].value == "3");
+    CHECK(records[1].file == "ADAS" && records[1].value == "true");
+
+    // A count that does not match the records, or a record missing a field,
+    // fails the whole batch
+    CHECK(tokenizeBatch("3::Gauge::int::Gear::3\x1e" "ADAS::bool::Visible::true", false, records) ==
+          TokenizeError::InvalidCount);
+    CHECK(tokenizeBatch("2::Gauge::int::Gear::3\x1e" "ADAS::bool::Visible", false, records) != TokenizeError::None);
+
+    CHECK(tokenizeCommand("COMPARE::golden.png::ignore=0,0,8,8", command) == TokenizeError::None);
+    CHECK(command.kind == CommandKind::Compare && command.value == "golden.png::ignore=0,0,8,8");
+    CHECK(tokenizeCommand("CAPTURE::2::shots/next.png", command) == TokenizeError::None);
+    CHECK(command.kind == CommandKind::Capture && command.value == "2::shots/next.png");
+    CHECK(tokenizeCommand("FRAMES::30::dump", command) == TokenizeError::None);
+    CHECK(command.kind == CommandKind::FrameDump && command.value == "30::dump");
+
+    PropertyDictionary dictionary;
+    CHECK(dictionary.loadText("2::3::Gauge::int::Gear\x1e" "4::Gauge::float::Rpm") == TokenizeError::None);
+    CHECK(dictionary.size() == 2);
+    CHECK(dictionary.loadText("3::5::Gauge::int::Gear") == TokenizeError::InvalidCount);
+
+    CHECK(BinaryProtocol::makeClientHello() == "HELLO::2::text,binary,batch\n");
+    CHECK(BinaryProtocol::makeClientHello("abc") == "HELLO::2::text,binary,batch,restored=abc\n");
+}
+}
+
+int main()
+{
+    testPropertyFrames();
+    testInternedFrames();
+    testBatchFrames();
+    testSampleFrames();
+    testTextForms();
+    return testResult();
+}
@@ -0,0 +1,168 @@
+// Reads PreCondition scripts into the steps the client plays back, compiles
+// them to the .dsc image and reads that back, in memory and through the file
+// cache SCRIPT uses
+#include "test_check.h"
+#include "compiled_script.h"
+#include "precondition_script.h"
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+const char *const SOURCE = "<script>\n"
+                           "  <!-- <Ignored filename=\"x\" type=\"int\" value=\"1\" /> -->\n"
+                           "  <Gauge.Rpm filename=\"Gauge\" type=\"float\" value=\"5400.5\" />\n"
+                           "  <Common.Language filename= \"Common\" type=\"int\" value=\"2\" />\n"
+                           "  <wait delay=\"250\" />\n"
+                           "  <ADAS.Label filename=\"ADAS\" type=\"string\" value=\"a &amp; b\" />\n"
+                           "  <Gauge.Rpm filename=\"Gauge\" type=\"float\" value=\"800\" />\n"
+                           "  <screenshot name=\"MTS_1\" />\n"
+                           "  <exit />\n"
+                           "</script>\n";
+
+void writeText(const std::filesystem::path &path, const std::string &text)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << text;
+}
+
+// Checks the steps of SOURCE as compiled into script
+void checkCompiled(const CompiledScript &script)
+{
+    CHECK(script.isOpen());
+    CHECK(script.stepCount() == 7);
+    // Gauge.Rpm appears twice but is one name
+    CHECK(script.nameCount() == 3);
+    if (script.stepCount() != 7 || script.nameCount() != 3)
+        return;
+
+    const ScriptFormat::Step &rpm = script.step(0);
+    CHECK(rpm.opcode == static_cast<uint8_t>(ScriptFormat::Opcode::Property));
+    CHECK(script.file(rpm.nameId) == "Gauge" && script.name(rpm.nameId) == "Gauge.Rpm");
+    CHECK(script.type(rpm.nameId) == PropertyType::Float);
+    CHECK(script.value(rpm).floatValue == 5400.5f);
+
+    const ScriptFormat::Step &language = script.step(1);
+    CHECK(script.file(language.nameId) == "Common" && script.value(language).intValue == 2);
+
+    const ScriptFormat::Step &wait = script.step(2);
+    CHECK(wait.opcode == static_cast<uint8_t>(ScriptFormat::Opcode::Wait) && wait.value == 250);
+
+    const ScriptFormat::Step &label = script.step(3);
+    CHECK(script.value(label).type == PropertyType::String && script.value(label).stringValue == "a & b");
+
+    const ScriptFormat::Step &rpmAgain = script.step(4);
+    CHECK(rpmAgain.nameId == rpm.nameId && script.value(rpmAgain).floatValue == 800.0f);
+
+    const ScriptFormat::Step &screenshot = script.step(5);
+    CHECK(screenshot.opcode == static_cast<uint8_t>(ScriptFormat::Opcode::Screenshot));
+    CHECK(script.text(screenshot) == "MTS_1");
+
+    CHECK(script.step(6).opcode == static_cast<uint8_t>(ScriptFormat::Opcode::Exit));
+}
+
+void testParse()
+{
+    std::vector<PreconditionStep> steps;
+    CHECK(parsePreconditionScript(SOURCE, steps));
+    CHECK(steps.size() == 7);
+    if (steps.size() != 7)
+        return;
+
+    CHECK(steps[0].kind == PreconditionStep::Kind::Property);
+    CHECK(steps[0].file == "Gauge" && steps[0].name == "Gauge.Rpm" && steps[0].type == "float");
+    CHECK(steps[0].value == "5400.5");
+    // filename= "x" with a space, as some scripts have it
+    CHECK(steps[1].file == "Common" && steps[1].value == "2");
+    CHECK(steps[2].kind == PreconditionStep::Kind::Wait && steps[2].delayMs == 250);
+    CHECK(steps[3].value == "a & b");
+    CHECK(steps[5].kind == PreconditionStep::Kind::Screenshot && steps[5].value == "MTS_1");
+    CHECK(steps[6].kind == PreconditionStep::Kind::Exit);
+
+    CHECK(!parsePreconditionScript("<script><Gauge.Rpm filename=\"Gauge\" value=\"1\" /></script>", steps));
+
+    // A delay that is not whole milliseconds rejects the script instead of
+    // waiting 0 ms
+    const char *const badDelays[] = {"3s", "", "-5", "1.5", " 100", "99999999999"};
+    for (const char *delay : badDelays)
+        CHECK(!parsePreconditionScript(std::string("<script><wait delay=\"") + delay + "\" /></script>", steps));
+    CHECK(!parsePreconditionScript("<script><wait time=\"100\" /></script>", steps));
+    CHECK(parsePreconditionScript("<script><wait delay=\"0\" /></script>", steps));
+    CHECK(steps.size() == 1 && steps[0].delayMs == 0);
+}
+
+void testInMemory()
+{
+    std::vector<PreconditionStep> steps;
+    CHECK(parsePreconditionScript(SOURCE, steps));
+    CHECK(steps.size() == 7);
+
+    std::string image;
+    CHECK(compileScript(steps, hashScriptSource(SOURCE), image));
+
+    CompiledScript script;
+    CHECK(script.assign(image));
+    CHECK(script.sourceHash() == hashScriptSource(SOURCE));
+    checkCompiled(script);
+
+    // A corrupted or cut image is refused instead of read out of bounds
+    std::string badMagic = image;
+    badMagic[0] = 'X';
+    CompiledScript rejected;
+    CHECK(!rejected.assign(badMagic));
+    CHECK(!rejected.assign(image.substr(0, image.size() / 2)));
+    CHECK(!rejected.assign(image.substr(0, sizeof(ScriptFormat::Header) - 1)));
+}
+
+void testFileCache()
+{
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "DataSourceTestTool_script_test";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    std::filesystem::path source = directory / "OPVisible.xml";
+    std::filesystem::path cache = directory / "cache";
+    writeText(source, SOURCE);
+
+    // A miss compiles and stores the script, a hit maps the stored file
+    CompiledScript script;
+    CHECK(loadCachedScript(source.string(), cache.string(), script));
+    checkCompiled(script);
+    script.close();
+    size_t cached = 0;
+    for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator(cache))
+        cached += entry.path().extension() == ScriptFormat::FILE_EXTENSION;
+    CHECK(cached == 1);
+
+    CHECK(loadCachedScript(source.string(), cache.string(), script));
+    checkCompiled(script);
+    script.close();
+
+    // An edited script is a different key
+    std::string edited = SOURCE;
+    edited.replace(edited.find("250"), 3, "500");
+    writeText(source, edited);
+    CHECK(loadCachedScript(source.string(), cache.string(), script));
+    CHECK(script.stepCount() == 7 && script.step(2).value == 500);
+    script.close();
+
+    // A damaged cache entry is compiled again rather than trusted
+    for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator(cache))
+        std::filesystem::resize_file(entry.path(), 20);
+    CHECK(loadCachedScript(source.string(), cache.string(), script));
+    CHECK(script.stepCount() == 7 && script.step(2).value == 500);
+    script.close();
+
+    CHECK(!loadCachedScript((directory / "missing.xml").string(), cache.string(), script));
+    std::filesystem::remove_all(directory);
+}
+}
+
+int main()
+{
+    testParse();
+    testInMemory();
+    testFileCache();
+    return testResult();
+}
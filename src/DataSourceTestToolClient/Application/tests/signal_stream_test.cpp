@@ -0,0 +1,63 @@
+// Streamed signals: resampling onto the render clock, and a re-declared
+// stream starting over instead of mixing in the earlier declaration
+#include "test_check.h"
+#include "property_store.h"
+#include "signal_stream.h"
+#include <vector>
+
+namespace
+{
+void pushSample(SignalStreams &streams, uint32_t id, int64_t timeUs, float value, int64_t clockBaseUs)
+{
+    StreamSample sample = {timeUs, value};
+    streams.push(id, &sample, 1, clockBaseUs + timeUs);
+}
+
+void testStreamGenerations()
+{
+    const int64_t base = 1000000;
+    SignalStreams streams;
+    PropertyStore store;
+    uint32_t speed = store.findOrInsert("Gauge", "Speed", PropertyType::Float);
+
+    CHECK(!streams.open(SignalStreams::MAX_STREAMS, PropertyType::Float));
+    CHECK(!streams.open(0, PropertyType::String));
+    StreamSample early = {0, 1.0f};
+    CHECK(!streams.push(0, &early, 1, base));
+
+    CHECK(streams.open(0, PropertyType::Float));
+    pushSample(streams, 0, 0, 0.0f, base);
+    pushSample(streams, 0, 1000, 10.0f, base);
+    CHECK(streams.declare(0, speed, PropertyType::Float));
+
+    // Halfway between the samples, then at the last one, then held
+    CHECK(streams.update(store, base + 500) == 1 && store.floatValue(speed) == 5.0f);
+    CHECK(streams.update(store, base + 1000) == 1 && store.floatValue(speed) == 10.0f);
+    CHECK(streams.update(store, base + 5000) == 0 && store.floatValue(speed) == 10.0f);
+
+    // A new declaration's samples wait for its declare() and replace the old
+    // ones instead of being interpolated into them
+    CHECK(streams.open(0, PropertyType::Float));
+    pushSample(streams, 0, 0, 100.0f, base + 10000);
+    pushSample(streams, 0, 1000, 200.0f, base + 10000);
+    CHECK(streams.update(store, base + 20000) == 0 && store.floatValue(speed) == 10.0f);
+    CHECK(streams.declare(0, speed, PropertyType::Float));
+    CHECK(streams.update(store, base + 10500) == 1 && store.floatValue(speed) == 150.0f);
+
+    // A full ring drops the rest and counts them
+    std::vector<StreamSample> burst(SignalStreams::SAMPLES_PER_STREAM + 10, StreamSample{5000, 1.0f});
+    CHECK(!streams.push(0, burst.data(), burst.size(), base + 20000));
+    CHECK(streams.droppedCount() > 0);
+
+    std::vector<StreamSample> parsed;
+    CHECK(parseSampleRecords("1000::1.5\x1e" "2000::-2", parsed) == TokenizeError::None);
+    CHECK(parsed.size() == 2 && parsed[1].timeUs == 2000 && parsed[1].value == -2.0f);
+    CHECK(parseSampleRecords("1000::x", parsed) == TokenizeError::InvalidValue);
+}
+}
+
+int main()
+{
+    testStreamGenerations();
+    return testResult();
+}
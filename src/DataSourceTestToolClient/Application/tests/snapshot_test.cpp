@@ -0,0 +1,85 @@
+// The property snapshot a restarted client restores: every value survives
+// a kill, growth of the file and of a string slot, and only the session that
+// wrote the snapshot gets it back
+#include "test_check.h"
+#include "property_snapshot.h"
+#include "property_store.h"
+#include <filesystem>
+#include <string>
+
+namespace
+{
+PropertyValue makeInt(int32_t value)
+{
+    PropertyValue result;
+    result.type = PropertyType::Int;
+    result.intValue = value;
+    return result;
+}
+
+PropertyValue makeString(std::string_view value)
+{
+    PropertyValue result;
+    result.type = PropertyType::String;
+    result.stringValue = value;
+    return result;
+}
+
+void testSnapshot()
+{
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "DataSourceTestTool_snapshot_test.snapshot";
+    std::filesystem::remove(path);
+    const char *const identity = "0123abcd@tcp";
+
+    {
+        PropertyStore store;
+        PropertySnapshot snapshot;
+        CHECK(snapshot.open(path.string(), identity) && snapshot.size() == 0);
+        store.set("Gauge", "Gear", makeInt(3));
+        store.set("ADAS", "Label", makeString("short"));
+        CHECK(snapshot.update(store));
+
+        // Enough properties to outgrow the file, and a string that outgrows its slot
+        for (int i = 0; i < 3000; ++i)
+            store.set("Bulk", "P" + std::to_string(i), makeInt(i));
+        store.set("ADAS", "Label", makeString(std::string(300, 'x')));
+        store.set("Gauge", "Gear", makeInt(4));
+        CHECK(snapshot.update(store));
+        CHECK(snapshot.size() == 3002);
+        // Closed without discard(), as when the client is killed
+    }
+
+    {
+        PropertyStore restored;
+        PropertySnapshot snapshot;
+        CHECK(snapshot.open(path.string(), identity));
+        CHECK(snapshot.restore(restored) == 3002);
+        uint32_t gear = restored.find("Gauge", "Gear");
+        uint32_t label = restored.find("ADAS", "Label");
+        uint32_t bulk = restored.find("Bulk", "P2999");
+        CHECK(gear != PropertyStore::NOT_FOUND && restored.intValue(gear) == 4);
+        CHECK(label != PropertyStore::NOT_FOUND && restored.stringValue(label) == std::string(300, 'x'));
+        CHECK(bulk != PropertyStore::NOT_FOUND && restored.intValue(bulk) == 2999);
+    }
+
+    {
+        // Another session's client starts empty, even at the same path
+        PropertyStore other;
+        PropertySnapshot snapshot;
+        CHECK(snapshot.open(path.string(), "4567ef01@tcp"));
+        CHECK(snapshot.restore(other) == 0 && other.size() == 0);
+        snapshot.discard();
+        CHECK(!std::filesystem::exists(path));
+    }
+
+    CHECK(defaultSnapshotPath("a@tcp") != defaultSnapshotPath("b@tcp"));
+    CHECK(defaultSnapshotPath("a@tcp") == defaultSnapshotPath("a@tcp"));
+    CHECK(SnapshotFormat::identityHash("a@tcp") != SnapshotFormat::identityHash("a@unix:/tmp/s"));
+}
+}
+
+int main()
+{
+    testSnapshot();
+    return testResult();
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <iostream>
+
+// Minimal checks for the ctest executables: a failed CHECK prints the
+// expression and where it is, and the test carries on so one run reports
+// every failure. main() returns testResult().
+namespace TestCheck
+{
+inline int failures = 0;
+}
+
+#define CHECK(condition)                                                                                          \
+    do                                                                                                            \
+    {                                                                                                             \
+        if (!(condition))                                                                                         \
+        {                                                                                                         \
+            ++TestCheck::failures;                                                                                \
+            std::cout << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed" << std::endl;            \
+        }                                                                                                         \
+    } while (false)
+
+inline int testResult()
+{
+    if (TestCheck::failures > 0)
+        std::cout << TestCheck::failures << " check(s) failed" << std::endl;
+    return TestCheck::failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,195 @@
+// Compares the tile fingerprints the client writes next to its screenshots
+// (see frame_fingerprint.h) and shows which screen regions changed, without
+// decoding any image.
+//
+// Given two directories, e.g. the out/ trees of two builds, every *.tiles
+// file below the first is paired with the file of the same relative path
+// below the second. --map also draws the changed tiles of each differing
+// pair as a grid ('#' changed, '.' unchanged).
+//
+//   DataSourceTestTool_tilediff [--map] A.tiles B.tiles
+//   DataSourceTestTool_tilediff [--map] DIR_A DIR_B
+//
+// Exits with 0 when everything matched, 1 otherwise.
+
+#include "frame_fingerprint.h"
+#include "steady_time.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace
+{
+struct Options
+{
+    bool showMap = false;
+    std::string first;
+    std::string second;
+};
+
+struct Totals
+{
+    size_t compared = 0;
+    size_t differing = 0;
+    size_t onlyFirst = 0;
+    size_t onlySecond = 0;
+    size_t unreadable = 0;
+};
+
+bool parseArguments(int argc, char *argv[], Options &options)
+{
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string argument = argv[i];
+        if (argument == "--map")
+        {
+            options.showMap = true;
+        }
+        else if (argument.compare(0, 2, "--") == 0)
+        {
+            std::cout << "Unknown option " << argument << std::endl;
+            return false;
+        }
+        else
+        {
+            paths.push_back(argument);
+        }
+    }
+
+    if (paths.size() != 2)
+    {
+        std::cout << "Usage: DataSourceTestTool_tilediff [--map] A.tiles B.tiles" << std::endl;
+        std::cout << "       DataSourceTestTool_tilediff [--map] DIR_A DIR_B" << std::endl;
+        return false;
+    }
+    options.first = paths[0];
+    options.second = paths[1];
+    return true;
+}
+
+void printMap(const FrameFingerprint &fingerprint, const std::vector<uint8_t> &changed)
+{
+    std::string line;
+    for (uint32_t row = 0; row < fingerprint.rows; ++row)
+    {
+        line.assign("    ");
+        for (uint32_t column = 0; column < fingerprint.columns; ++column)
+            line.push_back(changed[static_cast<size_t>(row) * fingerprint.columns + column] ? '#' : '.');
+        std::cout << line << std::endl;
+    }
+}
+
+void comparePair(const std::string &name, const std::string &firstPath, const std::string &secondPath,
+                 const Options &options, Totals &totals)
+{
+    FrameFingerprint first;
+    FrameFingerprint second;
+    if (!loadFingerprint(firstPath, first) || !loadFingerprint(secondPath, second))
+    {
+        ++totals.unreadable;
+        return;
+    }
+    ++totals.compared;
+
+    std::vector<uint8_t> changed;
+    size_t changedTiles = diffFingerprints(first, second, changed);
+    if (changedTiles == 0)
+        return;
+    ++totals.differing;
+
+    if (first.width != second.width || first.height != second.height || first.tileSize != second.tileSize)
+    {
+        std::cout << name << ": " << first.width << "x" << first.height << " in " << first.tileSize
+                  << " px tiles against " << second.width << "x" << second.height << " in " << second.tileSize
+                  << " px tiles" << std::endl;
+        return;
+    }
+
+    std::cout << name << ": " << changedTiles << " of " << changed.size() << " tiles changed in";
+    for (const CompareRegion &region : changedRegions(first, changed))
+        std::cout << " " << region.x << "," << region.y << " " << region.width << "x" << region.height;
+    std::cout << std::endl;
+    if (options.showMap)
+        printMap(first, changed);
+}
+
+// Relative paths of every fingerprint below directory, sorted
+std::vector<std::string> findFingerprints(const std::filesystem::path &directory)
+{
+    std::vector<std::string> names;
+    std::error_code error;
+    for (std::filesystem::recursive_directory_iterator it(directory, error), end; !error && it != end;
+         it.increment(error))
+    {
+        if (it->is_regular_file() && it->path().extension() == FingerprintFormat::FILE_SUFFIX)
+            names.push_back(it->path().lexically_relative(directory).generic_string());
+    }
+    if (error)
+        std::cout << "Cannot list " << directory.string() << ": " << error.message() << std::endl;
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+void compareDirectories(const Options &options, Totals &totals)
+{
+    std::vector<std::string> firstNames = findFingerprints(options.first);
+    std::vector<std::string> secondNames = findFingerprints(options.second);
+
+    // Both lists are sorted, so one merge pass pairs them up
+    size_t i = 0;
+    size_t j = 0;
+    while (i < firstNames.size() || j < secondNames.size())
+    {
+        if (j == secondNames.size() || (i < firstNames.size() && firstNames[i] < secondNames[j]))
+        {
+            std::cout << firstNames[i] << ": only in " << options.first << std::endl;
+            ++totals.onlyFirst;
+            ++i;
+        }
+        else if (i == firstNames.size() || secondNames[j] < firstNames[i])
+        {
+            std::cout << secondNames[j] << ": only in " << options.second << std::endl;
+            ++totals.onlySecond;
+            ++j;
+        }
+        else
+        {
+            comparePair(firstNames[i], (std::filesystem::path(options.first) / firstNames[i]).string(),
+                        (std::filesystem::path(options.second) / secondNames[j]).string(), options, totals);
+            ++i;
+            ++j;
+        }
+    }
+}
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseArguments(argc, argv, options))
+        return 1;
+
+    int64_t start = steadyMicroseconds();
+    Totals totals;
+    if (std::filesystem::is_directory(options.first) && std::filesystem::is_directory(options.second))
+        compareDirectories(options, totals);
+    else
+        comparePair(options.first, options.first, options.second, options, totals);
+
+    std::cout << totals.compared << " fingerprints compared in " << steadyMicroseconds() - start << " us: "
+              << totals.differing << " differ";
+    if (totals.onlyFirst + totals.onlySecond > 0)
+        std::cout << ", " << totals.onlyFirst << " only in " << options.first << ", " << totals.onlySecond
+                  << " only in " << options.second;
+    if (totals.unreadable > 0)
+        std::cout << ", " << totals.unreadable << " unreadable";
+    std::cout << std::endl;
+
+    bool matched = totals.differing + totals.onlyFirst + totals.onlySecond + totals.unreadable == 0;
+    return matched ? 0 : 1;
+}